@@ -0,0 +1,545 @@
+/*
+ *  libv4l2-test - check libv4l2 streaming against a vivid capture device
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Streams from the vivid driver through libv4l2. libv4lcontrol is told
+ *  that the device is an upside down cam, so that libv4l2 converts the
+ *  frames even though vivid supports the requested formats itself.
+ *
+ *  The device is given with -d, otherwise the first vivid capture device
+ *  found in sysfs is used. Without arguments all tests are run, else only
+ *  the named ones.
+ *
+ *  The dmabuf tests need /dev/udmabuf (CONFIG_UDMABUF) and are skipped
+ *  without it.
+ *
+ *  Exits with 0 when all tests pass, 1 on a failure and 77 (skipped) when
+ *  there is no vivid device to test with.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <linux/videodev2.h>
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_LINUX_UDMABUF_H)
+#include <linux/udmabuf.h>
+#endif
+#include "libv4l2.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+/* Another one of the sizes the vivid webcam input supports */
+#define HEIGHT_WIDE 360
+#define NBUFS 4
+/* More devices than libv4l2 could have open at once when its device table
+   had a fixed size */
+#define NFDS 40
+/* Returned by tests which cannot run here */
+#define SKIP 1
+
+static const char *device;
+static int fd = -1;
+
+#define fail_on_test(test)						\
+	do {								\
+		if (test) {						\
+			printf("FAIL: %s:%d: %s (%s)\n", __func__,	\
+			       __LINE__, #test, strerror(errno));	\
+			return -1;					\
+		}							\
+	} while (0)
+
+static int find_vivid(char *path, size_t size)
+{
+	DIR *dir = opendir("/sys/class/video4linux");
+	struct dirent *ent;
+	char name[300], line[64];
+	FILE *f;
+	int ret = -1;
+
+	if (!dir)
+		return -1;
+
+	while (ret && (ent = readdir(dir))) {
+		if (strncmp(ent->d_name, "video", 5))
+			continue;
+		snprintf(name, sizeof(name), "/sys/class/video4linux/%s/name",
+			 ent->d_name);
+		f = fopen(name, "r");
+		if (!f)
+			continue;
+		if (fgets(line, sizeof(line), f) &&
+		    !strncmp(line, "vivid-", 6) && strstr(line, "-vid-cap")) {
+			snprintf(path, size, "/dev/%s", ent->d_name);
+			ret = 0;
+		}
+		fclose(f);
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+static int open_device(int flags)
+{
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		return -1;
+	if (v4l2_fd_open(fd, flags) != fd) {
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static int set_format(unsigned int pixelformat, unsigned int width,
+		unsigned int height)
+{
+	struct v4l2_format fmt;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.pixelformat = pixelformat;
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (v4l2_ioctl(fd, VIDIOC_S_FMT, &fmt))
+		return -1;
+	if (fmt.fmt.pix.pixelformat != pixelformat ||
+	    fmt.fmt.pix.width != width || fmt.fmt.pix.height != height) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns the number of buffers */
+static int request_buffers(unsigned int memory, unsigned int count)
+{
+	struct v4l2_requestbuffers req;
+
+	memset(&req, 0, sizeof(req));
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = memory;
+	req.count = count;
+	if (v4l2_ioctl(fd, VIDIOC_REQBUFS, &req))
+		return -1;
+	return req.count;
+}
+
+static int queue_buffer(unsigned int memory, unsigned int index, int dmabuf_fd)
+{
+	struct v4l2_buffer buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = memory;
+	buf.index = index;
+	if (memory == V4L2_MEMORY_DMABUF)
+		buf.m.fd = dmabuf_fd;
+	return v4l2_ioctl(fd, VIDIOC_QBUF, &buf);
+}
+
+static int dequeue_buffer(unsigned int memory, struct v4l2_buffer *buf)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf->memory = memory;
+	return v4l2_ioctl(fd, VIDIOC_DQBUF, buf);
+}
+
+static int stream(unsigned long request)
+{
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	return v4l2_ioctl(fd, request, &type);
+}
+
+static int query_buffer(unsigned int memory, unsigned int index,
+		struct v4l2_buffer *buf)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf->memory = memory;
+	buf->index = index;
+	return v4l2_ioctl(fd, VIDIOC_QUERYBUF, buf);
+}
+
+/* Returns a dmabuf of the converted frame in buffer index, or -1 */
+static int export_buffer(unsigned int index)
+{
+	struct v4l2_exportbuffer exp;
+
+	memset(&exp, 0, sizeof(exp));
+	exp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	exp.index = index;
+	exp.flags = O_RDONLY | O_CLOEXEC;
+	if (v4l2_ioctl(fd, VIDIOC_EXPBUF, &exp))
+		return -1;
+	return exp.fd;
+}
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_LINUX_UDMABUF_H)
+/* Returns a dmabuf of size bytes allocated with udmabuf, or -1 */
+static int create_dmabuf(unsigned int size)
+{
+	struct udmabuf_create create;
+	long page_size = sysconf(_SC_PAGESIZE);
+	int memfd, udmabuf, dmabuf = -1;
+
+	memfd = memfd_create("libv4l2-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0)
+		return -1;
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.size = (size + page_size - 1) / page_size * page_size;
+	udmabuf = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (udmabuf >= 0 && !ftruncate(memfd, create.size) &&
+	    !fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK))
+		dmabuf = ioctl(udmabuf, UDMABUF_CREATE, &create);
+	if (udmabuf >= 0)
+		close(udmabuf);
+	close(memfd);
+
+	return dmabuf;
+}
+#endif
+
+/* Map a dmabuf, returns NULL on failure */
+static unsigned char *map_dmabuf(int dmabuf, unsigned int size)
+{
+	void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, dmabuf, 0);
+
+	return map == MAP_FAILED ? NULL : map;
+}
+
+/* The frames are flipped in both directions, so converting a rgb24 frame
+   rotates it 180 degrees */
+static int check_rotated(const unsigned char *raw,
+		const unsigned char *converted)
+{
+	int x, y;
+
+	for (y = 0; y < HEIGHT; y++)
+		for (x = 0; x < WIDTH; x++)
+			if (memcmp(converted + (y * WIDTH + x) * 3,
+				   raw + ((HEIGHT - 1 - y) * WIDTH +
+					  WIDTH - 1 - x) * 3, 3))
+				return -1;
+	return 0;
+}
+
+/* A format change while streaming with the conversion thread must fail
+   with EBUSY, and leave the thread converting */
+static int test_async_busy_s_fmt(void)
+{
+	struct v4l2_buffer buf;
+	int i, count;
+
+	fail_on_test(open_device(V4L2_ENABLE_ASYNC_CONVERSION));
+	fail_on_test(set_format(V4L2_PIX_FMT_RGB24, WIDTH, HEIGHT));
+	count = request_buffers(V4L2_MEMORY_MMAP, NBUFS);
+	fail_on_test(count <= 0);
+	for (i = 0; i < count; i++)
+		fail_on_test(queue_buffer(V4L2_MEMORY_MMAP, i, -1));
+	fail_on_test(stream(VIDIOC_STREAMON));
+
+	for (i = 0; i < 16; i++) {
+		fail_on_test(dequeue_buffer(V4L2_MEMORY_MMAP, &buf));
+		fail_on_test(buf.bytesused != WIDTH * HEIGHT * 3);
+		if (i == 4) {
+			fail_on_test(!set_format(V4L2_PIX_FMT_RGB24,
+						 WIDTH, HEIGHT_WIDE));
+			fail_on_test(errno != EBUSY);
+		}
+		fail_on_test(queue_buffer(V4L2_MEMORY_MMAP, buf.index, -1));
+	}
+
+	fail_on_test(stream(VIDIOC_STREAMOFF));
+	fail_on_test(request_buffers(V4L2_MEMORY_MMAP, 0));
+	fail_on_test(set_format(V4L2_PIX_FMT_RGB24, WIDTH, HEIGHT_WIDE));
+	return 0;
+}
+
+/* Capture into dmabufs of the app, libv4l2 converts from them and the
+   converted frames get exported as dmabufs */
+static int test_dmabuf_import(void)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_LINUX_UDMABUF_H)
+	const unsigned int size = WIDTH * HEIGHT * 3;
+	unsigned char *raw, *converted;
+	int dmabufs[NBUFS], i, count, exported, raw_rgb24, res;
+	struct v4l2_format fmt;
+	struct v4l2_buffer buf;
+
+	if (access("/dev/udmabuf", R_OK | W_OK))
+		return SKIP;
+
+	fail_on_test(open_device(0));
+	fail_on_test(set_format(V4L2_PIX_FMT_RGB24, WIDTH, HEIGHT));
+	/* What the driver really captures, only rgb24 can be compared with
+	   the converted frames directly */
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fail_on_test(ioctl(fd, VIDIOC_G_FMT, &fmt));
+	raw_rgb24 = fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24 &&
+		    fmt.fmt.pix.width == WIDTH && fmt.fmt.pix.height == HEIGHT &&
+		    fmt.fmt.pix.bytesperline == WIDTH * 3;
+
+	count = request_buffers(V4L2_MEMORY_DMABUF, NBUFS);
+	fail_on_test(count <= 0 || count > NBUFS);
+	for (i = 0; i < count; i++) {
+		fail_on_test(query_buffer(V4L2_MEMORY_DMABUF, i, &buf));
+		fail_on_test(buf.length < fmt.fmt.pix.sizeimage);
+		dmabufs[i] = create_dmabuf(buf.length);
+		fail_on_test(dmabufs[i] < 0);
+		fail_on_test(queue_buffer(V4L2_MEMORY_DMABUF, i, dmabufs[i]));
+	}
+	fail_on_test(stream(VIDIOC_STREAMON));
+
+	for (i = 0; i < 8; i++) {
+		fail_on_test(dequeue_buffer(V4L2_MEMORY_DMABUF, &buf));
+		fail_on_test(buf.index >= (unsigned int)count);
+		fail_on_test(buf.m.fd != dmabufs[buf.index]);
+		fail_on_test(buf.bytesused != size);
+
+		exported = export_buffer(buf.index);
+		fail_on_test(exported < 0);
+		converted = map_dmabuf(exported, size);
+		close(exported);
+		fail_on_test(!converted);
+		raw = map_dmabuf(dmabufs[buf.index], fmt.fmt.pix.sizeimage);
+		fail_on_test(!raw);
+		res = raw_rgb24 && check_rotated(raw, converted);
+		munmap(raw, fmt.fmt.pix.sizeimage);
+		munmap(converted, size);
+		fail_on_test(res);
+
+		fail_on_test(queue_buffer(V4L2_MEMORY_DMABUF, buf.index,
+					  dmabufs[buf.index]));
+	}
+
+	fail_on_test(stream(VIDIOC_STREAMOFF));
+	fail_on_test(request_buffers(V4L2_MEMORY_DMABUF, 0));
+	for (i = 0; i < count; i++)
+		close(dmabufs[i]);
+	return 0;
+#else
+	return SKIP;
+#endif
+}
+
+/* The exported converted frames are the ones v4l2_mmap() gives */
+static int test_dmabuf_export(void)
+{
+	const unsigned int size = WIDTH * HEIGHT * 3;
+	unsigned char *maps[NBUFS], *converted;
+	struct v4l2_buffer buf;
+	int i, count, exported, res;
+
+	if (access("/dev/udmabuf", R_OK | W_OK))
+		return SKIP;
+
+	fail_on_test(open_device(0));
+	fail_on_test(set_format(V4L2_PIX_FMT_RGB24, WIDTH, HEIGHT));
+	count = request_buffers(V4L2_MEMORY_MMAP, NBUFS);
+	fail_on_test(count <= 0 || count > NBUFS);
+	for (i = 0; i < count; i++) {
+		fail_on_test(query_buffer(V4L2_MEMORY_MMAP, i, &buf));
+		fail_on_test(buf.length < size);
+		maps[i] = v4l2_mmap(NULL, size, PROT_READ, MAP_SHARED, fd,
+				    buf.m.offset);
+		fail_on_test(maps[i] == MAP_FAILED);
+		fail_on_test(queue_buffer(V4L2_MEMORY_MMAP, i, -1));
+	}
+	fail_on_test(stream(VIDIOC_STREAMON));
+
+	for (i = 0; i < 8; i++) {
+		fail_on_test(dequeue_buffer(V4L2_MEMORY_MMAP, &buf));
+		fail_on_test(buf.bytesused != size);
+		exported = export_buffer(buf.index);
+		fail_on_test(exported < 0);
+		converted = map_dmabuf(exported, size);
+		close(exported);
+		fail_on_test(!converted);
+		res = memcmp(converted, maps[buf.index], size);
+		munmap(converted, size);
+		fail_on_test(res);
+		fail_on_test(queue_buffer(V4L2_MEMORY_MMAP, buf.index, -1));
+	}
+
+	fail_on_test(stream(VIDIOC_STREAMOFF));
+	for (i = 0; i < count; i++)
+		v4l2_munmap(maps[i], size);
+	fail_on_test(request_buffers(V4L2_MEMORY_MMAP, 0));
+	return 0;
+}
+
+static int check_format(int dev_fd, unsigned int height)
+{
+	struct v4l2_format fmt;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (v4l2_ioctl(dev_fd, VIDIOC_G_FMT, &fmt))
+		return -1;
+	if (fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24 ||
+	    fmt.fmt.pix.width != WIDTH || fmt.fmt.pix.height != height) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* Stream a few frames on fd, with the buffers already requested and
+   queued when queued is set */
+static int stream_frames(int queued)
+{
+	struct v4l2_buffer buf;
+	int i, count = NBUFS;
+
+	if (!queued) {
+		count = request_buffers(V4L2_MEMORY_MMAP, NBUFS);
+		fail_on_test(count <= 0);
+		for (i = 0; i < count; i++)
+			fail_on_test(queue_buffer(V4L2_MEMORY_MMAP, i, -1));
+		fail_on_test(stream(VIDIOC_STREAMON));
+	}
+	for (i = 0; i < 4; i++) {
+		fail_on_test(dequeue_buffer(V4L2_MEMORY_MMAP, &buf));
+		fail_on_test(buf.bytesused != WIDTH * HEIGHT * 3);
+		fail_on_test(queue_buffer(V4L2_MEMORY_MMAP, buf.index, -1));
+	}
+	return 0;
+}
+
+/* Open more devices than the old table held, close them and open them
+   again so that the device structs get reused, also for high fd numbers and
+   after closing a streaming fd */
+static int test_fd_table(void)
+{
+	int fds[NFDS], i, round, high;
+	struct rlimit limit;
+
+	fail_on_test(open_device(0));
+	fail_on_test(set_format(V4L2_PIX_FMT_RGB24, WIDTH, HEIGHT));
+	v4l2_close(fd);
+	fd = -1;
+
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < NFDS; i++) {
+			fds[i] = open(device, O_RDWR);
+			fail_on_test(fds[i] < 0);
+			fail_on_test(v4l2_fd_open(fds[i], 0) != fds[i]);
+		}
+		for (i = 0; i < NFDS; i++)
+			fail_on_test(check_format(fds[i], HEIGHT));
+		for (i = 0; i < NFDS; i++)
+			fail_on_test(v4l2_close(fds[i]));
+	}
+
+	/* The table grows in chunks, take an fd far from the others */
+	fail_on_test(getrlimit(RLIMIT_NOFILE, &limit));
+	high = limit.rlim_cur > 65536 ? 65535 : limit.rlim_cur - 1;
+	fail_on_test(open_device(0));
+	fail_on_test(dup2(fd, high) != high);
+	close(fd);
+	fd = high;
+	fail_on_test(v4l2_fd_open(fd, 0) != fd);
+	fail_on_test(check_format(fd, HEIGHT));
+	fail_on_test(stream_frames(0));
+	v4l2_close(fd);
+	fd = -1;
+
+	/* Close a streaming fd without stopping, the next open of the same
+	   fd number must start afresh, also with a conversion thread */
+	for (round = 0; round < 4; round++) {
+		fail_on_test(open_device(round & 1 ?
+					 V4L2_ENABLE_ASYNC_CONVERSION : 0));
+		fail_on_test(check_format(fd, HEIGHT));
+		fail_on_test(stream_frames(0));
+		v4l2_close(fd);
+		fd = -1;
+	}
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*fn)(void);
+} test_list[] = {
+	{ "async-busy-s-fmt", test_async_busy_s_fmt },
+	{ "dmabuf-import", test_dmabuf_import },
+	{ "dmabuf-export", test_dmabuf_export },
+	{ "fd-table", test_fd_table },
+};
+
+int main(int argc, char **argv)
+{
+	char path[300];
+	unsigned int i;
+	int opt, j, run, failed = 0;
+
+	while ((opt = getopt(argc, argv, "d:")) != -1) {
+		if (opt != 'd') {
+			fprintf(stderr, "usage: %s [-d <device>] [<test>...]\n",
+				argv[0]);
+			return 1;
+		}
+		device = optarg;
+	}
+
+	if (!device) {
+		if (find_vivid(path, sizeof(path))) {
+			printf("no vivid capture device found\n");
+			return 77;
+		}
+		device = path;
+	}
+	if (access(device, R_OK | W_OK)) {
+		printf("cannot open %s: %s\n", device, strerror(errno));
+		return 77;
+	}
+
+	/* Flipped in both directions, so that every frame gets converted */
+	setenv("LIBV4LCONTROL_FLAGS", "0x3", 1);
+
+	for (i = 0; i < sizeof(test_list) / sizeof(test_list[0]); i++) {
+		run = optind == argc;
+		for (j = optind; j < argc; j++)
+			if (!strcmp(argv[j], test_list[i].name))
+				run = 1;
+		if (!run)
+			continue;
+
+		run = test_list[i].fn();
+		if (fd >= 0) {
+			v4l2_close(fd);
+			fd = -1;
+		}
+		printf("%s: %s\n", test_list[i].name, run == SKIP ? "skipped" :
+		       run ? "FAILED" : "ok");
+		if (run && run != SKIP)
+			failed++;
+	}
+
+	return failed ? 1 : 0;
+}
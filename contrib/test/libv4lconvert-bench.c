@@ -0,0 +1,948 @@
+/*
+ *  libv4lconvert-bench - measure the libv4lconvert conversion throughput
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Converts frames of every src format libv4lconvert supports to every
+ *  dest format, at several resolutions, plain, flipped and with the
+ *  software processing (whitebalance + gamma) enabled, and prints the
+ *  throughput of each conversion as JSON.
+ *
+ *  The src frames are made by the test pattern generator where it supports
+ *  the format, the vendor specific raw formats are filled with noise.
+ *  Compressed formats need a captured frame passed with --input, except
+ *  for (m)jpeg which is encoded from the test pattern when libjpeg is
+ *  available.
+ *
+ *  Example, comparing the c and sse2 kernels at 1080p:
+ *             libv4lconvert-bench -k c -k sse2 -s 1920x1080 > bench.json
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <linux/videodev2.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#include "libv4lconvert.h"
+#include "libv4l-plugin.h"
+#include "v4l2-tpg.h"
+
+#define MAX_SIZES	16
+#define MAX_FILTERS	32
+#define MAX_KERNELS	8
+#define MAX_INPUTS	16
+
+enum gen {
+	GEN_TPG,	/* the tpg supports the format */
+	GEN_PACK10,	/* mipi 10 bit packed bayer, from the 10 bit tpg format */
+	GEN_PACK12,	/* mipi 12 bit packed bayer, from the 12 bit tpg format */
+	GEN_BPACK10,	/* big endian 10 bit packed grey, from tpg Y10 */
+	GEN_MASK,	/* tpg GREY with the low bits cleared */
+	GEN_NOISE,	/* raw vendor formats, any data is a valid frame */
+	GEN_JPEG,	/* tpg RGB24 encoded with libjpeg */
+	GEN_INPUT,	/* compressed, needs a captured frame */
+};
+
+struct bench_src {
+	unsigned int fourcc;
+	enum gen gen;
+	unsigned int tpg_fourcc;
+	int bpp;	/* bits per pixel for GEN_NOISE, low bits mask for GEN_MASK */
+};
+
+/* Every src format accepted by v4lconvert_convert_pixfmt(), in the order of
+   the supported_src_pixfmts table of libv4lconvert (rgb48 is only a dest) */
+static const struct bench_src srcs[] = {
+	{ V4L2_PIX_FMT_RGB24,		GEN_TPG },
+	{ V4L2_PIX_FMT_BGR24,		GEN_TPG },
+	{ V4L2_PIX_FMT_YUV420,		GEN_TPG },
+	{ V4L2_PIX_FMT_YVU420,		GEN_TPG },
+	{ V4L2_PIX_FMT_NV12,		GEN_TPG },
+	{ V4L2_PIX_FMT_YUYV,		GEN_TPG },
+	{ V4L2_PIX_FMT_XRGB32,		GEN_TPG },
+	{ V4L2_PIX_FMT_ARGB32,		GEN_TPG },
+	{ V4L2_PIX_FMT_RGB565,		GEN_TPG },
+	{ V4L2_PIX_FMT_BGR32,		GEN_TPG },
+	{ V4L2_PIX_FMT_RGB32,		GEN_TPG },
+	{ V4L2_PIX_FMT_XBGR32,		GEN_TPG },
+	{ V4L2_PIX_FMT_ABGR32,		GEN_TPG },
+	{ V4L2_PIX_FMT_YVYU,		GEN_TPG },
+	{ V4L2_PIX_FMT_UYVY,		GEN_TPG },
+	{ V4L2_PIX_FMT_NV16,		GEN_TPG },
+	{ V4L2_PIX_FMT_NV61,		GEN_TPG },
+	{ V4L2_PIX_FMT_SPCA501,		GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_SPCA505,		GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_SPCA508,		GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_CIT_YYVYUY,	GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_KONICA420,	GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_SN9C20X_I420,	GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_M420,		GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_NV12_16L16,	GEN_NOISE,	0, 12 },
+	{ V4L2_PIX_FMT_CPIA1,		GEN_INPUT },
+	{ V4L2_PIX_FMT_MJPEG,		GEN_JPEG,	V4L2_PIX_FMT_RGB24 },
+	{ V4L2_PIX_FMT_JPEG,		GEN_JPEG,	V4L2_PIX_FMT_RGB24 },
+	{ V4L2_PIX_FMT_PJPG,		GEN_INPUT },
+	{ V4L2_PIX_FMT_JPGL,		GEN_INPUT },
+	{ V4L2_PIX_FMT_OV511,		GEN_INPUT },
+	{ V4L2_PIX_FMT_OV518,		GEN_INPUT },
+	{ V4L2_PIX_FMT_SBGGR8,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGBRG8,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGRBG8,		GEN_TPG },
+	{ V4L2_PIX_FMT_SRGGB8,		GEN_TPG },
+	{ V4L2_PIX_FMT_STV0680,		GEN_NOISE,	0, 8 },
+	{ V4L2_PIX_FMT_SBGGR10P,	GEN_PACK10,	V4L2_PIX_FMT_SBGGR10 },
+	{ V4L2_PIX_FMT_SGBRG10P,	GEN_PACK10,	V4L2_PIX_FMT_SGBRG10 },
+	{ V4L2_PIX_FMT_SGRBG10P,	GEN_PACK10,	V4L2_PIX_FMT_SGRBG10 },
+	{ V4L2_PIX_FMT_SRGGB10P,	GEN_PACK10,	V4L2_PIX_FMT_SRGGB10 },
+	{ V4L2_PIX_FMT_SBGGR12P,	GEN_PACK12,	V4L2_PIX_FMT_SBGGR12 },
+	{ V4L2_PIX_FMT_SGBRG12P,	GEN_PACK12,	V4L2_PIX_FMT_SGBRG12 },
+	{ V4L2_PIX_FMT_SGRBG12P,	GEN_PACK12,	V4L2_PIX_FMT_SGRBG12 },
+	{ V4L2_PIX_FMT_SRGGB12P,	GEN_PACK12,	V4L2_PIX_FMT_SRGGB12 },
+	{ V4L2_PIX_FMT_SBGGR10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGBRG10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGRBG10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SRGGB10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SBGGR16,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGBRG16,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGRBG16,		GEN_TPG },
+	{ V4L2_PIX_FMT_SRGGB16,		GEN_TPG },
+	{ V4L2_PIX_FMT_SPCA561,		GEN_INPUT },
+	{ V4L2_PIX_FMT_SN9C10X,		GEN_INPUT },
+	{ V4L2_PIX_FMT_SN9C2028,	GEN_INPUT },
+	{ V4L2_PIX_FMT_PAC207,		GEN_INPUT },
+	{ V4L2_PIX_FMT_MR97310A,	GEN_INPUT },
+	{ V4L2_PIX_FMT_JL2005BCD,	GEN_INPUT },
+	{ V4L2_PIX_FMT_SQ905C,		GEN_INPUT },
+	{ V4L2_PIX_FMT_SE401,		GEN_INPUT },
+	{ V4L2_PIX_FMT_GREY,		GEN_TPG },
+	{ V4L2_PIX_FMT_Y4,		GEN_MASK,	V4L2_PIX_FMT_GREY, 0x0f },
+	{ V4L2_PIX_FMT_Y6,		GEN_MASK,	V4L2_PIX_FMT_GREY, 0x03 },
+	{ V4L2_PIX_FMT_Y10BPACK,	GEN_BPACK10,	V4L2_PIX_FMT_Y10 },
+	{ V4L2_PIX_FMT_Y16,		GEN_TPG },
+	{ V4L2_PIX_FMT_Y16_BE,		GEN_TPG },
+	{ V4L2_PIX_FMT_HSV32,		GEN_TPG },
+	{ V4L2_PIX_FMT_HSV24,		GEN_TPG },
+};
+
+static const unsigned int dests[] = {
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_YUYV,
+	V4L2_PIX_FMT_XRGB32,
+	V4L2_PIX_FMT_ARGB32,
+	V4L2_PIX_FMT_RGB48,
+};
+
+enum mode {
+	MODE_PLAIN,
+	MODE_FLIP,
+	MODE_PROCESS,
+	MODE_COUNT
+};
+
+static const char * const mode_names[MODE_COUNT] = {
+	"plain", "flip", "process"
+};
+
+struct bench_input {
+	unsigned int fourcc;
+	int width, height;
+	const char *filename;
+};
+
+struct bench_frame {
+	unsigned char *data;
+	int size;
+	int bytesperline;
+	const char *pattern;
+};
+
+static struct {
+	int sizes[MAX_SIZES][2];
+	int no_sizes;
+	unsigned int src_filter[MAX_FILTERS];
+	int no_src_filters;
+	unsigned int dest_filter[MAX_FILTERS];
+	int no_dest_filters;
+	const char *kernels[MAX_KERNELS];
+	int no_kernels;
+	struct bench_input inputs[MAX_INPUTS];
+	int no_inputs;
+	int modes;
+	int threads;
+	int min_time_ms;
+} opt = {
+	.threads = 0,
+	.min_time_ms = 20,
+};
+
+static int cycles_fd = -1;
+static const char *cycle_counter = "none";
+static int first_result = 1;
+
+/*
+ * The fake device, the conversions are driven by hand so all ioctls fail,
+ * which also makes libv4lcontrol add the flip and processing controls.
+ */
+
+static int bench_ioctl(void *dev_ops_priv, int fd, unsigned long request,
+		       void *arg)
+{
+	if (request == VIDIOC_QUERYCAP) {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "bench");
+		strcpy((char *)cap->card, "libv4lconvert-bench");
+		strcpy((char *)cap->bus_info, "bench");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE;
+		cap->device_caps = V4L2_CAP_VIDEO_CAPTURE;
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops bench_dev_ops = {
+	.ioctl = bench_ioctl,
+};
+
+/*
+ * Timing
+ */
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Use the cpu cycle counter of the calling thread when the kernel lets us,
+   with more than 1 thread only the cycles of the calling thread are counted.
+   Otherwise fall back to the x86 time stamp counter, which counts at a fixed
+   rate and thus includes the cycles of all threads */
+static void bench_cycles_init(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	cycles_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (cycles_fd >= 0) {
+		cycle_counter = "perf";
+		return;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	cycle_counter = "tsc";
+#endif
+}
+
+static uint64_t bench_cycles(void)
+{
+	uint64_t cycles = 0;
+
+	if (cycles_fd >= 0) {
+		if (read(cycles_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+			cycles = 0;
+		return cycles;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	cycles = __rdtsc();
+#endif
+	return cycles;
+}
+
+/*
+ * JSON output
+ */
+
+static const char *fourcc_str(unsigned int fourcc, char *buf)
+{
+	int i, len = 0;
+
+	for (i = 0; i < 4; i++) {
+		char c = (fourcc >> (8 * i)) & 0x7f;
+
+		if (c > ' ' && c < 0x7f && c != '"' && c != '\\')
+			buf[len++] = c;
+	}
+	if (fourcc & (1U << 31)) {
+		strcpy(buf + len, "-BE");
+		len += 3;
+	}
+	buf[len] = 0;
+
+	return buf;
+}
+
+static void json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		/* The error messages end with a newline */
+		if (*s == '\n' && !s[1])
+			break;
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < ' ')
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void json_result_start(struct v4lconvert_data *data,
+		const char *kernels, unsigned int src_fourcc,
+		unsigned int dest_fourcc, int width, int height, int mode,
+		const char *pattern)
+{
+	char src[8], dest[8];
+
+	printf("%s\n\t\t{ \"kernels\": ", first_result ? "" : ",");
+	first_result = 0;
+	json_string(kernels);
+	printf(", \"threads\": %d", v4lconvert_get_threads(data));
+	printf(", \"src\": \"%s\", \"dest\": \"%s\", \"width\": %d, "
+	       "\"height\": %d, \"mode\": \"%s\", \"pattern\": \"%s\"",
+	       fourcc_str(src_fourcc, src), fourcc_str(dest_fourcc, dest),
+	       width, height, mode_names[mode], pattern);
+}
+
+/*
+ * Src frame synthesis
+ */
+
+static int bench_tpg(unsigned int fourcc, int width, int height,
+		     struct bench_frame *frame)
+{
+	static struct tpg_data tpg;
+	unsigned int p;
+	int ret = -1;
+
+	tpg_init(&tpg, width, height);
+	if (tpg_alloc(&tpg, width))
+		goto out;
+	if (!tpg_s_fourcc(&tpg, fourcc))
+		goto out;
+	tpg_reset_source(&tpg, width, height, V4L2_FIELD_NONE);
+	tpg_s_pattern(&tpg, TPG_PAT_75_COLORBAR);
+	tpg_s_show_square(&tpg, true);
+
+	frame->size = 0;
+	for (p = 0; p < tpg_g_planes(&tpg); p++)
+		frame->size += tpg_calc_plane_size(&tpg, p);
+	frame->bytesperline = tpg_g_bytesperline(&tpg, 0);
+	frame->data = malloc(frame->size);
+	if (!frame->data)
+		goto out;
+
+	tpg_fillbuffer(&tpg, 0, 0, frame->data);
+	frame->pattern = "tpg";
+	ret = 0;
+out:
+	tpg_free(&tpg);
+	return ret;
+}
+
+#ifdef HAVE_JPEG
+static int bench_jpeg(const struct bench_frame *rgb, int width, int height,
+		      struct bench_frame *frame)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned long size = 0;
+	unsigned char *out = NULL;
+	JSAMPROW row;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &out, &size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 85, TRUE);
+	/* Most webcams send 4:2:2 */
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 1;
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		row = rgb->data + cinfo.next_scanline * rgb->bytesperline;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	/* Copy it, out must be freed by free() of the libjpeg in use */
+	frame->data = malloc(size);
+	if (!frame->data) {
+		free(out);
+		return -1;
+	}
+	memcpy(frame->data, out, size);
+	free(out);
+	frame->size = size;
+	frame->bytesperline = 0;
+	frame->pattern = "tpg";
+
+	return 0;
+}
+#endif
+
+static int bench_input(unsigned int fourcc, int width, int height,
+		       struct bench_frame *frame)
+{
+	FILE *f;
+	long size;
+	int i;
+
+	for (i = 0; i < opt.no_inputs; i++)
+		if (opt.inputs[i].fourcc == fourcc &&
+		    opt.inputs[i].width == width &&
+		    opt.inputs[i].height == height)
+			break;
+	if (i == opt.no_inputs)
+		return -1;
+
+	f = fopen(opt.inputs[i].filename, "rb");
+	if (!f) {
+		perror(opt.inputs[i].filename);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	frame->data = size > 0 ? malloc(size) : NULL;
+	if (!frame->data || fread(frame->data, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "%s: read error\n", opt.inputs[i].filename);
+		free(frame->data);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	frame->size = size;
+	/* Only used by uncompressed formats, assume unpadded lines */
+	frame->bytesperline = size / height;
+	frame->pattern = "input";
+
+	return 0;
+}
+
+/* Make a frame of src, returns -1 when this is not possible */
+static int bench_frame(const struct bench_src *src, int width, int height,
+		       struct bench_frame *frame)
+{
+	struct bench_frame tpg;
+	unsigned char *s, *d;
+	int x, y;
+
+	/* A captured frame always wins from a synthesized one */
+	if (!bench_input(src->fourcc, width, height, frame))
+		return 0;
+
+	switch (src->gen) {
+	case GEN_TPG:
+		return bench_tpg(src->fourcc, width, height, frame);
+	case GEN_NOISE:
+		/* The vendor formats only come in sizes of 16 pixel multiples */
+		if ((width & 15) || (height & 1))
+			return -1;
+		frame->bytesperline = width * src->bpp / 8;
+		frame->size = width * height * src->bpp / 8;
+		if (src->fourcc == V4L2_PIX_FMT_NV12_16L16) {
+			/* Lines are always 720 bytes, in 32 line macroblocks */
+			if (width > 720)
+				return -1;
+			frame->bytesperline = 720;
+			frame->size = 720 * ((height + 31) & ~31) * 3 / 2;
+		}
+		frame->data = malloc(frame->size);
+		if (!frame->data)
+			return -1;
+		srand(1);
+		for (x = 0; x < frame->size; x++)
+			frame->data[x] = rand() >> 7;
+		frame->pattern = "noise";
+		return 0;
+#ifndef HAVE_JPEG
+	case GEN_JPEG:
+#endif
+	case GEN_INPUT:
+		return -1;
+	default:
+		break;
+	}
+
+	if (bench_tpg(src->tpg_fourcc, width, height, &tpg))
+		return -1;
+
+#ifdef HAVE_JPEG
+	if (src->gen == GEN_JPEG) {
+		x = bench_jpeg(&tpg, width, height, frame);
+		free(tpg.data);
+		return x;
+	}
+#endif
+
+	switch (src->gen) {
+	case GEN_PACK10:
+		/* Lines are padded to a whole group of 4 pixels */
+		frame->bytesperline = (width + 3) / 4 * 5;
+		break;
+	case GEN_PACK12:
+		frame->bytesperline = (width + 1) / 2 * 3;
+		break;
+	case GEN_BPACK10:
+		frame->bytesperline = (width * 10 + 7) / 8;
+		break;
+	case GEN_MASK:
+		frame->bytesperline = width;
+		break;
+	default:
+		break;
+	}
+	frame->size = frame->bytesperline * height;
+	frame->data = calloc(1, frame->size);
+	frame->pattern = tpg.pattern;
+
+	for (y = 0; frame->data && y < height; y++) {
+		s = tpg.data + y * tpg.bytesperline;
+		d = frame->data + y * frame->bytesperline;
+
+		switch (src->gen) {
+		case GEN_PACK10:
+			/* 4 pixels, the 8 msb of each and then their 2 lsb */
+			for (x = 0; x < width; x++, s += 2) {
+				unsigned int v = s[0] | s[1] << 8;
+
+				d[(x >> 2) * 5 + (x & 3)] = v >> 2;
+				d[(x >> 2) * 5 + 4] |= (v & 3) << ((x & 3) * 2);
+			}
+			break;
+		case GEN_PACK12:
+			/* 2 pixels, the 8 msb of each and then their 4 lsb */
+			for (x = 0; x < width; x++, s += 2) {
+				unsigned int v = s[0] | s[1] << 8;
+
+				d[(x >> 1) * 3 + (x & 1)] = v >> 4;
+				d[(x >> 1) * 3 + 2] |= (v & 15) << ((x & 1) * 4);
+			}
+			break;
+		case GEN_BPACK10: {
+			unsigned int bits = 0, no_bits = 0;
+
+			for (x = 0; x < width; x++, s += 2) {
+				bits = bits << 10 | ((s[0] | s[1] << 8) & 0x3ff);
+				no_bits += 10;
+				while (no_bits >= 8) {
+					no_bits -= 8;
+					*d++ = bits >> no_bits;
+				}
+			}
+			if (no_bits)
+				*d = bits << (8 - no_bits);
+			break;
+		}
+		case GEN_MASK:
+			for (x = 0; x < width; x++)
+				d[x] = s[x] & ~src->bpp;
+			break;
+		default:
+			break;
+		}
+	}
+
+	free(tpg.data);
+
+	return frame->data ? 0 : -1;
+}
+
+/*
+ * The benchmark
+ */
+
+static int bench_set_mode(struct v4lconvert_data *data, int mode)
+{
+	struct v4l2_control ctrl[4] = {
+		{ V4L2_CID_HFLIP, mode == MODE_FLIP },
+		{ V4L2_CID_VFLIP, mode == MODE_FLIP },
+		{ V4L2_CID_AUTO_WHITE_BALANCE, mode == MODE_PROCESS },
+		{ V4L2_CID_GAMMA, mode == MODE_PROCESS ? 1500 : 1000 },
+	};
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (v4lconvert_vidioc_s_ctrl(data, &ctrl[i]))
+			return -1;
+
+	return 0;
+}
+
+static void bench_convert(struct v4lconvert_data *data, const char *kernels,
+		const struct bench_src *src, const struct bench_frame *frame,
+		unsigned int dest_fourcc, int width, int height, int mode)
+{
+	struct v4l2_format src_fmt, dest_fmt;
+	uint64_t start, end, cycles, min_ns;
+	unsigned char *dest;
+	double pixels;
+	int frames = 0;
+
+	json_result_start(data, kernels, src->fourcc, dest_fourcc, width, height,
+			  mode, frame->pattern);
+
+	memset(&src_fmt, 0, sizeof(src_fmt));
+	src_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	src_fmt.fmt.pix.width = width;
+	src_fmt.fmt.pix.height = height;
+	src_fmt.fmt.pix.pixelformat = src->fourcc;
+	src_fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	src_fmt.fmt.pix.bytesperline = frame->bytesperline;
+	src_fmt.fmt.pix.sizeimage = frame->size;
+
+	dest_fmt = src_fmt;
+	dest_fmt.fmt.pix.pixelformat = dest_fourcc;
+	v4lconvert_fixup_fmt(&dest_fmt);
+
+	dest = malloc(dest_fmt.fmt.pix.sizeimage);
+	if (!dest) {
+		printf(", \"error\": \"out of memory\" }");
+		return;
+	}
+
+	/* The first frame allocates the conversion buffers */
+	if (bench_set_mode(data, mode)) {
+		printf(", \"error\": \"controls not available\" }");
+		goto out;
+	}
+	if (v4lconvert_convert(data, &src_fmt, &dest_fmt, frame->data,
+			       frame->size, dest,
+			       dest_fmt.fmt.pix.sizeimage) < 0) {
+		printf(", \"error\": ");
+		json_string(v4lconvert_get_error_message(data));
+		printf(" }");
+		goto out;
+	}
+
+	min_ns = (uint64_t)opt.min_time_ms * 1000000;
+	start = bench_ns();
+	cycles = bench_cycles();
+	do {
+		v4lconvert_convert(data, &src_fmt, &dest_fmt, frame->data,
+				   frame->size, dest,
+				   dest_fmt.fmt.pix.sizeimage);
+		frames++;
+		end = bench_ns();
+	} while (end - start < min_ns || frames < 3);
+	cycles = bench_cycles() - cycles;
+
+	pixels = (double)width * height * frames;
+	printf(", \"frames\": %d, \"mpix_per_s\": %.2f, \"cycles_per_pixel\": ",
+	       frames, pixels * 1000 / (end - start));
+	if (strcmp(cycle_counter, "none"))
+		printf("%.2f }", cycles / pixels);
+	else
+		printf("null }");
+out:
+	free(dest);
+}
+
+static int bench_match(unsigned int fourcc, const unsigned int *filter,
+		       int no_filters)
+{
+	int i;
+
+	if (!no_filters)
+		return 1;
+
+	for (i = 0; i < no_filters; i++)
+		if (filter[i] == fourcc)
+			return 1;
+
+	return 0;
+}
+
+static int bench_run(const char *kernels)
+{
+	struct v4lconvert_data *data;
+	struct bench_frame frame;
+	unsigned int s, d;
+	int i, mode;
+
+	if (kernels)
+		setenv("LIBV4LCONVERT_SIMD", kernels, 1);
+	else
+		kernels = getenv("LIBV4LCONVERT_SIMD") ?: "default";
+
+	data = v4lconvert_create_with_dev_ops(-1, NULL, &bench_dev_ops);
+	if (!data) {
+		fprintf(stderr, "libv4lconvert-bench: v4lconvert_create failed\n");
+		return -1;
+	}
+	if (opt.threads && v4lconvert_set_threads(data, opt.threads)) {
+		fprintf(stderr, "libv4lconvert-bench: %s\n",
+			v4lconvert_get_error_message(data));
+		v4lconvert_destroy(data);
+		return -1;
+	}
+
+	for (i = 0; i < opt.no_sizes; i++) {
+		int width = opt.sizes[i][0], height = opt.sizes[i][1];
+
+		for (s = 0; s < sizeof(srcs) / sizeof(srcs[0]); s++) {
+			if (!bench_match(srcs[s].fourcc, opt.src_filter,
+					 opt.no_src_filters))
+				continue;
+
+			if (bench_frame(&srcs[s], width, height, &frame)) {
+				char fourcc[8];
+
+				fprintf(stderr, "libv4lconvert-bench: no %dx%d %s frame, "
+					"pass one with --input\n", width, height,
+					fourcc_str(srcs[s].fourcc, fourcc));
+				continue;
+			}
+
+			for (mode = 0; mode < MODE_COUNT; mode++) {
+				if (!(opt.modes & (1 << mode)))
+					continue;
+
+				for (d = 0; d < sizeof(dests) / sizeof(dests[0]); d++)
+					if (bench_match(dests[d], opt.dest_filter,
+							opt.no_dest_filters))
+						bench_convert(data, kernels, &srcs[s],
+							      &frame, dests[d], width,
+							      height, mode);
+			}
+			free(frame.data);
+		}
+	}
+
+	v4lconvert_destroy(data);
+	return 0;
+}
+
+/*
+ * Options
+ */
+
+static int parse_fourcc(const char *s, unsigned int *fourcc)
+{
+	int i;
+
+	*fourcc = 0;
+	for (i = 0; i < 4 && s[i] && s[i] != ':' && s[i] != '-'; i++)
+		*fourcc |= (unsigned int)s[i] << (8 * i);
+	if (i == 0)
+		return -1;
+	for (; i < 4; i++)
+		*fourcc |= (unsigned int)' ' << (8 * i);
+	if (!strncmp(s + strcspn(s, "-:"), "-BE", 3))
+		*fourcc |= 1U << 31;
+
+	return 0;
+}
+
+static int parse_size(const char *s, int *width, int *height)
+{
+	if (sscanf(s, "%dx%d", width, height) != 2 ||
+	    *width < 16 || *height < 16 || *width > 16384 || *height > 16384)
+		return -1;
+
+	return 0;
+}
+
+static void usage(FILE *fp, char **argv)
+{
+	fprintf(fp,
+		"Usage: %s [options]\n\n"
+		"Converts frames of every src format to every dest format and\n"
+		"prints the throughput as JSON.\n\n"
+		"Options:\n"
+		"-s | --size WxH           Frame size, can be repeated\n"
+		"                          [320x240, 640x480, 1280x720, 1920x1080]\n"
+		"-f | --src FOURCC         Only convert from FOURCC, can be repeated\n"
+		"-d | --dest FOURCC        Only convert to FOURCC, can be repeated\n"
+		"-m | --mode MODE          plain, flip or process, can be repeated\n"
+		"                          [all]\n"
+		"-k | --kernels NAME       Conversion kernels (LIBV4LCONVERT_SIMD),\n"
+		"                          e.g. c, sse2, avx2 or neon, can be repeated\n"
+		"-t | --threads N          Conversion threads [library default]\n"
+		"-T | --time MS            Minimum time per conversion [%d]\n"
+		"-i | --input FOURCC:WxH:FILE\n"
+		"                          Use a captured frame, needed for the\n"
+		"                          compressed formats, can be repeated\n"
+		"-h | --help               Print this message\n\n"
+		"Big endian formats are written as FOURCC-BE, e.g. Y16-BE\n",
+		argv[0], opt.min_time_ms);
+}
+
+static const char short_options[] = "s:f:d:m:k:t:T:i:h";
+
+static const struct option long_options[] = {
+	{ "size",    required_argument, NULL, 's' },
+	{ "src",     required_argument, NULL, 'f' },
+	{ "dest",    required_argument, NULL, 'd' },
+	{ "mode",    required_argument, NULL, 'm' },
+	{ "kernels", required_argument, NULL, 'k' },
+	{ "threads", required_argument, NULL, 't' },
+	{ "time",    required_argument, NULL, 'T' },
+	{ "input",   required_argument, NULL, 'i' },
+	{ "help",    no_argument,       NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	static const int default_sizes[][2] = {
+		{ 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }
+	};
+	struct bench_input *input;
+	const char *s;
+	int c, i, mode, ret = 0;
+
+	for (;;) {
+		c = getopt_long(argc, argv, short_options, long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 's':
+			if (opt.no_sizes == MAX_SIZES ||
+			    parse_size(optarg, &opt.sizes[opt.no_sizes][0],
+				       &opt.sizes[opt.no_sizes][1]))
+				goto bad_arg;
+			opt.no_sizes++;
+			break;
+		case 'f':
+			if (opt.no_src_filters == MAX_FILTERS ||
+			    parse_fourcc(optarg, &opt.src_filter[opt.no_src_filters]))
+				goto bad_arg;
+			opt.no_src_filters++;
+			break;
+		case 'd':
+			if (opt.no_dest_filters == MAX_FILTERS ||
+			    parse_fourcc(optarg, &opt.dest_filter[opt.no_dest_filters]))
+				goto bad_arg;
+			opt.no_dest_filters++;
+			break;
+		case 'm':
+			for (mode = 0; mode < MODE_COUNT; mode++)
+				if (!strcmp(optarg, mode_names[mode]))
+					break;
+			if (mode == MODE_COUNT)
+				goto bad_arg;
+			opt.modes |= 1 << mode;
+			break;
+		case 'k':
+			if (opt.no_kernels == MAX_KERNELS)
+				goto bad_arg;
+			opt.kernels[opt.no_kernels++] = optarg;
+			break;
+		case 't':
+			opt.threads = atoi(optarg);
+			if (opt.threads < 1)
+				goto bad_arg;
+			break;
+		case 'T':
+			opt.min_time_ms = atoi(optarg);
+			if (opt.min_time_ms < 0)
+				goto bad_arg;
+			break;
+		case 'i':
+			if (opt.no_inputs == MAX_INPUTS)
+				goto bad_arg;
+			input = &opt.inputs[opt.no_inputs];
+			s = strchr(optarg, ':');
+			if (!s || parse_fourcc(optarg, &input->fourcc) ||
+			    parse_size(s + 1, &input->width, &input->height))
+				goto bad_arg;
+			s = strchr(s + 1, ':');
+			if (!s || !s[1])
+				goto bad_arg;
+			input->filename = s + 1;
+			opt.no_inputs++;
+			break;
+		case 'h':
+			usage(stdout, argv);
+			return 0;
+		default:
+			usage(stderr, argv);
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		usage(stderr, argv);
+		return 1;
+	}
+
+	if (!opt.no_sizes) {
+		opt.no_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+		memcpy(opt.sizes, default_sizes, sizeof(default_sizes));
+	}
+	/* Frames given with --input are benchmarked at their size too */
+	for (i = 0; i < opt.no_inputs && opt.no_sizes < MAX_SIZES; i++) {
+		for (c = 0; c < opt.no_sizes; c++)
+			if (opt.sizes[c][0] == opt.inputs[i].width &&
+			    opt.sizes[c][1] == opt.inputs[i].height)
+				break;
+		if (c == opt.no_sizes) {
+			opt.sizes[c][0] = opt.inputs[i].width;
+			opt.sizes[c][1] = opt.inputs[i].height;
+			opt.no_sizes++;
+		}
+	}
+	if (!opt.modes)
+		opt.modes = (1 << MODE_COUNT) - 1;
+
+	bench_cycles_init();
+
+	printf("{\n\t\"cycle_counter\": \"%s\",\n\t\"min_time_ms\": %d,\n"
+	       "\t\"results\": [", cycle_counter, opt.min_time_ms);
+	if (!opt.no_kernels)
+		ret = bench_run(NULL);
+	for (i = 0; i < opt.no_kernels && !ret; i++)
+		ret = bench_run(opt.kernels[i]);
+	printf("\n\t]\n}\n");
+
+	return ret ? 1 : 0;
+
+bad_arg:
+	fprintf(stderr, "libv4lconvert-bench: invalid argument: %s\n", optarg);
+	usage(stderr, argv);
+	return 1;
+}
@@ -0,0 +1,442 @@
+/*
+ *  libv4lconvert-kernel-test - check the libv4lconvert SIMD kernels
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Runs every entry of every SIMD kernel table the cpu supports on random
+ *  data over a range of widths (odd ones included), heights and unaligned
+ *  line strides / plane addresses, and checks that the result is bit exact
+ *  with the c kernels. The bytes around the written area must be left
+ *  alone too, except for the padding at the end of the dest lines.
+ *
+ *  The kernels are private to libv4lconvert, so this is linked with the
+ *  library objects rather than the shared library.
+ *
+ *  Exits with 0 when all kernels match, 1 on a mismatch and 77 (skipped)
+ *  when the cpu only supports the c kernels.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+#define GUARD 0xa5
+/* Large enough for the biggest frame below, including padding and the
+   misaligned plane offsets */
+#define BUF_SIZE (4 * 1024 * 1024)
+
+static const int widths[] = {
+	1, 2, 3, 5, 8, 15, 16, 17, 30, 31, 32, 33, 34, 47, 48, 62, 63, 64,
+	65, 66, 97, 98, 639, 640,
+};
+static const int heights[] = { 1, 2, 3, 4, 6 };
+/* Extra bytes per line, the odd ones give unaligned strides */
+static const int pads[] = { 0, 1, 7, 16 };
+
+static unsigned char *src;
+static unsigned char *ref_buf, *out_buf;
+static const struct v4lconvert_kernels *c;
+static const struct v4lconvert_kernels *k;
+static unsigned tests, fails;
+
+static void fill_random(unsigned char *buf, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = rand();
+}
+
+static void reset_dest(void)
+{
+	memset(ref_buf, GUARD, BUF_SIZE);
+	memset(out_buf, GUARD, BUF_SIZE);
+}
+
+/* The SIMD kernels may use the padding at the end of a dest line as
+   scratch space, so only the bytes of the lines and around the frame
+   are compared */
+static void clear_padding(unsigned char *buf, int height, int bytes,
+		int stride)
+{
+	int y;
+
+	for (y = 0; y < height - 1; y++)
+		memset(buf + y * stride + bytes, GUARD, stride - bytes);
+}
+
+static void check(const char *kernel, const unsigned char *ref,
+		const unsigned char *out, size_t size, const char *fmt, ...)
+	__attribute__((format(printf, 5, 6)));
+
+static void check(const char *kernel, const unsigned char *ref,
+		const unsigned char *out, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	size_t i;
+
+	tests++;
+	if (!memcmp(ref, out, size))
+		return;
+
+	for (i = 0; ref[i] == out[i]; i++)
+		;
+	fails++;
+	printf("FAIL: %s %s ", k->name, kernel);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf(": byte %zu is 0x%02x, should be 0x%02x\n", i, out[i], ref[i]);
+}
+
+/* Places the planes at odd addresses, the chroma strides are not derived
+   from the luma one so that mixing them up is noticed */
+static void setup_planes(struct v4lconvert_planes *planes, unsigned char *base,
+		int height, int stride, int semi_planar)
+{
+	planes->plane[0] = base + 1;
+	planes->stride[0] = stride;
+	planes->plane[1] = planes->plane[0] + stride * height + 7;
+	planes->stride[1] = semi_planar ? stride + 2 : stride / 2 + 3;
+	planes->plane[2] = planes->plane[1] + planes->stride[1] * height + 5;
+	planes->stride[2] = stride / 2 + 5;
+}
+
+typedef void (*packed_fn)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride, int dest_stride);
+
+static void test_packed(const char *kernel, packed_fn ref_fn, packed_fn fn,
+		int width, int height, int pad)
+{
+	int stride = width * 2 + pad, dest_stride = width * 3 + pad / 2;
+
+	reset_dest();
+	ref_fn(src + 1, ref_buf, width, height, stride, dest_stride);
+	fn(src + 1, out_buf, width, height, stride, dest_stride);
+	clear_padding(ref_buf, height, (width & ~1) * 3, dest_stride);
+	clear_padding(out_buf, height, (width & ~1) * 3, dest_stride);
+	check(kernel, ref_buf, out_buf, BUF_SIZE, "%dx%d stride %d",
+	      width, height, stride);
+}
+
+typedef void (*planar_fn)(const struct v4lconvert_planes *src,
+		unsigned char *dst, int width, int height, int dest_stride,
+		int flag);
+
+static void test_planar(const char *kernel, planar_fn ref_fn, planar_fn fn,
+		int width, int height, int pad, int semi_planar, int flag)
+{
+	struct v4lconvert_planes planes;
+	int dest_stride = width * 3 + pad / 2;
+
+	setup_planes(&planes, src, height, width + pad, semi_planar);
+	reset_dest();
+	ref_fn(&planes, ref_buf, width, height, dest_stride, flag);
+	fn(&planes, out_buf, width, height, dest_stride, flag);
+	clear_padding(ref_buf, height, width * 3, dest_stride);
+	clear_padding(out_buf, height, width * 3, dest_stride);
+	check(kernel, ref_buf, out_buf, BUF_SIZE, "%dx%d stride %d flag %d",
+	      width, height, width + pad, flag);
+}
+
+static void test_nv12_to_yuv420(int width, int height, int pad, int yvu)
+{
+	struct v4lconvert_planes planes, ref_planes, out_planes;
+
+	setup_planes(&planes, src, height, width + pad, 1);
+	setup_planes(&ref_planes, ref_buf, height, width + pad + 3, 0);
+	setup_planes(&out_planes, out_buf, height, width + pad + 3, 0);
+	reset_dest();
+	c->nv12_to_yuv420(&planes, &ref_planes, width, height, yvu);
+	k->nv12_to_yuv420(&planes, &out_planes, width, height, yvu);
+	check("nv12_to_yuv420", ref_buf, out_buf, BUF_SIZE,
+	      "%dx%d stride %d yvu %d", width, height, width + pad, yvu);
+}
+
+static void test_nv16_to_yuyv(int width, int height, int pad)
+{
+	struct v4lconvert_planes planes;
+	int dest_stride = width * 2 + pad / 2;
+
+	setup_planes(&planes, src, height, width + pad, 1);
+	reset_dest();
+	c->nv16_to_yuyv(&planes, ref_buf, width, height, dest_stride);
+	k->nv16_to_yuyv(&planes, out_buf, width, height, dest_stride);
+	clear_padding(ref_buf, height, width * 2, dest_stride);
+	clear_padding(out_buf, height, width * 2, dest_stride);
+	check("nv16_to_yuyv", ref_buf, out_buf, BUF_SIZE, "%dx%d stride %d",
+	      width, height, width + pad);
+}
+
+static void test_rgb24_to_argb32(int width, int height, int pad, int bgr)
+{
+	int stride = width * 3 + pad, dest_stride = width * 4 + pad;
+	int size = dest_stride * height + 16;
+	/* Exactly sized src, so that reads past its end are noticed by
+	   valgrind / asan */
+	unsigned char *rgb = malloc(stride * height);
+
+	memcpy(rgb, src, stride * height);
+	reset_dest();
+	c->rgb24_to_argb32(rgb, ref_buf, width, height, stride, dest_stride,
+			   bgr);
+	k->rgb24_to_argb32(rgb, out_buf, width, height, stride, dest_stride,
+			   bgr);
+	clear_padding(ref_buf, height, width * 4, dest_stride);
+	clear_padding(out_buf, height, width * 4, dest_stride);
+	check("rgb24_to_argb32", ref_buf, out_buf, size,
+	      "%dx%d stride %d bgr %d", width, height, stride, bgr);
+
+	/* And in place, which is how libv4lconvert uses it */
+	memset(out_buf, GUARD, size);
+	memcpy(out_buf, rgb, stride * height);
+	k->rgb24_to_argb32(out_buf, out_buf, width, height, stride,
+			   dest_stride, bgr);
+	clear_padding(out_buf, height, width * 4, dest_stride);
+	check("rgb24_to_argb32 (in place)", ref_buf, out_buf,
+	      dest_stride * (height - 1) + width * 4, "%dx%d stride %d bgr %d",
+	      width, height, stride, bgr);
+	free(rgb);
+}
+
+static void test_lut_rgb24(int width)
+{
+	/* lut_rgb24 may read 3 bytes past the end of the lut */
+	unsigned char lut[768 + 3];
+
+	fill_random(lut, sizeof(lut));
+	reset_dest();
+	memcpy(ref_buf, src, width * 3);
+	memcpy(out_buf, src, width * 3);
+	c->lut_rgb24(ref_buf, width, lut);
+	k->lut_rgb24(out_buf, width, lut);
+	check("lut_rgb24", ref_buf, out_buf, width * 3 + 16, "width %d",
+	      width);
+}
+
+static void test_bayer_pairs_to_bgr24(int pairs, int pad, int blue_line)
+{
+	/* The kernel reads the line above and below the current one */
+	int stride = 2 * pairs + 2 + pad;
+
+	reset_dest();
+	c->bayer_pairs_to_bgr24(src + 1 + stride, stride, ref_buf, pairs,
+				blue_line);
+	k->bayer_pairs_to_bgr24(src + 1 + stride, stride, out_buf, pairs,
+				blue_line);
+	check("bayer_pairs_to_bgr24", ref_buf, out_buf, pairs * 6 + 16,
+	      "pairs %d stride %d blue_line %d", pairs, stride, blue_line);
+}
+
+static void test_scale_rows(int n, int weight)
+{
+	uint16_t ref_acc[700], out_acc[700];
+	int i;
+
+	for (i = 0; i < (int)ARRAY_SIZE(ref_acc); i++)
+		ref_acc[i] = out_acc[i] = rand() & 0x7fff;
+
+	/* A first line and an added second line, summing to weight 256 */
+	c->scale_rows(ref_acc, src + 1, n, weight, 0);
+	k->scale_rows(out_acc, src + 1, n, weight, 0);
+	c->scale_rows(ref_acc, src + 3, n, 256 - weight, 1);
+	k->scale_rows(out_acc, src + 3, n, 256 - weight, 1);
+	check("scale_rows", (unsigned char *)ref_acc, (unsigned char *)out_acc,
+	      sizeof(ref_acc), "n %d weight %d", n, weight);
+}
+
+static void test_jpeg_idct_islow(void)
+{
+	int16_t coef[64], quant[64];
+	unsigned char ref[8 * 16], out[8 * 16];
+	double pixels[64], sum;
+	int i, t, x, y, u, v, mode;
+
+	for (t = 0; t < 20000; t++) {
+		mode = t % 4;
+		for (i = 0; i < 64; i++)
+			quant[i] = 1 + rand() % (mode == 3 ? 8 :
+						 t % 7 ? 40 : 255);
+
+		if (mode == 3) {
+			/* Sparse coefficients, sometimes only the first row
+			   and column, which hit the idct shortcuts */
+			for (i = 0; i < 64; i++)
+				coef[i] = rand() % 5 ? 0 : rand() % 201 - 100;
+			if (t & 8)
+				for (i = 8; i < 64; i++)
+					if (i % 8)
+						coef[i] = 0;
+		} else {
+			/* Forward dct of random, smooth or saturated pixels */
+			for (i = 0; i < 64; i++) {
+				if (mode == 0)
+					pixels[i] = rand() % 256;
+				else if (mode == 1)
+					pixels[i] = 60 + (i % 8) * 10 +
+						    (i / 8) * 5 + rand() % 5;
+				else
+					pixels[i] = (rand() & 1) ? 255 : 0;
+			}
+			for (v = 0; v < 8; v++) {
+				for (u = 0; u < 8; u++) {
+					sum = 0;
+					for (y = 0; y < 8; y++)
+						for (x = 0; x < 8; x++)
+							sum += (pixels[y * 8 + x] - 128) *
+							       cos((2 * x + 1) * u * M_PI / 16) *
+							       cos((2 * y + 1) * v * M_PI / 16);
+					sum *= 0.25 * (u ? 1 : M_SQRT1_2) *
+					       (v ? 1 : M_SQRT1_2);
+					coef[v * 8 + u] =
+						lround(sum / quant[v * 8 + u]);
+				}
+			}
+		}
+
+		memset(ref, GUARD, sizeof(ref));
+		memset(out, GUARD, sizeof(out));
+		c->jpeg_idct_islow(coef, quant, ref + 3, 16);
+		k->jpeg_idct_islow(coef, quant, out + 3, 16);
+		check("jpeg_idct_islow", ref, out, sizeof(ref), "block %d", t);
+	}
+}
+
+static void test_hflip_u8(int width)
+{
+	reset_dest();
+	c->hflip_u8(src + width, ref_buf, width);
+	k->hflip_u8(src + width, out_buf, width);
+	check("hflip_u8", ref_buf, out_buf, width + 32, "width %d", width);
+}
+
+static void test_rotate90_u8(int width, int height, int pad)
+{
+	/* The src is height x width, the dest width x height */
+	int src_stride = height + pad, dest_stride = width + pad / 2;
+
+	reset_dest();
+	c->rotate90_u8(src + 1, src_stride, ref_buf, dest_stride, width,
+		       height);
+	k->rotate90_u8(src + 1, src_stride, out_buf, dest_stride, width,
+		       height);
+	check("rotate90_u8", ref_buf, out_buf, dest_stride * height + 32,
+	      "%dx%d src stride %d", width, height, src_stride);
+}
+
+static void test_kernels(void)
+{
+	unsigned w, h, p;
+	int width, height, pad, flag;
+
+	for (w = 0; w < ARRAY_SIZE(widths); w++) {
+		width = widths[w];
+		for (h = 0; h < ARRAY_SIZE(heights); h++) {
+			height = heights[h];
+			for (p = 0; p < ARRAY_SIZE(pads); p++) {
+				pad = pads[p];
+#define TEST_PACKED(f) test_packed(#f, c->f, k->f, width, height, pad)
+				TEST_PACKED(yuyv_to_rgb24);
+				TEST_PACKED(yuyv_to_bgr24);
+				TEST_PACKED(yvyu_to_rgb24);
+				TEST_PACKED(yvyu_to_bgr24);
+				TEST_PACKED(uyvy_to_rgb24);
+				TEST_PACKED(uyvy_to_bgr24);
+#undef TEST_PACKED
+				test_nv16_to_yuyv(width, height, pad);
+				test_rgb24_to_argb32(width, height, pad, 0);
+				test_rgb24_to_argb32(width, height, pad, 1);
+				test_rotate90_u8(width % 100 + 1, height * 7,
+						 pad);
+
+				/* 4:2:0 is subsampled by 2 in both directions */
+				if ((width & 1) || (height & 1))
+					continue;
+
+				for (flag = 0; flag < 2; flag++) {
+					test_planar("yuv420_to_rgb24",
+						    c->yuv420_to_rgb24,
+						    k->yuv420_to_rgb24,
+						    width, height, pad, 0, flag);
+					test_planar("yuv420_to_bgr24",
+						    c->yuv420_to_bgr24,
+						    k->yuv420_to_bgr24,
+						    width, height, pad, 0, flag);
+					test_planar("nv12_to_rgb24",
+						    c->nv12_to_rgb24,
+						    k->nv12_to_rgb24,
+						    width, height, pad, 1, flag);
+					test_nv12_to_yuv420(width, height, pad,
+							    flag);
+				}
+			}
+		}
+		test_lut_rgb24(width);
+		test_hflip_u8(width);
+		test_scale_rows(width, width % 257);
+		test_bayer_pairs_to_bgr24(width, 0, 0);
+		test_bayer_pairs_to_bgr24(width, 3, 1);
+	}
+
+	/* All lengths up to a few vector widths, to catch tail handling */
+	for (width = 0; width <= 100; width++) {
+		test_lut_rgb24(width);
+		test_hflip_u8(width);
+		test_scale_rows(width, 256);
+		test_scale_rows(width, 37);
+		for (flag = 0; flag < 2; flag++)
+			test_bayer_pairs_to_bgr24(width, flag * 19, flag);
+	}
+
+	test_jpeg_idct_islow();
+}
+
+int main(void)
+{
+	unsigned prev_tests = 0, prev_fails = 0;
+	int i, tested = 0;
+
+	src = malloc(BUF_SIZE);
+	ref_buf = malloc(BUF_SIZE);
+	out_buf = malloc(BUF_SIZE);
+	if (!src || !ref_buf || !out_buf) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	fill_random(src, BUF_SIZE);
+
+	c = &v4lconvert_c_kernels;
+	for (i = 0; (k = v4lconvert_supported_kernels(i)); i++) {
+		if (k == c)
+			continue;
+		test_kernels();
+		printf("%s: %u tests, %u failed\n", k->name,
+		       tests - prev_tests, fails - prev_fails);
+		prev_tests = tests;
+		prev_fails = fails;
+		tested++;
+	}
+
+	free(src);
+	free(ref_buf);
+	free(out_buf);
+
+	if (!tested) {
+		printf("only the c kernels are supported\n");
+		return 77;
+	}
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,858 @@
+/*
+ *  libv4lconvert-test - check libv4lconvert against a fake device
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  The device is faked through the dev_ops of
+ *  v4lconvert_create_with_dev_ops(), it captures yuyv at a few discrete
+ *  sizes. The rotate tests leave the libv4lcontrol shared memory segment
+ *  of the fake device behind, like any libv4l app does. Without arguments
+ *  all tests are run, else only the named ones.
+ *
+ *  Exits with 0 when all tests pass and 1 on a failure.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/videodev2.h>
+#include "libv4l-plugin.h"
+#include "libv4lconvert.h"
+
+#define GUARD 0xa5
+
+static const unsigned int sizes[][2] = {
+	{ 1280, 720 }, { 640, 480 }, { 320, 240 },
+};
+
+static struct fake_dev {
+	const char *driver;
+	unsigned int version;
+	const unsigned int (*sizes)[2];
+	int no_sizes;
+	/* How often these were called */
+	int enum_framesizes, try_fmts;
+} dev;
+
+#define fail_on_test(test)						\
+	do {								\
+		if (test) {						\
+			printf("FAIL: %s:%d: %s\n", __func__, __LINE__,	\
+			       #test);					\
+			return -1;					\
+		}							\
+	} while (0)
+
+/* The largest size which fits in the requested one, else the smallest */
+static void fake_fmt(struct v4l2_format *fmt)
+{
+	int i = 0;
+
+	while (i < dev.no_sizes - 1 &&
+	       (dev.sizes[i][0] > fmt->fmt.pix.width ||
+		dev.sizes[i][1] > fmt->fmt.pix.height))
+		i++;
+
+	fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+	fmt->fmt.pix.width = dev.sizes[i][0];
+	fmt->fmt.pix.height = dev.sizes[i][1];
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 2;
+	fmt->fmt.pix.sizeimage = fmt->fmt.pix.bytesperline *
+				 fmt->fmt.pix.height;
+}
+
+static int fake_ioctl(void *priv, int fd, unsigned long request, void *arg)
+{
+	struct v4l2_capability *cap = arg;
+	struct v4l2_fmtdesc *fmtdesc = arg;
+	struct v4l2_frmsizeenum *frmsize = arg;
+
+	switch (request) {
+	case VIDIOC_QUERYCAP:
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, dev.driver);
+		strcpy((char *)cap->card, "libv4lconvert-test");
+		cap->version = dev.version;
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	case VIDIOC_ENUM_FMT:
+		if (fmtdesc->index)
+			break;
+		fmtdesc->pixelformat = V4L2_PIX_FMT_YUYV;
+		return 0;
+	case VIDIOC_ENUM_FRAMESIZES:
+		dev.enum_framesizes++;
+		if (frmsize->pixel_format != V4L2_PIX_FMT_YUYV ||
+		    frmsize->index >= (unsigned int)dev.no_sizes)
+			break;
+		frmsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+		frmsize->discrete.width = dev.sizes[frmsize->index][0];
+		frmsize->discrete.height = dev.sizes[frmsize->index][1];
+		return 0;
+	case VIDIOC_TRY_FMT:
+		dev.try_fmts++;
+		fake_fmt(arg);
+		return 0;
+	case VIDIOC_S_FMT:
+	case VIDIOC_G_FMT:
+		fake_fmt(arg);
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops fake_dev_ops = {
+	.ioctl = fake_ioctl,
+};
+
+static struct v4lconvert_data *create_with_fd(int fd)
+{
+	return v4lconvert_create_with_dev_ops(fd, NULL, &fake_dev_ops);
+}
+
+static struct v4lconvert_data *create(void)
+{
+	return create_with_fd(-1);
+}
+
+/* With the software flip and rotate controls, which libv4lcontrol only
+   offers for devices known to need them unless told otherwise */
+static struct v4lconvert_data *create_with_controls(void)
+{
+	struct v4lconvert_data *data;
+
+	/* 1 << V4LCONTROL_HFLIP | 1 << V4LCONTROL_VFLIP | 1 << V4LCONTROL_ROTATE */
+	setenv("LIBV4LCONTROL_CONTROLS", "0x86", 1);
+	data = create();
+	unsetenv("LIBV4LCONTROL_CONTROLS");
+
+	return data;
+}
+
+static void fill_random(unsigned char *buf, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = rand();
+}
+
+static void set_fmt(struct v4l2_format *fmt, unsigned int pixelformat,
+		int width, int height)
+{
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt->fmt.pix.pixelformat = pixelformat;
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	v4lconvert_fixup_fmt(fmt);
+}
+
+/* Sample c of pixel x, y of a plane with bpp bytes per pixel */
+#define PIXEL(plane, stride, bpp, x, y, c) \
+	((plane)[(y) * (stride) + (x) * (bpp) + (c)])
+
+/* Float reference of what the area / bilinear scaler gives for dest pixel
+   x, y of an sw x sh plane scaled to dw x dh */
+static double scale_ref(const unsigned char *s, int stride, int bpp,
+		int sw, int sh, int dw, int dh, int x, int y, int c,
+		int bilinear)
+{
+	double x0, x1, y0, y1, ax, ay, sum = 0;
+	int i, j;
+
+	if (bilinear) {
+		/* Pixel centers, clamped to the frame */
+		x0 = fmax((x + 0.5) * sw / dw - 0.5, 0);
+		y0 = fmax((y + 0.5) * sh / dh - 0.5, 0);
+		i = x0;
+		j = y0;
+		ax = x0 - i;
+		ay = y0 - j;
+		if (i >= sw - 1) {
+			i = sw - 2;
+			ax = 1;
+		}
+		if (j >= sh - 1) {
+			j = sh - 2;
+			ay = 1;
+		}
+		return (PIXEL(s, stride, bpp, i, j, c) * (1 - ax) +
+			PIXEL(s, stride, bpp, i + 1, j, c) * ax) * (1 - ay) +
+		       (PIXEL(s, stride, bpp, i, j + 1, c) * (1 - ax) +
+			PIXEL(s, stride, bpp, i + 1, j + 1, c) * ax) * ay;
+	}
+
+	/* The src pixels covered by the dest pixel, weighted by how much of
+	   them it covers */
+	x0 = (double)x * sw / dw;
+	x1 = (double)(x + 1) * sw / dw;
+	y0 = (double)y * sh / dh;
+	y1 = (double)(y + 1) * sh / dh;
+	for (j = y0; j < y1 && j < sh; j++)
+		for (i = x0; i < x1 && i < sw; i++)
+			sum += PIXEL(s, stride, bpp, i, j, c) *
+			       (fmin(i + 1, x1) - fmax(i, x0)) *
+			       (fmin(j + 1, y1) - fmax(j, y0));
+	return sum / ((x1 - x0) * (y1 - y0));
+}
+
+/* Scale an rgb24 / bgr24 / yuv420 frame of sw x sh to dw x dh and compare
+   the result with the float reference, allowing for rounding. With the crop
+   scaler dw x dh must be half the size of the (centered) area cropped from
+   the src. */
+static int check_scale(struct v4lconvert_data *data, int scaler,
+		unsigned int pixelformat, int sw, int sh, int dw, int dh)
+{
+	struct v4l2_format src_fmt, dest_fmt;
+	int yuv = pixelformat == V4L2_PIX_FMT_YUV420;
+	int bpp = yuv ? 1 : 3, planes = yuv ? 3 : 1;
+	int p, x, y, c, pw, ph, qw, qh, aw, ah, cx = 0, cy = 0;
+	int src_size, dest_size, res, err, max_err = 0;
+	const unsigned char *s, *area;
+	double ref;
+	unsigned char *src, *dest, *d;
+
+	set_fmt(&src_fmt, pixelformat, sw, sh);
+	set_fmt(&dest_fmt, pixelformat, dw, dh);
+	src_size = src_fmt.fmt.pix.sizeimage;
+	dest_size = dest_fmt.fmt.pix.sizeimage;
+	src = malloc(src_size);
+	dest = malloc(dest_size + 1);
+	if (!src || !dest) {
+		free(src);
+		free(dest);
+		return -1;
+	}
+	fill_random(src, src_size);
+	memset(dest, GUARD, dest_size + 1);
+
+	fail_on_test(v4lconvert_set_scaler(data, scaler));
+	res = v4lconvert_convert(data, &src_fmt, &dest_fmt, src, src_size,
+				 dest, dest_size);
+
+	if (scaler == V4LCONVERT_SCALER_CROP) {
+		/* The crop of the luma plane starts at an even pixel */
+		cx = (sw / 2 - dw) & ~(yuv ? 1 : 0);
+		cy = (sh / 2 - dh) & ~(yuv ? 1 : 0);
+	}
+
+	s = src;
+	d = dest;
+	for (p = 0; res == dest_size && p < planes; p++) {
+		pw = p ? sw / 2 : sw;
+		ph = p ? sh / 2 : sh;
+		qw = p ? dw / 2 : dw;
+		qh = p ? dh / 2 : dh;
+		/* The area of the src plane the dest plane is scaled from */
+		area = s;
+		aw = pw;
+		ah = ph;
+		if (scaler == V4LCONVERT_SCALER_CROP) {
+			area = &PIXEL(s, pw * bpp, bpp, p ? cx / 2 : cx,
+				      p ? cy / 2 : cy, 0);
+			aw = 2 * qw;
+			ah = 2 * qh;
+		}
+		for (y = 0; y < qh; y++)
+			for (x = 0; x < qw; x++)
+				for (c = 0; c < bpp; c++) {
+					ref = scale_ref(area, pw * bpp, bpp, aw, ah,
+						qw, qh, x, y, c,
+						scaler == V4LCONVERT_SCALER_BILINEAR);
+					err = abs(PIXEL(d, qw * bpp, bpp, x, y, c) -
+						  (int)floor(ref + 0.5));
+					if (err > max_err)
+						max_err = err;
+				}
+		s += pw * ph * bpp;
+		d += qw * qh * bpp;
+	}
+
+	if (res != dest_size || max_err > 1 || dest[dest_size] != GUARD)
+		printf("FAIL: scaler %d %.4s %dx%d -> %dx%d: returned %d, max error %d%s\n",
+		       scaler, (char *)&pixelformat, sw, sh, dw, dh, res,
+		       max_err, dest[dest_size] != GUARD ? ", overrun" : "");
+	else
+		res = 0;
+
+	free(src);
+	free(dest);
+	return res ? -1 : 0;
+}
+
+/* Downscale to sizes with and without a common factor, odd scale factors,
+   less than 2x and a lot more */
+static const int scale_sizes[][4] = {
+	{ 640, 480, 320, 240 },
+	{ 640, 480, 300, 200 },
+	{ 640, 480, 64, 48 },
+	{ 640, 480, 638, 478 },
+	{ 640, 480, 620, 240 },
+	{ 642, 478, 100, 100 },
+	{ 1920, 1080, 1280, 720 },
+	{ 100, 100, 32, 98 },
+	{ 64, 32, 8, 2 },
+};
+
+static int test_scaler(int scaler)
+{
+	struct v4lconvert_data *data = create();
+	unsigned int i;
+	int res = 0;
+
+	fail_on_test(!data);
+	for (i = 0; i < sizeof(scale_sizes) / sizeof(scale_sizes[0]); i++) {
+		const int *s = scale_sizes[i];
+
+		if (check_scale(data, scaler, V4L2_PIX_FMT_RGB24,
+				s[0], s[1], s[2], s[3]) ||
+		    check_scale(data, scaler, V4L2_PIX_FMT_YUV420,
+				s[0], s[1], s[2], s[3]))
+			res = -1;
+	}
+	v4lconvert_destroy(data);
+	return res;
+}
+
+static int test_scaler_area(void)
+{
+	return test_scaler(V4LCONVERT_SCALER_AREA);
+}
+
+static int test_scaler_bilinear(void)
+{
+	return test_scaler(V4LCONVERT_SCALER_BILINEAR);
+}
+
+/* Halving the cropped area averages 2x2 pixels */
+static int test_scaler_crop(void)
+{
+	struct v4lconvert_data *data = create();
+	int res = 0;
+
+	fail_on_test(!data);
+	if (check_scale(data, V4LCONVERT_SCALER_CROP, V4L2_PIX_FMT_RGB24,
+			640, 480, 320, 240) ||
+	    check_scale(data, V4LCONVERT_SCALER_CROP, V4L2_PIX_FMT_BGR24,
+			704, 576, 352, 288) ||
+	    check_scale(data, V4LCONVERT_SCALER_CROP, V4L2_PIX_FMT_RGB24,
+			720, 576, 320, 240) ||
+	    check_scale(data, V4LCONVERT_SCALER_CROP, V4L2_PIX_FMT_YUV420,
+			720, 576, 320, 240))
+		res = -1;
+	v4lconvert_destroy(data);
+	return res;
+}
+
+/* With a scaler, try_fmt gives the requested size (rounded to what the dest
+   formats need) up to the largest frame size, from the next larger size */
+static int test_scaler_try_fmt(void)
+{
+	static const unsigned int tries[][4] = {
+		{ 400, 300, 640, 480 },
+		{ 1000, 500, 1280, 720 },
+		{ 320, 240, 320, 240 },
+		{ 100, 50, 320, 240 },
+		{ 2000, 2000, 1280, 720 },
+	};
+	struct v4lconvert_data *data = create();
+	struct v4l2_format src_fmt, dest_fmt;
+	unsigned int i, width, height;
+
+	fail_on_test(!data);
+	fail_on_test(v4lconvert_set_scaler(data, V4LCONVERT_SCALER_AREA));
+	fail_on_test(v4lconvert_get_scaler(data) != V4LCONVERT_SCALER_AREA);
+	for (i = 0; i < sizeof(tries) / sizeof(tries[0]); i++) {
+		width = tries[i][0] > sizes[0][0] ? sizes[0][0] : tries[i][0] & ~7;
+		height = tries[i][1] > sizes[0][1] ? sizes[0][1] : tries[i][1] & ~1;
+		set_fmt(&dest_fmt, V4L2_PIX_FMT_RGB24, tries[i][0], tries[i][1]);
+		fail_on_test(v4lconvert_try_format(data, &dest_fmt, &src_fmt));
+		fail_on_test(dest_fmt.fmt.pix.width != width ||
+			     dest_fmt.fmt.pix.height != height);
+		fail_on_test(dest_fmt.fmt.pix.bytesperline != width * 3);
+		fail_on_test(src_fmt.fmt.pix.width != tries[i][2] ||
+			     src_fmt.fmt.pix.height != tries[i][3]);
+	}
+
+	/* Cropping only gives the device sizes */
+	fail_on_test(v4lconvert_set_scaler(data, V4LCONVERT_SCALER_CROP));
+	set_fmt(&dest_fmt, V4L2_PIX_FMT_RGB24, 400, 300);
+	fail_on_test(v4lconvert_try_format(data, &dest_fmt, &src_fmt));
+	fail_on_test(dest_fmt.fmt.pix.width != 320 ||
+		     dest_fmt.fmt.pix.height != 240);
+	fail_on_test(!v4lconvert_set_scaler(data, -1));
+
+	v4lconvert_destroy(data);
+	return 0;
+}
+
+/* Set a control, returns -1 when it fails */
+static int set_ctrl(struct v4lconvert_data *data, unsigned int id, int value)
+{
+	struct v4l2_control ctrl = { .id = id, .value = value };
+
+	return v4lconvert_vidioc_s_ctrl(data, &ctrl);
+}
+
+/* Rotate the w x h plane src clockwise by rotate degrees and then flip it,
+   the way the rotate and flip controls are applied */
+static void rotate_ref(const unsigned char *src, int src_stride, int w, int h,
+		unsigned char *dest, int dest_stride, int bpp, int rotate,
+		int hflip, int vflip)
+{
+	int dw = rotate % 180 ? h : w, dh = rotate % 180 ? w : h;
+	int x, y, fx, fy, sx, sy;
+
+	for (y = 0; y < dh; y++)
+		for (x = 0; x < dw; x++) {
+			fx = hflip ? dw - 1 - x : x;
+			fy = vflip ? dh - 1 - y : y;
+			switch (rotate) {
+			case 0:
+				sx = fx;
+				sy = fy;
+				break;
+			case 90:
+				sx = fy;
+				sy = h - 1 - fx;
+				break;
+			case 180:
+				sx = w - 1 - fx;
+				sy = h - 1 - fy;
+				break;
+			default:
+				sx = w - 1 - fy;
+				sy = fx;
+				break;
+			}
+			memcpy(&PIXEL(dest, dest_stride, bpp, x, y, 0),
+			       &PIXEL(src, src_stride, bpp, sx, sy, 0), bpp);
+		}
+}
+
+/* Convert w x h frames from each src format to each dest format with every
+   rotation and flip, the result must be the rotated / flipped result of the
+   plain conversion */
+static int test_rotate(void)
+{
+	static const unsigned int src_formats[] = {
+		V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUV420,
+		V4L2_PIX_FMT_SBGGR8,
+	};
+	static const unsigned int dest_formats[] = {
+		V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_YUV420,
+		V4L2_PIX_FMT_YVU420,
+	};
+	/* Odd numbers of tiles / register blocks and partial ones */
+	static const int rotate_sizes[][2] = {
+		{ 64, 64 }, { 202, 132 }, { 36, 18 }, { 18, 36 }, { 8, 2 },
+	};
+	const int size = 202 * 132 * 3;
+	struct v4lconvert_data *data = create_with_controls();
+	struct v4l2_format src_fmt, dest_fmt;
+	unsigned char *src, *plain, *ref, *dest;
+	unsigned int s, d, z;
+	int w, h, dw, dh, rotate, flip, yuv, res, plain_res, ret = -1;
+
+	fail_on_test(!data);
+	src = malloc(size);
+	plain = malloc(size);
+	ref = malloc(size);
+	dest = malloc(size + 1);
+	if (!src || !plain || !ref || !dest)
+		goto leave;
+	fill_random(src, size);
+
+	for (s = 0; s < sizeof(src_formats) / sizeof(src_formats[0]); s++)
+	for (d = 0; d < sizeof(dest_formats) / sizeof(dest_formats[0]); d++)
+	for (z = 0; z < sizeof(rotate_sizes) / sizeof(rotate_sizes[0]); z++)
+	for (rotate = 0; rotate < 360; rotate += 90)
+	for (flip = 0; flip < 4; flip++) {
+		w = rotate_sizes[z][0];
+		h = rotate_sizes[z][1];
+		dw = rotate % 180 ? h : w;
+		dh = rotate % 180 ? w : h;
+		yuv = d >= 2;
+		set_fmt(&src_fmt, src_formats[s], w, h);
+		/* Bayer is not a dest format, v4lconvert_fixup_fmt() leaves it
+		   alone */
+		if (src_formats[s] == V4L2_PIX_FMT_SBGGR8) {
+			src_fmt.fmt.pix.bytesperline = w;
+			src_fmt.fmt.pix.sizeimage = w * h;
+		}
+
+		set_fmt(&dest_fmt, dest_formats[d], w, h);
+		if (set_ctrl(data, V4L2_CID_ROTATE, 0) ||
+		    set_ctrl(data, V4L2_CID_HFLIP, 0) ||
+		    set_ctrl(data, V4L2_CID_VFLIP, 0))
+			goto leave;
+		plain_res = v4lconvert_convert(data, &src_fmt, &dest_fmt, src,
+				src_fmt.fmt.pix.sizeimage, plain, size);
+
+		set_fmt(&dest_fmt, dest_formats[d], dw, dh);
+		if (set_ctrl(data, V4L2_CID_ROTATE, rotate) ||
+		    set_ctrl(data, V4L2_CID_HFLIP, flip & 1) ||
+		    set_ctrl(data, V4L2_CID_VFLIP, flip >> 1))
+			goto leave;
+		memset(dest, GUARD, size + 1);
+		res = v4lconvert_convert(data, &src_fmt, &dest_fmt, src,
+				src_fmt.fmt.pix.sizeimage, dest, size);
+
+		if (yuv) {
+			rotate_ref(plain, w, w, h, ref, dw, 1, rotate,
+				   flip & 1, flip >> 1);
+			rotate_ref(plain + w * h, w / 2, w / 2, h / 2,
+				   ref + w * h, dw / 2, 1, rotate,
+				   flip & 1, flip >> 1);
+			rotate_ref(plain + w * h * 5 / 4, w / 2, w / 2, h / 2,
+				   ref + w * h * 5 / 4, dw / 2, 1, rotate,
+				   flip & 1, flip >> 1);
+		} else {
+			rotate_ref(plain, w * 3, w, h, ref, dw * 3, 3, rotate,
+				   flip & 1, flip >> 1);
+		}
+
+		if (plain_res <= 0 || res != plain_res ||
+		    memcmp(dest, ref, res) || dest[res] != GUARD) {
+			printf("FAIL: %.4s -> %.4s %dx%d rotate %d hflip %d vflip %d: returned %d / %d\n",
+			       (char *)&src_formats[s], (char *)&dest_formats[d],
+			       w, h, rotate, flip & 1, flip >> 1, plain_res, res);
+			goto leave;
+		}
+
+		/* A rotation change while streaming keeps the old size */
+		if (rotate % 180) {
+			set_fmt(&dest_fmt, dest_formats[d], w, h);
+			memset(dest, GUARD, size + 1);
+			res = v4lconvert_convert(data, &src_fmt, &dest_fmt, src,
+					src_fmt.fmt.pix.sizeimage, dest, size);
+			if (res != plain_res || dest[res] != GUARD) {
+				printf("FAIL: %.4s -> %.4s %dx%d rotate %d while streaming: returned %d\n",
+				       (char *)&src_formats[s],
+				       (char *)&dest_formats[d], w, h, rotate, res);
+				goto leave;
+			}
+		}
+	}
+	ret = 0;
+
+leave:
+	free(src);
+	free(plain);
+	free(ref);
+	free(dest);
+	v4lconvert_destroy(data);
+	return ret;
+}
+
+/* try_fmt and enum_framesizes give the rotated sizes, other values than
+   multiples of 90 degrees are rejected */
+static int test_rotate_try_fmt(void)
+{
+	struct v4lconvert_data *data = create_with_controls();
+	struct v4l2_format src_fmt, dest_fmt;
+	struct v4l2_frmsizeenum frmsize;
+	unsigned int width, height;
+	int rotate;
+
+	fail_on_test(!data);
+	fail_on_test(set_ctrl(data, V4L2_CID_HFLIP, 0));
+	fail_on_test(set_ctrl(data, V4L2_CID_VFLIP, 0));
+	for (rotate = 0; rotate < 360; rotate += 90) {
+		width = rotate % 180 ? 480 : 640;
+		height = rotate % 180 ? 640 : 480;
+		fail_on_test(set_ctrl(data, V4L2_CID_ROTATE, rotate));
+
+		set_fmt(&dest_fmt, V4L2_PIX_FMT_RGB24, width, height);
+		fail_on_test(v4lconvert_try_format(data, &dest_fmt, &src_fmt));
+		fail_on_test(dest_fmt.fmt.pix.width != width ||
+			     dest_fmt.fmt.pix.height != height);
+		fail_on_test(dest_fmt.fmt.pix.bytesperline != width * 3);
+		fail_on_test(src_fmt.fmt.pix.width != 640 ||
+			     src_fmt.fmt.pix.height != 480);
+
+		memset(&frmsize, 0, sizeof(frmsize));
+		frmsize.index = 1;
+		frmsize.pixel_format = V4L2_PIX_FMT_RGB24;
+		fail_on_test(v4lconvert_enum_framesizes(data, &frmsize));
+		fail_on_test(frmsize.discrete.width != width ||
+			     frmsize.discrete.height != height);
+	}
+
+	fail_on_test(!set_ctrl(data, V4L2_CID_ROTATE, 45));
+	fail_on_test(!set_ctrl(data, V4L2_CID_ROTATE, 360));
+	fail_on_test(set_ctrl(data, V4L2_CID_ROTATE, 0));
+
+	v4lconvert_destroy(data);
+	return 0;
+}
+
+/* The framesize cache is only used for usb devices, the usb ids are looked
+   up in sysfs for the minor of the device. So this fakes a sysfs tree with a
+   usb video0 which has the minor of /dev/null, and passes libv4lconvert a
+   /dev/null fd. The sysfs tree and the cache dir are in a temporary dir. */
+static char cache_dir[64];
+static char cache_file[128];
+
+/* Write a file of the fake video0 in sysfs */
+static int write_sysfs(const char *name, const char *contents)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/sys/class/video4linux/video0/%s",
+		 cache_dir, name);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fputs(contents, f);
+	return fclose(f);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+		struct FTW *ftw)
+{
+	return remove(path);
+}
+
+/* Fills in the framesizes of rgb24 the device with the fd offers, as a
+   string for comparing them */
+static int create_and_list(int fd, struct v4lconvert_data **data,
+		char *list, int size)
+{
+	struct v4l2_frmsizeenum frmsize;
+	int len = 0;
+
+	dev.enum_framesizes = 0;
+	*data = create_with_fd(fd);
+	if (!*data)
+		return -1;
+
+	list[0] = 0;
+	memset(&frmsize, 0, sizeof(frmsize));
+	frmsize.pixel_format = V4L2_PIX_FMT_RGB24;
+	while (!v4lconvert_enum_framesizes(*data, &frmsize) && len < size) {
+		len += snprintf(list + len, size - len, "%ux%u ",
+				frmsize.discrete.width,
+				frmsize.discrete.height);
+		frmsize.index++;
+	}
+	return 0;
+}
+
+/* Try 1280x720 rgb24, returns the src height picked for it */
+static int try_720p(struct v4lconvert_data *data)
+{
+	struct v4l2_format src_fmt, dest_fmt;
+
+	dev.try_fmts = 0;
+	set_fmt(&dest_fmt, V4L2_PIX_FMT_RGB24, 1280, 720);
+	if (v4lconvert_try_format(data, &dest_fmt, &src_fmt))
+		return -1;
+	return src_fmt.fmt.pix.height;
+}
+
+/* Keep the header of the cache file, but garble the framesizes */
+static int corrupt_cache_file(void)
+{
+	char lines[3][1024];
+	FILE *f = fopen(cache_file, "r");
+	int i;
+
+	if (!f)
+		return -1;
+	for (i = 0; i < 3; i++)
+		if (!fgets(lines[i], sizeof(lines[i]), f))
+			break;
+	fclose(f);
+	if (i < 3)
+		return -1;
+
+	f = fopen(cache_file, "w");
+	if (!f)
+		return -1;
+	for (i = 0; i < 3; i++)
+		fputs(lines[i], f);
+	fputs("1 garbage\n", f);
+	return fclose(f);
+}
+
+static int check_framesize_cache(int fd)
+{
+	struct v4lconvert_data *data;
+	char list[256], ref_list[256];
+	int enum_framesizes;
+
+	/* Not enabled: enumerated, no cache file */
+	fail_on_test(create_and_list(fd, &data, ref_list, sizeof(ref_list)));
+	enum_framesizes = dev.enum_framesizes;
+	fail_on_test(!enum_framesizes);
+	fail_on_test(!strstr(ref_list, "1280x720"));
+	v4lconvert_destroy(data);
+	fail_on_test(!access(cache_file, F_OK));
+
+	/* A miss writes the cache file */
+	setenv("LIBV4LCONVERT_FRAMESIZE_CACHE", "1", 1);
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(dev.enum_framesizes != enum_framesizes);
+	fail_on_test(strcmp(list, ref_list));
+	v4lconvert_destroy(data);
+	fail_on_test(access(cache_file, F_OK));
+
+	/* A hit does not enumerate, the first format picked from the cached
+	   framesizes is checked with the driver */
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(dev.enum_framesizes);
+	fail_on_test(strcmp(list, ref_list));
+	fail_on_test(try_720p(data) != 720);
+	fail_on_test(dev.try_fmts != 1);
+	fail_on_test(try_720p(data) != 720);
+	fail_on_test(dev.try_fmts);
+	v4lconvert_destroy(data);
+
+	/* The device lost 1280x720 without the driver version changing, so the
+	   cache is stale, the check catches that and updates the cache */
+	dev.sizes = sizes + 1;
+	dev.no_sizes--;
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(dev.enum_framesizes);
+	fail_on_test(try_720p(data) != 480);
+	fail_on_test(!dev.enum_framesizes);
+	v4lconvert_destroy(data);
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(dev.enum_framesizes);
+	fail_on_test(strstr(list, "1280x720") || !strstr(list, "640x480"));
+	v4lconvert_destroy(data);
+
+	/* Another driver version is a miss */
+	dev.version++;
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(!dev.enum_framesizes);
+	v4lconvert_destroy(data);
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(dev.enum_framesizes);
+	v4lconvert_destroy(data);
+
+	/* So is a garbled file, which gets rewritten */
+	fail_on_test(corrupt_cache_file());
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(!dev.enum_framesizes);
+	fail_on_test(strstr(list, "1280x720") || !strstr(list, "640x480"));
+	v4lconvert_destroy(data);
+	fail_on_test(create_and_list(fd, &data, list, sizeof(list)));
+	fail_on_test(dev.enum_framesizes);
+	v4lconvert_destroy(data);
+
+	return 0;
+}
+
+static int test_framesize_cache(void)
+{
+	static const char *const dirs[] = {
+		"sys", "sys/class", "sys/class/video4linux",
+		"sys/class/video4linux/video0",
+		"sys/class/video4linux/video0/device",
+	};
+	char path[256], dev_t[32];
+	struct stat st;
+	unsigned int i;
+	int fd, res = -1;
+
+	strcpy(cache_dir, "/tmp/libv4lconvert-test-XXXXXX");
+	fail_on_test(!mkdtemp(cache_dir));
+	fd = open("/dev/null", O_RDWR);
+	if (fd < 0 || fstat(fd, &st))
+		goto leave;
+
+	for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", cache_dir, dirs[i]);
+		if (mkdir(path, 0700))
+			goto leave;
+	}
+	snprintf(dev_t, sizeof(dev_t), "%u:%u\n", major(st.st_rdev),
+		 minor(st.st_rdev));
+	if (write_sysfs("dev", dev_t) || write_sysfs("speed", "480\n") ||
+	    write_sysfs("device/modalias",
+			"usb:v1D6Bp0104d0100dcEFdsc02dp01ic0Eisc01ip00in00\n"))
+		goto leave;
+	/* The ids and device release give the name of the cache file */
+	snprintf(cache_file, sizeof(cache_file),
+		 "%s/libv4l/framesizes-1d6b:0104-0100", cache_dir);
+
+	/* uvc formats are picked from the framesizes, without asking the
+	   driver */
+	dev.driver = "uvcvideo";
+	setenv("LIBV4LCONTROL_SYSFS_PREFIX", cache_dir, 1);
+	setenv("XDG_CACHE_HOME", cache_dir, 1);
+	res = check_framesize_cache(fd);
+	unsetenv("LIBV4LCONVERT_FRAMESIZE_CACHE");
+	unsetenv("LIBV4LCONTROL_SYSFS_PREFIX");
+	unsetenv("XDG_CACHE_HOME");
+
+leave:
+	if (fd >= 0)
+		close(fd);
+	nftw(cache_dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+	return res;
+}
+
+static const struct {
+	const char *name;
+	int (*fn)(void);
+} test_list[] = {
+	{ "scaler-area", test_scaler_area },
+	{ "scaler-bilinear", test_scaler_bilinear },
+	{ "scaler-crop", test_scaler_crop },
+	{ "scaler-try-fmt", test_scaler_try_fmt },
+	{ "rotate", test_rotate },
+	{ "rotate-try-fmt", test_rotate_try_fmt },
+	{ "framesize-cache", test_framesize_cache },
+};
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int j, run, failed = 0;
+
+	for (i = 0; i < sizeof(test_list) / sizeof(test_list[0]); i++) {
+		run = argc == 1;
+		for (j = 1; j < argc; j++)
+			if (!strcmp(argv[j], test_list[i].name))
+				run = 1;
+		if (!run)
+			continue;
+
+		memset(&dev, 0, sizeof(dev));
+		dev.driver = "fake";
+		dev.version = 0x60100;
+		dev.sizes = sizes;
+		dev.no_sizes = sizeof(sizes) / sizeof(sizes[0]);
+		srand(1);
+
+		run = test_list[i].fn();
+		printf("%s: %s\n", test_list[i].name, run ? "FAILED" : "ok");
+		if (run)
+			failed++;
+	}
+
+	return failed ? 1 : 0;
+}
@@ -19,6 +19,7 @@
 #ifndef __LIBV4L_PLUGIN_H
 #define __LIBV4L_PLUGIN_H
 
+#include <poll.h>
 #include <sys/types.h>
 
 /* Structure libv4l_dev_ops holds the calls from libv4ls to video nodes.
@@ -32,9 +33,13 @@ struct libv4l_dev_ops {
     int (*ioctl)(void *dev_ops_priv, int fd, unsigned long int request, void *arg);
     ssize_t (*read)(void *dev_ops_priv, int fd, void *buffer, size_t n);
     ssize_t (*write)(void *dev_ops_priv, int fd, const void *buffer, size_t n);
+    /* Optional, poll(2) for fds, which include the video node fd among other
+       fds. libv4l2 only converts frames in a background thread (see
+       V4L2_ENABLE_ASYNC_CONVERSION) when this is set */
+    int (*poll)(void *dev_ops_priv, int fd, struct pollfd *fds, nfds_t nfds,
+                int timeout);
     /* For future plugin API extension, plugins implementing the current API
        must set these all to NULL, as future versions may check for these */
-    void (*reserved1)(void);
     void (*reserved2)(void);
     void (*reserved3)(void);
     void (*reserved4)(void);
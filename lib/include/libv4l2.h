@@ -48,6 +48,13 @@ LIBV4L_PUBLIC extern FILE *v4l2_log_file;
    Another difference is that you can make v4l2_read() calls even on devices
    which do not support the regular read() method.
 
+   Besides mmap buffers the application can also import its own dmabufs
+   (V4L2_MEMORY_DMABUF). When converting the imported dmabufs receive the
+   frames in the format of the cam, VIDIOC_QUERYBUF reports the size they need,
+   and the converted frames can be exported as dmabufs with VIDIOC_EXPBUF,
+   this needs the kernel's udmabuf driver. VIDIOC_EXPBUF exports the converted
+   frames with mmap buffers too.
+
    Note the device name passed to v4l2_open must be of a video4linux2 device,
    if it is anything else (including a video4linux1 device), v4l2_open will
    fail.
@@ -100,6 +107,24 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 /* This flag is *OBSOLETE*, since version 0.5.98 libv4l *always* reports
    emulated formats to ENUM_FMT, except when conversion is disabled. */
 #define V4L2_ENABLE_ENUM_FMT_EMULATION 0x02
+/* Give the application the driver's own buffers when the frames do not need
+   to be converted with the current format and control settings, instead of
+   copying each frame into a buffer of libv4l2. This is decided when buffers
+   are requested (VIDIOC_REQBUFS), so changing a software control (flipping,
+   whitebalance, etc.) only has effect on buffers requested after the change.
+   This can also be enabled by setting the LIBV4L2_ZERO_COPY environment
+   variable. */
+#define V4L2_ENABLE_ZERO_COPY 0x04
+/* Dequeue and convert frames in a thread of libv4l2 as soon as the device has
+   captured them, instead of when the application does a VIDIOC_DQBUF. Capture
+   and conversion then overlap, and DQBUF returns an already converted frame.
+   The frames are converted into the buffers the application has queued, so it
+   should queue at least 3 buffers for this to help. This is only used when
+   streaming with conversion, not for the read() emulation, and with plugins
+   only when they implement the poll dev_op.
+   This can also be enabled by setting the LIBV4L2_ASYNC_CONVERSION environment
+   variable. */
+#define V4L2_ENABLE_ASYNC_CONVERSION 0x08
 
 /* v4l2_fd_open: open an already opened fd for further use through
    v4l2lib and possibly modify libv4l2's default behavior through the
@@ -42,6 +42,13 @@
 #include <linux/videodev2.h>
 #endif
 
+/* 16 bits per component rgb, in host byte order, which libv4lconvert can
+   demosaic raw bayer formats of more than 8 bits to. Not (yet) a kernel
+   format, so define it here when videodev2.h does not. */
+#ifndef V4L2_PIX_FMT_RGB48
+#define V4L2_PIX_FMT_RGB48 v4l2_fourcc('R', 'G', 'B', '6') /* 48  RGB-16-16-16 */
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -57,6 +64,12 @@ struct v4lconvert_data;
 
 LIBV4L_PUBLIC const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops();
 
+/* Create a converter for the device fd. This enumerates the framesizes of all
+   formats of the device, which for USB cams with many modes can take a while.
+   Setting the LIBV4LCONVERT_FRAMESIZE_CACHE environment variable to 1 caches
+   these in $XDG_CACHE_HOME/libv4l, keyed by the USB ids, device release and
+   driver version. The cached framesizes are checked against the driver the
+   first time a format is picked from them and re-enumerated when stale. */
 LIBV4L_PUBLIC struct v4lconvert_data *v4lconvert_create(int fd);
 LIBV4L_PUBLIC struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd,
 		void *dev_ops_priv, const struct libv4l_dev_ops *dev_ops);
@@ -88,11 +101,27 @@ LIBV4L_PUBLIC int v4lconvert_try_format(struct v4lconvert_data *data,
 LIBV4L_PUBLIC int v4lconvert_enum_fmt(struct v4lconvert_data *data,
 		struct v4l2_fmtdesc *fmt);
 
-/* Is conversion necessary or can the app use the data directly? */
+/* Is conversion necessary or can the app use the data directly? When the
+   device has software controls (flipping, whitebalance, etc.) every dest
+   format needs conversion, including the src format itself. Since NV12,
+   YUYV, XRGB32 and ARGB32 are dest formats this also applies to cams
+   delivering those: such a cam is no longer switched to rgb24 when the app
+   asks for its own format, the frames get the controls applied instead,
+   and with all controls neutral v4lconvert_convert() copies them
+   unchanged. v4lconvert_frame_needs_conversion() tells when that is the
+   case, libv4l2 uses it to skip the copy with V4L2_ENABLE_ZERO_COPY. */
 LIBV4L_PUBLIC int v4lconvert_needs_conversion(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,   /* in */
 		const struct v4l2_format *dest_fmt); /* in */
 
+/* Like v4lconvert_needs_conversion, but this takes the current settings of
+   the software controls (flipping, whitebalance, etc.) into account, rather
+   than assuming the data needs conversion whenever there are such controls.
+   So the result of this may change when a control is changed. */
+LIBV4L_PUBLIC int v4lconvert_frame_needs_conversion(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,   /* in */
+		const struct v4l2_format *dest_fmt); /* in */
+
 /* This function does the following conversions:
     - format conversion
     - cropping
@@ -110,12 +139,37 @@ LIBV4L_PUBLIC int v4lconvert_needs_conversion(struct v4lconvert_data *data,
     - be called only once per frame
    Otherwise this may result in unintended double conversions !
 
+   The bytesperline of src_fmt and dest_fmt is honoured, a bytesperline of 0
+   in dest_fmt means lines without padding.
+
    Returns the amount of bytes written to dest and -1 on error */
 LIBV4L_PUBLIC int v4lconvert_convert(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,  /* in */
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
 
+/* The planes of a frame, each with its own start and bytes per line. The
+   planes are in the order of the multi-planar variant of the format, e.g.
+   y, u, v for YUV420, y, v, u for YVU420 and y, uv for NV12. Packed formats
+   only use the first plane. */
+struct v4lconvert_planes {
+	unsigned char *plane[3];
+	int stride[3];
+};
+
+/* Like v4lconvert_convert(), but the src and dest frames are passed per
+   plane, so that frames with padded lines or with planes which are not
+   stored right after each other (e.g. in separate buffers) can be converted
+   without first being repacked. The bytesperline of src_fmt and dest_fmt is
+   ignored, src_size and dest_size are the sizes of all planes together.
+
+   Returns the amount of bytes written to all planes of dest and -1 on error */
+LIBV4L_PUBLIC int v4lconvert_convert_planes(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		const struct v4lconvert_planes *src, int src_size,
+		const struct v4lconvert_planes *dest, int dest_size);
+
 /* get a string describing the last error */
 LIBV4L_PUBLIC const char *v4lconvert_get_error_message(struct v4lconvert_data *data);
 
@@ -151,6 +205,71 @@ LIBV4L_PUBLIC int v4lconvert_supported_dst_format(unsigned int pixelformat);
 LIBV4L_PUBLIC int v4lconvert_get_fps(struct v4lconvert_data *data);
 LIBV4L_PUBLIC void v4lconvert_set_fps(struct v4lconvert_data *data, int fps);
 
+/* Get/set if the src format is picked by a cost model, rather than by a
+   fixed ranking of the formats. The cost model picks the format which
+   delivers the highest frame rate, limited by the fps (see above), the bus
+   bandwidth and the measured cost of converting the format on this cpu, and
+   when that is equal the format using the least cpu. The conversion costs
+   are measured during plain conversions (no flipping, cropping or
+   processing) and cached in $XDG_CACHE_HOME/libv4l per cpu model and no
+   threads, the cost of formats which have not been used yet is measured
+   by converting a synthetic frame (compressed formats are estimated until
+   used). The default is off, which can be changed by setting the
+   LIBV4LCONVERT_COST_MODEL environment variable to 1 */
+LIBV4L_PUBLIC int v4lconvert_get_cost_model(struct v4lconvert_data *data);
+LIBV4L_PUBLIC void v4lconvert_set_cost_model(struct v4lconvert_data *data,
+		int enable);
+
+/* Get/set the no threads used for conversion, frames are split into bands
+   of lines which are converted in parallel. The default is 1, which means
+   all conversion is done by the calling thread. The default can be changed
+   with the LIBV4LCONVERT_THREADS environment variable. Returns 0 on success,
+   -1 on error */
+LIBV4L_PUBLIC int v4lconvert_get_threads(struct v4lconvert_data *data);
+LIBV4L_PUBLIC int v4lconvert_set_threads(struct v4lconvert_data *data, int threads);
+
+/* Demosaicing algorithms for raw bayer sources */
+enum v4lconvert_demosaic {
+	/* Averages the neighbors of each pixel, this is the fastest */
+	V4LCONVERT_DEMOSAIC_BILINEAR,
+	/* Interpolates the green of the red and blue pixels along edges
+	   instead of across them, which avoids zipper artifacts */
+	V4LCONVERT_DEMOSAIC_EDGE,
+};
+
+/* Get/set the demosaicing algorithm used when converting raw bayer to rgb
+   (conversion to yuv is always bilinear). The default is bilinear, which can
+   be changed with the LIBV4LCONVERT_DEMOSAIC environment variable ("bilinear"
+   or "edge"). Returns 0 on success, -1 on error */
+LIBV4L_PUBLIC int v4lconvert_get_demosaic(struct v4lconvert_data *data);
+LIBV4L_PUBLIC int v4lconvert_set_demosaic(struct v4lconvert_data *data,
+		int demosaic);
+
+/* Ways to get a dest frame smaller than the src frame */
+enum v4lconvert_scaler {
+	/* Crop the center, when the dest is at most half the src size first
+	   average 2x2 pixels. This only keeps the field of view for a few
+	   well known resolutions */
+	V4LCONVERT_SCALER_CROP,
+	/* Scale the whole frame, averaging the src pixels each dest pixel
+	   covers (box filter) */
+	V4LCONVERT_SCALER_AREA,
+	/* Scale the whole frame, interpolating between the 4 src pixels
+	   nearest to each dest pixel. Faster than area, but aliases when
+	   scaling down more than 2x */
+	V4LCONVERT_SCALER_BILINEAR,
+};
+
+/* Get/set how frames are made smaller (rgb48 is always cropped). With a
+   scaler other than crop, v4lconvert_try_format() accepts any dest size up
+   to the largest frame size of the device, the frames of the next larger
+   size are then scaled down to it. The default is crop, which can be
+   changed with the LIBV4LCONVERT_SCALER environment variable ("area" or
+   "bilinear"). Returns 0 on success, -1 on error */
+LIBV4L_PUBLIC int v4lconvert_get_scaler(struct v4lconvert_data *data);
+LIBV4L_PUBLIC int v4lconvert_set_scaler(struct v4lconvert_data *data,
+		int scaler);
+
 /* Fixup bytesperline and sizeimage for supported destination formats */
 LIBV4L_PUBLIC void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
@@ -463,10 +463,17 @@ static ssize_t plugin_write(void *dev_ops_priv, int fd, const void *buf,
 	return SYS_WRITE(fd, buf, len);
 }
 
+static int plugin_poll(void *dev_ops_priv, int fd, struct pollfd *fds,
+		       nfds_t nfds, int timeout)
+{
+	return poll(fds, nfds, timeout);
+}
+
 PLUGIN_PUBLIC const struct libv4l_dev_ops libv4l2_plugin = {
 	.init = &plugin_init,
 	.close = &plugin_close,
 	.ioctl = &plugin_ioctl,
 	.read = &plugin_read,
 	.write = &plugin_write,
+	.poll = &plugin_poll,
 };
@@ -21,11 +21,15 @@
 
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/types.h>
 #include <libv4lconvert.h> /* includes videodev2.h for us */
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
 
-#define V4L2_MAX_DEVICES 16
+/* The fd table covers fds up to 1M, devices with a larger fd still work, but
+   finding them is slower */
+#define V4L2_FD_TABLE_CHUNKS 4096
+#define V4L2_FD_TABLE_CHUNK_SIZE 256
 /* Warning when making this larger the frame_queued and frame_mapped members of
    the v4l2_dev_info struct can no longer be a bitfield, so the code needs to
    be adjusted! */
@@ -46,7 +50,7 @@
 #define V4L2_PERROR(format, ...)		\
 	do { 					\
 		if (errno == ENODEV) {		\
-			devices[index].gone = 1;\
+			dev->gone = 1;	\
 			break;			\
 		}				\
 		V4L2_LOG_ERR(format ": %s\n", ##__VA_ARGS__, strerror(errno)); \
@@ -72,6 +76,8 @@
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 struct v4l2_dev_info {
+	struct v4l2_dev_info *next;
+	int in_use; /* Protected by v4l2_open_mutex */
 	int fd;
 	int flags;
 	int open_count;
@@ -86,17 +92,35 @@ struct v4l2_dev_info {
 	unsigned int nreadbuffers;
 	int fps;
 	int first_frame;
+	/* V4L2_MEMORY_MMAP, or V4L2_MEMORY_DMABUF when the app imports dmabufs */
+	int memory;
 	struct v4lconvert_data *convert;
 	unsigned char *convert_mmap_buf;
 	size_t convert_mmap_buf_size;
 	size_t convert_mmap_frame_size;
+	/* memfd backing convert_mmap_buf, -1 when it is anonymous memory */
+	int convert_mmap_fd;
+	/* Our references to the dmabufs exported from convert_mmap_buf */
+	int convert_dmabuf_fds[V4L2_MAX_NO_FRAMES];
 	/* Frame bookkeeping is only done when in read or mmap-conversion mode */
 	unsigned char *frame_pointers[V4L2_MAX_NO_FRAMES];
 	int frame_sizes[V4L2_MAX_NO_FRAMES];
+	/* With V4L2_MEMORY_DMABUF frame_pointers map these dmabufs of the app */
+	int frame_dmabuf_fds[V4L2_MAX_NO_FRAMES];
+	ino_t frame_dmabuf_inos[V4L2_MAX_NO_FRAMES];
 	int frame_queued; /* 1 status bit per frame */
 	int frame_info_generation;
 	/* mapping tracking of our fake (converting mmap) frame buffers */
 	unsigned char frame_map_count[V4L2_MAX_NO_FRAMES];
+	/* Frames dequeued and converted ahead by the conversion thread, oldest
+	   first, see V4L2_ENABLE_ASYNC_CONVERSION */
+	pthread_t convert_thread;
+	pthread_cond_t convert_cond;
+	int convert_wake_pipe[2];
+	int convert_error; /* errno of a failed dequeue / convert, or 0 */
+	struct v4l2_buffer converted_bufs[V4L2_MAX_NO_FRAMES];
+	unsigned int converted_first;
+	unsigned int converted_count;
 	/* buffer when doing conversion and using read() for read() */
 	int readbuf_size;
 	unsigned char *readbuf;
@@ -62,9 +62,16 @@
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#ifdef HAVE_LINUX_DMA_BUF_H
+#include <linux/dma-buf.h>
+#endif
+#ifdef HAVE_LINUX_UDMABUF_H
+#include <linux/udmabuf.h>
+#endif
 #include "libv4l2.h"
 #include "libv4l2-priv.h"
 #include "libv4l-plugin.h"
@@ -79,62 +86,190 @@
 #define V4L2_STREAM_TOUCHED		0x1000
 #define V4L2_USE_READ_FOR_READ		0x2000
 #define V4L2_SUPPORTS_TIMEPERFRAME	0x4000
+#define V4L2_ZERO_COPY_ACTIVE		0x8000
+#define V4L2_CONVERT_THREAD_RUNNING	0x10000
+#define V4L2_CONVERT_THREAD_STOP	0x20000
+#define V4L2_CONVERT_THREAD_EXITED	0x40000
 
 #define V4L2_MMAP_OFFSET_MAGIC      0xABCDEF00u
 
-static void v4l2_adjust_src_fmt_to_fps(int index, int fps);
-static void v4l2_set_src_and_dest_format(int index,
+static void v4l2_adjust_src_fmt_to_fps(struct v4l2_dev_info *dev, int fps);
+static void v4l2_set_src_and_dest_format(struct v4l2_dev_info *dev,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt);
 
+/*
+ * Every intercepted call looks up its fd, so this is done without taking a
+ * lock, in a two level fd indexed table. Chunks of the table only get
+ * allocated for the fd ranges in use, with v4l2_open_mutex held, and are never
+ * freed. The few fds beyond the table are found by walking the devices list.
+ *
+ * Device structs are never freed either, another thread may still be looking
+ * at one, closed devices get reused by later opens instead.
+ */
 static pthread_mutex_t v4l2_open_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct v4l2_dev_info devices[V4L2_MAX_DEVICES] = {
-	{ .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
-};
-static int devices_used;
-
-static int v4l2_ensure_convert_mmap_buf(int index)
+static struct v4l2_dev_info **v4l2_fd_table[V4L2_FD_TABLE_CHUNKS];
+static struct v4l2_dev_info *devices; /* All device structs */
+
+static int v4l2_ensure_convert_mmap_buf(struct v4l2_dev_info *dev)
 {
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
+	int fd = -1;
+
+	if (dev->convert_mmap_buf != MAP_FAILED) {
 		return 0;
 	}
 
-	devices[index].convert_mmap_buf_size =
-		devices[index].convert_mmap_frame_size * devices[index].no_frames;
+	dev->convert_mmap_buf_size =
+		dev->convert_mmap_frame_size * dev->no_frames;
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_LINUX_UDMABUF_H)
+	/* Back the buffer by a memfd, so that the converted frames can be
+	   exported as dmabufs, see v4l2_export_convert_buf() */
+	fd = memfd_create("libv4l2", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd != -1 &&
+	    (ftruncate(fd, dev->convert_mmap_buf_size) ||
+	     fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK))) {
+		SYS_CLOSE(fd);
+		fd = -1;
+	}
+#endif
 
-	devices[index].convert_mmap_buf = (void *)SYS_MMAP(NULL,
-			devices[index].convert_mmap_buf_size,
+	dev->convert_mmap_buf = (void *)SYS_MMAP(NULL,
+			dev->convert_mmap_buf_size,
 			PROT_READ | PROT_WRITE,
-			MAP_ANONYMOUS | MAP_PRIVATE,
-			-1, 0);
+			fd == -1 ? MAP_ANONYMOUS | MAP_PRIVATE : MAP_SHARED,
+			fd, 0);
 
-	if (devices[index].convert_mmap_buf == MAP_FAILED) {
-		devices[index].convert_mmap_buf_size = 0;
+	if (dev->convert_mmap_buf == MAP_FAILED) {
+		dev->convert_mmap_buf_size = 0;
 
 		int saved_err = errno;
 		V4L2_LOG_ERR("allocating conversion buffer\n");
+		if (fd != -1)
+			SYS_CLOSE(fd);
+		errno = saved_err;
+		return -1;
+	}
+	dev->convert_mmap_fd = fd;
+
+	return 0;
+}
+
+static void v4l2_free_convert_mmap_buf(struct v4l2_dev_info *dev)
+{
+	unsigned int i;
+
+	if (dev->convert_mmap_buf != MAP_FAILED)
+		SYS_MUNMAP(dev->convert_mmap_buf,
+				dev->convert_mmap_buf_size);
+	dev->convert_mmap_buf = MAP_FAILED;
+	dev->convert_mmap_buf_size = 0;
+
+	if (dev->convert_mmap_fd != -1) {
+		SYS_CLOSE(dev->convert_mmap_fd);
+		dev->convert_mmap_fd = -1;
+	}
+
+	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
+		if (dev->convert_dmabuf_fds[i] != -1) {
+			SYS_CLOSE(dev->convert_dmabuf_fds[i]);
+			dev->convert_dmabuf_fds[i] = -1;
+		}
+	}
+}
+
+/* Export converted frame exp->index as a dmabuf, this needs udmabuf */
+static int v4l2_export_convert_buf(struct v4l2_dev_info *dev,
+		struct v4l2_exportbuffer *exp)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_LINUX_UDMABUF_H)
+	struct udmabuf_create create;
+	int fd, udmabuf;
+
+	if (exp->index >= dev->no_frames || exp->plane) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (v4l2_ensure_convert_mmap_buf(dev))
+		return -1;
+
+	if (dev->convert_mmap_fd == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	udmabuf = SYS_OPEN("/dev/udmabuf", O_RDWR | O_CLOEXEC, 0);
+	if (udmabuf == -1) {
+		int saved_err = errno;
+
+		V4L2_PERROR("opening /dev/udmabuf");
+		errno = saved_err;
+		return -1;
+	}
+
+	create.memfd = dev->convert_mmap_fd;
+	create.flags = (exp->flags & O_CLOEXEC) ? UDMABUF_FLAGS_CLOEXEC : 0;
+	create.offset = exp->index * dev->convert_mmap_frame_size;
+	create.size = dev->convert_mmap_frame_size;
+	fd = SYS_IOCTL(udmabuf, UDMABUF_CREATE, &create);
+	if (fd == -1) {
+		int saved_err = errno;
+
+		V4L2_PERROR("exporting buffer %u", exp->index);
+		SYS_CLOSE(udmabuf);
 		errno = saved_err;
 		return -1;
 	}
+	SYS_CLOSE(udmabuf);
+
+	/* Keep a reference to sync our writes to the buffer with */
+	if (dev->convert_dmabuf_fds[exp->index] == -1)
+		dev->convert_dmabuf_fds[exp->index] =
+			fcntl(fd, F_DUPFD_CLOEXEC, 0);
 
+	exp->fd = fd;
+	V4L2_LOG("exported buffer %u as dmabuf %d\n", exp->index, fd);
 	return 0;
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}
+
+/* Bracket cpu access to a dmabuf, the syncs are needed for cache coherency
+   with the devices also accessing it */
+static void v4l2_dmabuf_sync(int fd, int end, int write)
+{
+#ifdef HAVE_LINUX_DMA_BUF_H
+	struct dma_buf_sync sync;
+	int saved_err = errno;
+
+	if (fd == -1)
+		return;
+
+	sync.flags = (end ? DMA_BUF_SYNC_END : DMA_BUF_SYNC_START) |
+		     (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ);
+	while (SYS_IOCTL(fd, DMA_BUF_IOCTL_SYNC, &sync) == -1 &&
+	       errno == EINTR)
+		;
+	errno = saved_err;
+#endif
 }
 
-static int v4l2_request_read_buffers(int index)
+static int v4l2_request_read_buffers(struct v4l2_dev_info *dev)
 {
 	int result;
 	struct v4l2_requestbuffers req;
 
 	/* Note we re-request the buffers if they are already requested as the format
 	   and thus the needed buffer size may have changed. */
-	req.count = (devices[index].no_frames) ? devices[index].no_frames :
-		devices[index].nreadbuffers;
+	req.count = (dev->no_frames) ? dev->no_frames :
+		dev->nreadbuffers;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req);
+	dev->memory = V4L2_MEMORY_MMAP;
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_REQBUFS, &req);
 	if (result < 0) {
 		int saved_err = errno;
 
@@ -143,19 +278,22 @@ static int v4l2_request_read_buffers(int index)
 		return result;
 	}
 
-	if (!devices[index].no_frames && req.count)
-		devices[index].flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
+	if (!dev->no_frames && req.count)
+		dev->flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
+
+	/* read() always copies, so it always goes through libv4lconvert */
+	dev->flags &= ~V4L2_ZERO_COPY_ACTIVE;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
+	dev->no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
 	return 0;
 }
 
-static void v4l2_unrequest_read_buffers(int index)
+static void v4l2_unrequest_read_buffers(struct v4l2_dev_info *dev)
 {
 	struct v4l2_requestbuffers req;
 
-	if (!(devices[index].flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
-			devices[index].no_frames == 0)
+	if (!(dev->flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
+			dev->no_frames == 0)
 		return;
 
 	/* (Un)Request buffers, note not all driver support this, and those
@@ -163,32 +301,36 @@ static void v4l2_unrequest_read_buffers(int index)
 	req.count = 0;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req) < 0)
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_REQBUFS, &req) < 0)
 		return;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
-	if (devices[index].no_frames == 0)
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+	dev->no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
+	if (dev->no_frames == 0)
+		dev->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
 }
 
-static int v4l2_map_buffers(int index)
+static int v4l2_map_buffers(struct v4l2_dev_info *dev)
 {
 	int result = 0;
 	unsigned int i;
 	struct v4l2_buffer buf;
 
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED)
+	/* The app's dmabufs get mapped when they are dequeued */
+	if (dev->memory == V4L2_MEMORY_DMABUF)
+		return 0;
+
+	for (i = 0; i < dev->no_frames; i++) {
+		if (dev->frame_pointers[i] != MAP_FAILED)
 			continue;
 
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.memory = V4L2_MEMORY_MMAP;
 		buf.index = i;
 		buf.reserved = buf.reserved2 = 0;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_QUERYBUF, &buf);
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_QUERYBUF, &buf);
 		if (result) {
 			int saved_err = errno;
 
@@ -197,10 +339,10 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 
-		devices[index].frame_pointers[i] = (void *)SYS_MMAP(NULL,
-				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, devices[index].fd,
+		dev->frame_pointers[i] = (void *)SYS_MMAP(NULL,
+				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd,
 				buf.m.offset);
-		if (devices[index].frame_pointers[i] == MAP_FAILED) {
+		if (dev->frame_pointers[i] == MAP_FAILED) {
 			int saved_err = errno;
 
 			V4L2_PERROR("mmapping buffer %u", i);
@@ -209,38 +351,191 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 		V4L2_LOG("mapped buffer %u at %p\n", i,
-				devices[index].frame_pointers[i]);
+				dev->frame_pointers[i]);
 
-		devices[index].frame_sizes[i] = buf.length;
+		dev->frame_sizes[i] = buf.length;
 	}
 
 	return result;
 }
 
-static void v4l2_unmap_buffers(int index)
+static void v4l2_unmap_buffers(struct v4l2_dev_info *dev)
 {
 	unsigned int i;
 
 	/* unmap the buffers */
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
-			SYS_MUNMAP(devices[index].frame_pointers[i],
-					devices[index].frame_sizes[i]);
-			devices[index].frame_pointers[i] = MAP_FAILED;
+	for (i = 0; i < dev->no_frames; i++) {
+		if (dev->frame_pointers[i] != MAP_FAILED) {
+			SYS_MUNMAP(dev->frame_pointers[i],
+					dev->frame_sizes[i]);
+			dev->frame_pointers[i] = MAP_FAILED;
 			V4L2_LOG("unmapped buffer %u\n", i);
 		}
+		dev->frame_dmabuf_fds[i] = -1;
+	}
+}
+
+/* Map the dmabuf of the app which buf got dequeued from, the mapping is kept
+   until a different dmabuf gets queued with the same index */
+static int v4l2_map_dmabuf(struct v4l2_dev_info *dev, struct v4l2_buffer *buf)
+{
+	unsigned int i = buf->index;
+	struct stat st;
+	off_t size;
+
+	if (i >= dev->no_frames) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* The app may have closed the dmabuf and got the same fd for another */
+	if (fstat(buf->m.fd, &st)) {
+		int saved_err = errno;
+
+		V4L2_PERROR("getting dmabuf %d of buffer %u", buf->m.fd, i);
+		errno = saved_err;
+		return -1;
+	}
+
+	if (dev->frame_pointers[i] != MAP_FAILED) {
+		if (dev->frame_dmabuf_fds[i] == buf->m.fd &&
+		    dev->frame_dmabuf_inos[i] == st.st_ino)
+			return 0;
+
+		SYS_MUNMAP(dev->frame_pointers[i],
+				dev->frame_sizes[i]);
+		dev->frame_pointers[i] = MAP_FAILED;
+	}
+
+	size = buf->length ? (off_t)buf->length :
+			     lseek(buf->m.fd, 0, SEEK_END);
+	if (size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Processing of bayer frames is done in place */
+	dev->frame_pointers[i] = (void *)SYS_MMAP(NULL, (size_t)size,
+			PROT_READ | PROT_WRITE, MAP_SHARED, buf->m.fd, 0);
+	if (dev->frame_pointers[i] == MAP_FAILED) {
+		int saved_err = errno;
+
+		V4L2_PERROR("mmapping dmabuf %d of buffer %u", buf->m.fd, i);
+		errno = saved_err;
+		return -1;
+	}
+	V4L2_LOG("mapped dmabuf %d of buffer %u at %p\n", buf->m.fd, i,
+			dev->frame_pointers[i]);
+
+	dev->frame_sizes[i] = size;
+	dev->frame_dmabuf_fds[i] = buf->m.fd;
+	dev->frame_dmabuf_inos[i] = st.st_ino;
+	return 0;
+}
+
+/* Wait (without the stream_lock held) until the device has a frame for the
+   conversion thread. Fails with ECANCELED when the thread is being stopped. */
+static int v4l2_convert_thread_wait(struct v4l2_dev_info *dev)
+{
+	struct pollfd fds[2];
+	char drain[16];
+	int result;
+	nfds_t nfds = 2;
+
+	fds[0].fd = dev->convert_wake_pipe[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = dev->fd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		fds[0].revents = fds[1].revents = 0;
+		pthread_mutex_unlock(&dev->stream_lock);
+		result = dev->dev_ops->poll(dev->dev_ops_priv, dev->fd, fds,
+					    nfds, -1);
+		pthread_mutex_lock(&dev->stream_lock);
+
+		if (result == -1 && errno != EINTR)
+			return -1;
+
+		if (dev->flags & V4L2_CONVERT_THREAD_STOP) {
+			errno = ECANCELED;
+			return -1;
+		}
+
+		if (fds[0].revents) {
+			do {
+				result = SYS_READ(fds[0].fd, drain,
+						  sizeof(drain));
+			} while (result > 0);
+		}
+
+		if (fds[1].revents & (POLLIN | POLLHUP))
+			return 0;
+
+		/* Without POLLIN DQBUF may block with the stream_lock held,
+		   this happens with vb2 when no buffers have been queued, so
+		   then wait for QBUF to wake us up */
+		if (fds[1].revents)
+			nfds = 1;
+		else if (fds[0].revents)
+			nfds = 2;
 	}
 }
 
-static int v4l2_streamon(int index)
+/* Wake up the conversion thread, for a stop or a newly queued buffer */
+static void v4l2_convert_thread_wake(struct v4l2_dev_info *dev)
+{
+	int result;
+
+	do {
+		result = SYS_WRITE(dev->convert_wake_pipe[1], "", 1);
+	} while (result == -1 && errno == EINTR);
+}
+
+/* Stop the conversion thread, this drops frames it has converted but the app
+   has not dequeued yet. */
+static void v4l2_convert_thread_stop(struct v4l2_dev_info *dev)
+{
+	if (!(dev->flags & V4L2_CONVERT_THREAD_RUNNING))
+		return;
+
+	/* Another thread is stopping it already, wait until it has been joined
+	   so that our caller can safely free the buffers it converts into */
+	if (dev->flags & V4L2_CONVERT_THREAD_STOP) {
+		while (dev->flags & V4L2_CONVERT_THREAD_RUNNING)
+			pthread_cond_wait(&dev->convert_cond,
+					  &dev->stream_lock);
+		return;
+	}
+
+	dev->flags |= V4L2_CONVERT_THREAD_STOP;
+	v4l2_convert_thread_wake(dev);
+
+	pthread_mutex_unlock(&dev->stream_lock);
+	pthread_join(dev->convert_thread, NULL);
+	pthread_mutex_lock(&dev->stream_lock);
+
+	SYS_CLOSE(dev->convert_wake_pipe[0]);
+	SYS_CLOSE(dev->convert_wake_pipe[1]);
+	dev->flags &= ~(V4L2_CONVERT_THREAD_RUNNING |
+				  V4L2_CONVERT_THREAD_STOP |
+				  V4L2_CONVERT_THREAD_EXITED);
+	dev->converted_count = 0;
+	dev->convert_error = 0;
+
+	/* Wake up DQBUF-s waiting for a converted frame */
+	pthread_cond_broadcast(&dev->convert_cond);
+}
+
+static int v4l2_streamon(struct v4l2_dev_info *dev)
 {
 	int result;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (!(devices[index].flags & V4L2_STREAMON)) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMON, &type);
+	if (!(dev->flags & V4L2_STREAMON)) {
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_STREAMON, &type);
 		if (result) {
 			int saved_err = errno;
 
@@ -248,22 +543,24 @@ static int v4l2_streamon(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags |= V4L2_STREAMON;
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->flags |= V4L2_STREAMON;
+		dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 	}
 
 	return 0;
 }
 
-static int v4l2_streamoff(int index)
+static int v4l2_streamoff(struct v4l2_dev_info *dev)
 {
 	int result;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (devices[index].flags & V4L2_STREAMON) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMOFF, &type);
+	v4l2_convert_thread_stop(dev);
+
+	if (dev->flags & V4L2_STREAMON) {
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_STREAMOFF, &type);
 		if (result) {
 			int saved_err = errno;
 
@@ -271,29 +568,33 @@ static int v4l2_streamoff(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags &= ~V4L2_STREAMON;
+		dev->flags &= ~V4L2_STREAMON;
 
 		/* Stream off also dequeues all our buffers! */
-		devices[index].frame_queued = 0;
+		dev->frame_queued = 0;
 	}
 
 	return 0;
 }
 
-static int v4l2_queue_read_buffer(int index, int buffer_index)
+static int v4l2_queue_read_buffer(struct v4l2_dev_info *dev, int buffer_index)
 {
 	int result;
 	struct v4l2_buffer buf;
 
-	if (devices[index].frame_queued & (1 << buffer_index))
+	if (dev->frame_queued & (1 << buffer_index))
 		return 0;
 
 	memset(&buf, 0, sizeof(buf));
 	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	buf.memory = V4L2_MEMORY_MMAP;
+	buf.memory = dev->memory;
 	buf.index  = buffer_index;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_QBUF, &buf);
+	if (buf.memory == V4L2_MEMORY_DMABUF) {
+		buf.m.fd = dev->frame_dmabuf_fds[buffer_index];
+		buf.length = dev->frame_sizes[buffer_index];
+	}
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_QBUF, &buf);
 	if (result) {
 		int saved_err = errno;
 
@@ -302,28 +603,40 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 		return result;
 	}
 
-	devices[index].frame_queued |= 1 << buffer_index;
+	dev->frame_queued |= 1 << buffer_index;
 	return 0;
 }
 
-static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
-		unsigned char *dest, int dest_size)
+static int v4l2_dequeue_and_convert(struct v4l2_dev_info *dev,
+		struct v4l2_buffer *buf, unsigned char *dest, int dest_size,
+		int from_thread)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
-	int result, tries = max_tries, frame_info_gen;
+	int result, tries = max_tries, frame_info_gen, src_fd, dest_fd;
 
 	/* Make sure we have the real v4l2 buffers mapped */
-	result = v4l2_map_buffers(index);
+	result = v4l2_map_buffers(dev);
 	if (result)
 		return result;
 
 	do {
-		frame_info_gen = devices[index].frame_info_generation;
-		pthread_mutex_unlock(&devices[index].stream_lock);
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_DQBUF, buf);
-		pthread_mutex_lock(&devices[index].stream_lock);
+		frame_info_gen = dev->frame_info_generation;
+		if (from_thread) {
+			/* Only wait for the frame unlocked, so that a DQBUF of
+			   the app sees it either with the driver or converted */
+			result = v4l2_convert_thread_wait(dev);
+			if (result)
+				return result;
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					dev->fd, VIDIOC_DQBUF, buf);
+		} else {
+			pthread_mutex_unlock(&dev->stream_lock);
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					dev->fd, VIDIOC_DQBUF, buf);
+			pthread_mutex_lock(&dev->stream_lock);
+		}
 		if (result) {
 			if (errno != EAGAIN) {
 				int saved_err = errno;
@@ -334,27 +647,48 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 			return result;
 		}
 
-		devices[index].frame_queued &= ~(1 << buf->index);
+		dev->frame_queued &= ~(1 << buf->index);
 
-		if (frame_info_gen != devices[index].frame_info_generation) {
-			errno = -EINVAL;
+		if (frame_info_gen != dev->frame_info_generation) {
+			/* The buffers changed under the conversion thread, give
+			   the frame back and let it wait for the next one */
+			if (from_thread) {
+				v4l2_queue_read_buffer(dev, buf->index);
+				errno = EAGAIN;
+				return -1;
+			}
+			errno = EINVAL;
 			return -1;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].frame_pointers[buf->index],
-				buf->bytesused, dest ? dest : (devices[index].convert_mmap_buf +
-					buf->index * devices[index].convert_mmap_frame_size),
+		src_fd = dest_fd = -1;
+		if (dev->memory == V4L2_MEMORY_DMABUF) {
+			result = v4l2_map_dmabuf(dev, buf);
+			if (result)
+				return result;
+			src_fd = buf->m.fd;
+		}
+		if (!dest)
+			dest_fd = dev->convert_dmabuf_fds[buf->index];
+
+		v4l2_dmabuf_sync(src_fd, 0, 1);
+		v4l2_dmabuf_sync(dest_fd, 0, 1);
+		result = v4lconvert_convert(dev->convert,
+				&dev->src_fmt, &dev->dest_fmt,
+				dev->frame_pointers[buf->index],
+				buf->bytesused, dest ? dest : (dev->convert_mmap_buf +
+					buf->index * dev->convert_mmap_frame_size),
 				dest_size);
+		v4l2_dmabuf_sync(dest_fd, 1, 1);
+		v4l2_dmabuf_sync(src_fd, 1, 1);
 
-		if (devices[index].first_frame) {
+		if (dev->first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
 			   some cams produce bad frames at the start of the stream
 			   (hsync and vsync still syncing ??). */
 			if (result < 0)
 				errno = EAGAIN;
-			devices[index].first_frame--;
+			dev->first_frame--;
 		}
 
 		if (result < 0) {
@@ -362,10 +696,10 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 
 			/*
 			 * If this is the last try, and the frame is short
@@ -373,7 +707,7 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 			 * so we must not re-queue it then!
 			 */
 			if (!(tries == 1 && errno == EPIPE))
-				v4l2_queue_read_buffer(index, buf->index);
+				v4l2_queue_read_buffer(dev, buf->index);
 			errno = saved_err;
 		}
 		tries--;
@@ -381,42 +715,43 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, v4lconvert_get_error_message(dev->convert));
 		errno = EIO;
 	}
 
 	if (result < 0 && errno == EPIPE) {
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		result = dev->dest_fmt.fmt.pix.sizeimage;
 		errno = 0;
 	}
 
 	return result;
 }
 
-static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
+static int v4l2_read_and_convert(struct v4l2_dev_info *dev,
+		unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
 	int result, buf_size, tries = max_tries;
 
-	buf_size = devices[index].dest_fmt.fmt.pix.sizeimage;
+	buf_size = dev->dest_fmt.fmt.pix.sizeimage;
 
-	if (devices[index].readbuf_size < buf_size) {
+	if (dev->readbuf_size < buf_size) {
 		unsigned char *new_buf;
 
-		new_buf = realloc(devices[index].readbuf, buf_size);
+		new_buf = realloc(dev->readbuf, buf_size);
 		if (!new_buf)
 			return -1;
 
-		devices[index].readbuf = new_buf;
-		devices[index].readbuf_size = buf_size;
+		dev->readbuf = new_buf;
+		dev->readbuf_size = buf_size;
 	}
 
 	do {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
-				devices[index].fd, devices[index].readbuf,
+		result = dev->dev_ops->read(
+				dev->dev_ops_priv,
+				dev->fd, dev->readbuf,
 				buf_size);
 		if (result <= 0) {
 			if (result && errno != EAGAIN) {
@@ -428,17 +763,17 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 			return result;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].readbuf, result, dest, dest_size);
+		result = v4lconvert_convert(dev->convert,
+				&dev->src_fmt, &dev->dest_fmt,
+				dev->readbuf, result, dest, dest_size);
 
-		if (devices[index].first_frame) {
+		if (dev->first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
 			   some cams produce bad frames at the start of the stream
 			   (hsync and vsync still syncing ??). */
 			if (result < 0)
 				errno = EAGAIN;
-			devices[index].first_frame--;
+			dev->first_frame--;
 		}
 
 		if (result < 0) {
@@ -446,10 +781,10 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 
 			errno = saved_err;
 		}
@@ -458,29 +793,29 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, v4lconvert_get_error_message(dev->convert));
 		errno = EIO;
 	}
 
 	if (result < 0 && errno == EPIPE) {
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		result = dev->dest_fmt.fmt.pix.sizeimage;
 		errno = 0;
 	}
 
 	return result;
 }
 
-static int v4l2_queue_read_buffers(int index)
+static int v4l2_queue_read_buffers(struct v4l2_dev_info *dev)
 {
 	unsigned int i;
 	int last_error = EIO, queued = 0;
 
-	for (i = 0; i < devices[index].no_frames; i++) {
+	for (i = 0; i < dev->no_frames; i++) {
 		/* Don't queue unmapped buffers (should never happen) */
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
-			if (v4l2_queue_read_buffer(index, i)) {
+		if (dev->frame_pointers[i] != MAP_FAILED) {
+			if (v4l2_queue_read_buffer(dev, i)) {
 				last_error = errno;
 				continue;
 			}
@@ -495,89 +830,96 @@ static int v4l2_queue_read_buffers(int index)
 	return 0;
 }
 
-static int v4l2_activate_read_stream(int index)
+static int v4l2_activate_read_stream(struct v4l2_dev_info *dev)
 {
 	int result;
 
-	if ((devices[index].flags & V4L2_STREAMON) || devices[index].frame_queued) {
+	if ((dev->flags & V4L2_STREAMON) || dev->frame_queued) {
 		errno = EBUSY;
 		return -1;
 	}
 
-	result = v4l2_request_read_buffers(index);
+	result = v4l2_request_read_buffers(dev);
 	if (!result)
-		result = v4l2_map_buffers(index);
+		result = v4l2_map_buffers(dev);
 	if (!result)
-		result = v4l2_queue_read_buffers(index);
+		result = v4l2_queue_read_buffers(dev);
 	if (result)
 		return result;
 
-	devices[index].flags |= V4L2_STREAM_CONTROLLED_BY_READ;
+	dev->flags |= V4L2_STREAM_CONTROLLED_BY_READ;
 
-	return v4l2_streamon(index);
+	return v4l2_streamon(dev);
 }
 
-static int v4l2_deactivate_read_stream(int index)
+static int v4l2_deactivate_read_stream(struct v4l2_dev_info *dev)
 {
 	int result;
 
-	result = v4l2_streamoff(index);
+	result = v4l2_streamoff(dev);
 	if (result)
 		return result;
 
 	/* No need to dequeue our buffers, streamoff does that for us */
 
-	v4l2_unmap_buffers(index);
+	v4l2_unmap_buffers(dev);
 
-	v4l2_unrequest_read_buffers(index);
+	v4l2_unrequest_read_buffers(dev);
 
-	devices[index].flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
+	dev->flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
 
 	return 0;
 }
 
-static int v4l2_needs_conversion(int index)
+static int v4l2_needs_conversion(struct v4l2_dev_info *dev)
 {
-	if (devices[index].convert == NULL)
+	if (dev->convert == NULL ||
+			(dev->flags & V4L2_ZERO_COPY_ACTIVE))
 		return 0;
 
-	return v4lconvert_needs_conversion(devices[index].convert,
-			&devices[index].src_fmt, &devices[index].dest_fmt);
+	return v4lconvert_needs_conversion(dev->convert,
+			&dev->src_fmt, &dev->dest_fmt);
 }
 
-static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
+static void v4l2_set_conversion_buf_params(struct v4l2_dev_info *dev,
+		struct v4l2_buffer *buf)
 {
-	if (!v4l2_needs_conversion(index))
+	/* dmabufs are the app's, the converted frames get exported instead */
+	if (!v4l2_needs_conversion(dev) || buf->memory == V4L2_MEMORY_DMABUF)
 		return;
 
 	/* This may happen if the ioctl failed */
-	if (buf->index >= devices[index].no_frames)
+	if (buf->index >= dev->no_frames)
 		buf->index = 0;
 
 	buf->m.offset = V4L2_MMAP_OFFSET_MAGIC | buf->index;
-	buf->length = devices[index].convert_mmap_frame_size;
-	if (devices[index].frame_map_count[buf->index])
+	buf->length = dev->convert_mmap_frame_size;
+	if (dev->frame_map_count[buf->index])
 		buf->flags |= V4L2_BUF_FLAG_MAPPED;
 	else
 		buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
 }
 
-static int v4l2_buffers_mapped(int index)
+static int v4l2_buffers_mapped(struct v4l2_dev_info *dev)
 {
 	unsigned int i;
 
-	if (!v4l2_needs_conversion(index)) {
+	if (!v4l2_needs_conversion(dev)) {
 		/* Normal (no conversion) mode */
 		struct v4l2_buffer buf;
 
-		for (i = 0; i < devices[index].no_frames; i++) {
+		/* dmabufs are mapped by the app, not from the device */
+		if (dev->memory == V4L2_MEMORY_DMABUF)
+			return 0;
+
+		for (i = 0; i < dev->no_frames; i++) {
 			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 			buf.memory = V4L2_MEMORY_MMAP;
 			buf.index = i;
 			buf.reserved = buf.reserved2 = 0;
-			if (devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
-					devices[index].fd, VIDIOC_QUERYBUF,
+			if (dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					dev->fd, VIDIOC_QUERYBUF,
 					&buf)) {
 				int saved_err = errno;
 
@@ -590,27 +932,135 @@ static int v4l2_buffers_mapped(int index)
 		}
 	} else {
 		/* Conversion mode */
-		for (i = 0; i < devices[index].no_frames; i++)
-			if (devices[index].frame_map_count[i])
+		for (i = 0; i < dev->no_frames; i++)
+			if (dev->frame_map_count[i])
 				break;
 	}
 
-	if (i != devices[index].no_frames)
+	if (i != dev->no_frames)
 		V4L2_LOG("v4l2_buffers_mapped(): buffers still mapped\n");
 
-	return i != devices[index].no_frames;
+	return i != dev->no_frames;
+}
+
+static void *v4l2_convert_thread(void *arg)
+{
+	struct v4l2_dev_info *dev = arg;
+	struct v4l2_buffer buf;
+	unsigned int i;
+	int result;
+
+	pthread_mutex_lock(&dev->stream_lock);
+	while (!(dev->flags & V4L2_CONVERT_THREAD_STOP)) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = dev->memory;
+		result = v4l2_dequeue_and_convert(dev, &buf, NULL,
+				dev->convert_mmap_frame_size, 1);
+		if (result >= 0) {
+			buf.bytesused = result;
+			i = (dev->converted_first +
+			     dev->converted_count) % V4L2_MAX_NO_FRAMES;
+			dev->converted_bufs[i] = buf;
+			dev->converted_count++;
+		} else if (errno == EAGAIN || errno == ECANCELED) {
+			continue;
+		} else {
+			dev->convert_error = errno;
+			/* After decode errors the buffer has been requeued
+			   and the next frame may be fine */
+			if (errno != EIO)
+				break;
+		}
+		pthread_cond_broadcast(&dev->convert_cond);
+	}
+	dev->flags |= V4L2_CONVERT_THREAD_EXITED;
+	pthread_cond_broadcast(&dev->convert_cond);
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return NULL;
+}
+
+static void v4l2_convert_thread_start(struct v4l2_dev_info *dev)
+{
+	/* The thread needs to wait for frames, plugins without poll get their
+	   frames converted by DQBUF */
+	if (!(dev->flags & V4L2_ENABLE_ASYNC_CONVERSION) ||
+	    (dev->flags & V4L2_CONVERT_THREAD_RUNNING) ||
+	    !dev->dev_ops->poll || !v4l2_needs_conversion(dev))
+		return;
+
+	/* The thread converts before the app has mapped its buffers, on
+	   failure DQBUF will do the conversion and report the error */
+	if (v4l2_ensure_convert_mmap_buf(dev) || v4l2_map_buffers(dev))
+		return;
+
+	if (pipe2(dev->convert_wake_pipe, O_CLOEXEC | O_NONBLOCK)) {
+		V4L2_LOG_WARN("creating conversion thread pipe: %s\n",
+			      strerror(errno));
+		return;
+	}
+
+	dev->converted_count = 0;
+	dev->convert_error = 0;
+	if (pthread_create(&dev->convert_thread, NULL,
+			   v4l2_convert_thread, dev)) {
+		V4L2_LOG_WARN("creating conversion thread failed\n");
+		SYS_CLOSE(dev->convert_wake_pipe[0]);
+		SYS_CLOSE(dev->convert_wake_pipe[1]);
+		return;
+	}
+	dev->flags |= V4L2_CONVERT_THREAD_RUNNING;
+	V4L2_LOG("started conversion thread\n");
 }
 
-static void v4l2_update_fps(int index, struct v4l2_streamparm *parm)
+/* DQBUF of the app while the conversion thread is running */
+static int v4l2_dequeue_converted(struct v4l2_dev_info *dev,
+		struct v4l2_buffer *buf)
 {
-	if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+	while (!dev->converted_count) {
+		if (dev->convert_error) {
+			errno = dev->convert_error;
+			/* Keep failing when the thread has given up */
+			if (!(dev->flags & V4L2_CONVERT_THREAD_EXITED))
+				dev->convert_error = 0;
+			return -1;
+		}
+
+		/* Streamed off while waiting */
+		if (!(dev->flags & V4L2_CONVERT_THREAD_RUNNING)) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (fcntl(dev->fd, F_GETFL) & O_NONBLOCK) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		pthread_cond_wait(&dev->convert_cond,
+				  &dev->stream_lock);
+	}
+
+	*buf = dev->converted_bufs[dev->converted_first];
+	dev->converted_first =
+		(dev->converted_first + 1) % V4L2_MAX_NO_FRAMES;
+	dev->converted_count--;
+
+	return 0;
+}
+
+static void v4l2_update_fps(struct v4l2_dev_info *dev,
+		struct v4l2_streamparm *parm)
+{
+	if ((dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 	    parm->parm.capture.timeperframe.numerator != 0) {
 		int fps = parm->parm.capture.timeperframe.denominator;
 		fps += parm->parm.capture.timeperframe.numerator - 1;
 		fps /= parm->parm.capture.timeperframe.numerator;
-		devices[index].fps = fps;
+		dev->fps = fps;
 	} else
-		devices[index].fps = 0;
+		dev->fps = 0;
 }
 
 int v4l2_open(const char *file, int oflag, ...)
@@ -649,7 +1099,8 @@ int v4l2_open(const char *file, int oflag, ...)
 
 int v4l2_fd_open(int fd, int v4l2_flags)
 {
-	int i, index;
+	struct v4l2_dev_info *dev, **chunk = NULL;
+	int i;
 	char *lfname;
 	struct v4l2_capability cap;
 	struct v4l2_format fmt = { 0, };
@@ -670,6 +1121,11 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 			v4l2_log_file = fopen(lfname, "w");
 	}
 
+	if (getenv("LIBV4L2_ZERO_COPY"))
+		v4l2_flags |= V4L2_ENABLE_ZERO_COPY;
+	if (getenv("LIBV4L2_ASYNC_CONVERSION"))
+		v4l2_flags |= V4L2_ENABLE_ASYNC_CONVERSION;
+
 	/* Get page_size (for mmap emulation) */
 	page_size = sysconf(_SC_PAGESIZE);
 	if (page_size < 0) {
@@ -724,70 +1180,104 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 	}
 
 no_capture:
-	/* So we have a v4l2 capture device, register it in our devices array */
+	/* So we have a v4l2 capture device, get a device struct for it, it gets
+	   added to the fd table once it has been initialized */
 	pthread_mutex_lock(&v4l2_open_mutex);
-	for (index = 0; index < V4L2_MAX_DEVICES; index++) {
-		if (devices[index].fd == -1) {
-			devices[index].fd = fd;
-			devices[index].plugin_library = plugin_library;
-			devices[index].dev_ops_priv = dev_ops_priv;
-			devices[index].dev_ops = dev_ops;
+	if (fd < V4L2_FD_TABLE_CHUNKS * V4L2_FD_TABLE_CHUNK_SIZE) {
+		chunk = v4l2_fd_table[fd / V4L2_FD_TABLE_CHUNK_SIZE];
+		if (!chunk) {
+			chunk = calloc(V4L2_FD_TABLE_CHUNK_SIZE, sizeof(*chunk));
+			__atomic_store_n(&v4l2_fd_table[fd / V4L2_FD_TABLE_CHUNK_SIZE],
+					 chunk, __ATOMIC_RELEASE);
+		}
+	}
+	for (dev = devices; dev; dev = dev->next)
+		if (!dev->in_use)
 			break;
+	if (!dev &&
+	    (chunk || fd >= V4L2_FD_TABLE_CHUNKS * V4L2_FD_TABLE_CHUNK_SIZE)) {
+		dev = calloc(1, sizeof(*dev));
+		if (dev) {
+			/* A stale lookup may still lock a closed struct, so its
+			   lock and cond live as long as the struct */
+			pthread_mutex_init(&dev->stream_lock, NULL);
+			pthread_cond_init(&dev->convert_cond, NULL);
+			dev->fd = -1;
+			dev->next = devices;
+			__atomic_store_n(&devices, dev, __ATOMIC_RELEASE);
 		}
 	}
+	if (fd < V4L2_FD_TABLE_CHUNKS * V4L2_FD_TABLE_CHUNK_SIZE && !chunk)
+		dev = NULL;
+	if (dev)
+		dev->in_use = 1;
 	pthread_mutex_unlock(&v4l2_open_mutex);
 
-	if (index == V4L2_MAX_DEVICES) {
-		V4L2_LOG_ERR("attempting to open more than %d video devices\n",
-				V4L2_MAX_DEVICES);
+	if (!dev) {
+		V4L2_LOG_ERR("allocating video device info for fd %d\n", fd);
 		v4l2_plugin_cleanup(plugin_library, dev_ops_priv, dev_ops);
-		errno = EBUSY;
+		errno = ENOMEM;
 		return -1;
 	}
 
-	devices[index].flags = v4l2_flags;
+	pthread_mutex_lock(&dev->stream_lock);
+	dev->plugin_library = plugin_library;
+	dev->dev_ops_priv = dev_ops_priv;
+	dev->dev_ops = dev_ops;
+	dev->flags = v4l2_flags;
+	dev->gone = 0;
+	dev->first_frame = 0;
 	if (cap.capabilities & V4L2_CAP_READWRITE)
-		devices[index].flags |= V4L2_SUPPORTS_READ;
+		dev->flags |= V4L2_SUPPORTS_READ;
 	if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-		devices[index].flags |= V4L2_USE_READ_FOR_READ;
+		dev->flags |= V4L2_USE_READ_FOR_READ;
 		/* This device only supports read so the stream gets started by the
 		   driver on the first read */
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 	}
 	if ((parm.type == V4L2_BUF_TYPE_VIDEO_CAPTURE) &&
 	    (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
-		devices[index].flags |= V4L2_SUPPORTS_TIMEPERFRAME;
-	devices[index].open_count = 1;
-	devices[index].page_size = page_size;
-	devices[index].src_fmt  = fmt;
-	devices[index].dest_fmt = fmt;
-	v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-				     &devices[index].dest_fmt);
-
-	pthread_mutex_init(&devices[index].stream_lock, NULL);
-
-	devices[index].no_frames = 0;
-	devices[index].nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
-	devices[index].convert = convert;
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
+		dev->flags |= V4L2_SUPPORTS_TIMEPERFRAME;
+	dev->open_count = 1;
+	dev->page_size = page_size;
+	dev->src_fmt  = fmt;
+	dev->dest_fmt = fmt;
+	v4l2_set_src_and_dest_format(dev, &dev->src_fmt,
+				     &dev->dest_fmt);
+	dev->no_frames = 0;
+	dev->nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
+	dev->memory = V4L2_MEMORY_MMAP;
+	dev->convert = convert;
+	dev->convert_mmap_buf = MAP_FAILED;
+	dev->convert_mmap_buf_size = 0;
+	dev->convert_mmap_fd = -1;
 	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
-		devices[index].frame_pointers[i] = MAP_FAILED;
-		devices[index].frame_map_count[i] = 0;
-	}
-	devices[index].frame_queued = 0;
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
-
-	if (index >= devices_used)
-		devices_used = index + 1;
+		dev->convert_dmabuf_fds[i] = -1;
+		dev->frame_pointers[i] = MAP_FAILED;
+		dev->frame_dmabuf_fds[i] = -1;
+		dev->frame_map_count[i] = 0;
+	}
+	dev->frame_queued = 0;
+	dev->converted_first = 0;
+	dev->converted_count = 0;
+	dev->convert_error = 0;
+	dev->readbuf = NULL;
+	dev->readbuf_size = 0;
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	/* Only now the lookups of other threads can find the device, fds beyond
+	   the table are found through the devices list and dev->fd */
+	__atomic_store_n(&dev->fd, fd, __ATOMIC_RELEASE);
+	if (chunk)
+		__atomic_store_n(&chunk[fd % V4L2_FD_TABLE_CHUNK_SIZE], dev,
+				 __ATOMIC_RELEASE);
 
 	/* Note we always tell v4lconvert to optimize src fmt selection for
 	   our default fps, the only exception is the app explicitly selecting
 	   a frame rate using the S_PARM ioctl after a S_FMT */
-	if (devices[index].convert)
-		v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
-	v4l2_update_fps(index, &parm);
+	if (dev->convert)
+		v4lconvert_set_fps(dev->convert, V4L2_DEFAULT_FPS);
+	v4l2_update_fps(dev, &parm);
 
 	V4L2_LOG("open: %d\n", fd);
 
@@ -795,69 +1285,88 @@ no_capture:
 }
 
 /* Is this an fd for which we are emulating v4l1 ? */
-static int v4l2_get_index(int fd)
+static struct v4l2_dev_info *v4l2_get_dev(int fd)
 {
-	int index;
+	struct v4l2_dev_info **chunk, *dev;
 
 	/* We never handle fd -1 */
-	if (fd == -1)
-		return -1;
+	if (fd < 0)
+		return NULL;
 
-	for (index = 0; index < devices_used; index++)
-		if (devices[index].fd == fd)
-			break;
+	if (fd >= V4L2_FD_TABLE_CHUNKS * V4L2_FD_TABLE_CHUNK_SIZE) {
+		for (dev = __atomic_load_n(&devices, __ATOMIC_ACQUIRE); dev;
+		     dev = dev->next)
+			if (__atomic_load_n(&dev->fd, __ATOMIC_ACQUIRE) == fd)
+				return dev;
+		return NULL;
+	}
 
-	if (index == devices_used)
-		return -1;
+	chunk = __atomic_load_n(&v4l2_fd_table[fd / V4L2_FD_TABLE_CHUNK_SIZE],
+				__ATOMIC_ACQUIRE);
+	if (!chunk)
+		return NULL;
 
-	return index;
+	return __atomic_load_n(&chunk[fd % V4L2_FD_TABLE_CHUNK_SIZE],
+			       __ATOMIC_ACQUIRE);
 }
 
 
 int v4l2_close(int fd)
 {
-	int index, result;
+	struct v4l2_dev_info *dev;
+	int result;
 
-	index = v4l2_get_index(fd);
-	if (index == -1)
+	dev = v4l2_get_dev(fd);
+	if (!dev)
 		return SYS_CLOSE(fd);
 
 	/* Abuse stream_lock to stop 2 closes from racing and trying to free
 	   the resources twice */
-	pthread_mutex_lock(&devices[index].stream_lock);
-	devices[index].open_count--;
-	result = devices[index].open_count != 0;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
+	dev->open_count--;
+	result = dev->open_count != 0;
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	if (result)
 		return 0;
 
-	v4l2_plugin_cleanup(devices[index].plugin_library,
-			devices[index].dev_ops_priv,
-			devices[index].dev_ops);
+	/* Keep the stream_lock while freeing the buffers, so that they are not
+	   freed under a STREAMOFF which is stopping the conversion thread */
+	pthread_mutex_lock(&dev->stream_lock);
+	v4l2_convert_thread_stop(dev);
+
+	v4l2_plugin_cleanup(dev->plugin_library,
+			dev->dev_ops_priv,
+			dev->dev_ops);
 
 	/* Free resources */
-	v4l2_unmap_buffers(index);
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
-		if (v4l2_buffers_mapped(index)) {
-			if (!devices[index].gone)
-				V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
-		} else {
-			SYS_MUNMAP(devices[index].convert_mmap_buf,
-					devices[index].convert_mmap_buf_size);
-		}
-		devices[index].convert_mmap_buf = MAP_FAILED;
-		devices[index].convert_mmap_buf_size = 0;
-	}
-	v4lconvert_destroy(devices[index].convert);
-	free(devices[index].readbuf);
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
+	v4l2_unmap_buffers(dev);
+	if (dev->convert_mmap_buf != MAP_FAILED &&
+	    v4l2_buffers_mapped(dev)) {
+		if (!dev->gone)
+			V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
+		/* Leave the buffer to the app */
+		dev->convert_mmap_buf = MAP_FAILED;
+	}
+	v4l2_free_convert_mmap_buf(dev);
+	v4lconvert_destroy(dev->convert);
+	free(dev->readbuf);
+	dev->readbuf = NULL;
+	dev->readbuf_size = 0;
+	/* Racing ioctls read dev->fd with the stream_lock held */
+	__atomic_store_n(&dev->fd, -1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close, the fd maybe returned by an open() in
 	   another thread and we don't want to intercept calls to this new fd. */
-	devices[index].fd = -1;
+	pthread_mutex_lock(&v4l2_open_mutex);
+	if (fd < V4L2_FD_TABLE_CHUNKS * V4L2_FD_TABLE_CHUNK_SIZE)
+		__atomic_store_n(&v4l2_fd_table[fd / V4L2_FD_TABLE_CHUNK_SIZE]
+					[fd % V4L2_FD_TABLE_CHUNK_SIZE], NULL,
+				 __ATOMIC_RELEASE);
+	dev->in_use = 0;
+	pthread_mutex_unlock(&v4l2_open_mutex);
 
 	/* Since we've marked the fd as no longer used, and freed the resources,
 	   redo the close in case it was interrupted */
@@ -872,45 +1381,50 @@ int v4l2_close(int fd)
 
 int v4l2_dup(int fd)
 {
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1)
+	if (!dev)
 		return syscall(SYS_dup, fd);
 
-	devices[index].open_count++;
+	dev->open_count++;
 
 	return fd;
 }
 
-static int v4l2_check_buffer_change_ok(int index)
+static int v4l2_check_buffer_change_ok(struct v4l2_dev_info *dev)
 {
-	devices[index].frame_info_generation++;
-	v4l2_unmap_buffers(index);
-
-	/* Check if the app itself still is using the stream */
-	if (v4l2_buffers_mapped(index) ||
-			(!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			 ((devices[index].flags & V4L2_STREAMON) ||
-			  devices[index].frame_queued))) {
-		V4L2_LOG("v4l2_check_buffer_change_ok(): stream busy\n");
-		errno = EBUSY;
-		return -1;
-	}
+	/* Check if the app itself still is streaming, before unmapping the
+	   buffers a running stream (and the conversion thread) uses */
+	if (!(dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			((dev->flags & V4L2_STREAMON) || dev->frame_queued))
+		goto busy;
+
+	/* Our own mappings would make the buffers look mapped by the app */
+	dev->frame_info_generation++;
+	v4l2_unmap_buffers(dev);
+
+	if (v4l2_buffers_mapped(dev))
+		goto busy;
 
 	/* We may change from convert to non conversion mode and
 	   v4l2_unrequest_read_buffers may change the no_frames, so free the
 	   convert mmap buffer */
-	SYS_MUNMAP(devices[index].convert_mmap_buf,
-			devices[index].convert_mmap_buf_size);
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
+	v4l2_free_convert_mmap_buf(dev);
+	/* Whether the new settings allow zero-copy is decided by the next
+	   REQBUFS */
+	dev->flags &= ~V4L2_ZERO_COPY_ACTIVE;
 
-	if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+	if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 		V4L2_LOG("deactivating read-stream for settings change\n");
-		return v4l2_deactivate_read_stream(index);
+		return v4l2_deactivate_read_stream(dev);
 	}
 
 	return 0;
+
+busy:
+	V4L2_LOG("v4l2_check_buffer_change_ok(): stream busy\n");
+	errno = EBUSY;
+	return -1;
 }
 
 static int v4l2_pix_fmt_compat(struct v4l2_format *a, struct v4l2_format *b)
@@ -934,7 +1448,7 @@ static int v4l2_pix_fmt_identical(struct v4l2_format *a, struct v4l2_format *b)
 	return 0;
 }
 
-static void v4l2_set_src_and_dest_format(int index,
+static void v4l2_set_src_and_dest_format(struct v4l2_dev_info *dev,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt)
 {
 	/*
@@ -965,15 +1479,15 @@ static void v4l2_set_src_and_dest_format(int index,
 	} else
 		v4lconvert_fixup_fmt(dest_fmt);
 
-	devices[index].src_fmt = *src_fmt;
-	devices[index].dest_fmt = *dest_fmt;
+	dev->src_fmt = *src_fmt;
+	dev->dest_fmt = *dest_fmt;
 	/* round up to full page size */
-	devices[index].convert_mmap_frame_size =
-		(((dest_fmt->fmt.pix.sizeimage + devices[index].page_size - 1)
-		/ devices[index].page_size) * devices[index].page_size);
+	dev->convert_mmap_frame_size =
+		(((dest_fmt->fmt.pix.sizeimage + dev->page_size - 1)
+		/ dev->page_size) * dev->page_size);
 }
 
-static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
+static int v4l2_s_fmt(struct v4l2_dev_info *dev, struct v4l2_format *dest_fmt)
 {
 	struct v4l2_format src_fmt;
 	struct v4l2_pix_format req_pix_fmt;
@@ -989,7 +1503,7 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 				pixfmt >> 24);
 	}
 
-	result = v4lconvert_try_format(devices[index].convert,
+	result = v4lconvert_try_format(dev->convert,
 				       dest_fmt, &src_fmt);
 	if (result) {
 		int saved_err = errno;
@@ -1008,19 +1522,19 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 			(pixfmt >> 16) & 0xff, pixfmt >> 24);
 	}
 
-	result = v4l2_check_buffer_change_ok(index);
+	result = v4l2_check_buffer_change_ok(dev);
 	if (result)
 		return result;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-					       devices[index].fd,
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+					       dev->fd,
 					       VIDIOC_S_FMT, &src_fmt);
 	if (result) {
 		int saved_err = errno;
 		V4L2_PERROR("setting pixformat");
 		/* Report to the app dest_fmt has not changed */
-		*dest_fmt = devices[index].dest_fmt;
+		*dest_fmt = dev->dest_fmt;
 		errno = saved_err;
 		return result;
 	}
@@ -1035,17 +1549,17 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 		*dest_fmt = src_fmt;
 	}
 
-	v4l2_set_src_and_dest_format(index, &src_fmt, dest_fmt);
+	v4l2_set_src_and_dest_format(dev, &src_fmt, dest_fmt);
 
-	if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) {
+	if (dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) {
 		struct v4l2_streamparm parm = {
 			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
 		};
-		if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-						  devices[index].fd,
+		if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+						  dev->fd,
 						  VIDIOC_G_PARM, &parm))
 			return 0;
-		v4l2_update_fps(index, &parm);
+		v4l2_update_fps(dev, &parm);
 	}
 
 	return 0;
@@ -1055,15 +1569,16 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 {
 	void *arg;
 	va_list ap;
-	int result, index, saved_err;
+	struct v4l2_dev_info *dev;
+	int result, saved_err;
 	int is_capture_request = 0, stream_needs_locking = 0;
 
 	va_start(ap, request);
 	arg = va_arg(ap, void *);
 	va_end(ap);
 
-	index = v4l2_get_index(fd);
-	if (index == -1)
+	dev = v4l2_get_dev(fd);
+	if (!dev)
 		return SYS_IOCTL(fd, request, arg);
 
 	/* Apparently the kernel and / or glibc ignore the 32 most significant bits
@@ -1071,7 +1586,7 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	   ioctl, causing it to get sign extended, depending upon this behavior */
 	request = (unsigned int)request;
 
-	if (devices[index].convert == NULL)
+	if (dev->convert == NULL)
 		goto no_capture_request;
 
 	/* Is this a capture request and do we need to take the stream lock? */
@@ -1121,6 +1636,13 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 			stream_needs_locking = 1;
 		}
 		break;
+	case VIDIOC_EXPBUF:
+		if (((struct v4l2_exportbuffer *)arg)->type ==
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+			is_capture_request = 1;
+			stream_needs_locking = 1;
+		}
+		break;
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
 		if (*((enum v4l2_buf_type *)arg) ==
@@ -1133,7 +1655,7 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 		if (((struct v4l2_streamparm *)arg)->type ==
 				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
-			if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME)
+			if (dev->flags & V4L2_SUPPORTS_TIMEPERFRAME)
 				stream_needs_locking = 1;
 		}
 		break;
@@ -1147,8 +1669,8 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 
 	if (!is_capture_request) {
 no_capture_request:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		saved_err = errno;
 		v4l2_log_ioctl(request, arg, result);
@@ -1158,55 +1680,55 @@ no_capture_request:
 
 
 	if (stream_needs_locking) {
-		pthread_mutex_lock(&devices[index].stream_lock);
+		pthread_mutex_lock(&dev->stream_lock);
 		/* If this is the first stream-related ioctl, and we should only allow
 		   libv4lconvert supported destination formats (so that it can do flipping,
 		   processing, etc.) and the current destination format is not supported,
 		   try setting the format to RGB24 (which is a supported dest. format). */
-		if (!(devices[index].flags & V4L2_STREAM_TOUCHED) &&
-				v4lconvert_supported_dst_fmt_only(devices[index].convert) &&
+		if (!(dev->flags & V4L2_STREAM_TOUCHED) &&
+				v4lconvert_supported_dst_fmt_only(dev->convert) &&
 				!v4lconvert_supported_dst_format(
-					devices[index].dest_fmt.fmt.pix.pixelformat)) {
-			struct v4l2_format fmt = devices[index].dest_fmt;
+					dev->dest_fmt.fmt.pix.pixelformat)) {
+			struct v4l2_format fmt = dev->dest_fmt;
 
 			V4L2_LOG("Setting pixelformat to RGB24 (supported_dst_fmt_only)");
 			fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
-			v4l2_s_fmt(index, &fmt);
+			v4l2_s_fmt(dev, &fmt);
 			V4L2_LOG("Done setting pixelformat (supported_dst_fmt_only)");
 		}
-		devices[index].flags |= V4L2_STREAM_TOUCHED;
+		dev->flags |= V4L2_STREAM_TOUCHED;
 	}
 
 	switch (request) {
 	case VIDIOC_QUERYCTRL:
-		result = v4lconvert_vidioc_queryctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_queryctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_G_CTRL:
-		result = v4lconvert_vidioc_g_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_S_CTRL:
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_G_EXT_CTRLS:
-		result = v4lconvert_vidioc_g_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_TRY_EXT_CTRLS:
-		result = v4lconvert_vidioc_try_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_try_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_S_EXT_CTRLS:
-		result = v4lconvert_vidioc_s_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_QUERYCAP: {
 		struct v4l2_capability *cap = arg;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QUERYCAP, cap);
 		if (result == 0) {
 			/* We always support read() as we fake it using mmap mode */
@@ -1217,33 +1739,33 @@ no_capture_request:
 	}
 
 	case VIDIOC_ENUM_FMT:
-		result = v4lconvert_enum_fmt(devices[index].convert, arg);
+		result = v4lconvert_enum_fmt(dev->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMESIZES:
-		result = v4lconvert_enum_framesizes(devices[index].convert, arg);
+		result = v4lconvert_enum_framesizes(dev->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMEINTERVALS:
-		result = v4lconvert_enum_frameintervals(devices[index].convert, arg);
+		result = v4lconvert_enum_frameintervals(dev->convert, arg);
 		if (result)
 			V4L2_LOG("ENUM_FRAMEINTERVALS Error: %s",
-					v4lconvert_get_error_message(devices[index].convert));
+					v4lconvert_get_error_message(dev->convert));
 		break;
 
 	case VIDIOC_TRY_FMT:
-		result = v4lconvert_try_format(devices[index].convert,
+		result = v4lconvert_try_format(dev->convert,
 					       arg, NULL);
 		break;
 
 	case VIDIOC_S_FMT:
-		result = v4l2_s_fmt(index, arg);
+		result = v4l2_s_fmt(dev, arg);
 		break;
 
 	case VIDIOC_G_FMT: {
 		struct v4l2_format *fmt = arg;
 
-		*fmt = devices[index].dest_fmt;
+		*fmt = dev->dest_fmt;
 		result = 0;
 		break;
 	}
@@ -1253,18 +1775,18 @@ no_capture_request:
 	case VIDIOC_S_DV_TIMINGS: {
 		struct v4l2_format src_fmt = { 0 };
 		unsigned int orig_dest_pixelformat =
-			devices[index].dest_fmt.fmt.pix.pixelformat;
+			dev->dest_fmt.fmt.pix.pixelformat;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		if (result)
 			break;
 
 		/* These ioctls may have changed the device's fmt */
 		src_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_G_FMT, &src_fmt);
 		if (result) {
 			V4L2_PERROR("getting pixformat after %s",
@@ -1273,20 +1795,20 @@ no_capture_request:
 			break;
 		}
 
-		if (v4l2_pix_fmt_compat(&devices[index].src_fmt, &src_fmt)) {
-			v4l2_set_src_and_dest_format(index, &src_fmt,
-						     &devices[index].dest_fmt);
+		if (v4l2_pix_fmt_compat(&dev->src_fmt, &src_fmt)) {
+			v4l2_set_src_and_dest_format(dev, &src_fmt,
+						     &dev->dest_fmt);
 			break;
 		}
 
 		/* The fmt has been changed, remember the new format ... */
-		devices[index].src_fmt  = src_fmt;
-		devices[index].dest_fmt = src_fmt;
-		v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-					     &devices[index].dest_fmt);
+		dev->src_fmt  = src_fmt;
+		dev->dest_fmt = src_fmt;
+		v4l2_set_src_and_dest_format(dev, &dev->src_fmt,
+					     &dev->dest_fmt);
 		/* and try to restore the last set destination pixelformat. */
 		src_fmt.fmt.pix.pixelformat = orig_dest_pixelformat;
-		result = v4l2_s_fmt(index, &src_fmt);
+		result = v4l2_s_fmt(dev, &src_fmt);
 		if (result) {
 			V4L2_LOG_WARN("restoring destination pixelformat after %s failed\n",
 				      v4l2_ioctls[_IOC_NR(request)]);
@@ -1300,13 +1822,14 @@ no_capture_request:
 		struct v4l2_requestbuffers *req = arg;
 
 		/* IMPROVEME (maybe?) add support for userptr's? */
-		if (req->memory != V4L2_MEMORY_MMAP) {
+		if (req->memory != V4L2_MEMORY_MMAP &&
+		    req->memory != V4L2_MEMORY_DMABUF) {
 			errno = EINVAL;
 			result = -1;
 			break;
 		}
 
-		result = v4l2_check_buffer_change_ok(index);
+		result = v4l2_check_buffer_change_ok(dev);
 		if (result)
 			break;
 
@@ -1314,76 +1837,118 @@ no_capture_request:
 		if (req->count > V4L2_MAX_NO_FRAMES)
 			req->count = V4L2_MAX_NO_FRAMES;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_REQBUFS, req);
 		if (result < 0)
 			break;
 		result = 0; /* some drivers return the number of buffers on success */
 
-		devices[index].no_frames = MIN(req->count, V4L2_MAX_NO_FRAMES);
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+		dev->no_frames = MIN(req->count, V4L2_MAX_NO_FRAMES);
+		dev->memory = req->memory;
+		dev->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+
+		/* When the frames need no conversion with the current settings,
+		   let the app use the driver's buffers directly until the next
+		   REQBUFS */
+		dev->flags &= ~V4L2_ZERO_COPY_ACTIVE;
+		if ((dev->flags & V4L2_ENABLE_ZERO_COPY) &&
+				dev->no_frames &&
+				!v4lconvert_frame_needs_conversion(
+					dev->convert,
+					&dev->src_fmt,
+					&dev->dest_fmt)) {
+			V4L2_LOG("zero-copy: using the driver's buffers\n");
+			dev->flags |= V4L2_ZERO_COPY_ACTIVE;
+		}
 		break;
 	}
 
 	case VIDIOC_QUERYBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
 		/* Do a real query even when converting to let the driver fill in
 		   things like buf->field */
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QUERYBUF, buf);
 
-		v4l2_set_conversion_buf_params(index, buf);
+		/* When converting dmabufs of the app receive the frames of the
+		   cam, tell it how large they need to be */
+		if (result == 0 && buf->memory == V4L2_MEMORY_DMABUF &&
+		    v4l2_needs_conversion(dev) &&
+		    buf->length < dev->src_fmt.fmt.pix.sizeimage)
+			buf->length = dev->src_fmt.fmt.pix.sizeimage;
+
+		v4l2_set_conversion_buf_params(dev, buf);
 		break;
 	}
 
+	case VIDIOC_EXPBUF:
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
+			if (result)
+				break;
+		}
+
+		/* Export the converted frames rather than the cam's */
+		if (v4l2_needs_conversion(dev))
+			result = v4l2_export_convert_buf(dev, arg);
+		else
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					fd, VIDIOC_EXPBUF, arg);
+		break;
+
 	case VIDIOC_QBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
 		/* With some drivers the buffers must be mapped before queuing */
-		if (v4l2_needs_conversion(index)) {
-			result = v4l2_map_buffers(index);
+		if (v4l2_needs_conversion(dev)) {
+			result = v4l2_map_buffers(dev);
 			if (result)
 				break;
 		}
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QBUF, arg);
 
-		v4l2_set_conversion_buf_params(index, buf);
+		/* The thread may be waiting for a buffer to get queued */
+		if (!result && (dev->flags & V4L2_CONVERT_THREAD_RUNNING))
+			v4l2_convert_thread_wake(dev);
+
+		v4l2_set_conversion_buf_params(dev, buf);
 		break;
 	}
 
 	case VIDIOC_DQBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
-		if (!v4l2_needs_conversion(index)) {
-			pthread_mutex_unlock(&devices[index].stream_lock);
-			result = devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
+		if (!v4l2_needs_conversion(dev)) {
+			pthread_mutex_unlock(&dev->stream_lock);
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
 					fd, VIDIOC_DQBUF, buf);
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&dev->stream_lock);
 			if (result) {
 				saved_err = errno;
 				V4L2_PERROR("dequeuing buf");
@@ -1395,33 +1960,41 @@ no_capture_request:
 		/* An application can do a DQBUF before mmap-ing in the buffer,
 		   but we need the buffer _now_ to write our converted data
 		   to it! */
-		result = v4l2_ensure_convert_mmap_buf(index);
+		if (dev->flags & V4L2_CONVERT_THREAD_RUNNING) {
+			result = v4l2_dequeue_converted(dev, buf);
+			v4l2_set_conversion_buf_params(dev, buf);
+			break;
+		}
+
+		result = v4l2_ensure_convert_mmap_buf(dev);
 		if (result)
 			break;
 
-		result = v4l2_dequeue_and_convert(index, buf, 0,
-				devices[index].convert_mmap_frame_size);
+		result = v4l2_dequeue_and_convert(dev, buf, 0,
+				dev->convert_mmap_frame_size, 0);
 		if (result >= 0) {
 			buf->bytesused = result;
 			result = 0;
 		}
 
-		v4l2_set_conversion_buf_params(index, buf);
+		v4l2_set_conversion_buf_params(dev, buf);
 		break;
 	}
 
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
-			result = v4l2_deactivate_read_stream(index);
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(dev);
 			if (result)
 				break;
 		}
 
-		if (request == VIDIOC_STREAMON)
-			result = v4l2_streamon(index);
-		else
-			result = v4l2_streamoff(index);
+		if (request == VIDIOC_STREAMON) {
+			result = v4l2_streamon(dev);
+			if (result == 0)
+				v4l2_convert_thread_start(dev);
+		} else
+			result = v4l2_streamoff(dev);
 		break;
 
 	case VIDIOC_S_PARM: {
@@ -1429,33 +2002,33 @@ no_capture_request:
 
 		/* See if libv4lconvert wishes to use a different src_fmt
 		   for the new frame rate and set that first */
-		if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+		if ((dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 		    parm->parm.capture.timeperframe.numerator != 0) {
 			int fps = parm->parm.capture.timeperframe.denominator;
 			fps += parm->parm.capture.timeperframe.numerator - 1;
 			fps /= parm->parm.capture.timeperframe.numerator;
-			v4l2_adjust_src_fmt_to_fps(index, fps);
+			v4l2_adjust_src_fmt_to_fps(dev, fps);
 		}
 
-		result = devices[index].dev_ops->ioctl(
-						devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+						dev->dev_ops_priv,
 						fd, VIDIOC_S_PARM, parm);
 		if (result)
 			break;
 
-		v4l2_update_fps(index, parm);
+		v4l2_update_fps(dev, parm);
 		break;
 	}
 
 	default:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		break;
 	}
 
 	if (stream_needs_locking)
-		pthread_mutex_unlock(&devices[index].stream_lock);
+		pthread_mutex_unlock(&dev->stream_lock);
 
 	saved_err = errno;
 	v4l2_log_ioctl(request, arg, result);
@@ -1464,24 +2037,24 @@ no_capture_request:
 	return result;
 }
 
-static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
+static void v4l2_adjust_src_fmt_to_fps(struct v4l2_dev_info *dev, int fps)
 {
 	struct v4l2_pix_format req_pix_fmt;
 	struct v4l2_format src_fmt;
-	struct v4l2_format dest_fmt = devices[index].dest_fmt;
-	struct v4l2_format orig_src_fmt = devices[index].src_fmt;
-	struct v4l2_format orig_dest_fmt = devices[index].dest_fmt;
+	struct v4l2_format dest_fmt = dev->dest_fmt;
+	struct v4l2_format orig_src_fmt = dev->src_fmt;
+	struct v4l2_format orig_dest_fmt = dev->dest_fmt;
 	int r;
 
-	if (fps == devices[index].fps)
+	if (fps == dev->fps)
 		return;
 
-	if (v4l2_check_buffer_change_ok(index))
+	if (v4l2_check_buffer_change_ok(dev))
 		return;
 
-	v4lconvert_set_fps(devices[index].convert, fps);
-	r = v4lconvert_try_format(devices[index].convert, &dest_fmt, &src_fmt);
-	v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
+	v4lconvert_set_fps(dev->convert, fps);
+	r = v4lconvert_try_format(dev->convert, &dest_fmt, &src_fmt);
+	v4lconvert_set_fps(dev->convert, V4L2_DEFAULT_FPS);
 	if (r)
 		return;
 
@@ -1490,11 +2063,11 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 		return;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt))
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_S_FMT, &src_fmt))
 		return;
 
-	v4l2_set_src_and_dest_format(index, &src_fmt, &dest_fmt);
+	v4l2_set_src_and_dest_format(dev, &src_fmt, &dest_fmt);
 
 	/* Check we've gotten what try_fmt promised us and that the
 	   new dest fmt matches the original, if this is true we're done. */
@@ -1518,12 +2091,12 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 	src_fmt = orig_src_fmt;
 	dest_fmt = orig_dest_fmt;
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt)) {
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_S_FMT, &src_fmt)) {
 		V4L2_PERROR("restoring src fmt");
 		return;
 	}
-	v4l2_set_src_and_dest_format(index, &src_fmt, &dest_fmt);
+	v4l2_set_src_and_dest_format(dev, &src_fmt, &dest_fmt);
 	if (src_fmt.fmt.pix.width != req_pix_fmt.width ||
 	    src_fmt.fmt.pix.height != req_pix_fmt.height ||
 	    src_fmt.fmt.pix.pixelformat != req_pix_fmt.pixelformat ||
@@ -1535,25 +2108,25 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 {
 	ssize_t result;
 	int saved_errno;
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1)
+	if (!dev)
 		return SYS_READ(fd, dest, n);
 
-	if (!devices[index].dev_ops->read) {
+	if (!dev->dev_ops->read) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 
 	/* When not converting and the device supports read(), let the kernel handle
 	   it */
-	if (devices[index].convert == NULL ||
-	    ((devices[index].flags & V4L2_SUPPORTS_READ) &&
-			!v4l2_needs_conversion(index))) {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
+	if (dev->convert == NULL ||
+	    ((dev->flags & V4L2_SUPPORTS_READ) &&
+			!v4l2_needs_conversion(dev))) {
+		result = dev->dev_ops->read(
+				dev->dev_ops_priv,
 				fd, dest, n);
 		goto leave;
 	}
@@ -1566,33 +2139,33 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 	   select or poll() is done before any buffers are requested. So using mmap
 	   mode under the hood will fail if a select() or poll() is done before the
 	   first emulated read() call. */
-	if (!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			!(devices[index].flags & V4L2_USE_READ_FOR_READ)) {
-		result = v4l2_activate_read_stream(index);
+	if (!(dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			!(dev->flags & V4L2_USE_READ_FOR_READ)) {
+		result = v4l2_activate_read_stream(dev);
 		if (result) {
 			/* Activating mmap mode failed, use read() instead */
-			devices[index].flags |= V4L2_USE_READ_FOR_READ;
+			dev->flags |= V4L2_USE_READ_FOR_READ;
 			/* The read call done by v4l2_read_and_convert will start the stream */
-			devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+			dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 		}
 	}
 
-	if (devices[index].flags & V4L2_USE_READ_FOR_READ) {
-		result = v4l2_read_and_convert(index, dest, n);
+	if (dev->flags & V4L2_USE_READ_FOR_READ) {
+		result = v4l2_read_and_convert(dev, dest, n);
 	} else {
 		struct v4l2_buffer buf;
 
 		buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.memory = V4L2_MEMORY_MMAP;
-		result = v4l2_dequeue_and_convert(index, &buf, dest, n);
+		result = v4l2_dequeue_and_convert(dev, &buf, dest, n, 0);
 
 		if (result >= 0)
-			v4l2_queue_read_buffer(index, buf.index);
+			v4l2_queue_read_buffer(dev, buf.index);
 	}
 
 leave:
 	saved_errno = errno;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 	errno = saved_errno;
 
 	return result;
@@ -1600,34 +2173,34 @@ leave:
 
 ssize_t v4l2_write(int fd, const void *buffer, size_t n)
 {
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1)
+	if (!dev)
 		return SYS_WRITE(fd, buffer, n);
 
-	if (!devices[index].dev_ops->write) {
+	if (!dev->dev_ops->write) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return devices[index].dev_ops->write(
-			devices[index].dev_ops_priv, fd, buffer, n);
+	return dev->dev_ops->write(
+			dev->dev_ops_priv, fd, buffer, n);
 }
 
 void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		int64_t offset)
 {
-	int index;
+	struct v4l2_dev_info *dev;
 	unsigned int buffer_index;
 	void *result;
 
-	index = v4l2_get_index(fd);
-	if (index == -1 ||
+	dev = v4l2_get_dev(fd);
+	if (!dev ||
 			/* Check if the mmap data matches our answer to QUERY_BUF. If it doesn't,
 			   let the kernel handle it (to allow for mmap-based non capture use) */
-			start || length != devices[index].convert_mmap_frame_size ||
+			start || length != dev->convert_mmap_frame_size ||
 			((unsigned int)offset & ~0xFFu) != V4L2_MMAP_OFFSET_MAGIC) {
-		if (index != -1)
+		if (dev)
 			V4L2_LOG("Passing mmap(%p, %d, ..., %x, through to the driver\n",
 					start, (int)length, (int)offset);
 
@@ -1639,72 +2212,73 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		return (void *)SYS_MMAP(start, length, prot, flags, fd, offset);
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 
 	buffer_index = offset & 0xff;
-	if (buffer_index >= devices[index].no_frames ||
+	if (buffer_index >= dev->no_frames ||
 			/* Got magic offset and not converting ?? */
-			!v4l2_needs_conversion(index)) {
+			!v4l2_needs_conversion(dev)) {
 		errno = EINVAL;
 		result = MAP_FAILED;
 		goto leave;
 	}
 
-	if (v4l2_ensure_convert_mmap_buf(index)) {
+	if (v4l2_ensure_convert_mmap_buf(dev)) {
 		errno = EINVAL;
 		result = MAP_FAILED;
 		goto leave;
 	}
 
-	devices[index].frame_map_count[buffer_index]++;
+	dev->frame_map_count[buffer_index]++;
 
-	result = devices[index].convert_mmap_buf +
-		buffer_index * devices[index].convert_mmap_frame_size;
+	result = dev->convert_mmap_buf +
+		buffer_index * dev->convert_mmap_frame_size;
 
 	V4L2_LOG("Fake (conversion) mmap buf %u, seen by app at: %p\n",
 			buffer_index, result);
 
 leave:
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	return result;
 }
 
 int v4l2_munmap(void *_start, size_t length)
 {
-	int index;
+	struct v4l2_dev_info *dev;
 	unsigned int buffer_index;
 	unsigned char *start = _start;
 
 	/* Is this memory ours? */
 	if (start != MAP_FAILED) {
-		for (index = 0; index < devices_used; index++)
-			if (devices[index].fd != -1 &&
-					devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0)
+		for (dev = __atomic_load_n(&devices, __ATOMIC_ACQUIRE); dev;
+		     dev = dev->next)
+			if (dev->fd != -1 &&
+					dev->convert_mmap_buf != MAP_FAILED &&
+					length == dev->convert_mmap_frame_size &&
+					start >= dev->convert_mmap_buf &&
+					(start - dev->convert_mmap_buf) % length == 0)
 				break;
 
-		if (index != devices_used) {
+		if (dev) {
 			int unmapped = 0;
 
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&dev->stream_lock);
 
-			buffer_index = (start - devices[index].convert_mmap_buf) / length;
+			buffer_index = (start - dev->convert_mmap_buf) / length;
 
 			/* Re-do our checks now that we have the lock, things may have changed */
-			if (devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0 &&
-					buffer_index < devices[index].no_frames) {
-				if (devices[index].frame_map_count[buffer_index] > 0)
-					devices[index].frame_map_count[buffer_index]--;
+			if (dev->convert_mmap_buf != MAP_FAILED &&
+					length == dev->convert_mmap_frame_size &&
+					start >= dev->convert_mmap_buf &&
+					(start - dev->convert_mmap_buf) % length == 0 &&
+					buffer_index < dev->no_frames) {
+				if (dev->frame_map_count[buffer_index] > 0)
+					dev->frame_map_count[buffer_index]--;
 				unmapped = 1;
 			}
 
-			pthread_mutex_unlock(&devices[index].stream_lock);
+			pthread_mutex_unlock(&dev->stream_lock);
 
 			if (unmapped) {
 				V4L2_LOG("v4l2 fake buffer munmap %p, %d\n", start, (int)length);
@@ -1723,16 +2297,17 @@ int v4l2_set_control(int fd, int cid, int value)
 {
 	struct v4l2_queryctrl qctrl = { .id = cid };
 	struct v4l2_control ctrl = { .id = cid };
-	int index, result;
+	struct v4l2_dev_info *dev;
+	int result;
 
-	index = v4l2_get_index(fd);
-	if (index == -1 || devices[index].convert == NULL) {
+	dev = v4l2_get_dev(fd);
+	if (!dev || dev->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	result = v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl);
+	result = v4lconvert_vidioc_queryctrl(dev->convert, &qctrl);
 	if (result)
 		return result;
 
@@ -1744,7 +2319,7 @@ int v4l2_set_control(int fd, int cid, int value)
 			ctrl.value = ((long long) value * (qctrl.maximum - qctrl.minimum) + 32767) / 65535 +
 				qctrl.minimum;
 
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, &ctrl);
+		result = v4lconvert_vidioc_s_ctrl(dev->convert, &ctrl);
 	}
 
 	return result;
@@ -1754,15 +2329,15 @@ int v4l2_get_control(int fd, int cid)
 {
 	struct v4l2_queryctrl qctrl = { .id = cid };
 	struct v4l2_control ctrl = { .id = cid };
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = v4l2_get_dev(fd);
 
-	if (index == -1 || devices[index].convert == NULL) {
+	if (!dev || dev->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	if (v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl))
+	if (v4lconvert_vidioc_queryctrl(dev->convert, &qctrl))
 		return -1;
 
 	if (qctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
@@ -1770,7 +2345,7 @@ int v4l2_get_control(int fd, int cid)
 		return -1;
 	}
 
-	if (v4lconvert_vidioc_g_ctrl(devices[index].convert, &ctrl))
+	if (v4lconvert_vidioc_g_ctrl(dev->convert, &ctrl))
 		return -1;
 
 	return (((long long) ctrl.value - qctrl.minimum) * 65535 +
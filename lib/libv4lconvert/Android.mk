@@ -4,12 +4,14 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     bayer.c \
+    cost.c \
     cpia1.c \
     crop.c \
     flip.c \
     helper.c \
     nv12_16l16.c \
-    jidctflt.c \
+    jidctint.c \
+    jidctred.c \
     jl2005bcd.c \
     jpeg.c \
     jpeg_memsrcdest.c \
@@ -19,6 +21,9 @@ LOCAL_SRC_FILES := \
     pac207.c \
     rgbyuv.c \
     se401.c \
+    simd.c \
+    simd-neon.c \
+    simd-x86.c \
     sn9c10x.c \
     sn9c2028-decomp.c \
     sn9c20x.c \
@@ -26,6 +31,7 @@ LOCAL_SRC_FILES := \
     spca561-decompress.c \
     sq905c.c \
     stv0680.c \
+    threads.c \
     tinyjpeg.c \
     control/libv4lcontrol.c \
     processing/autogain.c  \
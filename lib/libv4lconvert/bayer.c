@@ -29,6 +29,7 @@
  * see bayer.c from libdc1394 for all supported algorithms
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
@@ -74,6 +75,9 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 		bayer++;
 		adjacent_bayer++;
 		width -= 2;
+		/* Both pixels of a 2 pixel wide line are done */
+		if (!width)
+			return;
 	} else {
 		/* First pixel */
 		t0 = (bayer[1] + adjacent_bayer[0] + 1) >> 1;
@@ -162,22 +166,132 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 	}
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
+/* The interior of a line is demosaiced 2 pixels at a time, of which the first
+   is not green and the second is green. bayer points to the pixel above and
+   left of the first pixel, the pixels are interpolated from the 3 lines
+   starting at bayer. With blue_line the first pixel is blue and the bgr
+   components are written in bgr order, otherwise it is red and the
+   components are written in rgb order. This is the reference for the
+   bayer_pairs_to_bgr24 kernels in simd-*.c. */
+void v4lconvert_bayer_pairs_to_bgr24(const unsigned char *bayer, int stride,
+		unsigned char *bgr, int pairs, int blue_line)
+{
+	int t0, t1;
+
+	for (; pairs > 0; pairs--) {
+		t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+			bayer[stride * 2 + 2] + 2) >> 2;
+		t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
+			bayer[stride * 2 + 1] + 2) >> 2;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+
+		t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+		t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t1;
+		} else {
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
+		bayer += 2;
+	}
+}
+
+/* Edge-aware version of v4lconvert_bayer_pairs_to_bgr24(). The green of
+   the red and blue pixels is interpolated along the direction in which the
+   green changes the least, instead of averaging all 4 neighbors, which
+   avoids the zipper artifacts bilinear interpolation gives on edges. */
+void v4lconvert_bayer_pairs_to_bgr24_edge(const unsigned char *bayer,
+		int stride, unsigned char *bgr, int pairs, int blue_line)
+{
+	int t0, t1, dh, dv;
+
+	for (; pairs > 0; pairs--) {
+		t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+			bayer[stride * 2 + 2] + 2) >> 2;
+		dh = abs(bayer[stride] - bayer[stride + 2]);
+		dv = abs(bayer[1] - bayer[stride * 2 + 1]);
+		if (dh < dv)
+			t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
+		else if (dv < dh)
+			t1 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
+		else
+			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
+				bayer[stride * 2 + 1] + 2) >> 2;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+
+		t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+		t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t1;
+		} else {
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
+		bayer += 2;
+	}
+}
+
+/* From libdc1394, which on turn was based on OpenCV's Bayer decoding.
+   Renders output lines first - last, so that a frame can be split into bands
+   which are converted in parallel. bayer points to line first - 1 of the
+   frame (line 0 when first is 0), as only the lines around the rendered ones
+   are read. bgr points to where line first must be written, lines of bgr are
+   dest_stride bytes apart. start_with_green and blue_line are for the first
+   line of the frame. The interior of the lines is demosaiced by pairs. */
 static void bayer_to_rgbbgr24(const unsigned char *bayer,
 		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
-		int start_with_green, int blue_line)
+		int dest_stride, int start_with_green, int blue_line, int first, int last,
+		v4lconvert_bayer_pairs_fn pairs)
 {
+	int line = first;
+
 	/* render the first line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
-			start_with_green, blue_line);
-	bgr += width * 3;
+	if (line == 0) {
+		v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
+				start_with_green, blue_line);
+		bgr += dest_stride;
+		line++;
+	}
 
-	/* reduce height by 2 because of the special case top/bottom line */
-	for (height -= 2; height; height--) {
-		int t0, t1;
+	/* line n is interpolated from lines n - 1, n and n + 1, the line
+	   parity flags are those of line n - 1 */
+	if (!((line - 1) & 1)) {
+		start_with_green = !start_with_green;
+		blue_line = !blue_line;
+	}
+
+	/* the last line is a special case too */
+	for (; line < last && line < height - 1; line++) {
+		int t0, t1, n;
 		/* (width - 2) because of the border */
 		const unsigned char *bayer_end = bayer + (width - 2);
 
+		blue_line = !blue_line;
+		start_with_green = !start_with_green;
+
 		if (start_with_green) {
 
 			t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
@@ -219,39 +333,10 @@ static void bayer_to_rgbbgr24(const unsigned char *bayer,
 			}
 		}
 
-		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t1;
-			}
-		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
-		}
+		n = bayer_end - bayer > 0 ? (bayer_end - bayer) / 2 : 0;
+		pairs(bayer, stride, bgr, n, blue_line);
+		bayer += 2 * n;
+		bgr += 6 * n;
 
 		if (bayer < bayer_end) {
 			/* write second to last pixel */
@@ -300,34 +385,64 @@ static void bayer_to_rgbbgr24(const unsigned char *bayer,
 
 		/* skip 2 border pixels and padding */
 		bayer += (stride - width) + 2;
-
-		blue_line = !blue_line;
-		start_with_green = !start_with_green;
+		bgr += dest_stride - width * 3;
 	}
 
 	/* render the last line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
-			!start_with_green, !blue_line);
+	if (last == height)
+		v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
+				start_with_green, blue_line);
+}
+
+/* Like bayer_to_rgbbgr24(), with the line flags of the 8 bit bayer pixfmt */
+static void bayer8_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, int rgb,
+		v4lconvert_bayer_pairs_fn pairs)
+{
+	int start_with_green = pixfmt == V4L2_PIX_FMT_SGBRG8 ||
+			       pixfmt == V4L2_PIX_FMT_SGRBG8;
+	int blue_line = pixfmt == V4L2_PIX_FMT_SBGGR8 ||
+			pixfmt == V4L2_PIX_FMT_SGBRG8;
+
+	/* For rgb24 the colors get written in the reverse order */
+	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt, dest_stride,
+			start_with_green, rgb ? !blue_line : blue_line,
+			first, last, pairs);
+}
+
+void v4lconvert_bayer_to_rgb24_lines(const unsigned char *bayer,
+		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, v4lconvert_bayer_pairs_fn pairs)
+{
+	bayer8_to_rgbbgr24(bayer + (first ? first - 1 : 0) * stride, bgr, width,
+			height, stride, pixfmt, dest_stride, first, last, 1, pairs);
+}
+
+void v4lconvert_bayer_to_bgr24_lines(const unsigned char *bayer,
+		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, v4lconvert_bayer_pairs_fn pairs)
+{
+	bayer8_to_rgbbgr24(bayer + (first ? first - 1 : 0) * stride, bgr, width,
+			height, stride, pixfmt, dest_stride, first, last, 0, pairs);
 }
 
 void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt != V4L2_PIX_FMT_SBGGR8		/* blue line */
-			&& pixfmt != V4L2_PIX_FMT_SGBRG8);
+	v4lconvert_bayer_to_rgb24_lines(bayer, bgr, width, height, stride,
+			pixfmt, dest_stride, 0, height,
+			v4lconvert_bayer_pairs_to_bgr24);
 }
 
 void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt == V4L2_PIX_FMT_SBGGR8		/* blue line */
-			|| pixfmt == V4L2_PIX_FMT_SGBRG8);
+	v4lconvert_bayer_to_bgr24_lines(bayer, bgr, width, height, stride,
+			pixfmt, dest_stride, 0, height,
+			v4lconvert_bayer_pairs_to_bgr24);
 }
 
 static void v4lconvert_border_bayer_line_to_y(
@@ -355,6 +470,9 @@ static void v4lconvert_border_bayer_line_to_y(
 		bayer++;
 		adjacent_bayer++;
 		width -= 2;
+		/* Both pixels of a 2 pixel wide line are done */
+		if (!width)
+			return;
 	} else {
 		/* First pixel */
 		t0 = bayer[1] + adjacent_bayer[0];
@@ -429,25 +547,30 @@ static void v4lconvert_border_bayer_line_to_y(
 	}
 }
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+/* Renders lines first - last (which must be even) of a frame, so that it can
+   be split into bands which are converted in parallel. bayer points to the
+   start of the frame and the yuv planes to the start of the dest frame. */
+void v4lconvert_bayer_to_yuv420_lines(const unsigned char *bayer,
+		const struct v4lconvert_planes *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu,
+		int first, int last)
 {
-	int blue_line = 0, start_with_green = 0, x, y;
-	unsigned char *ydst = yuv;
-	unsigned char *udst, *vdst;
+	int blue_line = 0, start_with_green = 0, x, y, line;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	int uskip = yuv->stride[uplane] - width / 2;
+	int vskip = yuv->stride[vplane] - width / 2;
+	const unsigned char *frame = bayer;
+	unsigned char *ydst;
+	unsigned char *udst = yuv->plane[uplane] + first / 2 * yuv->stride[uplane];
+	unsigned char *vdst = yuv->plane[vplane] + first / 2 * yuv->stride[vplane];
 
-	if (yvu) {
-		vdst = yuv + width * height;
-		udst = vdst + width * height / 4;
-	} else {
-		udst = yuv + width * height;
-		vdst = udst + width * height / 4;
-	}
+	bayer += first * stride;
 
-	/* First calculate the u and v planes 2x2 pixels at a time */
+	/* First calculate the u and v planes 2x2 pixels at a time, the last
+	   line of an odd height has no chroma line of its own */
 	switch (src_pixfmt) {
 	case V4L2_PIX_FMT_SBGGR8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last && y + 1 < height; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -459,12 +582,14 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
 			bayer += 2 * stride;
+			udst += uskip;
+			vdst += vskip;
 		}
 		blue_line = 1;
 		break;
 
 	case V4L2_PIX_FMT_SRGGB8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last && y + 1 < height; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -476,11 +601,13 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
 			bayer += 2 * stride;
+			udst += uskip;
+			vdst += vskip;
 		}
 		break;
 
 	case V4L2_PIX_FMT_SGBRG8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last && y + 1 < height; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -492,13 +619,15 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
 			bayer += 2 * stride;
+			udst += uskip;
+			vdst += vskip;
 		}
 		blue_line = 1;
 		start_with_green = 1;
 		break;
 
 	case V4L2_PIX_FMT_SGRBG8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last && y + 1 < height; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
@@ -510,21 +639,34 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
 			bayer += 2 * stride;
+			udst += uskip;
+			vdst += vskip;
 		}
 		start_with_green = 1;
 		break;
 	}
 
-	/* Point bayer back to start of frame */
-	bayer -= stride * height;
+	line = first;
+	ydst = yuv->plane[0] + line * yuv->stride[0];
 
 	/* render the first line */
-	v4lconvert_border_bayer_line_to_y(bayer, bayer + stride, ydst, width,
-			start_with_green, blue_line);
-	ydst += width;
+	if (line == 0) {
+		v4lconvert_border_bayer_line_to_y(frame, frame + stride, ydst,
+				width, start_with_green, blue_line);
+		ydst += yuv->stride[0];
+		line++;
+	}
 
-	/* reduce height by 2 because of the border */
-	for (height -= 2; height; height--) {
+	/* line n is interpolated from lines n - 1, n and n + 1, the line
+	   parity flags are those of line n - 1 */
+	bayer = frame + (line - 1) * stride;
+	if ((line - 1) & 1) {
+		start_with_green = !start_with_green;
+		blue_line = !blue_line;
+	}
+
+	/* the last line is a special case too */
+	for (; line < last && line < height - 1; line++) {
 		int t0, t1;
 		/* (width - 2) because of the border */
 		const unsigned char *bayer_end = bayer + (width - 2);
@@ -622,52 +764,310 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 
 		/* skip 2 border pixels and padding */
 		bayer += (stride - width) + 2;
+		ydst += yuv->stride[0] - width;
 
 		blue_line = !blue_line;
 		start_with_green = !start_with_green;
 	}
 
 	/* render the last line */
-	v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst, width,
-			!start_with_green, !blue_line);
+	if (last == height)
+		v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst,
+				width, !start_with_green, !blue_line);
 }
 
-void v4lconvert_bayer10_to_bayer8(void *bayer10,
-		unsigned char *bayer8, int width, int height)
+/* Returns the 8 bit bayer format with the same color pattern as the raw
+   bayer format pixfmt, or 0 if pixfmt is not a raw bayer format */
+unsigned int v4lconvert_bayer8_pixfmt(unsigned int pixfmt)
+{
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SBGGR16:
+		return V4L2_PIX_FMT_SBGGR8;
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGBRG16:
+		return V4L2_PIX_FMT_SGBRG8;
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SGRBG16:
+		return V4L2_PIX_FMT_SGRBG8;
+	case V4L2_PIX_FMT_SRGGB8:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SRGGB12P:
+	case V4L2_PIX_FMT_SRGGB16:
+		return V4L2_PIX_FMT_SRGGB8;
+	}
+	return 0;
+}
+
+/* Returns the bits per pixel of the lines of the raw bayer format pixfmt, the
+   10 bit non packed formats use 16 bits per pixel */
+int v4lconvert_bayer_bpp(unsigned int pixfmt)
+{
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		return 10;
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
+		return 12;
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16:
+		return 16;
+	}
+	return 8;
+}
+
+static int bayer_is_10bit(unsigned int pixfmt)
+{
+	return pixfmt == V4L2_PIX_FMT_SBGGR10 || pixfmt == V4L2_PIX_FMT_SGBRG10 ||
+	       pixfmt == V4L2_PIX_FMT_SGRBG10 || pixfmt == V4L2_PIX_FMT_SRGGB10;
+}
+
+/* The 10 bit formats store their samples in the low bits of 16 bit little
+   endian words. The packed MIPI formats store the 8 msb-s of 4 (10P) or 2
+   (12P) samples in a byte each, followed by a byte with their lsb-s. */
+static void bayer_unpack_line8(const unsigned char *src, unsigned char *dst,
+		int width, unsigned int pixfmt)
 {
 	int i;
-	uint16_t *src = bayer10;
 
-	for (i = 0; i < width * height; i++)
-		bayer8[i] = src[i] >> 2;
+	switch (v4lconvert_bayer_bpp(pixfmt)) {
+	case 10:
+		for (i = 0; i + 4 <= width; i += 4) {
+			dst[i] = src[0];
+			dst[i + 1] = src[1];
+			dst[i + 2] = src[2];
+			dst[i + 3] = src[3];
+			src += 5;
+		}
+		for (; i < width; i++)
+			dst[i] = src[i & 3];
+		break;
+	case 12:
+		for (i = 0; i + 2 <= width; i += 2) {
+			dst[i] = src[0];
+			dst[i + 1] = src[1];
+			src += 3;
+		}
+		if (i < width)
+			dst[i] = src[0];
+		break;
+	case 16:
+		if (bayer_is_10bit(pixfmt)) {
+			for (i = 0; i < width; i++)
+				dst[i] = (src[2 * i] >> 2) | (src[2 * i + 1] << 6);
+		} else {
+			for (i = 0; i < width; i++)
+				dst[i] = src[2 * i + 1];
+		}
+		break;
+	default:
+		memcpy(dst, src, width);
+	}
+}
+
+/* Like bayer_unpack_line8(), but the samples are scaled to the full 16 bit
+   range instead of being truncated to 8 bits */
+static void bayer_unpack_line16(const unsigned char *src, uint16_t *dst,
+		int width, unsigned int pixfmt)
+{
+	int i, v;
+
+	switch (v4lconvert_bayer_bpp(pixfmt)) {
+	case 10:
+		for (i = 0; i < width; i++) {
+			const unsigned char *group = src + (i >> 2) * 5;
+
+			v = (group[i & 3] << 2) | ((group[4] >> ((i & 3) * 2)) & 3);
+			dst[i] = (v << 6) | (v >> 4);
+		}
+		break;
+	case 12:
+		for (i = 0; i < width; i++) {
+			const unsigned char *group = src + (i >> 1) * 3;
+
+			v = (group[i & 1] << 4) | ((group[2] >> ((i & 1) * 4)) & 15);
+			dst[i] = (v << 4) | (v >> 8);
+		}
+		break;
+	case 16:
+		if (bayer_is_10bit(pixfmt)) {
+			for (i = 0; i < width; i++) {
+				v = (src[2 * i] | (src[2 * i + 1] << 8)) & 0x3ff;
+				dst[i] = (v << 6) | (v >> 4);
+			}
+		} else {
+			for (i = 0; i < width; i++)
+				dst[i] = src[2 * i] | (src[2 * i + 1] << 8);
+		}
+		break;
+	default:
+		for (i = 0; i < width; i++)
+			dst[i] = src[i] * 257;
+	}
+}
+
+/* Truncate a 10, 12 or 16 bit raw bayer frame to 8 bits, bayer8 gets lines
+   of width bytes without padding. This may be used in place (bayer8 pointing
+   to the src). */
+void v4lconvert_bayer_hi_to_bayer8(const unsigned char *bayer,
+		unsigned char *bayer8, int width, int height, int stride,
+		unsigned int pixfmt)
+{
+	while (--height >= 0) {
+		bayer_unpack_line8(bayer, bayer8, width, pixfmt);
+		bayer += stride;
+		bayer8 += width;
+	}
 }
 
-void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
-		unsigned char *bayer8, int width, int height)
+/* Bilinear demosaicing of line cur of a 16 bit bayer frame to rgb48, prev and
+   next are the lines above and below it (or the line on the other side at the
+   top / bottom border) */
+static void bayer16_line_to_rgb48(const uint16_t *prev, const uint16_t *cur,
+		const uint16_t *next, uint16_t *rgb, int width,
+		int start_with_green, int blue_line)
 {
-	unsigned long i;
-	unsigned long len = width * height;
-
-	for (i = 0; i < len ; i += 4) {
-		/*
-		 * Do not use a second loop, hoping that
-		 * a clever compiler with understand the
-		 * pattern and will optimize it.
-		 */
-		bayer8[0] = bayer10p[0];
-		bayer8[1] = bayer10p[1];
-		bayer8[2] = bayer10p[2];
-		bayer8[3] = bayer10p[3];
-		bayer10p += 5;
-		bayer8 += 4;
+	int x;
+
+	for (x = 0; x < width; x++) {
+		int l = x ? x - 1 : 1;
+		int r = x < width - 1 ? x + 1 : width - 2;
+		unsigned int line, other, g;
+
+		if (((x & 1) == 0) == !!start_with_green) {
+			/* green, with the color of this line left and right
+			   and the other color above and below */
+			g = cur[x];
+			line = (cur[l] + cur[r] + 1) >> 1;
+			other = (prev[x] + next[x] + 1) >> 1;
+		} else {
+			g = (cur[l] + cur[r] + prev[x] + next[x] + 2) >> 2;
+			line = cur[x];
+			other = (prev[l] + prev[r] + next[l] + next[r] + 2) >> 2;
+		}
+		rgb[0] = blue_line ? other : line;
+		rgb[1] = g;
+		rgb[2] = blue_line ? line : other;
+		rgb += 3;
 	}
 }
 
-void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
-		unsigned char *bayer8, int width, int height)
+/* Lines are unpacked in groups of this many, the unpacked lines (and the ones
+   above and below them) are reused for demosaicing while in the cache */
+#define BAYER_UNPACK_LINES 16
+
+/* Demosaic lines first - last of a raw bayer frame of any depth, unpacking the
+   lines as they are needed instead of first truncating the whole frame. The
+   result is 8 bit rgb24 / bgr24 or 16 bit rgb48 (out_bits 8 / 16). */
+static void bayer_raw_lines(const unsigned char *bayer, unsigned char *dest,
+		int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int dest_stride, int first, int last,
+		int out_bits, int rgb, v4lconvert_bayer_pairs_fn pairs)
 {
-	int i;
+	unsigned int pixfmt8 = v4lconvert_bayer8_pixfmt(pixfmt);
+	int sample = out_bits / 8, line_size = width * sample;
+	unsigned char *buf;
+	int line, n, i;
 
-	for (i = 0; i < width * height; i++)
-		bayer8[i] = bayer16[2*i+1];
+	buf = malloc((BAYER_UNPACK_LINES + 2) * line_size);
+	if (!buf) {
+		/* Nothing to report the error to from a (worker) thread */
+		for (line = first; line < last; line++)
+			memset(dest + (line - first) * dest_stride, 0,
+			       width * 3 * sample);
+		return;
+	}
+
+	for (line = first; line < last; line += n) {
+		int top = line ? line - 1 : 0;
+		int bottom;
+
+		n = last - line;
+		if (n > BAYER_UNPACK_LINES)
+			n = BAYER_UNPACK_LINES;
+		bottom = line + n + 1 < height ? line + n + 1 : height;
+
+		for (i = top; i < bottom; i++) {
+			if (out_bits == 16)
+				bayer_unpack_line16(bayer + i * stride,
+					(uint16_t *)(buf + (i - top) * line_size),
+					width, pixfmt);
+			else
+				bayer_unpack_line8(bayer + i * stride,
+					buf + (i - top) * line_size, width, pixfmt);
+		}
+
+		if (out_bits == 16) {
+			for (i = line; i < line + n; i++) {
+				const uint16_t *cur =
+					(uint16_t *)(buf + (i - top) * line_size);
+				/* The pattern flags of line 0 toggle every line */
+				int odd = i & 1;
+
+				bayer16_line_to_rgb48(i ? cur - width : cur + width,
+					cur, i < height - 1 ? cur + width : cur - width,
+					(uint16_t *)(dest + (i - first) * dest_stride),
+					width,
+					(pixfmt8 == V4L2_PIX_FMT_SGBRG8 ||
+					 pixfmt8 == V4L2_PIX_FMT_SGRBG8) != odd,
+					(pixfmt8 == V4L2_PIX_FMT_SBGGR8 ||
+					 pixfmt8 == V4L2_PIX_FMT_SGBRG8) != odd);
+			}
+		} else {
+			bayer8_to_rgbbgr24(buf,
+					dest + (line - first) * dest_stride,
+					width, height, line_size, pixfmt8,
+					dest_stride, line, line + n, rgb, pairs);
+		}
+	}
+
+	free(buf);
+}
+
+void v4lconvert_bayer_hi_to_rgb24_lines(const unsigned char *bayer,
+		unsigned char *rgb, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int dest_stride, int first, int last,
+		v4lconvert_bayer_pairs_fn pairs)
+{
+	bayer_raw_lines(bayer, rgb, width, height, stride, pixfmt, dest_stride,
+			first, last, 8, 1, pairs);
+}
+
+void v4lconvert_bayer_hi_to_bgr24_lines(const unsigned char *bayer,
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int dest_stride, int first, int last,
+		v4lconvert_bayer_pairs_fn pairs)
+{
+	bayer_raw_lines(bayer, bgr, width, height, stride, pixfmt, dest_stride,
+			first, last, 8, 0, pairs);
+}
+
+void v4lconvert_bayer_to_rgb48_lines(const unsigned char *bayer,
+		unsigned char *rgb48, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int dest_stride, int first, int last,
+		v4lconvert_bayer_pairs_fn pairs)
+{
+	bayer_raw_lines(bayer, rgb48, width, height, stride, pixfmt, dest_stride,
+			first, last, 16, 1, pairs);
 }
@@ -34,6 +34,9 @@ struct v4lcontrol_flags_info;
 struct v4lcontrol_data {
 	int fd;                   /* Device fd */
 	int bandwidth;            /* Connection bandwidth (0 = unknown) */
+	unsigned short vendor_id; /* USB ids, 0 when not an USB device */
+	unsigned short product_id;
+	unsigned short bcd_device;
 	int flags;                /* Flags for this device */
 	int priv_flags;           /* Internal use only flags */
 	int controls;             /* Which controls to use for this device */
@@ -48,6 +51,8 @@ struct v4lcontrol_flags_info {
 	unsigned short vendor_id;
 	unsigned short product_id;
 	unsigned short product_mask;
+	/* The dmi strings may be shell wildcard patterns [see glob(7)], NULL
+	   matches anything */
 	const char *dmi_board_vendor;
 	const char *dmi_board_name;
 	/* We could also use the USB manufacturer and product strings some devices have
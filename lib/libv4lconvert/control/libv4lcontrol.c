@@ -29,6 +29,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fnmatch.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -350,15 +351,26 @@ static void v4lcontrol_get_dmi_string(const char *sysfs_prefix, const char *stri
 	}
 
 	s = fgets(buf, size, f);
-	if (s)
-		s[strlen(s) - 1] = 0;
 	fclose(f);
+	if (!s) {
+		buf[0] = 0;
+		return;
+	}
+
+	/* Trim the value, some vendors pad their dmi strings with spaces */
+	while (isspace(*s))
+		s++;
+	size = strlen(s);
+	while (size > 0 && isspace(s[size - 1]))
+		size--;
+	memmove(buf, s, size);
+	buf[size] = 0;
 }
 
 static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 		const char *sysfs_prefix,
 		unsigned short *vendor_id, unsigned short *product_id,
-		int *speed)
+		unsigned short *bcd_device, int *speed)
 {
 	FILE *f;
 	int i, minor_dev;
@@ -402,8 +414,8 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 		s = fgets(buf, sizeof(buf), f);
 		fclose(f);
 
-		if (!s || sscanf(s, "usb:v%4hxp%4hx%c", vendor_id, product_id,
-				 &c) != 3 || c != 'd')
+		if (!s || sscanf(s, "usb:v%4hxp%4hxd%4hx%c", vendor_id,
+				 product_id, bcd_device, &c) != 4 || c != 'd')
 			return 0; /* Not an USB device */
 
 		snprintf(sysfs_name, sizeof(sysfs_name),
@@ -441,6 +453,18 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 		    c != '\n')
 			return 0; /* Should never happen */
 
+		/* Get device release number */
+		*bcd_device = 0;
+		snprintf(sysfs_name, sizeof(sysfs_name),
+			 "%s/sys/class/video4linux/video%d/device/bcdDevice", sysfs_prefix, i);
+		f = fopen(sysfs_name, "r");
+		if (f) {
+			s = fgets(buf, sizeof(buf), f);
+			fclose(f);
+			if (!s || sscanf(s, "%04hx", bcd_device) != 1)
+				*bcd_device = 0;
+		}
+
 		snprintf(sysfs_name, sizeof(sysfs_name),
 			 "%s/sys/class/video4linux/video%d/device/speed", sysfs_prefix, i);
 	}
@@ -459,39 +483,47 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 }
 
 /*
- * Tries to match value in NULL terminated table_entries string array
- * aganist the space trimmed dmi_value. The upside down table entries
- * might contain shell wildcard patterns [see glob(7)].
+ * Match a dmi string from the tables, which may be a shell wildcard pattern
+ * [see glob(7)], so "Foo*" matches all values starting with Foo, against a
+ * space trimmed dmi value. Leading and trailing spaces of the table entries
+ * are ignored too.
  *
- * Returns non zero value if value is found, otherwise 0.
+ * Returns non zero value if the value matches, otherwise 0.
  */
-static int find_dmi_string(const char **table_entries, const char *dmi_value)
+static int v4lcontrol_dmi_match(const char *pattern, const char *dmi_value)
 {
-	const char *start = dmi_value;
-	const char **entry_ptr;
-	char *trimmed_dmi;
+	char trimmed[512];
 	size_t n;
-	int found = 0;
 
-	if (!start) return 0;
+	while (isspace(*pattern))
+		pattern++;
+	n = strlen(pattern);
+	while (n > 0 && isspace(pattern[n - 1]))
+		n--;
+	if (n >= sizeof(trimmed))
+		return 0;
+
+	memcpy(trimmed, pattern, n);
+	trimmed[n] = 0;
 
-	/* trim value */
-	while (isspace(*start)) start++;
-	n = strlen(start);
-	while (n > 0 && isspace(start[n-1])) --n;
-	trimmed_dmi = strndup(start, n);
+	return fnmatch(trimmed, dmi_value, 0) == 0;
+}
 
-	/* find trimmed value */
-	for (entry_ptr = table_entries; *entry_ptr;  entry_ptr++) {
-		found = fnmatch(*entry_ptr, trimmed_dmi, 0) == 0;
-		/* fprintf(stderr, "find_dmi_string('%s', '%s'->'%s')=%i\n", *entry_ptr, dmi_value, trimmed_dmi, found); */
-		if (found)
-			break;
-	}
+/*
+ * Tries to match value in NULL terminated table_entries string array
+ * aganist the space trimmed dmi_value.
+ *
+ * Returns non zero value if value is found, otherwise 0.
+ */
+static int find_dmi_string(const char **table_entries, const char *dmi_value)
+{
+	const char **entry_ptr;
 
-	free(trimmed_dmi);
+	for (entry_ptr = table_entries; *entry_ptr; entry_ptr++)
+		if (v4lcontrol_dmi_match(*entry_ptr, dmi_value))
+			return 1;
 
-	return found;
+	return 0;
 }
 
 /*
@@ -508,58 +540,193 @@ static int find_usb_id(const struct v4lcontrol_usb_id *table_entries,
 	return 0;
 }
 
+/*
+ * Index of the v4lcontrol_flags table, so that the table can grow without
+ * making each open slower. The first v4lcontrol_flags_no_exact entries are
+ * sorted by USB id, entries for the same id stay in table order as the first
+ * match wins. These are followed by the entries with a product_mask, which
+ * match a range of ids, in table order. The index is built once per process.
+ */
+static int v4lcontrol_flags_index[ARRAY_SIZE(v4lcontrol_flags)];
+static int v4lcontrol_flags_no_exact;
+static pthread_once_t v4lcontrol_flags_index_once = PTHREAD_ONCE_INIT;
+
+static int v4lcontrol_flags_cmp(const void *a, const void *b)
+{
+	const struct v4lcontrol_flags_info *x = &v4lcontrol_flags[*(const int *)a];
+	const struct v4lcontrol_flags_info *y = &v4lcontrol_flags[*(const int *)b];
+
+	if (x->vendor_id != y->vendor_id)
+		return x->vendor_id - y->vendor_id;
+	if (x->product_id != y->product_id)
+		return x->product_id - y->product_id;
+	return *(const int *)a - *(const int *)b;
+}
+
+static void v4lcontrol_flags_build_index(void)
+{
+	int i, masked = ARRAY_SIZE(v4lcontrol_flags);
+
+	for (i = 0; i < ARRAY_SIZE(v4lcontrol_flags); i++)
+		if (!v4lcontrol_flags[i].product_mask)
+			v4lcontrol_flags_index[v4lcontrol_flags_no_exact++] = i;
+
+	/* Fill the masked entries from the end, then put them in table order */
+	for (i = ARRAY_SIZE(v4lcontrol_flags) - 1; i >= 0; i--)
+		if (v4lcontrol_flags[i].product_mask)
+			v4lcontrol_flags_index[--masked] = i;
+
+	qsort(v4lcontrol_flags_index, v4lcontrol_flags_no_exact,
+	      sizeof(v4lcontrol_flags_index[0]), v4lcontrol_flags_cmp);
+}
+
+/* Returns the first index entry for the USB id, or v4lcontrol_flags_no_exact
+   when there is none */
+static int v4lcontrol_flags_find(unsigned short vendor_id,
+		unsigned short product_id)
+{
+	const struct v4lcontrol_flags_info *entry;
+	int low = 0, high = v4lcontrol_flags_no_exact;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+
+		entry = &v4lcontrol_flags[v4lcontrol_flags_index[mid]];
+		if (entry->vendor_id < vendor_id ||
+		    (entry->vendor_id == vendor_id &&
+		     entry->product_id < product_id))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low < v4lcontrol_flags_no_exact) {
+		entry = &v4lcontrol_flags[v4lcontrol_flags_index[low]];
+		if (entry->vendor_id == vendor_id &&
+		    entry->product_id == product_id)
+			return low;
+	}
+
+	return v4lcontrol_flags_no_exact;
+}
+
+struct v4lcontrol_dmi_info {
+	char system_vendor[512];
+	char system_name[512];
+	char system_version[512];
+	char board_vendor[512];
+	char board_name[512];
+	char board_version[512];
+};
+
+static void v4lcontrol_get_dmi_info(const char *sysfs_prefix,
+		struct v4lcontrol_dmi_info *dmi)
+{
+	v4lcontrol_get_dmi_string(sysfs_prefix, "sys_vendor",
+			dmi->system_vendor, sizeof(dmi->system_vendor));
+	v4lcontrol_get_dmi_string(sysfs_prefix, "product_name",
+			dmi->system_name, sizeof(dmi->system_name));
+	v4lcontrol_get_dmi_string(sysfs_prefix, "product_version",
+			dmi->system_version, sizeof(dmi->system_version));
+
+	v4lcontrol_get_dmi_string(sysfs_prefix, "board_vendor",
+			dmi->board_vendor, sizeof(dmi->board_vendor));
+	v4lcontrol_get_dmi_string(sysfs_prefix, "board_name",
+			dmi->board_name, sizeof(dmi->board_name));
+	v4lcontrol_get_dmi_string(sysfs_prefix, "board_version",
+			dmi->board_version, sizeof(dmi->board_version));
+}
+
+static int v4lcontrol_flags_match_dmi(const struct v4lcontrol_flags_info *entry,
+		const struct v4lcontrol_dmi_info *dmi)
+{
+	return (entry->dmi_system_vendor == NULL ||
+		v4lcontrol_dmi_match(entry->dmi_system_vendor, dmi->system_vendor)) &&
+	       (entry->dmi_system_name == NULL ||
+		v4lcontrol_dmi_match(entry->dmi_system_name, dmi->system_name)) &&
+	       (entry->dmi_system_version == NULL ||
+		v4lcontrol_dmi_match(entry->dmi_system_version, dmi->system_version)) &&
+	       (entry->dmi_board_vendor == NULL ||
+		v4lcontrol_dmi_match(entry->dmi_board_vendor, dmi->board_vendor)) &&
+	       (entry->dmi_board_name == NULL ||
+		v4lcontrol_dmi_match(entry->dmi_board_name, dmi->board_name)) &&
+	       (entry->dmi_board_version == NULL ||
+		v4lcontrol_dmi_match(entry->dmi_board_version, dmi->board_version));
+}
+
 static void v4lcontrol_get_flags_from_db(struct v4lcontrol_data *data,
 		const char *sysfs_prefix,
 		unsigned short vendor_id, unsigned short product_id)
 {
-	char dmi_system_vendor[512], dmi_system_name[512], dmi_system_version[512];
-	char dmi_board_vendor[512], dmi_board_name[512], dmi_board_version[512];
-	int i;
+	const struct v4lcontrol_flags_info *entry, *found = NULL;
+	struct v4lcontrol_dmi_info dmi;
+	int i, first, upside_down_id = -1, got_dmi = 0;
 
-	/* Get DMI board and system strings */
-	v4lcontrol_get_dmi_string(sysfs_prefix, "sys_vendor", dmi_system_vendor,
-			sizeof(dmi_system_vendor));
-	v4lcontrol_get_dmi_string(sysfs_prefix, "product_name", dmi_system_name,
-			sizeof(dmi_system_name));
-	v4lcontrol_get_dmi_string(sysfs_prefix, "product_version", dmi_system_version,
-			sizeof(dmi_system_version));
-
-	v4lcontrol_get_dmi_string(sysfs_prefix, "board_vendor", dmi_board_vendor,
-			sizeof(dmi_board_vendor));
-	v4lcontrol_get_dmi_string(sysfs_prefix, "board_name", dmi_board_name,
-			sizeof(dmi_board_name));
-	v4lcontrol_get_dmi_string(sysfs_prefix, "board_version", dmi_board_version,
-			sizeof(dmi_board_version));
+	pthread_once(&v4lcontrol_flags_index_once,
+		     v4lcontrol_flags_build_index);
 
-	for (i = 0; i < ARRAY_SIZE(v4lcontrol_flags); i++)
-		if (v4lcontrol_flags[i].vendor_id == vendor_id &&
-				v4lcontrol_flags[i].product_id ==
-				(product_id & ~v4lcontrol_flags[i].product_mask) &&
-
-				(v4lcontrol_flags[i].dmi_system_vendor == NULL ||
-				 !strcmp(v4lcontrol_flags[i].dmi_system_vendor, dmi_system_vendor)) &&
-				(v4lcontrol_flags[i].dmi_system_name == NULL ||
-				 !strcmp(v4lcontrol_flags[i].dmi_system_name, dmi_system_name)) &&
-				(v4lcontrol_flags[i].dmi_system_version == NULL ||
-				 !strcmp(v4lcontrol_flags[i].dmi_system_version, dmi_system_version)) &&
-
-				(v4lcontrol_flags[i].dmi_board_vendor == NULL ||
-				 !strcmp(v4lcontrol_flags[i].dmi_board_vendor, dmi_board_vendor)) &&
-				(v4lcontrol_flags[i].dmi_board_name == NULL ||
-				 !strcmp(v4lcontrol_flags[i].dmi_board_name, dmi_board_name)) &&
-				(v4lcontrol_flags[i].dmi_board_version == NULL ||
-				 !strcmp(v4lcontrol_flags[i].dmi_board_version, dmi_board_version))) {
-			data->flags |= v4lcontrol_flags[i].flags;
-			data->flags_info = &v4lcontrol_flags[i];
-			/* Entries in the v4lcontrol_flags table override
-			   wildcard matches in the upside_down table. */
-			return;
-		}
+	first = v4lcontrol_flags_find(vendor_id, product_id);
 
 	for (i = 0; i < ARRAY_SIZE(upside_down); i++)
-		if (find_dmi_string(upside_down[i].board_vendor, dmi_board_vendor) &&
-		    find_dmi_string(upside_down[i].board_name, dmi_board_name) &&
-		    find_usb_id(upside_down[i].camera_id, vendor_id, product_id)) {
+		if (find_usb_id(upside_down[i].camera_id, vendor_id, product_id)) {
+			upside_down_id = i;
+			break;
+		}
+
+	/* The dmi strings are only read when there is an entry for the id.
+	   The first matching entry in table order wins, this is the first
+	   matching one for the id, unless a masked entry before it matches */
+	for (i = first; i < v4lcontrol_flags_no_exact; i++) {
+		entry = &v4lcontrol_flags[v4lcontrol_flags_index[i]];
+		if (entry->vendor_id != vendor_id ||
+		    entry->product_id != product_id)
+			break;
+
+		if (!got_dmi) {
+			v4lcontrol_get_dmi_info(sysfs_prefix, &dmi);
+			got_dmi = 1;
+		}
+		if (v4lcontrol_flags_match_dmi(entry, &dmi)) {
+			found = entry;
+			break;
+		}
+	}
+
+	for (i = v4lcontrol_flags_no_exact; i < ARRAY_SIZE(v4lcontrol_flags); i++) {
+		entry = &v4lcontrol_flags[v4lcontrol_flags_index[i]];
+		if (found && entry > found)
+			break;
+		if (entry->vendor_id != vendor_id ||
+		    entry->product_id != (product_id & ~entry->product_mask))
+			continue;
+
+		if (!got_dmi) {
+			v4lcontrol_get_dmi_info(sysfs_prefix, &dmi);
+			got_dmi = 1;
+		}
+		if (v4lcontrol_flags_match_dmi(entry, &dmi)) {
+			found = entry;
+			break;
+		}
+	}
+
+	if (found) {
+		data->flags |= found->flags;
+		data->flags_info = found;
+		/* Entries in the v4lcontrol_flags table override
+		   wildcard matches in the upside_down table. */
+		return;
+	}
+
+	if (upside_down_id == -1)
+		return;
+
+	if (!got_dmi)
+		v4lcontrol_get_dmi_info(sysfs_prefix, &dmi);
+	for (i = upside_down_id; i < ARRAY_SIZE(upside_down); i++)
+		if (find_usb_id(upside_down[i].camera_id, vendor_id, product_id) &&
+		    find_dmi_string(upside_down[i].board_vendor, dmi.board_vendor) &&
+		    find_dmi_string(upside_down[i].board_name, dmi.board_name)) {
 			/* found entry */
 			data->flags |= V4LCONTROL_HFLIPPED | V4LCONTROL_VFLIPPED;
 			break;
@@ -577,6 +744,7 @@ struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 	struct passwd pwd, *pwd_p;
 	unsigned short vendor_id = 0;
 	unsigned short product_id = 0;
+	unsigned short bcd_device = 0;
 	struct v4l2_input input;
 
 	struct v4lcontrol_data *data = calloc(1, sizeof(struct v4lcontrol_data));
@@ -606,8 +774,11 @@ struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 		s = "";
 
 	got_usb_info = v4lcontrol_get_usb_info(data, s, &vendor_id, &product_id,
-					       &speed);
+					       &bcd_device, &speed);
 	if (got_usb_info) {
+		data->vendor_id = vendor_id;
+		data->product_id = product_id;
+		data->bcd_device = bcd_device;
 		v4lcontrol_get_flags_from_db(data, s, vendor_id, product_id);
 		switch (speed) {
 		case 12:
@@ -650,6 +821,18 @@ struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 		}
 	}
 
+	/* Software rotation is offered together with software flipping, it is
+	   not auto enabled with the other fake controls to keep the bits of
+	   LIBV4LCONTROL_CONTROLS stable */
+	if (data->controls & (1 << V4LCONTROL_HFLIP)) {
+		ctrl.id = V4L2_CID_ROTATE;
+		rc = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+				VIDIOC_QUERYCTRL, &ctrl);
+		if (rc == -1 ||
+		    (rc == 0 && (ctrl.flags & V4L2_CTRL_FLAG_DISABLED)))
+			data->controls |= 1 << V4LCONTROL_ROTATE;
+	}
+
 	/* Check if a camera does not have hardware autogain and has the necessary
 	   controls, before enabling sw autogain, even if this is requested by flags.
 	   This is necessary because some cameras share a USB-ID, but can have
@@ -846,9 +1029,26 @@ static const struct v4l2_queryctrl fake_controls[V4LCONTROL_COUNT] = {
 		.step = 1,
 		.default_value = 100,
 		.flags = V4L2_CTRL_FLAG_SLIDER
+	}, {
+		.id = V4L2_CID_ROTATE,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name =  "Rotate",
+		.minimum = 0,
+		.maximum = 270,
+		.step = 90,
+		.default_value = 0,
+		.flags = 0
 	},
 };
 
+static int v4lcontrol_invalid_value(int i, int value)
+{
+	return value > fake_controls[i].maximum ||
+	       value < fake_controls[i].minimum ||
+	       (fake_controls[i].step > 1 &&
+		(value - fake_controls[i].minimum) % fake_controls[i].step);
+}
+
 static void v4lcontrol_copy_queryctrl(struct v4lcontrol_data *data,
 		struct v4l2_queryctrl *ctrl, int i)
 {
@@ -1005,8 +1205,7 @@ int v4lcontrol_vidioc_s_ctrl(struct v4lcontrol_data *data, void *arg)
 	for (i = 0; i < V4LCONTROL_COUNT; i++)
 		if ((data->controls & (1 << i)) &&
 				ctrl->id == fake_controls[i].id) {
-			if (ctrl->value > fake_controls[i].maximum ||
-					ctrl->value < fake_controls[i].minimum) {
+			if (v4lcontrol_invalid_value(i, ctrl->value)) {
 				errno = EINVAL;
 				return -1;
 			}
@@ -1030,8 +1229,8 @@ static int v4lcontrol_validate_ext_ctrls(struct v4lcontrol_data *data,
 		for (j = 0; j < V4LCONTROL_COUNT; j++)
 			if ((data->controls & (1 << j)) &&
 			    ctrls->controls[i].id == fake_controls[j].id) {
-				if (ctrls->controls[i].value > fake_controls[j].maximum ||
-				    ctrls->controls[i].value < fake_controls[j].minimum) {
+				if (v4lcontrol_invalid_value(j,
+						ctrls->controls[i].value)) {
 					ctrls->error_idx = i;
 					errno = EINVAL;
 					return -1;
@@ -1090,6 +1289,19 @@ int v4lcontrol_get_bandwidth(struct v4lcontrol_data *data)
 	return data->bandwidth;
 }
 
+int v4lcontrol_get_usb_id(struct v4lcontrol_data *data,
+		unsigned short *vendor_id, unsigned short *product_id,
+		unsigned short *bcd_device)
+{
+	if (!data->vendor_id)
+		return 0;
+
+	*vendor_id = data->vendor_id;
+	*product_id = data->product_id;
+	*bcd_device = data->bcd_device;
+	return 1;
+}
+
 int v4lcontrol_get_flags(struct v4lcontrol_data *data)
 {
 	return data->flags;
@@ -45,6 +45,7 @@ enum {
 	V4LCONTROL_AUTO_ENABLE_COUNT,
 	V4LCONTROL_AUTOGAIN,
 	V4LCONTROL_AUTOGAIN_TARGET,
+	V4LCONTROL_ROTATE,
 	V4LCONTROL_COUNT
 };
 
@@ -55,6 +56,11 @@ struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 void v4lcontrol_destroy(struct v4lcontrol_data *data);
 
 int v4lcontrol_get_bandwidth(struct v4lcontrol_data *data);
+/* Get the USB vendor / product id and device release (bcdDevice), returns 0
+   when this is not an USB device */
+int v4lcontrol_get_usb_id(struct v4lcontrol_data *data,
+		unsigned short *vendor_id, unsigned short *product_id,
+		unsigned short *bcd_device);
 
 /* Functions used by v4lprocessing to get the control state */
 int v4lcontrol_get_flags(struct v4lcontrol_data *data);
@@ -0,0 +1,271 @@
+/*
+
+# Measured conversion costs, used to pick the src format
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "libv4lconvert-priv.h"
+
+#define V4LCONVERT_COST_FILE "convert-cost"
+#define V4LCONVERT_CPU_MODEL_MAX 64
+
+/* Get the path of file name in the libv4l cache dir, creating the dir when
+   it does not exist yet. Returns 0 on success, -1 when there is no cache dir */
+int v4lconvert_cache_path(char *path, int size, const char *name)
+{
+	const char *dir = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int len;
+
+	if (dir && dir[0] == '/')
+		len = snprintf(path, size, "%s/libv4l", dir);
+	else if (home && home[0] == '/')
+		len = snprintf(path, size, "%s/.cache/libv4l", home);
+	else
+		return -1;
+	if (len >= size)
+		return -1;
+
+	if (mkdir(path, 0700) && errno == ENOENT) {
+		/* The dirs above it (~/.cache) may not exist yet either */
+		char *slash;
+
+		for (slash = strchr(path + 1, '/'); slash;
+		     slash = strchr(slash + 1, '/')) {
+			*slash = 0;
+			mkdir(path, 0700);
+			*slash = '/';
+		}
+		mkdir(path, 0700);
+	}
+
+	if (snprintf(path + len, size - len, "/%s", name) >= size - len)
+		return -1;
+
+	return 0;
+}
+
+uint64_t v4lconvert_cost_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Get a file name safe identification of the cpu model from /proc/cpuinfo,
+   the model name on x86 and the implementer / part numbers on arm */
+static void v4lconvert_cpu_model(char *model, int size)
+{
+	char line[256], *s;
+	int len = 0, model_name;
+	FILE *f;
+
+	f = fopen("/proc/cpuinfo", "r");
+	while (f && fgets(line, sizeof(line), f)) {
+		model_name = !strncmp(line, "model name", 10);
+		s = strchr(line, ':');
+		if (!s || (!model_name && strncmp(line, "CPU implementer", 15) &&
+			   strncmp(line, "CPU part", 8)))
+			continue;
+
+		for (s++; *s && len < size - 1; s++) {
+			if (isalnum((unsigned char)*s) || *s == '.')
+				model[len++] = *s;
+			else if (len && model[len - 1] != '_')
+				model[len++] = '_';
+		}
+
+		/* Only look at the first cpu */
+		if (model_name || !strncmp(line, "CPU part", 8))
+			break;
+	}
+	if (f)
+		fclose(f);
+
+	while (len && model[len - 1] == '_')
+		len--;
+	model[len] = 0;
+	if (!len)
+		snprintf(model, size, "unknown");
+}
+
+/* The costs depend on the cpu, the kernels and the no threads, so these are
+   part of the cache file name */
+static int v4lconvert_cost_path(struct v4lconvert_data *data, int threads,
+		char *path, int size)
+{
+	char model[V4LCONVERT_CPU_MODEL_MAX], name[128];
+
+	v4lconvert_cpu_model(model, sizeof(model));
+	snprintf(name, sizeof(name), "%s-%s-%s-%dt", V4LCONVERT_COST_FILE,
+		 model, data->kernels->name, threads);
+
+	return v4lconvert_cache_path(path, size, name);
+}
+
+static struct v4lconvert_cost *v4lconvert_cost_find(
+		struct v4lconvert_data *data, unsigned int pixelformat, int yuv)
+{
+	int i;
+
+	for (i = 0; i < data->no_costs; i++)
+		if (data->costs[i].pixelformat == pixelformat &&
+		    data->costs[i].yuv == yuv)
+			return &data->costs[i];
+
+	return NULL;
+}
+
+static void v4lconvert_cost_load(struct v4lconvert_data *data)
+{
+	char path[PATH_MAX], line[80], dest[4];
+	unsigned int pixelformat, ps;
+	FILE *f;
+
+	data->costs_loaded = 1;
+	data->costs_threads = v4lconvert_threads_count(data->threads);
+	data->costs_changed = 0;
+	data->no_costs = 0;
+	if (v4lconvert_cost_path(data, data->costs_threads, path,
+				 sizeof(path)))
+		return;
+
+	f = fopen(path, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f) &&
+	       data->no_costs < V4LCONVERT_MAX_COSTS) {
+		if (sscanf(line, "%x %3s %u", &pixelformat, dest, &ps) != 3 ||
+		    !ps || v4lconvert_cost_find(data, pixelformat,
+						!strcmp(dest, "yuv")))
+			continue;
+
+		data->costs[data->no_costs].pixelformat = pixelformat;
+		data->costs[data->no_costs].yuv = !strcmp(dest, "yuv");
+		data->costs[data->no_costs].ps = ps;
+		data->no_costs++;
+	}
+	fclose(f);
+}
+
+/* Load the costs for the current no threads, saving the ones for the
+   previous no threads first when that has changed */
+static void v4lconvert_cost_check_loaded(struct v4lconvert_data *data)
+{
+	if (data->costs_loaded &&
+	    data->costs_threads == v4lconvert_threads_count(data->threads))
+		return;
+
+	if (data->costs_loaded)
+		v4lconvert_cost_save(data);
+	v4lconvert_cost_load(data);
+}
+
+/* Returns the picoseconds per src pixel converting from pixelformat to yuv
+   (or rgb when yuv is 0) costs, or 0 when this has not been measured yet */
+unsigned int v4lconvert_cost_get(struct v4lconvert_data *data,
+		unsigned int pixelformat, int yuv)
+{
+	struct v4lconvert_cost *cost;
+
+	v4lconvert_cost_check_loaded(data);
+
+	cost = v4lconvert_cost_find(data, pixelformat, yuv);
+	return cost ? cost->ps : 0;
+}
+
+/* Add a measurement of converting pixels pixels, which started at start (see
+   v4lconvert_cost_now()), to the running average */
+void v4lconvert_cost_update(struct v4lconvert_data *data,
+		unsigned int pixelformat, int yuv, uint64_t start, int pixels)
+{
+	struct v4lconvert_cost *cost;
+	uint64_t ps;
+
+	if (pixels <= 0)
+		return;
+
+	ps = (v4lconvert_cost_now() - start) * 1000 / pixels;
+	if (ps == 0)
+		ps = 1;
+	if (ps > 0xffffffff)
+		ps = 0xffffffff;
+
+	v4lconvert_cost_check_loaded(data);
+
+	cost = v4lconvert_cost_find(data, pixelformat, yuv);
+	if (!cost) {
+		if (data->no_costs == V4LCONVERT_MAX_COSTS)
+			return;
+		cost = &data->costs[data->no_costs++];
+		cost->pixelformat = pixelformat;
+		cost->yuv = yuv;
+		cost->ps = ps;
+	} else {
+		/* Smooth out the odd slow frame */
+		cost->ps = ((uint64_t)cost->ps * 7 + ps) / 8;
+	}
+	data->costs_changed = 1;
+}
+
+/* Write the costs to the cache, so that the next process does not need to
+   measure them again */
+void v4lconvert_cost_save(struct v4lconvert_data *data)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 8];
+	FILE *f;
+	int i, fd;
+
+	if (!data->costs_changed ||
+	    v4lconvert_cost_path(data, data->costs_threads, path,
+				 sizeof(path)))
+		return;
+
+	/* Replace the file atomically, other processes may be reading it */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		return;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	fprintf(f, "# libv4lconvert conversion costs: fourcc dest picoseconds/pixel\n");
+	for (i = 0; i < data->no_costs; i++)
+		fprintf(f, "%08x %s %u\n", data->costs[i].pixelformat,
+			data->costs[i].yuv ? "yuv" : "rgb", data->costs[i].ps);
+
+	if (fclose(f) || rename(tmp, path))
+		unlink(tmp);
+	else
+		data->costs_changed = 0;
+}
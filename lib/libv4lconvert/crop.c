@@ -20,269 +20,389 @@
 
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
-static void v4lconvert_reduceandcrop_rgbbgr24(
-		unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+/* rgb24 / bgr24 frames have a single plane of 3 byte pixels, rgb48 frames a
+   single plane of 6 byte pixels, yuv420 / yvu420 frames have 3 planes of 1
+   byte pixels, of which the chroma planes are half the width and height of
+   the luma plane. */
+static int v4lconvert_crop_planes(const struct v4l2_format *fmt, int *bpp)
 {
-	int x, y;
-	int startx = src_fmt->fmt.pix.width / 2 - dest_fmt->fmt.pix.width;
-	int starty = src_fmt->fmt.pix.height / 2 - dest_fmt->fmt.pix.height;
-
-	src += starty * src_fmt->fmt.pix.bytesperline + 3 * startx;
-
-	for (y = 0; y < dest_fmt->fmt.pix.height; y++) {
-		unsigned char *mysrc = src;
-		for (x = 0; x < dest_fmt->fmt.pix.width; x++) {
-			*(dest++) = *(mysrc++);
-			*(dest++) = *(mysrc++);
-			*(dest++) = *(mysrc++);
-			mysrc += 3; /* skip one pixel */
-		}
-		src += 2 * src_fmt->fmt.pix.bytesperline; /* skip one line */
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		*bpp = 3;
+		return 1;
+	case V4L2_PIX_FMT_RGB48:
+		*bpp = 6;
+		return 1;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		*bpp = 1;
+		return 3;
 	}
+	return 0;
 }
 
-static void v4lconvert_crop_rgbbgr24(unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+/* Drops every other pixel and line, only used for rgb48, which the scaler
+   cannot handle */
+static void v4lconvert_reduceandcrop_plane(const unsigned char *src,
+		int src_stride, unsigned char *dest, int dest_stride,
+		int width, int height, int bpp)
 {
-	int x;
-	int startx = (src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2;
-	int starty = (src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2;
+	int x, y;
 
-	src += starty * src_fmt->fmt.pix.bytesperline + 3 * startx;
+	for (y = 0; y < height; y++) {
+		const unsigned char *mysrc = src;
+		unsigned char *mydest = dest;
 
-	for (x = 0; x < dest_fmt->fmt.pix.height; x++) {
-		memcpy(dest, src, dest_fmt->fmt.pix.width * 3);
-		src += src_fmt->fmt.pix.bytesperline;
-		dest += dest_fmt->fmt.pix.bytesperline;
+		for (x = 0; x < width; x++) {
+			memcpy(mydest, mysrc, bpp);
+			mydest += bpp;
+			mysrc += 2 * bpp; /* skip one pixel */
+		}
+		src += 2 * src_stride; /* skip one line */
+		dest += dest_stride;
 	}
 }
 
-static void v4lconvert_reduceandcrop_yuv420(
-		unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+void v4lconvert_scale_rows(uint16_t *acc, const unsigned char *src, int n,
+		int weight, int add)
 {
-	int x, y;
-	int dest_height_half = dest_fmt->fmt.pix.height / 2;
-	int dest_width_half = dest_fmt->fmt.pix.width / 2;
-	int startx = (src_fmt->fmt.pix.width / 2 - dest_fmt->fmt.pix.width) & ~1;
-	int starty = (src_fmt->fmt.pix.height / 2 - dest_fmt->fmt.pix.height) & ~1;
-	unsigned char *mysrc, *mysrc2;
-
-	/* Y */
-	mysrc = src + starty * src_fmt->fmt.pix.bytesperline + startx;
-	for (y = 0; y < dest_fmt->fmt.pix.height; y++) {
-		mysrc2 = mysrc;
-		for (x = 0; x < dest_fmt->fmt.pix.width; x++) {
-			*(dest++) = *mysrc2;
-			mysrc2 += 2; /* skip one pixel */
-		}
-		mysrc += 2 * src_fmt->fmt.pix.bytesperline; /* skip one line */
-	}
+	int i;
+
+	if (add)
+		for (i = 0; i < n; i++)
+			acc[i] += src[i] * weight;
+	else
+		for (i = 0; i < n; i++)
+			acc[i] = src[i] * weight;
+}
 
-	/* U */
-	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline +
-		(starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (y = 0; y < dest_height_half; y++) {
-		mysrc2 = mysrc;
-		for (x = 0; x < dest_width_half; x++) {
-			*(dest++) = *mysrc2;
-			mysrc2 += 2; /* skip one pixel */
+/* Get the filter taps for dest pixel (or line) i when scaling src_size
+   pixels to size pixels. The weights are in 1/256 and add up to 256, so that
+   the weighted sums of 8 bit samples fit in 16 bits. Returns the number of
+   taps, which is at most v4lconvert_scale_max_taps(). */
+static int v4lconvert_scale_taps(int i, int src_size, int size, int scaler,
+		int *first, uint16_t *weight)
+{
+	int j, last, start, end;
+
+	if (scaler == V4LCONVERT_SCALER_BILINEAR) {
+		/* Sample at the center of the dest pixel, in 1/256 src pixels */
+		int pos = (int)(((2LL * i + 1) * src_size * 128 + size / 2) /
+				size) - 128;
+
+		if (pos < 0)
+			pos = 0;
+		*first = pos >> 8;
+		if (*first >= src_size - 1) {
+			*first = src_size - 1;
+			weight[0] = 256;
+			return 1;
 		}
-		mysrc += src_fmt->fmt.pix.bytesperline ; /* skip one line */
+		weight[0] = 256 - (pos & 255);
+		weight[1] = pos & 255;
+		return 2;
 	}
 
-	/* V */
-	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline * 5 / 4
-		+ (starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (y = 0; y < dest_height_half; y++) {
-		mysrc2 = mysrc;
-		for (x = 0; x < dest_width_half; x++) {
-			*(dest++) = *mysrc2;
-			mysrc2 += 2; /* skip one pixel */
-		}
-		mysrc += src_fmt->fmt.pix.bytesperline ; /* skip one line */
+	/* In 1/size src pixels dest pixel i covers [i * src_size,
+	   (i + 1) * src_size) and src pixel j covers [j * size, (j + 1) * size),
+	   rounding the ends of the overlaps makes the weights add up to 256 */
+	start = i * src_size;
+	end = start + src_size;
+	*first = start / size;
+	last = (end - 1) / size;
+	for (j = *first; j <= last; j++) {
+		int from = j * size > start ? j * size - start : 0;
+		int to = (j + 1) * size < end ? (j + 1) * size - start : src_size;
+
+		weight[j - *first] = (to * 256 + src_size / 2) / src_size -
+				     (from * 256 + src_size / 2) / src_size;
 	}
+	return last - *first + 1;
 }
 
-static void v4lconvert_crop_yuv420(unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+static int v4lconvert_scale_max_taps(int src_size, int size, int scaler)
 {
-	int x;
-	int startx = ((src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2) & ~1;
-	int starty = ((src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2) & ~1;
-	unsigned char *mysrc = src + starty * src_fmt->fmt.pix.bytesperline + startx;
-
-	/* Y */
-	for (x = 0; x < dest_fmt->fmt.pix.height; x++) {
-		memcpy(dest, mysrc, dest_fmt->fmt.pix.width);
-		mysrc += src_fmt->fmt.pix.bytesperline;
-		dest += dest_fmt->fmt.pix.bytesperline;
-	}
-
-	/* U */
-	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline +
-		(starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (x = 0; x < dest_fmt->fmt.pix.height / 2; x++) {
-		memcpy(dest, mysrc, dest_fmt->fmt.pix.width / 2);
-		mysrc += src_fmt->fmt.pix.bytesperline / 2;
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
-	}
-
-	/* V */
-	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline * 5 / 4
-		+ (starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (x = 0; x < dest_fmt->fmt.pix.height / 2; x++) {
-		memcpy(dest, mysrc, dest_fmt->fmt.pix.width / 2);
-		mysrc += src_fmt->fmt.pix.bytesperline / 2;
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
-	}
+	if (scaler == V4LCONVERT_SCALER_BILINEAR)
+		return 2;
+	return (src_size + size - 1) / size + 1;
 }
 
-/* Ok, so this is not really cropping, but more the reverse, whatever */
-static void v4lconvert_add_border_rgbbgr24(
-		unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+struct v4lconvert_scale_job {
+	const struct v4lconvert_kernels *kernels;
+	const unsigned char *src;
+	unsigned char *dest;
+	int src_stride, dest_stride;
+	int src_width, src_height, width, height, bpp, scaler;
+	/* The taps of each dest pixel, max_taps weights per pixel */
+	const int *first, *count;
+	const uint16_t *weight;
+	int max_taps;
+};
+
+/* Scale lines first - last of the dest: first sum the src lines of a dest
+   line into 16 bit accumulators, then the accumulated pixels of each dest
+   pixel */
+static void v4lconvert_scale_lines(void *arg, int first, int last)
 {
-	int y;
-	int borderx = (dest_fmt->fmt.pix.width - src_fmt->fmt.pix.width) / 2;
-	int bordery = (dest_fmt->fmt.pix.height - src_fmt->fmt.pix.height) / 2;
-
-	for (y = 0; y < bordery; y++) {
-		memset(dest, 0, dest_fmt->fmt.pix.width * 3);
-		dest += dest_fmt->fmt.pix.bytesperline;
+	struct v4lconvert_scale_job *job = arg;
+	int bpp = job->bpp, bytes = job->src_width * bpp;
+	int max_taps = v4lconvert_scale_max_taps(job->src_height, job->height,
+						 job->scaler);
+	uint16_t *acc, *weight;
+	int x, y, i, c, src_y, taps;
+
+	acc = malloc((bytes + max_taps) * sizeof(uint16_t));
+	if (!acc) {
+		/* Nothing to report the error to from a (worker) thread */
+		for (y = first; y < last; y++)
+			memset(job->dest + y * job->dest_stride, 0,
+			       job->width * bpp);
+		return;
 	}
-
-	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
-		memset(dest, 0, borderx * 3);
-		dest += borderx * 3;
-
-		memcpy(dest, src, src_fmt->fmt.pix.width * 3);
-		src += src_fmt->fmt.pix.bytesperline;
-		dest += src_fmt->fmt.pix.width * 3;
-
-		memset(dest, 0, borderx * 3);
-		dest += dest_fmt->fmt.pix.bytesperline -
-			(borderx + src_fmt->fmt.pix.width) * 3;
+	weight = acc + bytes;
+
+	for (y = first; y < last; y++) {
+		unsigned char *dest = job->dest + y * job->dest_stride;
+
+		taps = v4lconvert_scale_taps(y, job->src_height, job->height,
+					     job->scaler, &src_y, weight);
+		for (i = 0; i < taps; i++)
+			job->kernels->scale_rows(acc,
+					job->src + (src_y + i) * job->src_stride,
+					bytes, weight[i], i);
+
+		for (x = 0; x < job->width; x++) {
+			const uint16_t *a = acc + job->first[x] * bpp;
+			const uint16_t *w = job->weight + x * job->max_taps;
+
+			if (bpp == 3) {
+				unsigned int r = 32768, g = 32768, b = 32768;
+
+				for (i = 0; i < job->count[x]; i++, a += 3) {
+					r += a[0] * w[i];
+					g += a[1] * w[i];
+					b += a[2] * w[i];
+				}
+				*dest++ = r >> 16;
+				*dest++ = g >> 16;
+				*dest++ = b >> 16;
+				continue;
+			}
+
+			for (c = 0; c < bpp; c++) {
+				unsigned int sum = 32768;
+
+				for (i = 0; i < job->count[x]; i++)
+					sum += a[i * bpp + c] * w[i];
+				*dest++ = sum >> 16;
+			}
+		}
 	}
 
-	for (y = 0; y < bordery; y++) {
-		memset(dest, 0, dest_fmt->fmt.pix.width * 3);
-		dest += dest_fmt->fmt.pix.bytesperline;
-	}
+	free(acc);
 }
 
-static void v4lconvert_add_border_yuv420(
-		unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+/* Scale a src_width x src_height plane of 8 bit samples to width x height */
+static int v4lconvert_scale_plane(struct v4lconvert_data *data,
+		const unsigned char *src, int src_stride,
+		int src_width, int src_height,
+		unsigned char *dest, int dest_stride, int width, int height,
+		int bpp, int scaler)
 {
-	int y;
-	int borderx = ((dest_fmt->fmt.pix.width - src_fmt->fmt.pix.width) / 2) & ~1;
-	int bordery = ((dest_fmt->fmt.pix.height - src_fmt->fmt.pix.height) / 2) & ~1;
-
-	/* Y */
-	for (y = 0; y < bordery; y++) {
-		memset(dest, 16, dest_fmt->fmt.pix.width);
-		dest += dest_fmt->fmt.pix.bytesperline;
-	}
-
-	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
-		memset(dest, 16, borderx);
-		dest += borderx;
-
-		memcpy(dest, src, src_fmt->fmt.pix.width);
-		src += src_fmt->fmt.pix.bytesperline;
-		dest += src_fmt->fmt.pix.width;
+	struct v4lconvert_scale_job job = {
+		.kernels = data->kernels,
+		.src = src,
+		.dest = dest,
+		.src_stride = src_stride,
+		.dest_stride = dest_stride,
+		.src_width = src_width,
+		.src_height = src_height,
+		.width = width,
+		.height = height,
+		.bpp = bpp,
+		.scaler = scaler,
+	};
+	int *first, *count, x, max_taps;
+	uint16_t *weight;
+
+	if (width <= 0 || height <= 0)
+		return 0;
+
+	/* The horizontal taps are the same for all lines */
+	max_taps = v4lconvert_scale_max_taps(src_width, width, scaler);
+	first = (int *)v4lconvert_alloc_buffer(width * (2 * sizeof(int) +
+				max_taps * sizeof(uint16_t)),
+			&data->scale_buf, &data->scale_buf_size);
+	if (!first)
+		return -1;
+	count = first + width;
+	weight = (uint16_t *)(count + width);
+	for (x = 0; x < width; x++)
+		count[x] = v4lconvert_scale_taps(x, src_width, width, scaler,
+				&first[x], weight + x * max_taps);
+
+	job.first = first;
+	job.count = count;
+	job.weight = weight;
+	job.max_taps = max_taps;
+	v4lconvert_threads_run(data->threads, v4lconvert_scale_lines, &job,
+			       height);
+	return 0;
+}
 
-		memset(dest, 16, borderx);
-		dest += dest_fmt->fmt.pix.bytesperline -
-			(borderx + src_fmt->fmt.pix.width);
-	}
+/* Ok, so this is not really cropping, but more the reverse, whatever */
+static void v4lconvert_add_border_plane(const unsigned char *src,
+		int src_stride, int src_width, int src_height,
+		unsigned char *dest, int dest_stride, int dest_width, int dest_height,
+		int borderx, int bordery, int bpp, int fill)
+{
+	int y;
 
 	for (y = 0; y < bordery; y++) {
-		memset(dest, 16, dest_fmt->fmt.pix.width);
-		dest += dest_fmt->fmt.pix.bytesperline;
+		memset(dest, fill, dest_width * bpp);
+		dest += dest_stride;
 	}
 
-	/* U */
-	for (y = 0; y < bordery / 2; y++) {
-		memset(dest, 128, dest_fmt->fmt.pix.width / 2);
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
-	}
-
-	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
-		memset(dest, 128, borderx / 2);
-		dest += borderx / 2;
-
-		memcpy(dest, src, src_fmt->fmt.pix.width / 2);
-		src += src_fmt->fmt.pix.bytesperline / 2;
-		dest += src_fmt->fmt.pix.width / 2;
-
-		memset(dest, 128, borderx / 2);
-		dest += (dest_fmt->fmt.pix.bytesperline -
-				(borderx + src_fmt->fmt.pix.width)) / 2;
+	for (y = 0; y < src_height; y++) {
+		memset(dest, fill, borderx * bpp);
+		memcpy(dest + borderx * bpp, src, src_width * bpp);
+		memset(dest + (borderx + src_width) * bpp, fill,
+		       (dest_width - borderx - src_width) * bpp);
+		src += src_stride;
+		dest += dest_stride;
 	}
 
-	for (y = 0; y < bordery / 2; y++) {
-		memset(dest, 128, dest_fmt->fmt.pix.width / 2);
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
+	for (y = bordery + src_height; y < dest_height; y++) {
+		memset(dest, fill, dest_width * bpp);
+		dest += dest_stride;
 	}
+}
 
-	/* V */
-	for (y = 0; y < bordery / 2; y++) {
-		memset(dest, 128, dest_fmt->fmt.pix.width / 2);
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
-	}
+/* Returns the filter with which v4lconvert_crop() scales a src_width x
+   src_height frame to width x height, or V4LCONVERT_SCALER_CROP when it only
+   crops it or adds a border */
+int v4lconvert_crop_scaler(struct v4lconvert_data *data,
+		unsigned int pixelformat, int src_width, int src_height,
+		int width, int height)
+{
+	if (src_width <= width && src_height <= height)
+		return V4LCONVERT_SCALER_CROP;
 
-	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
-		memset(dest, 128, borderx / 2);
-		dest += borderx / 2;
+	/* The scaler only handles 8 bit samples */
+	if (pixelformat == V4L2_PIX_FMT_RGB48)
+		return V4LCONVERT_SCALER_CROP;
 
-		memcpy(dest, src, src_fmt->fmt.pix.width / 2);
-		src += src_fmt->fmt.pix.bytesperline / 2;
-		dest += src_fmt->fmt.pix.width / 2;
+	if (data->scaler != V4LCONVERT_SCALER_CROP)
+		return data->scaler;
 
-		memset(dest, 128, borderx / 2);
-		dest += (dest_fmt->fmt.pix.bytesperline -
-				(borderx + src_fmt->fmt.pix.width)) / 2;
-	}
+	/* Averaging 2x2 pixels before cropping */
+	if (src_width >= 2 * width && src_height >= 2 * height)
+		return V4LCONVERT_SCALER_AREA;
 
-	for (y = 0; y < bordery / 2; y++) {
-		memset(dest, 128, dest_fmt->fmt.pix.width / 2);
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
-	}
+	return V4LCONVERT_SCALER_CROP;
 }
 
-void v4lconvert_crop(unsigned char *src, unsigned char *dest,
+int v4lconvert_crop(struct v4lconvert_data *data,
+		const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
 {
-	switch (dest_fmt->fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		if (src_fmt->fmt.pix.width  <= dest_fmt->fmt.pix.width &&
-				src_fmt->fmt.pix.height <= dest_fmt->fmt.pix.height)
-			v4lconvert_add_border_rgbbgr24(src, dest, src_fmt, dest_fmt);
-		else if (src_fmt->fmt.pix.width  >= 2 * dest_fmt->fmt.pix.width &&
-				src_fmt->fmt.pix.height >= 2 * dest_fmt->fmt.pix.height)
-			v4lconvert_reduceandcrop_rgbbgr24(src, dest, src_fmt, dest_fmt);
-		else
-			v4lconvert_crop_rgbbgr24(src, dest, src_fmt, dest_fmt);
-		break;
+	int i, bpp, planes = v4lconvert_crop_planes(dest_fmt, &bpp);
+	int sw = src_fmt->fmt.pix.width, sh = src_fmt->fmt.pix.height;
+	int dw = dest_fmt->fmt.pix.width, dh = dest_fmt->fmt.pix.height;
+	int scaler = v4lconvert_crop_scaler(data, dest_fmt->fmt.pix.pixelformat,
+					    sw, sh, dw, dh);
+	/* The offsets of planar formats must be even for the chroma planes */
+	int mask = planes == 3 ? ~1 : ~0;
+	int x, y;
 
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-		if (src_fmt->fmt.pix.width  <= dest_fmt->fmt.pix.width &&
-				src_fmt->fmt.pix.height <= dest_fmt->fmt.pix.height)
-			v4lconvert_add_border_yuv420(src, dest, src_fmt, dest_fmt);
-		else if (src_fmt->fmt.pix.width  >= 2 * dest_fmt->fmt.pix.width &&
-				src_fmt->fmt.pix.height >= 2 * dest_fmt->fmt.pix.height)
-			v4lconvert_reduceandcrop_yuv420(src, dest, src_fmt, dest_fmt);
-		else
-			v4lconvert_crop_yuv420(src, dest, src_fmt, dest_fmt);
-		break;
+	if (sw <= dw && sh <= dh) {
+		x = ((dw - sw) / 2) & mask;
+		y = ((dh - sh) / 2) & mask;
+		for (i = 0; i < planes; i++) {
+			int shift = i ? 1 : 0;
+
+			v4lconvert_add_border_plane(src->plane[i], src->stride[i],
+					sw >> shift, sh >> shift,
+					dest->plane[i], dest->stride[i],
+					dw >> shift, dh >> shift,
+					x >> shift, y >> shift, bpp,
+					planes == 1 ? 0 : (i ? 128 : 16));
+		}
+	} else if (scaler != V4LCONVERT_SCALER_CROP &&
+		   data->scaler != V4LCONVERT_SCALER_CROP) {
+		for (i = 0; i < planes; i++) {
+			int shift = i ? 1 : 0;
+
+			if (v4lconvert_scale_plane(data, src->plane[i],
+					src->stride[i], sw >> shift, sh >> shift,
+					dest->plane[i], dest->stride[i],
+					dw >> shift, dh >> shift, bpp, scaler))
+				return -1;
+		}
+	} else if (sw >= 2 * dw && sh >= 2 * dh) {
+		x = (sw / 2 - dw) & mask;
+		y = (sh / 2 - dh) & mask;
+		for (i = 0; i < planes; i++) {
+			int shift = i ? 1 : 0;
+			const unsigned char *plane = src->plane[i] +
+				(y >> shift) * src->stride[i] +
+				(x >> shift) * bpp;
+
+			if (scaler == V4LCONVERT_SCALER_CROP) {
+				v4lconvert_reduceandcrop_plane(plane,
+						src->stride[i], dest->plane[i],
+						dest->stride[i],
+						dw >> shift, dh >> shift, bpp);
+			} else if (v4lconvert_scale_plane(data, plane,
+					src->stride[i], (2 * dw) >> shift,
+					(2 * dh) >> shift, dest->plane[i],
+					dest->stride[i], dw >> shift, dh >> shift,
+					bpp, scaler)) {
+				return -1;
+			}
+		}
+	} else if (sw < dw || sh < dh) {
+		/* Wider but less high or the other way around, this happens
+		   when the rotation changes while streaming. Crop the
+		   dimension which is too large and add a border to the other */
+		int cw = MIN(sw, dw), ch = MIN(sh, dh);
+
+		x = ((sw - cw) / 2) & mask;
+		y = ((sh - ch) / 2) & mask;
+		for (i = 0; i < planes; i++) {
+			int shift = i ? 1 : 0;
+
+			v4lconvert_add_border_plane(src->plane[i] +
+					(y >> shift) * src->stride[i] +
+					(x >> shift) * bpp, src->stride[i],
+					cw >> shift, ch >> shift,
+					dest->plane[i], dest->stride[i],
+					dw >> shift, dh >> shift,
+					(((dw - cw) / 2) & mask) >> shift,
+					(((dh - ch) / 2) & mask) >> shift, bpp,
+					planes == 1 ? 0 : (i ? 128 : 16));
+		}
+	} else {
+		x = ((sw - dw) / 2) & mask;
+		y = ((sh - dh) / 2) & mask;
+		for (i = 0; i < planes; i++) {
+			int shift = i ? 1 : 0;
+
+			v4lconvert_copy_lines(src->plane[i] +
+					(y >> shift) * src->stride[i] +
+					(x >> shift) * bpp, dest->plane[i],
+					(dw >> shift) * bpp, dh >> shift,
+					src->stride[i], dest->stride[i]);
+		}
 	}
+
+	return 0;
 }
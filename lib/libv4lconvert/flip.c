@@ -23,245 +23,233 @@
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
-static void v4lconvert_vflip_rgbbgr24(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
-{
-	int y;
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline;
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src -= fmt->fmt.pix.bytesperline;
-		memcpy(dest, src, fmt->fmt.pix.width * 3);
-		dest += fmt->fmt.pix.width * 3;
-	}
-}
-
-static void v4lconvert_vflip_yuv420(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
+/* rgb24 / bgr24 frames have a single plane of 3 byte pixels, rgb48 frames a
+   single plane of 6 byte pixels, yuv420 / yvu420 frames have 3 planes of 1
+   byte pixels, of which the chroma planes are half the width and height of
+   the luma plane. */
+static int v4lconvert_flip_planes(const struct v4l2_format *fmt, int *bpp)
 {
-	int y;
-
-	/* First flip the Y plane */
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline;
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src -= fmt->fmt.pix.bytesperline;
-		memcpy(dest, src, fmt->fmt.pix.width);
-		dest += fmt->fmt.pix.width;
-	}
-
-	/* Now flip the U plane */
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline * 5 / 4;
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src -= fmt->fmt.pix.bytesperline / 2;
-		memcpy(dest, src, fmt->fmt.pix.width / 2);
-		dest += fmt->fmt.pix.width / 2;
-	}
-
-	/* Last flip the V plane */
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 2;
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src -= fmt->fmt.pix.bytesperline / 2;
-		memcpy(dest, src, fmt->fmt.pix.width / 2);
-		dest += fmt->fmt.pix.width / 2;
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		*bpp = 3;
+		return 1;
+	case V4L2_PIX_FMT_RGB48:
+		*bpp = 6;
+		return 1;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		*bpp = 1;
+		return 3;
 	}
+	return 0;
 }
 
-static void v4lconvert_hflip_rgbbgr24(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
+/* Mirror width 8 bit samples, see the hflip_u8 kernel */
+void v4lconvert_hflip_u8(const unsigned char *src, unsigned char *dest,
+		int width)
 {
-	int x, y;
+	int i;
 
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width * 3;
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			src -= 3;
-			dest[0] = src[0];
-			dest[1] = src[1];
-			dest[2] = src[2];
-			dest += 3;
-		}
-		src += fmt->fmt.pix.bytesperline;
-	}
+	for (i = 0; i < width; i++)
+		dest[i] = src[width - 1 - i];
 }
 
-static void v4lconvert_hflip_yuv420(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
+/* Rotate a plane of 8 bit samples clockwise, width and height are the
+   dimensions after rotating, see the rotate90_u8 kernel */
+void v4lconvert_rotate90_u8(const unsigned char *src, int src_stride,
+		unsigned char *dest, int dest_stride, int width, int height)
 {
 	int x, y;
 
-	/* First flip the Y plane */
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline;
-	}
-
-	/* Now flip the U plane */
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline / 2;
-	}
+	src += (width - 1) * src_stride;
+	for (y = 0; y < height; y++) {
+		const unsigned char *s = src + y;
 
-	/* Last flip the V plane */
-	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
-		src += fmt->fmt.pix.bytesperline / 2;
+		for (x = 0; x < width; x++) {
+			dest[x] = *s;
+			s -= src_stride;
+		}
+		dest += dest_stride;
 	}
 }
 
-static void v4lconvert_rotate180_rgbbgr24(const unsigned char *src,
-		unsigned char *dst, int width, int height)
+struct v4lconvert_flip_job {
+	const struct v4lconvert_kernels *kernels;
+	const unsigned char *src;
+	unsigned char *dest;
+	int src_stride, dest_stride;
+	int width, height, bpp;
+};
+
+/* Mirror each line, with a negative src_stride and src pointing to the last
+   line this rotates the plane by 180 degrees */
+static void v4lconvert_hflip_lines(void *arg, int first, int last)
 {
-	int i;
-
-	src += 3 * width * height - 3;
-
-	for (i = 0; i < width * height; i++) {
-		dst[0] = src[0];
-		dst[1] = src[1];
-		dst[2] = src[2];
-		dst += 3;
-		src -= 3;
+	struct v4lconvert_flip_job *job = arg;
+	int x, y, bpp = job->bpp;
+
+	for (y = first; y < last; y++) {
+		const unsigned char *s = job->src + y * job->src_stride +
+					 (job->width - 1) * bpp;
+		unsigned char *d = job->dest + y * job->dest_stride;
+
+		if (bpp == 1) {
+			job->kernels->hflip_u8(s - (job->width - 1), d,
+					       job->width);
+		} else if (bpp == 3) {
+			for (x = 0; x < job->width; x++) {
+				d[0] = s[0];
+				d[1] = s[1];
+				d[2] = s[2];
+				d += 3;
+				s -= 3;
+			}
+		} else {
+			for (x = 0; x < job->width; x++) {
+				memcpy(d, s, bpp);
+				d += bpp;
+				s -= bpp;
+			}
+		}
 	}
 }
 
-static void v4lconvert_rotate180_yuv420(const unsigned char *src,
-		unsigned char *dst, int width, int height)
+static void v4lconvert_vflip_lines(void *arg, int first, int last)
 {
-	int i;
-
-	/* First flip x and y of the Y plane */
-	src += width * height - 1;
-	for (i = 0; i < width * height; i++)
-		*dst++ = *src--;
-
-	/* Now flip the U plane */
-	src += width * height * 5 / 4;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
+	struct v4lconvert_flip_job *job = arg;
+	int y;
 
-	/* Last flip the V plane */
-	src += width * height / 2;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
+	for (y = first; y < last; y++)
+		memcpy(job->dest + y * job->dest_stride,
+		       job->src + (job->height - 1 - y) * job->src_stride,
+		       job->width * job->bpp);
 }
 
-static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
-		unsigned char *dst, int destwidth, int destheight)
+/* Mirror a single line in place */
+void v4lconvert_hflip_rgbbgr24_line(unsigned char *line, int width)
 {
-	int x, y;
-#define srcwidth destheight
-#define srcheight destwidth
-
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = ((srcheight - x - 1) * srcwidth + y) * 3;
-			*dst++ = src[offset++];
-			*dst++ = src[offset++];
-			*dst++ = src[offset];
-		}
+	unsigned char *end = line + (width - 1) * 3;
+	unsigned char tmp[3];
+
+	while (line < end) {
+		memcpy(tmp, line, 3);
+		memcpy(line, end, 3);
+		memcpy(end, tmp, 3);
+		line += 3;
+		end -= 3;
+	}
 }
 
-static void v4lconvert_rotate90_yuv420(const unsigned char *src,
-		unsigned char *dst, int destwidth, int destheight)
-{
-	int x, y;
+/* Rotating reads the src a column at a time, so it is done in tiles of
+   V4LCONVERT_ROTATE_TILE x V4LCONVERT_ROTATE_TILE pixels, of which the src
+   and dest lines stay in the cache */
+#define V4LCONVERT_ROTATE_TILE 64
 
-	/* Y-plane */
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
-
-	/* U-plane */
-	src += srcwidth * srcheight;
-	destwidth /= 2;
-	destheight /= 2;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
-
-	/* V-plane */
-	src += srcwidth * srcheight;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
+/* Clockwise, job->width and job->height are the dimensions after rotating */
+static void v4lconvert_rotate90_lines(void *arg, int first, int last)
+{
+	struct v4lconvert_flip_job *job = arg;
+	int tx, ty, x, y, w, h, bpp = job->bpp;
+
+	for (ty = first; ty < last; ty += V4LCONVERT_ROTATE_TILE) {
+		h = MIN(V4LCONVERT_ROTATE_TILE, last - ty);
+		for (tx = 0; tx < job->width; tx += V4LCONVERT_ROTATE_TILE) {
+			/* Dest pixel (x, y) is src pixel (y, srcheight - 1 - x),
+			   the src of this tile starts at line srcheight - tx - w */
+			const unsigned char *src;
+			unsigned char *dest;
+
+			w = MIN(V4LCONVERT_ROTATE_TILE, job->width - tx);
+			src = job->src + (job->width - tx - w) * job->src_stride +
+			      ty * bpp;
+			dest = job->dest + ty * job->dest_stride + tx * bpp;
+
+			if (bpp == 1) {
+				job->kernels->rotate90_u8(src, job->src_stride,
+						dest, job->dest_stride, w, h);
+				continue;
+			}
+
+			for (y = 0; y < h; y++) {
+				const unsigned char *s = src +
+					(w - 1) * job->src_stride + y * bpp;
+				unsigned char *d = dest + y * job->dest_stride;
+
+				for (x = 0; x < w; x++) {
+					memcpy(d, s, bpp);
+					d += bpp;
+					s -= job->src_stride;
+				}
+			}
 		}
+	}
 }
 
-void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
+void v4lconvert_rotate90(struct v4lconvert_data *data,
+		const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, struct v4l2_format *fmt)
 {
-	int tmp;
+	int i, tmp, bpp, planes = v4lconvert_flip_planes(fmt, &bpp);
 
 	tmp = fmt->fmt.pix.width;
 	fmt->fmt.pix.width = fmt->fmt.pix.height;
 	fmt->fmt.pix.height = tmp;
 
-	switch (fmt->fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		v4lconvert_rotate90_rgbbgr24(src, dest, fmt->fmt.pix.width,
-				fmt->fmt.pix.height);
-		break;
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-		v4lconvert_rotate90_yuv420(src, dest, fmt->fmt.pix.width,
-				fmt->fmt.pix.height);
-		break;
+	for (i = 0; i < planes; i++) {
+		int shift = i ? 1 : 0;
+		struct v4lconvert_flip_job job = {
+			.kernels = data->kernels,
+			.src = src->plane[i],
+			.dest = dest->plane[i],
+			.src_stride = src->stride[i],
+			.dest_stride = dest->stride[i],
+			.width = fmt->fmt.pix.width >> shift,
+			.height = fmt->fmt.pix.height >> shift,
+			.bpp = bpp,
+		};
+
+		v4lconvert_threads_run(data->threads,
+				v4lconvert_rotate90_lines, &job, job.height);
 	}
 	v4lconvert_fixup_fmt(fmt);
 }
 
-void v4lconvert_flip(unsigned char *src, unsigned char *dest,
+void v4lconvert_flip(struct v4lconvert_data *data,
+		const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest,
 		struct v4l2_format *fmt, int hflip, int vflip)
 {
-	if (vflip && hflip) {
-		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_rotate180_rgbbgr24(src, dest, fmt->fmt.pix.width,
-					fmt->fmt.pix.height);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rotate180_yuv420(src, dest, fmt->fmt.pix.width,
-					fmt->fmt.pix.height);
-			break;
-		}
-	} else if (hflip) {
-		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_hflip_rgbbgr24(src, dest, fmt);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hflip_yuv420(src, dest, fmt);
-			break;
-		}
-	} else if (vflip) {
-		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_vflip_rgbbgr24(src, dest, fmt);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_vflip_yuv420(src, dest, fmt);
-			break;
+	int i, bpp, planes = v4lconvert_flip_planes(fmt, &bpp);
+
+	for (i = 0; i < planes; i++) {
+		int shift = i ? 1 : 0;
+		struct v4lconvert_flip_job job = {
+			.kernels = data->kernels,
+			.src = src->plane[i],
+			.dest = dest->plane[i],
+			.src_stride = src->stride[i],
+			.dest_stride = dest->stride[i],
+			.width = fmt->fmt.pix.width >> shift,
+			.height = fmt->fmt.pix.height >> shift,
+			.bpp = bpp,
+		};
+
+		if (vflip && hflip) {
+			job.src += (job.height - 1) * job.src_stride;
+			job.src_stride = -job.src_stride;
+			v4lconvert_threads_run(data->threads,
+					v4lconvert_hflip_lines, &job, job.height);
+		} else if (hflip) {
+			v4lconvert_threads_run(data->threads,
+					v4lconvert_hflip_lines, &job, job.height);
+		} else if (vflip) {
+			v4lconvert_threads_run(data->threads,
+					v4lconvert_vflip_lines, &job, job.height);
 		}
 	}
 
-	/* Our newly written data has no padding */
 	v4lconvert_fixup_fmt(fmt);
 }
@@ -29,6 +29,9 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "helper-shm.h"
 
 static int v4lconvert_helper_write(int fd, const void *b, size_t count,
   char *progname)
@@ -77,3 +80,57 @@ static int v4lconvert_helper_read(int fd, void *b, size_t count,
 
   return 0;
 }
+
+/* Returns the shm fd passed by libv4lconvert, or -1 when the frame data
+   is piped */
+static int v4lconvert_helper_shm_fd(int argc, char *argv[])
+{
+  if (argc == 3 && !strcmp(argv[1], "--shm"))
+    return atoi(argv[2]);
+
+  return -1;
+}
+
+/* Point src and dest at the frame data in the shm, the shm gets (re)mapped
+   when libv4lconvert has grown it */
+static int v4lconvert_helper_shm_map(int fd, int src_size, int dest_size,
+  unsigned char **src, unsigned char **dest, char *progname)
+{
+  static unsigned char *map;
+  static size_t map_size;
+  size_t size = V4LCONVERT_HELPER_SHM_DEST(src_size) + dest_size;
+  struct stat st;
+
+  if (size > map_size) {
+    if (map) {
+      munmap(map, map_size);
+      map = NULL;
+      map_size = 0;
+    }
+
+    if (fstat(fd, &st)) {
+      fprintf(stderr, "%s: error with shm: %s\n", progname, strerror(errno));
+      return -1;
+    }
+
+    if (st.st_size < size) {
+      fprintf(stderr, "%s: error: shm too small, need: %zu\n", progname,
+	      size);
+      return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "%s: error mapping shm: %s\n", progname,
+	      strerror(errno));
+      map = NULL;
+      return -1;
+    }
+    map_size = st.st_size;
+  }
+
+  *src = map;
+  *dest = map + V4LCONVERT_HELPER_SHM_DEST(src_size);
+
+  return 0;
+}
@@ -22,8 +22,11 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include "libv4lconvert-priv.h"
+#include "helper-shm.h"
 
 #define READ_END  0
 #define WRITE_END 1
@@ -46,11 +49,24 @@
    From the helper to libv4l the following is send:
    int			data length (-1 in case of a decompression error)
    unsigned char[]	data (not present when a decompression error happened)
+
+   When memfd_create() is available the helper gets started with
+   "--shm <fd>" and the frame data is not send through the pipes at all,
+   only the ints are. We copy the src data to the start of the shared memory
+   and the helper decompresses it into the shared memory directly behind it
+   (at V4LCONVERT_HELPER_SHM_DEST(src_size)), from where it gets used as is.
+   This saves the 4 kernel copies of piping every frame there and back.
  */
 
 static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		const char *helper)
 {
+#ifdef HAVE_MEMFD_CREATE
+	/* Fall back to piping the frame data when this fails */
+	data->decompress_shm_fd = memfd_create("libv4lconvert-helper",
+					       MFD_CLOEXEC);
+#endif
+
 	if (pipe(data->decompress_in_pipe)) {
 		V4LCONVERT_ERR("with helper pipe: %s\n", strerror(errno));
 		goto error;
@@ -85,7 +101,20 @@ static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		}
 
 		/* And execute the helper */
-		execl(helper, helper, NULL);
+		if (data->decompress_shm_fd != -1) {
+			char fd_str[16];
+
+			/* Let the shm fd survive the exec */
+			if (fcntl(data->decompress_shm_fd, F_SETFD, 0) == -1) {
+				perror("libv4lconvert: error with helper fcntl");
+				exit(1);
+			}
+			snprintf(fd_str, sizeof(fd_str), "%d",
+				 data->decompress_shm_fd);
+			execl(helper, helper, "--shm", fd_str, NULL);
+		} else {
+			execl(helper, helper, NULL);
+		}
 
 		/* We should never get here */
 		perror("libv4lconvert: error starting helper");
@@ -105,9 +134,41 @@ error_close_in_pipe:
 	close(data->decompress_in_pipe[READ_END]);
 	close(data->decompress_in_pipe[WRITE_END]);
 error:
+	if (data->decompress_shm_fd != -1) {
+		close(data->decompress_shm_fd);
+		data->decompress_shm_fd = -1;
+	}
 	return -1;
 }
 
+static int v4lconvert_helper_shm_resize(struct v4lconvert_data *data,
+		int size)
+{
+	unsigned char *shm;
+
+	/* Grow in 64k steps, so that the helper does not need to remap often */
+	size = (size + 65535) & ~65535;
+
+	if (ftruncate(data->decompress_shm_fd, size)) {
+		V4LCONVERT_ERR("resizing helper shm: %s\n", strerror(errno));
+		return -1;
+	}
+
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   data->decompress_shm_fd, 0);
+	if (shm == MAP_FAILED) {
+		V4LCONVERT_ERR("mapping helper shm: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (data->decompress_shm)
+		munmap(data->decompress_shm, data->decompress_shm_size);
+	data->decompress_shm = shm;
+	data->decompress_shm_size = size;
+
+	return 0;
+}
+
 /* IMPROVE ME: we could block SIGPIPE here using pthread_sigmask()
    and then in case of EPIPE consume the signal using
    sigtimedwait (we need to check if a blocked signal wasn't present
@@ -165,46 +226,64 @@ static int v4lconvert_helper_read(struct v4lconvert_data *data, void *b,
 	return 0;
 }
 
-int v4lconvert_helper_decompress(struct v4lconvert_data *data,
+/* Returns a pointer to the decompressed yuv420 frame, this is dest when the
+   frame data got piped and the shared memory with the helper otherwise, in
+   which case it stays valid until the next call. Returns NULL on error. */
+unsigned char *v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int flags)
 {
-	int r;
+	int r, shm_dest = V4LCONVERT_HELPER_SHM_DEST(src_size);
 
 	if (data->decompress_pid == -1) {
 		if (v4lconvert_helper_start(data, helper))
-			return -1;
+			return NULL;
+	}
+
+	if (data->decompress_shm_fd != -1) {
+		if (shm_dest + dest_size > data->decompress_shm_size &&
+		    v4lconvert_helper_shm_resize(data, shm_dest + dest_size))
+			return NULL;
+
+		memcpy(data->decompress_shm, src, src_size);
 	}
 
 	if (v4lconvert_helper_write(data, &width, sizeof(int)))
-		return -1;
+		return NULL;
 
 	if (v4lconvert_helper_write(data, &height, sizeof(int)))
-		return -1;
+		return NULL;
 
 	if (v4lconvert_helper_write(data, &flags, sizeof(int)))
-		return -1;
+		return NULL;
 
 	if (v4lconvert_helper_write(data, &src_size, sizeof(int)))
-		return -1;
+		return NULL;
 
-	if (v4lconvert_helper_write(data, src, src_size))
-		return -1;
+	if (data->decompress_shm_fd == -1 &&
+	    v4lconvert_helper_write(data, src, src_size))
+		return NULL;
 
 	if (v4lconvert_helper_read(data, &r, sizeof(int)))
-		return -1;
+		return NULL;
 
 	if (r < 0) {
 		V4LCONVERT_ERR("decompressing frame data\n");
-		return -1;
+		return NULL;
 	}
 
 	if (dest_size < r) {
 		V4LCONVERT_ERR("destination buffer to small\n");
-		return -1;
+		return NULL;
 	}
 
-	return v4lconvert_helper_read(data, dest, r);
+	if (data->decompress_shm_fd != -1)
+		return data->decompress_shm + shm_dest;
+
+	if (v4lconvert_helper_read(data, dest, r))
+		return NULL;
+
+	return dest;
 }
 
 void v4lconvert_helper_cleanup(struct v4lconvert_data *data)
@@ -217,4 +296,15 @@ void v4lconvert_helper_cleanup(struct v4lconvert_data *data)
 		waitpid(data->decompress_pid, &status, 0);
 		data->decompress_pid = -1;
 	}
+
+	if (data->decompress_shm) {
+		munmap(data->decompress_shm, data->decompress_shm_size);
+		data->decompress_shm = NULL;
+		data->decompress_shm_size = 0;
+	}
+
+	if (data->decompress_shm_fd != -1) {
+		close(data->decompress_shm_fd);
+		data->decompress_shm_fd = -1;
+	}
 }
@@ -0,0 +1,333 @@
+/*
+ * jidctint.c
+ *
+ * Copyright (C) 1994-1998, Thomas G. Lane.
+ * This file is part of the Independent JPEG Group's software.
+ *
+ * The authors make NO WARRANTY or representation, either express or implied,
+ * with respect to this software, its quality, accuracy, merchantability, or
+ * fitness for a particular purpose.  This software is provided "AS IS", and you,
+ * its user, assume the entire risk as to its quality and accuracy.
+ *
+ * This software is copyright (C) 1991-1998, Thomas G. Lane.
+ * All Rights Reserved except as specified below.
+ *
+ * Permission is hereby granted to use, copy, modify, and distribute this
+ * software (or portions thereof) for any purpose, without fee, subject to these
+ * conditions:
+ * (1) If any part of the source code for this software is distributed, then this
+ * README file must be included, with this copyright and no-warranty notice
+ * unaltered; and any additions, deletions, or changes to the original files
+ * must be clearly indicated in accompanying documentation.
+ * (2) If only executable code is distributed, then the accompanying
+ * documentation must state that "this software is based in part on the work of
+ * the Independent JPEG Group".
+ * (3) Permission for use of this software is granted only if the user accepts
+ * full responsibility for any undesirable consequences; the authors accept
+ * NO LIABILITY for damages of any kind.
+ *
+ * These conditions apply to any software derived from or based on the IJG code,
+ * not just to the unmodified library.  If you use our work, you ought to
+ * acknowledge us.
+ *
+ * Permission is NOT granted for the use of any IJG author's name or company name
+ * in advertising or publicity relating to this software or products derived from
+ * it.  This software may be referred to only as "the Independent JPEG Group's
+ * software".
+ *
+ * We specifically permit and encourage the use of this software as the basis of
+ * commercial products, provided that all warranty or liability claims are
+ * assumed by the product vendor.
+ *
+ *
+ * This file contains a slow-but-accurate integer implementation of the
+ * inverse DCT (Discrete Cosine Transform).  In the IJG code, this routine
+ * must also perform dequantization of the input coefficients.
+ *
+ * A 2-D IDCT can be done by 1-D IDCT on each column followed by 1-D IDCT
+ * on each row (or vice versa, but it's more convenient to emit a row at
+ * a time).  Direct algorithms are also available, but they are much more
+ * complex and seem not to be any faster when reduced to code.
+ *
+ * The poop on this scaling stuff is as follows:
+ *
+ * Each 1-D IDCT step produces outputs which are a factor of sqrt(N)
+ * larger than the true IDCT outputs.  The final outputs are therefore
+ * a factor of N larger than desired; since N=8 this can be cured by
+ * a simple right shift at the end of the algorithm.  The advantage of
+ * this arrangement is that we save two multiplications per 1-D IDCT,
+ * because the y0 and y4 inputs need not be divided by sqrt(N).
+ *
+ * We have to do addition and subtraction of the integer inputs, which
+ * is no problem, and multiplication by fractional constants, which is
+ * a problem to do in integer arithmetic.  We multiply all the constants
+ * by CONST_SCALE and convert them to integer constants (thus retaining
+ * CONST_BITS bits of precision in the constants).  After doing a
+ * multiplication we have to divide the product by CONST_SCALE, with proper
+ * rounding, to produce the correct output.  This division can be done
+ * cheaply as a right shift of CONST_BITS bits.  We postpone shifting
+ * as long as possible so that partial sums can be added together with
+ * full fractional precision.
+ *
+ * The outputs of the first pass are scaled up by PASS1_BITS bits so that
+ * they are represented to better-than-integral precision.  These outputs
+ * require BITS_IN_JSAMPLE + PASS1_BITS + 3 bits; this fits in a 16-bit word
+ * with the recommended scaling.
+ *
+ * This implementation is based on an algorithm described in
+ *   C. Loeffler, A. Ligtenberg and G. Moschytz, "Practical Fast 1-D DCT
+ *   Algorithms with 11 Multiplications", Proc. Int'l. Conf. on Acoustics,
+ *   Speech, and Signal Processing 1989 (ICASSP '89), pp. 988-991.
+ * The primary algorithm described there uses 11 multiplies and 29 adds.
+ * We use their alternate method with 12 multiplies and 32 adds.
+ *
+ * Modified for tinyjpeg: the quantization table holds the plain (not
+ * prescaled) quantization values in natural order. The SSE2 and NEON
+ * versions in simd-x86.c and simd-neon.c produce identical results for
+ * valid JPEG data (dequantized coefficients which fit in 16 bits).
+ * Intermediate values are 64 bits wide, so that corrupt data cannot
+ * overflow them.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "tinyjpeg-internal.h"
+
+#define DCTSIZE	   8
+#define DCTSIZE2   (DCTSIZE * DCTSIZE)
+
+#define DEQUANTIZE(coef, quantval)  (((int) (coef)) * (quantval))
+
+#define DESCALE(x, n)  (((x) + (1 << ((n) - 1))) >> (n))
+
+/* Left shift of a possibly negative value, without undefined behavior */
+#define LEFT_SHIFT(x, n)  ((int64_t) ((uint64_t) (x) << (n)))
+
+static inline uint8_t range_limit(int64_t x)
+{
+	x += 128;
+	if (x > 255)
+		return 255;
+	if (x < 0)
+		return 0;
+	return x;
+}
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients.
+ */
+
+void tinyjpeg_idct_islow(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride)
+{
+	int64_t tmp0, tmp1, tmp2, tmp3;
+	int64_t tmp10, tmp11, tmp12, tmp13;
+	int64_t z1, z2, z3, z4, z5;
+	const int16_t *inptr;
+	const int16_t *quantptr;
+	int64_t *wsptr;
+	uint8_t *outptr;
+	int ctr;
+	int64_t workspace[DCTSIZE2]; /* buffers data between passes */
+
+	/* Pass 1: process columns from input, store into work array. */
+	/* Note results are scaled up by sqrt(8) compared to a true IDCT; */
+	/* furthermore, we scale the results by 2**PASS1_BITS. */
+
+	inptr = coef;
+	quantptr = quant;
+	wsptr = workspace;
+	for (ctr = DCTSIZE; ctr > 0; ctr--) {
+		/* Due to quantization, we will usually find that many of the input
+		 * coefficients are zero, especially the AC terms.  We can exploit this
+		 * by short-circuiting the IDCT calculation for any column in which all
+		 * the AC terms are zero.  In that case each output is equal to the
+		 * DC coefficient (with scale factor as needed).
+		 * With typical images and quantization tables, half or more of the
+		 * column DCT calculations can be simplified this way.
+		 */
+
+		if (inptr[DCTSIZE*1] == 0 && inptr[DCTSIZE*2] == 0 &&
+				inptr[DCTSIZE*3] == 0 && inptr[DCTSIZE*4] == 0 &&
+				inptr[DCTSIZE*5] == 0 && inptr[DCTSIZE*6] == 0 &&
+				inptr[DCTSIZE*7] == 0) {
+			/* AC terms all zero */
+			int64_t dcval = LEFT_SHIFT(DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]), PASS1_BITS);
+
+			wsptr[DCTSIZE*0] = dcval;
+			wsptr[DCTSIZE*1] = dcval;
+			wsptr[DCTSIZE*2] = dcval;
+			wsptr[DCTSIZE*3] = dcval;
+			wsptr[DCTSIZE*4] = dcval;
+			wsptr[DCTSIZE*5] = dcval;
+			wsptr[DCTSIZE*6] = dcval;
+			wsptr[DCTSIZE*7] = dcval;
+
+			inptr++;			/* advance pointers to next column */
+			quantptr++;
+			wsptr++;
+			continue;
+		}
+
+		/* Even part: reverse the even part of the forward DCT. */
+		/* The rotator is sqrt(2)*c(-6). */
+
+		z2 = DEQUANTIZE(inptr[DCTSIZE*2], quantptr[DCTSIZE*2]);
+		z3 = DEQUANTIZE(inptr[DCTSIZE*6], quantptr[DCTSIZE*6]);
+
+		z1 = (z2 + z3) * FIX_0_541196100;
+		tmp2 = z1 + z3 * (-FIX_1_847759065);
+		tmp3 = z1 + z2 * FIX_0_765366865;
+
+		z2 = DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]);
+		z3 = DEQUANTIZE(inptr[DCTSIZE*4], quantptr[DCTSIZE*4]);
+
+		tmp0 = LEFT_SHIFT(z2 + z3, CONST_BITS);
+		tmp1 = LEFT_SHIFT(z2 - z3, CONST_BITS);
+
+		tmp10 = tmp0 + tmp3;
+		tmp13 = tmp0 - tmp3;
+		tmp11 = tmp1 + tmp2;
+		tmp12 = tmp1 - tmp2;
+
+		/* Odd part per figure 8; the matrix is unitary and hence its
+		 * transpose is its inverse.  i0..i3 are y7,y5,y3,y1 respectively.
+		 */
+
+		tmp0 = DEQUANTIZE(inptr[DCTSIZE*7], quantptr[DCTSIZE*7]);
+		tmp1 = DEQUANTIZE(inptr[DCTSIZE*5], quantptr[DCTSIZE*5]);
+		tmp2 = DEQUANTIZE(inptr[DCTSIZE*3], quantptr[DCTSIZE*3]);
+		tmp3 = DEQUANTIZE(inptr[DCTSIZE*1], quantptr[DCTSIZE*1]);
+
+		z1 = tmp0 + tmp3;
+		z2 = tmp1 + tmp2;
+		z3 = tmp0 + tmp2;
+		z4 = tmp1 + tmp3;
+		z5 = (z3 + z4) * FIX_1_175875602; /* sqrt(2) * c3 */
+
+		tmp0 = tmp0 * FIX_0_298631336; /* sqrt(2) * (-c1+c3+c5-c7) */
+		tmp1 = tmp1 * FIX_2_053119869; /* sqrt(2) * ( c1+c3-c5+c7) */
+		tmp2 = tmp2 * FIX_3_072711026; /* sqrt(2) * ( c1+c3+c5-c7) */
+		tmp3 = tmp3 * FIX_1_501321110; /* sqrt(2) * ( c1+c3-c5-c7) */
+		z1 = z1 * (-FIX_0_899976223); /* sqrt(2) * ( c7-c3) */
+		z2 = z2 * (-FIX_2_562915447); /* sqrt(2) * (-c1-c3) */
+		z3 = z3 * (-FIX_1_961570560); /* sqrt(2) * (-c3-c5) */
+		z4 = z4 * (-FIX_0_390180644); /* sqrt(2) * ( c5-c3) */
+
+		z3 += z5;
+		z4 += z5;
+
+		tmp0 += z1 + z3;
+		tmp1 += z2 + z4;
+		tmp2 += z2 + z3;
+		tmp3 += z1 + z4;
+
+		/* Final output stage: inputs are tmp10..tmp13, tmp0..tmp3 */
+
+		wsptr[DCTSIZE*0] = DESCALE(tmp10 + tmp3, CONST_BITS-PASS1_BITS);
+		wsptr[DCTSIZE*7] = DESCALE(tmp10 - tmp3, CONST_BITS-PASS1_BITS);
+		wsptr[DCTSIZE*1] = DESCALE(tmp11 + tmp2, CONST_BITS-PASS1_BITS);
+		wsptr[DCTSIZE*6] = DESCALE(tmp11 - tmp2, CONST_BITS-PASS1_BITS);
+		wsptr[DCTSIZE*2] = DESCALE(tmp12 + tmp1, CONST_BITS-PASS1_BITS);
+		wsptr[DCTSIZE*5] = DESCALE(tmp12 - tmp1, CONST_BITS-PASS1_BITS);
+		wsptr[DCTSIZE*3] = DESCALE(tmp13 + tmp0, CONST_BITS-PASS1_BITS);
+		wsptr[DCTSIZE*4] = DESCALE(tmp13 - tmp0, CONST_BITS-PASS1_BITS);
+
+		inptr++;			/* advance pointers to next column */
+		quantptr++;
+		wsptr++;
+	}
+
+	/* Pass 2: process rows from work array, store into output array. */
+	/* Note that we must descale the results by a factor of 8 == 2**3, */
+	/* and also undo the PASS1_BITS scaling. */
+
+	wsptr = workspace;
+	outptr = output_buf;
+	for (ctr = 0; ctr < DCTSIZE; ctr++) {
+		/* Rows of zeroes can be exploited in the same way as we did with columns.
+		 * However, the column calculation has created many nonzero AC terms, so
+		 * the simplification applies less often (typically 5% to 10% of the time).
+		 * On machines with very fast multiplication, it's possible that the
+		 * test takes more time than it's worth.  In that case this section
+		 * may be commented out.
+		 */
+
+		if (wsptr[1] == 0 && wsptr[2] == 0 && wsptr[3] == 0 &&
+				wsptr[4] == 0 && wsptr[5] == 0 && wsptr[6] == 0 &&
+				wsptr[7] == 0) {
+			/* AC terms all zero */
+			uint8_t outval = range_limit(DESCALE(wsptr[0], PASS1_BITS+3));
+
+			memset(outptr, outval, DCTSIZE);
+
+			wsptr += DCTSIZE;		/* advance pointer to next row */
+			outptr += stride;
+			continue;
+		}
+
+		/* Even part: reverse the even part of the forward DCT. */
+		/* The rotator is sqrt(2)*c(-6). */
+
+		z2 = wsptr[2];
+		z3 = wsptr[6];
+
+		z1 = (z2 + z3) * FIX_0_541196100;
+		tmp2 = z1 + z3 * (-FIX_1_847759065);
+		tmp3 = z1 + z2 * FIX_0_765366865;
+
+		tmp0 = LEFT_SHIFT(wsptr[0] + wsptr[4], CONST_BITS);
+		tmp1 = LEFT_SHIFT(wsptr[0] - wsptr[4], CONST_BITS);
+
+		tmp10 = tmp0 + tmp3;
+		tmp13 = tmp0 - tmp3;
+		tmp11 = tmp1 + tmp2;
+		tmp12 = tmp1 - tmp2;
+
+		/* Odd part per figure 8; the matrix is unitary and hence its
+		 * transpose is its inverse.  i0..i3 are y7,y5,y3,y1 respectively.
+		 */
+
+		tmp0 = wsptr[7];
+		tmp1 = wsptr[5];
+		tmp2 = wsptr[3];
+		tmp3 = wsptr[1];
+
+		z1 = tmp0 + tmp3;
+		z2 = tmp1 + tmp2;
+		z3 = tmp0 + tmp2;
+		z4 = tmp1 + tmp3;
+		z5 = (z3 + z4) * FIX_1_175875602; /* sqrt(2) * c3 */
+
+		tmp0 = tmp0 * FIX_0_298631336; /* sqrt(2) * (-c1+c3+c5-c7) */
+		tmp1 = tmp1 * FIX_2_053119869; /* sqrt(2) * ( c1+c3-c5+c7) */
+		tmp2 = tmp2 * FIX_3_072711026; /* sqrt(2) * ( c1+c3+c5-c7) */
+		tmp3 = tmp3 * FIX_1_501321110; /* sqrt(2) * ( c1+c3-c5-c7) */
+		z1 = z1 * (-FIX_0_899976223); /* sqrt(2) * ( c7-c3) */
+		z2 = z2 * (-FIX_2_562915447); /* sqrt(2) * (-c1-c3) */
+		z3 = z3 * (-FIX_1_961570560); /* sqrt(2) * (-c3-c5) */
+		z4 = z4 * (-FIX_0_390180644); /* sqrt(2) * ( c5-c3) */
+
+		z3 += z5;
+		z4 += z5;
+
+		tmp0 += z1 + z3;
+		tmp1 += z2 + z4;
+		tmp2 += z2 + z3;
+		tmp3 += z1 + z4;
+
+		/* Final output stage: inputs are tmp10..tmp13, tmp0..tmp3 */
+
+		outptr[0] = range_limit(DESCALE(tmp10 + tmp3, CONST_BITS+PASS1_BITS+3));
+		outptr[7] = range_limit(DESCALE(tmp10 - tmp3, CONST_BITS+PASS1_BITS+3));
+		outptr[1] = range_limit(DESCALE(tmp11 + tmp2, CONST_BITS+PASS1_BITS+3));
+		outptr[6] = range_limit(DESCALE(tmp11 - tmp2, CONST_BITS+PASS1_BITS+3));
+		outptr[2] = range_limit(DESCALE(tmp12 + tmp1, CONST_BITS+PASS1_BITS+3));
+		outptr[5] = range_limit(DESCALE(tmp12 - tmp1, CONST_BITS+PASS1_BITS+3));
+		outptr[3] = range_limit(DESCALE(tmp13 + tmp0, CONST_BITS+PASS1_BITS+3));
+		outptr[4] = range_limit(DESCALE(tmp13 - tmp0, CONST_BITS+PASS1_BITS+3));
+
+		wsptr += DCTSIZE;		/* advance pointer to next row */
+		outptr += stride;
+	}
+}
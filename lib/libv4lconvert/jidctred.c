@@ -0,0 +1,328 @@
+/*
+ * jidctred.c
+ *
+ * Copyright (C) 1994-1998, Thomas G. Lane.
+ * This file is part of the Independent JPEG Group's software.
+ *
+ * The authors make NO WARRANTY or representation, either express or implied,
+ * with respect to this software, its quality, accuracy, merchantability, or
+ * fitness for a particular purpose.  This software is provided "AS IS", and you,
+ * its user, assume the entire risk as to its quality and accuracy.
+ *
+ * This software is copyright (C) 1991-1998, Thomas G. Lane.
+ * All Rights Reserved except as specified below.
+ *
+ * Permission is hereby granted to use, copy, modify, and distribute this
+ * software (or portions thereof) for any purpose, without fee, subject to these
+ * conditions:
+ * (1) If any part of the source code for this software is distributed, then this
+ * README file must be included, with this copyright and no-warranty notice
+ * unaltered; and any additions, deletions, or changes to the original files
+ * must be clearly indicated in accompanying documentation.
+ * (2) If only executable code is distributed, then the accompanying
+ * documentation must state that "this software is based in part on the work of
+ * the Independent JPEG Group".
+ * (3) Permission for use of this software is granted only if the user accepts
+ * full responsibility for any undesirable consequences; the authors accept
+ * NO LIABILITY for damages of any kind.
+ *
+ * These conditions apply to any software derived from or based on the IJG code,
+ * not just to the unmodified library.  If you use our work, you ought to
+ * acknowledge us.
+ *
+ * Permission is NOT granted for the use of any IJG author's name or company name
+ * in advertising or publicity relating to this software or products derived from
+ * it.  This software may be referred to only as "the Independent JPEG Group's
+ * software".
+ *
+ * We specifically permit and encourage the use of this software as the basis of
+ * commercial products, provided that all warranty or liability claims are
+ * assumed by the product vendor.
+ *
+ *
+ * This file contains inverse-DCT routines that produce reduced-size output:
+ * either 4x4, 2x2, or 1x1 pixels from an 8x8 DCT block.
+ *
+ * The implementation is based on the Loeffler, Ligtenberg and Moschytz (LL&M)
+ * algorithm used in jidctint.c.  We simply replace each 8-to-8 1-D IDCT step
+ * with an 8-to-4 step that produces the four averages of two adjacent outputs
+ * (or an 8-to-2 step producing two averages of four outputs, for 2x2 output).
+ * These steps were derived by computing the corresponding values at the end
+ * of the normal LL&M code, then simplifying as much as possible.
+ *
+ * 1x1 is trivial: just take the DC coefficient divided by 8.
+ *
+ * See jidctint.c for additional comments.
+ *
+ * Modified for tinyjpeg: the quantization table holds the plain quantization
+ * values in natural order and intermediate values are 64 bits wide, as in
+ * tinyjpeg_idct_islow(). These are used for decoding at 1/2, 1/4 and 1/8 of
+ * the frame size.
+ */
+
+#include <stdint.h>
+#include "tinyjpeg-internal.h"
+
+#define DCTSIZE	   8
+
+#define FIX_0_211164243  1730		/* FIX(0.211164243) */
+#define FIX_0_509795579  4176		/* FIX(0.509795579) */
+#define FIX_0_601344887  4926		/* FIX(0.601344887) */
+#define FIX_0_720959822  5906		/* FIX(0.720959822) */
+#define FIX_0_850430095  6967		/* FIX(0.850430095) */
+#define FIX_1_061594337  8697		/* FIX(1.061594337) */
+#define FIX_1_272758580  10426		/* FIX(1.272758580) */
+#define FIX_1_451774981  11893		/* FIX(1.451774981) */
+#define FIX_2_172734803  17799		/* FIX(2.172734803) */
+#define FIX_3_624509785  29692		/* FIX(3.624509785) */
+
+#define DEQUANTIZE(coef, quantval)  (((int) (coef)) * (quantval))
+
+#define DESCALE(x, n)  (((x) + (1 << ((n) - 1))) >> (n))
+
+/* Left shift of a possibly negative value, without undefined behavior */
+#define LEFT_SHIFT(x, n)  ((int64_t) ((uint64_t) (x) << (n)))
+
+static inline uint8_t range_limit(int64_t x)
+{
+	x += 128;
+	if (x > 255)
+		return 255;
+	if (x < 0)
+		return 0;
+	return x;
+}
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients,
+ * producing a reduced-size 4x4 output block.
+ */
+
+void tinyjpeg_idct_4x4(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride)
+{
+	int64_t tmp0, tmp2, tmp10, tmp12;
+	int64_t z1, z2, z3, z4;
+	const int16_t *inptr = coef;
+	const int16_t *quantptr = quant;
+	int64_t *wsptr;
+	uint8_t *outptr;
+	int ctr;
+	int64_t workspace[DCTSIZE * 4];	/* buffers data between passes */
+
+	/* Pass 1: process columns from input, store into work array. */
+
+	wsptr = workspace;
+	for (ctr = DCTSIZE; ctr > 0; inptr++, quantptr++, wsptr++, ctr--) {
+		/* Don't bother to process column 4, because second pass won't use it */
+		if (ctr == DCTSIZE - 4)
+			continue;
+		if (inptr[DCTSIZE * 1] == 0 && inptr[DCTSIZE * 2] == 0 &&
+		    inptr[DCTSIZE * 3] == 0 && inptr[DCTSIZE * 5] == 0 &&
+		    inptr[DCTSIZE * 6] == 0 && inptr[DCTSIZE * 7] == 0) {
+			/* AC terms all zero; we need not examine term 4 for 4x4 output */
+			int64_t dcval = LEFT_SHIFT(DEQUANTIZE(inptr[DCTSIZE * 0],
+					quantptr[DCTSIZE * 0]), PASS1_BITS);
+
+			wsptr[DCTSIZE * 0] = dcval;
+			wsptr[DCTSIZE * 1] = dcval;
+			wsptr[DCTSIZE * 2] = dcval;
+			wsptr[DCTSIZE * 3] = dcval;
+			continue;
+		}
+
+		/* Even part */
+
+		tmp0 = DEQUANTIZE(inptr[DCTSIZE * 0], quantptr[DCTSIZE * 0]);
+		tmp0 = LEFT_SHIFT(tmp0, CONST_BITS + 1);
+
+		z2 = DEQUANTIZE(inptr[DCTSIZE * 2], quantptr[DCTSIZE * 2]);
+		z3 = DEQUANTIZE(inptr[DCTSIZE * 6], quantptr[DCTSIZE * 6]);
+
+		tmp2 = z2 * FIX_1_847759065 - z3 * FIX_0_765366865;
+
+		tmp10 = tmp0 + tmp2;
+		tmp12 = tmp0 - tmp2;
+
+		/* Odd part */
+
+		z1 = DEQUANTIZE(inptr[DCTSIZE * 7], quantptr[DCTSIZE * 7]);
+		z2 = DEQUANTIZE(inptr[DCTSIZE * 5], quantptr[DCTSIZE * 5]);
+		z3 = DEQUANTIZE(inptr[DCTSIZE * 3], quantptr[DCTSIZE * 3]);
+		z4 = DEQUANTIZE(inptr[DCTSIZE * 1], quantptr[DCTSIZE * 1]);
+
+		tmp0 = - z1 * FIX_0_211164243	/* sqrt(2) * (c3-c1) */
+		       + z2 * FIX_1_451774981	/* sqrt(2) * (c3+c7) */
+		       - z3 * FIX_2_172734803	/* sqrt(2) * (-c1-c5) */
+		       + z4 * FIX_1_061594337;	/* sqrt(2) * (c5+c7) */
+
+		tmp2 = - z1 * FIX_0_509795579	/* sqrt(2) * (c7-c5) */
+		       - z2 * FIX_0_601344887	/* sqrt(2) * (c5-c1) */
+		       + z3 * FIX_0_899976223	/* sqrt(2) * (c3-c7) */
+		       + z4 * FIX_2_562915447;	/* sqrt(2) * (c1+c3) */
+
+		/* Final output stage */
+
+		wsptr[DCTSIZE * 0] = DESCALE(tmp10 + tmp2, CONST_BITS - PASS1_BITS + 1);
+		wsptr[DCTSIZE * 3] = DESCALE(tmp10 - tmp2, CONST_BITS - PASS1_BITS + 1);
+		wsptr[DCTSIZE * 1] = DESCALE(tmp12 + tmp0, CONST_BITS - PASS1_BITS + 1);
+		wsptr[DCTSIZE * 2] = DESCALE(tmp12 - tmp0, CONST_BITS - PASS1_BITS + 1);
+	}
+
+	/* Pass 2: process 4 rows from work array, store into output array. */
+
+	wsptr = workspace;
+	for (ctr = 0; ctr < 4; ctr++) {
+		outptr = output_buf + ctr * stride;
+
+		if (wsptr[1] == 0 && wsptr[2] == 0 && wsptr[3] == 0 &&
+		    wsptr[5] == 0 && wsptr[6] == 0 && wsptr[7] == 0) {
+			/* AC terms all zero */
+			uint8_t outval = range_limit(DESCALE(wsptr[0], PASS1_BITS + 3));
+
+			outptr[0] = outval;
+			outptr[1] = outval;
+			outptr[2] = outval;
+			outptr[3] = outval;
+
+			wsptr += DCTSIZE;	/* advance pointer to next row */
+			continue;
+		}
+
+		/* Even part */
+
+		tmp0 = LEFT_SHIFT(wsptr[0], CONST_BITS + 1);
+
+		tmp2 = wsptr[2] * FIX_1_847759065 - wsptr[6] * FIX_0_765366865;
+
+		tmp10 = tmp0 + tmp2;
+		tmp12 = tmp0 - tmp2;
+
+		/* Odd part */
+
+		z1 = wsptr[7];
+		z2 = wsptr[5];
+		z3 = wsptr[3];
+		z4 = wsptr[1];
+
+		tmp0 = - z1 * FIX_0_211164243	/* sqrt(2) * (c3-c1) */
+		       + z2 * FIX_1_451774981	/* sqrt(2) * (c3+c7) */
+		       - z3 * FIX_2_172734803	/* sqrt(2) * (-c1-c5) */
+		       + z4 * FIX_1_061594337;	/* sqrt(2) * (c5+c7) */
+
+		tmp2 = - z1 * FIX_0_509795579	/* sqrt(2) * (c7-c5) */
+		       - z2 * FIX_0_601344887	/* sqrt(2) * (c5-c1) */
+		       + z3 * FIX_0_899976223	/* sqrt(2) * (c3-c7) */
+		       + z4 * FIX_2_562915447;	/* sqrt(2) * (c1+c3) */
+
+		/* Final output stage */
+
+		outptr[0] = range_limit(DESCALE(tmp10 + tmp2,
+					CONST_BITS + PASS1_BITS + 3 + 1));
+		outptr[3] = range_limit(DESCALE(tmp10 - tmp2,
+					CONST_BITS + PASS1_BITS + 3 + 1));
+		outptr[1] = range_limit(DESCALE(tmp12 + tmp0,
+					CONST_BITS + PASS1_BITS + 3 + 1));
+		outptr[2] = range_limit(DESCALE(tmp12 - tmp0,
+					CONST_BITS + PASS1_BITS + 3 + 1));
+
+		wsptr += DCTSIZE;	/* advance pointer to next row */
+	}
+}
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients,
+ * producing a reduced-size 2x2 output block.
+ */
+
+void tinyjpeg_idct_2x2(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride)
+{
+	int64_t tmp0, tmp10, z1;
+	const int16_t *inptr = coef;
+	const int16_t *quantptr = quant;
+	int64_t *wsptr;
+	uint8_t *outptr;
+	int ctr;
+	int64_t workspace[DCTSIZE * 2];	/* buffers data between passes */
+
+	/* Pass 1: process columns from input, store into work array. */
+
+	wsptr = workspace;
+	for (ctr = DCTSIZE; ctr > 0; inptr++, quantptr++, wsptr++, ctr--) {
+		/* Don't bother to process columns 2,4,6 */
+		if (ctr == DCTSIZE - 2 || ctr == DCTSIZE - 4 || ctr == DCTSIZE - 6)
+			continue;
+		if (inptr[DCTSIZE * 1] == 0 && inptr[DCTSIZE * 3] == 0 &&
+		    inptr[DCTSIZE * 5] == 0 && inptr[DCTSIZE * 7] == 0) {
+			/* AC terms all zero; we need not examine terms 2,4,6 for 2x2 output */
+			int64_t dcval = LEFT_SHIFT(DEQUANTIZE(inptr[DCTSIZE * 0],
+					quantptr[DCTSIZE * 0]), PASS1_BITS);
+
+			wsptr[DCTSIZE * 0] = dcval;
+			wsptr[DCTSIZE * 1] = dcval;
+			continue;
+		}
+
+		/* Even part */
+
+		z1 = DEQUANTIZE(inptr[DCTSIZE * 0], quantptr[DCTSIZE * 0]);
+		tmp10 = LEFT_SHIFT(z1, CONST_BITS + 2);
+
+		/* Odd part */
+
+		z1 = DEQUANTIZE(inptr[DCTSIZE * 7], quantptr[DCTSIZE * 7]);
+		tmp0 = - z1 * FIX_0_720959822;	/* sqrt(2) * (c7-c5+c3-c1) */
+		z1 = DEQUANTIZE(inptr[DCTSIZE * 5], quantptr[DCTSIZE * 5]);
+		tmp0 += z1 * FIX_0_850430095;	/* sqrt(2) * (-c1+c3+c5+c7) */
+		z1 = DEQUANTIZE(inptr[DCTSIZE * 3], quantptr[DCTSIZE * 3]);
+		tmp0 += - z1 * FIX_1_272758580;	/* sqrt(2) * (-c1+c3-c5-c7) */
+		z1 = DEQUANTIZE(inptr[DCTSIZE * 1], quantptr[DCTSIZE * 1]);
+		tmp0 += z1 * FIX_3_624509785;	/* sqrt(2) * (c1+c3+c5+c7) */
+
+		/* Final output stage */
+
+		wsptr[DCTSIZE * 0] = DESCALE(tmp10 + tmp0, CONST_BITS - PASS1_BITS + 2);
+		wsptr[DCTSIZE * 1] = DESCALE(tmp10 - tmp0, CONST_BITS - PASS1_BITS + 2);
+	}
+
+	/* Pass 2: process 2 rows from work array, store into output array. */
+
+	wsptr = workspace;
+	for (ctr = 0; ctr < 2; ctr++) {
+		outptr = output_buf + ctr * stride;
+
+		/* Even part */
+
+		tmp10 = LEFT_SHIFT(wsptr[0], CONST_BITS + 2);
+
+		/* Odd part */
+
+		tmp0 = - wsptr[7] * FIX_0_720959822	/* sqrt(2) * (c7-c5+c3-c1) */
+		       + wsptr[5] * FIX_0_850430095	/* sqrt(2) * (-c1+c3+c5+c7) */
+		       - wsptr[3] * FIX_1_272758580	/* sqrt(2) * (-c1+c3-c5-c7) */
+		       + wsptr[1] * FIX_3_624509785;	/* sqrt(2) * (c1+c3+c5+c7) */
+
+		/* Final output stage */
+
+		outptr[0] = range_limit(DESCALE(tmp10 + tmp0,
+					CONST_BITS + PASS1_BITS + 3 + 2));
+		outptr[1] = range_limit(DESCALE(tmp10 - tmp0,
+					CONST_BITS + PASS1_BITS + 3 + 2));
+
+		wsptr += DCTSIZE;	/* advance pointer to next row */
+	}
+}
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients,
+ * producing a reduced-size 1x1 output block.
+ */
+
+void tinyjpeg_idct_1x1(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride)
+{
+	int dcval = DEQUANTIZE(coef[0], quant[0]);
+
+	output_buf[0] = range_limit(DESCALE(dcval, 3));
+}
@@ -23,9 +23,12 @@
 #include "jpeg_memsrcdest.h"
 #endif
 
+/* Decode a jpeg frame of fmt's size into dest at 1/scale of its size (scale
+   is 1, 2, 4 or 8), on return fmt holds the size of the decoded image */
 int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags)
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags,
+	int scale)
 {
 	int result = 0;
 	unsigned char *components[3];
@@ -40,6 +43,8 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	}
 	flags |= TINYJPEG_FLAGS_MJPEG_TABLE;
 	tinyjpeg_set_flags(data->tinyjpeg, flags);
+	tinyjpeg_set_threads(data->tinyjpeg, data->threads);
+	tinyjpeg_set_scale(data->tinyjpeg, scale);
 	if (tinyjpeg_parse_header(data->tinyjpeg, src, src_size)) {
 		V4LCONVERT_ERR("parsing JPEG header: %s",
 				tinyjpeg_get_errorstring(data->tinyjpeg));
@@ -61,8 +66,10 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 		errno = EIO;
 		return -1;
 	}
-	fmt->fmt.pix.width = header_width;
-	fmt->fmt.pix.height = header_height;
+	width = header_width / scale;
+	height = header_height / scale;
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
 
 	components[0] = dest;
 
@@ -172,46 +179,47 @@ static void init_libjpeg_cinfo(struct v4lconvert_data *data)
 	data->cinfo_initialized = 1;
 }
 
+/* dct is the (scaled) DCT block size, 8 when not scaling */
 static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
 	unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
-	int v_samp)
+	int v_samp, int dct)
 {
 	struct jpeg_decompress_struct *cinfo = &data->cinfo;
 	int x, y;
 	unsigned char *uv_buf;
-	unsigned int width = cinfo->image_width;
+	unsigned int width = cinfo->output_width;
 	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
 	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
 
-	uv_buf = v4lconvert_alloc_buffer(width * 16,
+	uv_buf = v4lconvert_alloc_buffer(width * 2 * dct,
 					 &data->convert_pixfmt_buf,
 					 &data->convert_pixfmt_buf_size);
 	if (!uv_buf)
 		return v4lconvert_oom_error(data);
 
-	for (y = 0; y < 8; y++) {
+	for (y = 0; y < dct; y++) {
 		u_rows[y] = uv_buf;
 		uv_buf += width;
 		v_rows[y] = uv_buf;
 		uv_buf += width;
 	}
-	uv_buf -= width * 16;
+	uv_buf -= width * 2 * dct;
 
-	while (cinfo->output_scanline < cinfo->image_height) {
-		for (y = 0; y < 8 * v_samp; y++) {
+	while (cinfo->output_scanline < cinfo->output_height) {
+		for (y = 0; y < dct * v_samp; y++) {
 			y_rows[y] = ydest;
-			ydest += cinfo->image_width;
+			ydest += width;
 		}
-		y = jpeg_read_raw_data(cinfo, rows, 8 * v_samp);
-		if (y != 8 * v_samp)
+		y = jpeg_read_raw_data(cinfo, rows, dct * v_samp);
+		if (y != dct * v_samp)
 			return -1;
 
 		/* For v_samp == 1 skip copying uv vals every other time */
-		if (cinfo->output_scanline % 16)
+		if (cinfo->output_scanline % (2 * dct))
 			continue;
 
-		/* Copy over every other u + v pixel for 8 lines */
-		for (y = 0; y < 8; y++) {
+		/* Copy over every other u + v pixel for dct lines */
+		for (y = 0; y < dct; y++) {
 			for (x = 0; x < width; x += 2) {
 				*udest++ = *uv_buf++;
 				uv_buf++;
@@ -221,23 +229,23 @@ static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
 				uv_buf++;
 			}
 		}
-		uv_buf -= width * 16;
+		uv_buf -= width * 2 * dct;
 	}
 	return 0;
 }
 
 static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
 	unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
-	int v_samp)
+	int v_samp, int dct)
 {
 	struct jpeg_decompress_struct *cinfo = &data->cinfo;
 	int y;
-	unsigned int width = cinfo->image_width;
+	unsigned int width = cinfo->output_width;
 	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
 	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
 
-	while (cinfo->output_scanline < cinfo->image_height) {
-		for (y = 0; y < 8 * v_samp; y++) {
+	while (cinfo->output_scanline < cinfo->output_height) {
+		for (y = 0; y < dct * v_samp; y++) {
 			y_rows[y] = ydest;
 			ydest += width;
 		}
@@ -248,7 +256,7 @@ static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
 		 * effectively using the second set for each output line.
 		 */
 		if (v_samp == 1) {
-			for (y = 0; y < 8; y++) {
+			for (y = 0; y < dct; y++) {
 				u_rows[y] = udest;
 				v_rows[y] = vdest;
 				y++;
@@ -258,7 +266,7 @@ static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
 				vdest += width / 2;
 			}
 		} else { /* v_samp == 2 */
-			for (y = 0; y < 8; y++) {
+			for (y = 0; y < dct; y++) {
 				u_rows[y] = udest;
 				v_rows[y] = vdest;
 				udest += width / 2;
@@ -266,16 +274,17 @@ static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
 			}
 		}
 
-		y = jpeg_read_raw_data(cinfo, rows, 8 * v_samp);
-		if (y != 8 * v_samp)
+		y = jpeg_read_raw_data(cinfo, rows, dct * v_samp);
+		if (y != dct * v_samp)
 			return -1;
 	}
 	return 0;
 }
 
+/* See v4lconvert_decode_jpeg_tinyjpeg() */
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int scale)
 {
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
@@ -322,7 +331,11 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 			data->cinfo.out_color_space = JCS_EXT_BGR;
 #endif
 		row_pointer[0] = dest;
+		data->cinfo.scale_num = 1;
+		data->cinfo.scale_denom = scale;
 		jpeg_start_decompress(&data->cinfo);
+		width = data->cinfo.output_width;
+		height = data->cinfo.output_height;
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
 		while (data->cinfo.output_scanline < height) {
@@ -332,7 +345,8 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		jpeg_finish_decompress(&data->cinfo);
 #ifndef JCS_EXTENSIONS
 		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
-			v4lconvert_swap_rgb(dest, dest, width, height);
+			v4lconvert_swap_rgb(dest, dest, width, height,
+					    width * 3, width * 3);
 #endif
 	} else {
 		int h_samp, v_samp;
@@ -392,6 +406,12 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 			return -1;
 		}
 
+		/* We need at least 2 lines of each block for the uv handling */
+		if (scale > 4)
+			scale = 4;
+		width /= scale;
+		height /= scale;
+
 		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
 			vdest = dest + width * height;
 			udest = vdest + (width * height) / 4;
@@ -402,15 +422,17 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 
 		data->cinfo.raw_data_out = TRUE;
 		data->cinfo.do_fancy_upsampling = FALSE;
+		data->cinfo.scale_num = 1;
+		data->cinfo.scale_denom = scale;
 		jpeg_start_decompress(&data->cinfo);
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
 		if (h_samp == 1) {
 			result = decode_libjpeg_h_samp1(data, dest, udest,
-							vdest, v_samp);
+							vdest, v_samp, 8 / scale);
 		} else {
 			result = decode_libjpeg_h_samp2(data, dest, udest,
-							vdest, v_samp);
+							vdest, v_samp, 8 / scale);
 		}
 		if (result)
 			jpeg_abort_decompress(&data->cinfo);
@@ -418,6 +440,9 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 			jpeg_finish_decompress(&data->cinfo);
 	}
 
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
+
 	return result;
 }
 
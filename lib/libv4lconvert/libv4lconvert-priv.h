@@ -37,15 +37,97 @@
 
 #define V4LCONVERT_ERROR_MSG_SIZE 256
 #define V4LCONVERT_MAX_FRAMESIZES 256
+#define V4LCONVERT_MAX_THREADS 64
+#define V4LCONVERT_MAX_COSTS 256
 
 #define V4LCONVERT_ERR(...) \
 	snprintf(data->error_msg, V4LCONVERT_ERROR_MSG_SIZE, \
 			"v4l-convert: error " __VA_ARGS__)
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define V4LCONVERT_HAVE_X86_SIMD
+#endif
+#if defined(__GNUC__) && defined(__aarch64__)
+#define V4LCONVERT_HAVE_NEON
+#endif
+
 /* Card flags */
 #define V4LCONVERT_IS_UVC                0x01
 #define V4LCONVERT_USE_TINYJPEG          0x02
 
+/* Demosaics pairs * 2 pixels of the interior of an 8 bit bayer line, see
+   v4lconvert_bayer_pairs_to_bgr24() in bayer.c */
+typedef void (*v4lconvert_bayer_pairs_fn)(const unsigned char *bayer,
+		int stride, unsigned char *bgr, int pairs, int blue_line);
+
+/* Table of the conversion kernels which have cpu specific implementations,
+   one table is selected at v4lconvert_create() time based on the features of
+   the cpu we are running on, see simd.c. Entries which an implementation does
+   not accelerate point to the plain C version, which is the reference all
+   other implementations must match bit-exactly. stride and dest_stride are
+   the bytes per line of packed src and dst frames, planar frames are passed
+   as struct v4lconvert_planes which holds the stride of each plane. */
+struct v4lconvert_kernels {
+	const char *name;
+	void (*yuyv_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int dest_stride);
+	void (*yuyv_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int dest_stride);
+	void (*yvyu_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int dest_stride);
+	void (*yvyu_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int dest_stride);
+	void (*uyvy_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int dest_stride);
+	void (*uyvy_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int dest_stride);
+	void (*yuv420_to_rgb24)(const struct v4lconvert_planes *src,
+			unsigned char *dst, int width, int height,
+			int dest_stride, int yvu);
+	void (*yuv420_to_bgr24)(const struct v4lconvert_planes *src,
+			unsigned char *dst, int width, int height,
+			int dest_stride, int yvu);
+	void (*nv12_to_rgb24)(const struct v4lconvert_planes *src,
+			unsigned char *dst, int width, int height,
+			int dest_stride, int bgr);
+	void (*nv12_to_yuv420)(const struct v4lconvert_planes *src,
+			const struct v4lconvert_planes *dst, int width, int height,
+			int yvu);
+	void (*nv16_to_yuyv)(const struct v4lconvert_planes *src,
+			unsigned char *dst, int width, int height, int dest_stride);
+	/* Must work in place (src == dst), see v4lconvert_rgb24_to_argb32 */
+	void (*rgb24_to_argb32)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int dest_stride, int bgr);
+	/* Apply lut[0 - 255] to the first, lut[256 - 511] to the second and
+	   lut[512 - 767] to the third byte of width rgb24 / bgr24 pixels in
+	   place, lut must be readable for 3 bytes past its end */
+	void (*lut_rgb24)(unsigned char *buf, int width,
+			const unsigned char *lut);
+	/* Must write exactly pairs * 6 bytes of bgr */
+	v4lconvert_bayer_pairs_fn bayer_pairs_to_bgr24;
+	/* acc[i] = src[i] * weight for the first line (add == 0) of a scaled
+	   line, acc[i] += src[i] * weight for the next ones, weight <= 256 */
+	void (*scale_rows)(uint16_t *acc, const unsigned char *src, int n,
+			int weight, int add);
+	/* Dequantize and inverse DCT one 8x8 block of JPEG coefficients (in
+	   natural order), must give the same results as tinyjpeg_idct_islow */
+	void (*jpeg_idct_islow)(const int16_t *coef, const int16_t *quant,
+			uint8_t *output_buf, int stride);
+	/* dest[i] = src[width - 1 - i] */
+	void (*hflip_u8)(const unsigned char *src, unsigned char *dest,
+			int width);
+	/* Rotate a height x width plane clockwise to a width x height one */
+	void (*rotate90_u8)(const unsigned char *src, int src_stride,
+			unsigned char *dest, int dest_stride, int width,
+			int height);
+};
+
+struct v4lconvert_cost {
+	unsigned int pixelformat; /* src format */
+	int yuv; /* Converting to yuv rather then rgb */
+	unsigned int ps; /* Picoseconds per src pixel */
+};
+
 struct v4lconvert_data {
 	int fd;
 	int flags; /* bitfield */
@@ -62,23 +144,40 @@ struct v4lconvert_data {
 	int cinfo_initialized;
 #endif // HAVE_JPEG
 	struct v4l2_frmsizeenum framesizes[V4LCONVERT_MAX_FRAMESIZES];
-	/* Bitmask of all supported src_formats which can do for a size */
-	int64_t framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES];
+	/* Bitmap of all supported src_formats which can do for a size */
+	unsigned long framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES][128 / BITS_PER_LONG];
 	unsigned int no_framesizes;
+	int framesizes_cached; /* Loaded from the cache, not checked yet */
 	int bandwidth;
 	int fps;
-	int convert1_buf_size;
 	int convert2_buf_size;
 	int rotate90_buf_size;
 	int flip_buf_size;
 	int convert_pixfmt_buf_size;
-	unsigned char *convert1_buf;
+	int pack_buf_size;
+	int planes_buf_size;
+	int repack_buf_size;
+	int scale_buf_size;
 	unsigned char *convert2_buf;
 	unsigned char *rotate90_buf;
 	unsigned char *flip_buf;
 	unsigned char *convert_pixfmt_buf;
+	unsigned char *pack_buf;
+	unsigned char *planes_buf;
+	unsigned char *repack_buf;
+	unsigned char *scale_buf;
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
+	const struct v4lconvert_kernels *kernels;
+	struct v4lconvert_threads *threads; /* NULL when not using threads */
+	int demosaic; /* enum v4lconvert_demosaic */
+	int scaler; /* enum v4lconvert_scaler */
+	int cost_model;
+	int costs_loaded;
+	int costs_threads; /* The no threads the costs are for */
+	int costs_changed;
+	int no_costs;
+	struct v4lconvert_cost costs[V4LCONVERT_MAX_COSTS];
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
 
@@ -86,6 +185,9 @@ struct v4lconvert_data {
 	pid_t decompress_pid;
 	int decompress_in_pipe[2];  /* Data from helper to us */
 	int decompress_out_pipe[2]; /* Data from us to helper */
+	int decompress_shm_fd;      /* -1 when the frame data is piped */
+	unsigned char *decompress_shm;
+	int decompress_shm_size;
 
 	/* For mr97310a decoder */
 	int frames_dropped;
@@ -109,62 +211,72 @@ unsigned char *v4lconvert_alloc_buffer(int needed,
 
 int v4lconvert_oom_error(struct v4lconvert_data *data);
 
-void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_rgb24_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp);
 
-void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride, int yvu);
+void v4lconvert_yuv420_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dst, int width, int height, int dest_stride, int yvu);
+
+void v4lconvert_yuv420_to_bgr24(const struct v4lconvert_planes *src,
+		unsigned char *dst, int width, int height, int dest_stride, int yvu);
 
-void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride, int yvu);
+void v4lconvert_yuv420_to_rgb24_line(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int bgr);
 
 void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
 void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
-void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride, int yvu);
+void v4lconvert_yuyv_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dst, int width, int height,
+		int stride, int yvu);
 
-void v4lconvert_nv16_to_yuyv(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride);
+void v4lconvert_nv16_to_yuyv(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride);
 
 void v4lconvert_yvyu_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
 void v4lconvert_yvyu_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
 void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
 void v4lconvert_uyvy_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
-void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride, int yvu);
+void v4lconvert_uyvy_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dst, int width, int height,
+		int stride, int yvu);
 
 void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+		int width, int height, int stride, int dest_stride);
 
-void v4lconvert_swap_uv(const unsigned char *src, unsigned char *dst,
-		const struct v4l2_format *src_fmt);
+void v4lconvert_swap_uv(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dst, int width, int height);
 
 void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
-void v4lconvert_grey_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_grey_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt);
 
 void v4lconvert_y16_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int little_endian);
+		int width, int height, int stride, int dest_stride,
+		int little_endian);
 
-void v4lconvert_y16_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_y16_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, int little_endian);
 
 void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int bgr);
+		int width, int height, int stride, int dest_stride, int bgr);
 
 int v4lconvert_y10b_to_rgb24(struct v4lconvert_data *data,
 	const unsigned char *src, unsigned char *dest, int width, int height);
@@ -173,12 +285,13 @@ int v4lconvert_y10b_to_yuv420(struct v4lconvert_data *data,
 	const unsigned char *src, unsigned char *dest, int width, int height);
 
 void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
 void v4lconvert_rgb565_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride);
+		int width, int height, int stride, int dest_stride);
 
-void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_rgb565_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, int yvu);
 
 void v4lconvert_spca501_to_yuv420(const unsigned char *src, unsigned char *dst,
@@ -215,11 +328,12 @@ int v4lconvert_se401_to_rgb24(struct v4lconvert_data *data,
 
 int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags);
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags,
+	int scale);
 
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int scale);
 
 int v4lconvert_decode_jpgl(const unsigned char *src, int src_size,
 	unsigned int dest_pix_fmt, unsigned char *dest, int width, int height);
@@ -252,22 +366,51 @@ void v4lconvert_decode_stv0680(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
 void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride);
 
 void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride);
+
+void v4lconvert_bayer_to_rgb24_lines(const unsigned char *bayer,
+		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, v4lconvert_bayer_pairs_fn pairs);
+
+void v4lconvert_bayer_to_bgr24_lines(const unsigned char *bayer,
+		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, v4lconvert_bayer_pairs_fn pairs);
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu);
+void v4lconvert_bayer_pairs_to_bgr24(const unsigned char *bayer, int stride,
+		unsigned char *bgr, int pairs, int blue_line);
 
-void v4lconvert_bayer10_to_bayer8(void *bayer10,
-		unsigned char *bayer8, int width, int height);
+void v4lconvert_bayer_pairs_to_bgr24_edge(const unsigned char *bayer,
+		int stride, unsigned char *bgr, int pairs, int blue_line);
 
-void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
-		unsigned char *bayer8, int width, int height);
+void v4lconvert_bayer_to_yuv420_lines(const unsigned char *bayer,
+		const struct v4lconvert_planes *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu,
+		int first, int last);
 
-void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
-		unsigned char *bayer8, int width, int height);
+unsigned int v4lconvert_bayer8_pixfmt(unsigned int pixfmt);
+
+int v4lconvert_bayer_bpp(unsigned int pixfmt);
+
+void v4lconvert_bayer_hi_to_bayer8(const unsigned char *bayer,
+		unsigned char *bayer8, int width, int height, int stride,
+		unsigned int pixfmt);
+
+void v4lconvert_bayer_hi_to_rgb24_lines(const unsigned char *bayer,
+		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, v4lconvert_bayer_pairs_fn pairs);
+
+void v4lconvert_bayer_hi_to_bgr24_lines(const unsigned char *bayer,
+		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, v4lconvert_bayer_pairs_fn pairs);
+
+void v4lconvert_bayer_to_rgb48_lines(const unsigned char *bayer,
+		unsigned char *rgb48, int width, int height, const unsigned int stride, unsigned int pixfmt,
+		int dest_stride, int first, int last, v4lconvert_bayer_pairs_fn pairs);
 
 void v4lconvert_nv12_16l16_to_rgb24(const unsigned char *src,
 		unsigned char *dst, int width, int height);
@@ -279,24 +422,114 @@ void v4lconvert_nv12_16l16_to_yuv420(const unsigned char *src,
 		unsigned char *dst, int width, int height, int yvu);
 
 void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int bgr, int Xin, unsigned char hsv_enc);
+		int width, int height, int stride, int dest_stride, int bgr,
+		int Xin, unsigned char hsv_enc);
+
+void v4lconvert_nv12_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int bgr);
+
+void v4lconvert_nv12_to_rgb24_line(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int width, int bgr);
+
+void v4lconvert_nv12_to_yuv420(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, int width, int height, int yvu);
+
+void v4lconvert_nv12_to_yuyv(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride);
+
+void v4lconvert_yuv420_to_nv12(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, int width, int height, int yvu);
+
+void v4lconvert_yuv420_to_yuyv(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu);
+
+void v4lconvert_yuyv_to_nv12(const unsigned char *src,
+		const struct v4lconvert_planes *dest, int width, int height,
+		int stride, int yvu);
 
-void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int bgr);
+void v4lconvert_uyvy_to_nv12(const unsigned char *src,
+		const struct v4lconvert_planes *dest, int width, int height,
+		int stride);
 
-void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu);
+void v4lconvert_packed_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride,
+		int y0, int u, int y1, int v);
 
-void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt);
+void v4lconvert_copy_lines(const unsigned char *src, unsigned char *dest,
+		int length, int lines, int stride, int dest_stride);
 
-void v4lconvert_flip(unsigned char *src, unsigned char *dest,
+void v4lconvert_rgb24_to_argb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride, int bgr);
+
+void v4lconvert_rgb32_to_argb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride, int bgr);
+
+void v4lconvert_hflip_u8(const unsigned char *src, unsigned char *dest,
+		int width);
+
+void v4lconvert_rotate90_u8(const unsigned char *src, int src_stride,
+		unsigned char *dest, int dest_stride, int width, int height);
+
+void v4lconvert_rotate90(struct v4lconvert_data *data,
+		const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, struct v4l2_format *fmt);
+
+void v4lconvert_flip(struct v4lconvert_data *data,
+		const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest,
 		struct v4l2_format *fmt, int hflip, int vflip);
 
-void v4lconvert_crop(unsigned char *src, unsigned char *dest,
+void v4lconvert_hflip_rgbbgr24_line(unsigned char *line, int width);
+
+int v4lconvert_crop_scaler(struct v4lconvert_data *data,
+		unsigned int pixelformat, int src_width, int src_height,
+		int width, int height);
+
+int v4lconvert_crop(struct v4lconvert_data *data,
+		const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt);
 
-int v4lconvert_helper_decompress(struct v4lconvert_data *data,
+void v4lconvert_scale_rows(uint16_t *acc, const unsigned char *src, int n,
+		int weight, int add);
+
+int v4lconvert_cache_path(char *path, int size, const char *name);
+
+uint64_t v4lconvert_cost_now(void);
+
+unsigned int v4lconvert_cost_get(struct v4lconvert_data *data,
+		unsigned int pixelformat, int yuv);
+
+void v4lconvert_cost_update(struct v4lconvert_data *data,
+		unsigned int pixelformat, int yuv, uint64_t start, int pixels);
+
+void v4lconvert_cost_save(struct v4lconvert_data *data);
+
+extern const struct v4lconvert_kernels v4lconvert_c_kernels;
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+extern const struct v4lconvert_kernels v4lconvert_sse2_kernels;
+extern const struct v4lconvert_kernels v4lconvert_avx2_kernels;
+#endif
+#ifdef V4LCONVERT_HAVE_NEON
+extern const struct v4lconvert_kernels v4lconvert_neon_kernels;
+#endif
+
+/* Returns the i-th implementation the cpu supports, best first, the c
+   kernels last, NULL past the end */
+const struct v4lconvert_kernels *v4lconvert_supported_kernels(int i);
+
+const struct v4lconvert_kernels *v4lconvert_get_kernels(void);
+
+struct v4lconvert_threads *v4lconvert_threads_create(int count);
+
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads);
+
+int v4lconvert_threads_count(struct v4lconvert_threads *threads);
+
+void v4lconvert_threads_run(struct v4lconvert_threads *threads,
+		void (*func)(void *arg, int first, int last), void *arg, int lines);
+
+unsigned char *v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int command);
 
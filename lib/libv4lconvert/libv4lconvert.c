@@ -17,6 +17,7 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,6 +30,8 @@
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
 #define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
+/* Added to the cost rank of grey formats, larger than any other cost rank */
+#define V4LCONVERT_COST_RANK_GREY (1 << 28)
 
 static inline void set_bit(int nr, volatile unsigned long *addr)
 {
@@ -76,12 +79,19 @@ static ssize_t dev_write(void *dev_ops_priv, int fd, const void *buf,
 	return SYS_WRITE(fd, buf, len);
 }
 
+static int dev_poll(void *dev_ops_priv, int fd, struct pollfd *fds,
+		    nfds_t nfds, int timeout)
+{
+	return poll(fds, nfds, timeout);
+}
+
 static const struct libv4l_dev_ops default_dev_ops = {
 	.init = dev_init,
 	.close = dev_close,
 	.ioctl = dev_ioctl,
 	.read = dev_read,
 	.write = dev_write,
+	.poll = dev_poll,
 };
 
 const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops()
@@ -89,8 +99,8 @@ const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops()
 	return &default_dev_ops;
 }
 
-static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
-		unsigned int pixelformat, int index);
+static void v4lconvert_init_framesizes(struct v4lconvert_data *data);
+static void v4lconvert_refresh_framesizes(struct v4lconvert_data *data);
 
 /*
  * Notes:
@@ -107,7 +117,12 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 	{ V4L2_PIX_FMT_RGB24,		24,	 1,	 5,	0 }, \
 	{ V4L2_PIX_FMT_BGR24,		24,	 1,	 5,	0 }, \
 	{ V4L2_PIX_FMT_YUV420,		12,	 6,	 1,	0 }, \
-	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }
+	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }, \
+	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	1 }, \
+	{ V4L2_PIX_FMT_YUYV,		16,	 5,	 4,	0 }, \
+	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 }, \
+	{ V4L2_PIX_FMT_ARGB32,		32,	 4,	 6,	0 }, \
+	{ V4L2_PIX_FMT_RGB48,		48,	 1,	 5,	0 }
 
 static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	SUPPORTED_DST_PIXFMTS,
@@ -116,11 +131,8 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_BGR32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_RGB32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_ABGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_ARGB32,		32,	 4,	 6,	0 },
 	/* yuv 4:2:2 formats */
-	{ V4L2_PIX_FMT_YUYV,		16,	 5,	 4,	0 },
 	{ V4L2_PIX_FMT_YVYU,		16,	 5,	 4,	0 },
 	{ V4L2_PIX_FMT_UYVY,		16,	 5,	 4,	0 },
 	{ V4L2_PIX_FMT_NV16,		16,	 5,	 4,	1 },
@@ -134,7 +146,6 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_SN9C20X_I420,	12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_M420,		12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_NV12_16L16,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	1 },
 	{ V4L2_PIX_FMT_CPIA1,		 0,	 6,	 3,	1 },
 	/* JPEG and variants */
 	{ V4L2_PIX_FMT_MJPEG,		 0,	 7,	 7,	0 },
@@ -155,6 +166,10 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_SGBRG10P,	10,	 8,	 8,	1 },
 	{ V4L2_PIX_FMT_SGRBG10P,	10,	 8,	 8,	1 },
 	{ V4L2_PIX_FMT_SRGGB10P,	10,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR12P,	12,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGBRG12P,	12,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGRBG12P,	12,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SRGGB12P,	12,	 8,	 8,	1 },
 	{ V4L2_PIX_FMT_SBGGR10,		16,	 8,	 8,	1 },
 	{ V4L2_PIX_FMT_SGBRG10,		16,	 8,	 8,	1 },
 	{ V4L2_PIX_FMT_SGRBG10,		16,	 8,	 8,	1 },
@@ -215,6 +230,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	int i, j;
 	struct v4lconvert_data *data = calloc(1, sizeof(struct v4lconvert_data));
 	struct v4l2_capability cap;
+	char *s;
 	/*
 	 * This keeps tracks of device-specific formats for which apps most
 	 * likely don't know. If all a driver can offer are proprietary
@@ -233,7 +249,27 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->dev_ops = dev_ops;
 	data->dev_ops_priv = dev_ops_priv;
 	data->decompress_pid = -1;
+	data->decompress_shm_fd = -1;
 	data->fps = 30;
+	data->kernels = v4lconvert_get_kernels();
+
+	s = getenv("LIBV4LCONVERT_THREADS");
+	if (s)
+		v4lconvert_set_threads(data, atoi(s));
+
+	s = getenv("LIBV4LCONVERT_DEMOSAIC");
+	if (s && !strcmp(s, "edge"))
+		data->demosaic = V4LCONVERT_DEMOSAIC_EDGE;
+
+	s = getenv("LIBV4LCONVERT_COST_MODEL");
+	if (s)
+		data->cost_model = atoi(s) != 0;
+
+	s = getenv("LIBV4LCONVERT_SCALER");
+	if (s && !strcmp(s, "area"))
+		data->scaler = V4LCONVERT_SCALER_AREA;
+	else if (s && !strcmp(s, "bilinear"))
+		data->scaler = V4LCONVERT_SCALER_BILINEAR;
 
 	/* Check supported formats */
 	for (i = 0; ; i++) {
@@ -251,7 +287,6 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 
 		if (j < ARRAY_SIZE(supported_src_pixfmts)) {
 			set_bit(j, data->supported_src_formats);
-			v4lconvert_get_framesizes(data, fmt.pixelformat, j);
 			if (!supported_src_pixfmts[j].needs_conversion)
 				always_needs_conversion = 0;
 		} else
@@ -275,6 +310,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->control = v4lcontrol_create(fd, dev_ops_priv, dev_ops,
 						always_needs_conversion);
 	if (!data->control) {
+		v4lconvert_threads_destroy(data->threads);
 		free(data);
 		return NULL;
 	}
@@ -286,10 +322,14 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->processing = v4lprocessing_create(fd, data->control);
 	if (!data->processing) {
 		v4lcontrol_destroy(data->control);
+		v4lconvert_threads_destroy(data->threads);
 		free(data);
 		return NULL;
 	}
 
+	/* This needs the usb ids from libv4lcontrol for the cache */
+	v4lconvert_init_framesizes(data);
+
 	return data;
 }
 
@@ -298,6 +338,8 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 	if (!data)
 		return;
 
+	v4lconvert_cost_save(data);
+	v4lconvert_threads_destroy(data->threads);
 	v4lprocessing_destroy(data->processing);
 	v4lcontrol_destroy(data->control);
 	if (data->tinyjpeg) {
@@ -313,11 +355,14 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 #ifdef HAVE_LIBV4LCONVERT_HELPERS
 	v4lconvert_helper_cleanup(data);
 #endif
-	free(data->convert1_buf);
 	free(data->convert2_buf);
 	free(data->rotate90_buf);
 	free(data->flip_buf);
 	free(data->convert_pixfmt_buf);
+	free(data->pack_buf);
+	free(data->planes_buf);
+	free(data->repack_buf);
+	free(data->scale_buf);
 	free(data->previous_frame);
 	free(data);
 }
@@ -346,6 +391,19 @@ int v4lconvert_supported_dst_fmt_only(struct v4lconvert_data *data)
 	return v4lcontrol_needs_conversion(data->control);
 }
 
+/* rgb48 is only offered when the cam has a raw bayer format to make it from */
+static int v4lconvert_has_raw_bayer(struct v4lconvert_data *data)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++)
+		if (test_bit(i, data->supported_src_formats) &&
+		    v4lconvert_bayer8_pixfmt(supported_src_pixfmts[i].fmt))
+			return 1;
+
+	return 0;
+}
+
 /* See libv4lconvert.h for description of in / out parameters */
 int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
 {
@@ -359,8 +417,10 @@ int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
 				VIDIOC_ENUM_FMT, fmt);
 
 	for (i = 0; i < ARRAY_SIZE(supported_dst_pixfmts); i++)
-		if (v4lconvert_supported_dst_fmt_only(data) ||
-		    !test_bit(i, data->supported_src_formats)) {
+		if ((v4lconvert_supported_dst_fmt_only(data) ||
+		     !test_bit(i, data->supported_src_formats)) &&
+		    (supported_dst_pixfmts[i].fmt != V4L2_PIX_FMT_RGB48 ||
+		     v4lconvert_has_raw_bayer(data))) {
 			faked_fmts[no_faked_fmts] = supported_dst_pixfmts[i].fmt;
 			no_faked_fmts++;
 		}
@@ -387,6 +447,10 @@ int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
 	return 0;
 }
 
+static int v4lconvert_cost_rank(struct v4lconvert_data *data,
+	int src_index, int src_width, int src_height,
+	unsigned int dest_pixelformat);
+
 /* This function returns a value to rank (sort) source format by preference
    when multiple source formats are available for a certain resolution, the
    source format for which this function returns the lowest value wins.
@@ -410,18 +474,45 @@ static int v4lconvert_get_rank(struct v4lconvert_data *data,
 	switch (dest_pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+	case V4L2_PIX_FMT_RGB48:
 		rank = supported_src_pixfmts[src_index].rgb_rank;
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUYV:
 		rank = supported_src_pixfmts[src_index].yuv_rank;
 		break;
 	}
 
-	/* So that if both rgb32 and bgr32 are supported, or both yuv420 and
-	   yvu420 the right one wins */
+	/* The dest format itself needs no conversion at all, so it wins (this
+	   also makes rgb24 win from bgr24, nv12 from yuv420, etc.) */
 	if (supported_src_pixfmts[src_index].fmt == dest_pixelformat)
-		rank--;
+		rank = 0;
+
+	/* rgb48 can only be made from raw bayer (preferably with more than 8
+	   bits), and not be converted to anything else. -1 means impossible. */
+	if (supported_src_pixfmts[src_index].fmt != dest_pixelformat) {
+		unsigned int src_pixelformat = supported_src_pixfmts[src_index].fmt;
+
+		if (src_pixelformat == V4L2_PIX_FMT_RGB48)
+			return -1;
+		if (dest_pixelformat == V4L2_PIX_FMT_RGB48) {
+			if (!v4lconvert_bayer8_pixfmt(src_pixelformat))
+				return -1;
+			if (v4lconvert_bayer8_pixfmt(src_pixelformat) ==
+			    src_pixelformat)
+				rank++;
+		}
+	}
+
+	if (data->cost_model)
+		return v4lconvert_cost_rank(data, src_index, src_width,
+				src_height, dest_pixelformat) +
+			/* Still never autoselect grey */
+			(rank >= 20 ? V4LCONVERT_COST_RANK_GREY : 0);
 
 	/* check bandwidth needed */
 	needed = src_width * src_height * data->fps *
@@ -450,7 +541,7 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 	unsigned int closest_fmt_size_diff = -1;
 	int best_framesize = 0;/* Just use the first format if no small enough one */
 	int best_format = 0;
-	int best_rank = 100;
+	int best_rank = INT_MAX;
 
 	for (i = 0; i < data->no_framesizes; i++) {
 		if (data->framesizes[i].discrete.width <= dest_fmt->fmt.pix.width &&
@@ -471,8 +562,7 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 
 	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++) {
 		/* is this format supported? */
-		if (!(data->framesize_supported_src_formats[best_framesize] &
-		      (1ULL << i)))
+		if (!test_bit(i, data->framesize_supported_src_formats[best_framesize]))
 			continue;
 
 		/* Note the hardcoded use of discrete is based on this function
@@ -481,12 +571,15 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 			    data->framesizes[best_framesize].discrete.width,
 			    data->framesizes[best_framesize].discrete.height,
 			    dest_fmt->fmt.pix.pixelformat);
-		if (rank < best_rank) {
+		if (rank >= 0 && rank < best_rank) {
 			best_rank = rank;
 			best_format = supported_src_pixfmts[i].fmt;
 		}
 	}
 
+	if (best_rank == INT_MAX)
+		return -1;
+
 	dest_fmt->fmt.pix.width = data->framesizes[best_framesize].discrete.width;
 	dest_fmt->fmt.pix.height = data->framesizes[best_framesize].discrete.height;
 	dest_fmt->fmt.pix.field = V4L2_FIELD_NONE; /* UVC has no fields */
@@ -541,6 +634,8 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 					   try_fmt.fmt.pix.width,
 					   try_fmt.fmt.pix.height,
 					   desired_pixfmt);
+		if (rank < 0)
+			continue;
 		if (size_diff < closest_fmt_size_diff ||
 		    (size_diff == closest_fmt_size_diff && rank < best_rank)) {
 			closest_fmt = try_fmt;
@@ -570,27 +665,86 @@ void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
 		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width;
 		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 3 / 2;
 		break;
+	case V4L2_PIX_FMT_YUYV:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 2;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 2;
+		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 4;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 4;
+		break;
+	case V4L2_PIX_FMT_RGB48:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 6;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 6;
+		break;
+	}
+}
+
+/* Find the resolution to scale down to width x height from: the smallest
+   discrete frame size which is at least as large, or when there is none
+   whatever the largest resolution of the driver is */
+static void v4lconvert_scale_src_size(struct v4lconvert_data *data,
+		unsigned int *width, unsigned int *height)
+{
+	unsigned int i, area, best_area = 0;
+	unsigned int best_width = 16384, best_height = 16384;
+
+	for (i = 0; i < data->no_framesizes; i++) {
+		if (data->framesizes[i].type != V4L2_FRMSIZE_TYPE_DISCRETE ||
+		    data->framesizes[i].discrete.width < *width ||
+		    data->framesizes[i].discrete.height < *height)
+			continue;
+
+		area = data->framesizes[i].discrete.width *
+		       data->framesizes[i].discrete.height;
+		if (best_area == 0 || area < best_area) {
+			best_area = area;
+			best_width = data->framesizes[i].discrete.width;
+			best_height = data->framesizes[i].discrete.height;
+		}
 	}
+
+	*width = best_width;
+	*height = best_height;
+}
+
+/* Is the software rotation control set to 90 or 270 degrees, in which case
+   the converted frames have the width and height of the src swapped ? */
+static int v4lconvert_rotation_swaps_size(struct v4lconvert_data *data)
+{
+	return v4lcontrol_get_ctrl(data->control, V4LCONTROL_ROTATE) % 180;
 }
 
 /* See libv4lconvert.h for description of in / out parameters */
 int v4lconvert_try_format(struct v4lconvert_data *data,
 		struct v4l2_format *dest_fmt, struct v4l2_format *src_fmt)
 {
-	int i, result;
-	unsigned int desired_width = dest_fmt->fmt.pix.width;
-	unsigned int desired_height = dest_fmt->fmt.pix.height;
-	struct v4l2_format try_src, try_dest, try2_src, try2_dest;
+	int i, result, swap;
+	unsigned int desired_width, desired_height;
+	struct v4l2_format try_src, try_dest, try2_src, try2_dest, want;
 
 	if (dest_fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE &&
 			v4lconvert_supported_dst_fmt_only(data) &&
 			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat))
 		dest_fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
 
-	try_dest = *dest_fmt;
+	/* When rotating by 90 or 270 degrees look for a src of the size the
+	   app wants with width and height swapped */
+	want = *dest_fmt;
+	swap = v4lconvert_rotation_swaps_size(data);
+	if (swap) {
+		want.fmt.pix.width = dest_fmt->fmt.pix.height;
+		want.fmt.pix.height = dest_fmt->fmt.pix.width;
+	}
+	desired_width = want.fmt.pix.width;
+	desired_height = want.fmt.pix.height;
+
+	try_dest = want;
 
 	/* Can we do conversion to the requested format & type? */
 	if (!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat) ||
@@ -609,7 +763,7 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 	   which we will then just crop off in software */
 	if (try_dest.fmt.pix.width != desired_width ||
 			try_dest.fmt.pix.height != desired_height) {
-		try2_dest = *dest_fmt;
+		try2_dest = want;
 		try2_dest.fmt.pix.width  = desired_width + 7;
 		try2_dest.fmt.pix.height = desired_height + 1;
 		result = v4lconvert_do_try_format(data, &try2_dest, &try2_src);
@@ -635,7 +789,7 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 		for (i = 0; i < ARRAY_SIZE(v4lconvert_crop_res); i++) {
 			if (v4lconvert_crop_res[i][0] == desired_width &&
 					v4lconvert_crop_res[i][1] == desired_height) {
-				try2_dest = *dest_fmt;
+				try2_dest = want;
 
 				/* Note these are chosen so that cropping to vga res just works for
 				   vv6410 sensor cams, which have 356x292 and 180x148 */
@@ -669,6 +823,48 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 		}
 	}
 
+	/* Still no exact match, when scaling give the app what it asked for by
+	   scaling down the next larger resolution */
+	if ((try_dest.fmt.pix.width != desired_width ||
+	     try_dest.fmt.pix.height != desired_height) &&
+	    data->scaler != V4LCONVERT_SCALER_CROP &&
+	    dest_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_RGB48) {
+		try2_dest = want;
+		v4lconvert_scale_src_size(data, &try2_dest.fmt.pix.width,
+					  &try2_dest.fmt.pix.height);
+		result = v4lconvert_do_try_format(data, &try2_dest, &try2_src);
+		if (result == 0 &&
+				try2_dest.fmt.pix.width >= desired_width &&
+				try2_dest.fmt.pix.height >= desired_height) {
+			try2_dest.fmt.pix.width = desired_width;
+			try2_dest.fmt.pix.height = desired_height;
+			try_dest = try2_dest;
+			try_src = try2_src;
+		}
+	}
+
+	/* Framesizes loaded from the cache get checked against the driver the
+	   first time a src format is picked from them */
+	if (data->framesizes_cached) {
+		try2_src = try_src;
+		data->framesizes_cached = 0;
+		if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+				VIDIOC_TRY_FMT, &try2_src) == 0 &&
+		    (try2_src.fmt.pix.width != try_src.fmt.pix.width ||
+		     try2_src.fmt.pix.height != try_src.fmt.pix.height ||
+		     try2_src.fmt.pix.pixelformat != try_src.fmt.pix.pixelformat)) {
+			v4lconvert_refresh_framesizes(data);
+			return v4lconvert_try_format(data, dest_fmt, src_fmt);
+		}
+	}
+
+	if (swap) {
+		unsigned int tmp = try_dest.fmt.pix.width;
+
+		try_dest.fmt.pix.width = try_dest.fmt.pix.height;
+		try_dest.fmt.pix.height = tmp;
+	}
+
 	/* Some applications / libs (*cough* gstreamer *cough*) will not work
 	   correctly with planar YUV formats when the width is not a multiple of 8
 	   or the height is not a multiple of 2. With RGB formats these apps require
@@ -705,47 +901,54 @@ int v4lconvert_needs_conversion(struct v4lconvert_data *data,
 	return 0;
 }
 
-static int v4lconvert_processing_needs_double_conversion(
-		unsigned int src_pix_fmt, unsigned int dest_pix_fmt)
+int v4lconvert_frame_needs_conversion(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt) /* in */
 {
-	switch (src_pix_fmt) {
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-	case V4L2_PIX_FMT_SPCA561:
-	case V4L2_PIX_FMT_SN9C10X:
-	case V4L2_PIX_FMT_PAC207:
-	case V4L2_PIX_FMT_MR97310A:
-#ifdef HAVE_JPEG
-	case V4L2_PIX_FMT_JL2005BCD:
-#endif
-	case V4L2_PIX_FMT_SN9C2028:
-	case V4L2_PIX_FMT_SQ905C:
-	case V4L2_PIX_FMT_SBGGR8:
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SGRBG8:
-	case V4L2_PIX_FMT_SRGGB8:
-	case V4L2_PIX_FMT_SBGGR10P:
-	case V4L2_PIX_FMT_SGBRG10P:
-	case V4L2_PIX_FMT_SGRBG10P:
-	case V4L2_PIX_FMT_SRGGB10P:
-	case V4L2_PIX_FMT_SBGGR10:
-	case V4L2_PIX_FMT_SGBRG10:
-	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SRGGB10:
-	case V4L2_PIX_FMT_SBGGR16:
-	case V4L2_PIX_FMT_SGBRG16:
-	case V4L2_PIX_FMT_SGRBG16:
-	case V4L2_PIX_FMT_SRGGB16:
-	case V4L2_PIX_FMT_STV0680:
-		return 0;
-	}
-	switch (dest_pix_fmt) {
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
+	if (src_fmt->fmt.pix.width != dest_fmt->fmt.pix.width ||
+			src_fmt->fmt.pix.height != dest_fmt->fmt.pix.height ||
+			src_fmt->fmt.pix.pixelformat != dest_fmt->fmt.pix.pixelformat)
+		return 1;
+
+	/* Same checks as v4lconvert_convert() does to see if it can simply
+	   copy the data */
+	if (!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat))
 		return 0;
-	}
 
-	return 1;
+	return (data->control_flags & V4LCONTROL_ROTATED_90_JPEG) ||
+		v4lcontrol_get_ctrl(data->control, V4LCONTROL_ROTATE) ||
+		v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP) ||
+		v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP) ||
+		v4lprocessing_pre_processing(data->processing);
+}
+
+static int v4lconvert_is_yuv420(unsigned int pixelformat)
+{
+	return pixelformat == V4L2_PIX_FMT_YUV420 ||
+		pixelformat == V4L2_PIX_FMT_YVU420;
+}
+
+/* When a jpeg frame gets cropped / reduced to a smaller dest size, it is
+   cheaper to decode it at 1/2, 1/4 or 1/8 of its size, as long as that still
+   is at least the dest size. The scaled size must remain a multiple of 2. */
+static int v4lconvert_jpeg_scale(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt)
+{
+	unsigned int width = src_fmt->fmt.pix.width;
+	unsigned int height = src_fmt->fmt.pix.height;
+	int scale = 1;
+
+	if (src_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG &&
+	    src_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_JPEG)
+		return 1;
+
+	while (scale < 8 &&
+	       width / (scale * 2) >= dest_fmt->fmt.pix.width &&
+	       height / (scale * 2) >= dest_fmt->fmt.pix.height &&
+	       width % (scale * 4) == 0 && height % (scale * 4) == 0)
+		scale *= 2;
+
+	return scale;
 }
 
 unsigned char *v4lconvert_alloc_buffer(int needed,
@@ -770,143 +973,766 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
-static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
-	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+/* Fill in the length in bytes and the number of lines of each plane of a
+   width x height frame, planes are in the order of the multi-planar variant
+   of the format. Returns the number of planes, or 0 for formats which are not
+   a destination format, nor a planar source format. */
+static int v4lconvert_plane_sizes(unsigned int pixelformat,
+		int width, int height, int bytes[3], int lines[3])
 {
-	int result = 0;
-	unsigned int src_pix_fmt = fmt->fmt.pix.pixelformat;
-	unsigned int width  = fmt->fmt.pix.width;
-	unsigned int height = fmt->fmt.pix.height;
-	unsigned int bytesperline = fmt->fmt.pix.bytesperline;
-
-	switch (src_pix_fmt) {
-	/* JPG and variants */
-	case V4L2_PIX_FMT_MJPEG:
-	case V4L2_PIX_FMT_JPEG:
-#ifdef HAVE_JPEG
-		if (data->flags & V4LCONVERT_USE_TINYJPEG) {
-#endif // HAVE_JPEG
-			result = v4lconvert_decode_jpeg_tinyjpeg(data,
-							src, src_size, dest,
-							fmt, dest_pix_fmt, 0);
-#ifdef HAVE_JPEG
-		} else {
-			result = v4lconvert_decode_jpeg_libjpeg(data,
-							src, src_size, dest,
-							fmt, dest_pix_fmt);
-			if (result == -1 && errno == EOPNOTSUPP) {
-				/* Fall back to tinyjpeg */
-				jpeg_destroy_decompress(&data->cinfo);
-				data->cinfo_initialized = 0;
-				data->flags |= V4LCONVERT_USE_TINYJPEG;
-				result = v4lconvert_decode_jpeg_tinyjpeg(data,
-							src, src_size, dest,
-							fmt, dest_pix_fmt, 0);
-			}
-		}
-#endif // HAVE_JPEG
+	switch (pixelformat) {
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		bytes[0] = width;
+		bytes[1] = bytes[2] = width / 2;
+		lines[0] = height;
+		lines[1] = lines[2] = height / 2;
+		return 3;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		bytes[0] = bytes[1] = width;
+		lines[0] = height;
+		lines[1] = pixelformat == V4L2_PIX_FMT_NV12 ? height / 2 : height;
+		return 2;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		bytes[0] = width * 3;
 		break;
-	case V4L2_PIX_FMT_PJPG:
-		result = v4lconvert_decode_jpeg_tinyjpeg(data, src, src_size,
-				dest, fmt, dest_pix_fmt,
-				TINYJPEG_FLAGS_PIXART_JPEG);
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		bytes[0] = width * 2;
 		break;
-	case V4L2_PIX_FMT_JPGL:
-		result = v4lconvert_decode_jpgl(src, src_size, dest_pix_fmt,
-						dest, width, height);
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+		bytes[0] = width * 4;
+		break;
+	case V4L2_PIX_FMT_RGB48:
+		bytes[0] = width * 6;
 		break;
+	default:
+		return 0;
+	}
+	lines[0] = height;
+	return 1;
+}
 
-	/* Custom cam specific YUV formats */
-	case V4L2_PIX_FMT_SPCA501:
-	case V4L2_PIX_FMT_SPCA505:
-	case V4L2_PIX_FMT_SPCA508:
-	case V4L2_PIX_FMT_CIT_YYVYUY:
-	case V4L2_PIX_FMT_KONICA420:
-	case V4L2_PIX_FMT_M420:
-	case V4L2_PIX_FMT_SN9C20X_I420:
-	case V4L2_PIX_FMT_CPIA1:
-	case V4L2_PIX_FMT_OV511:
-	case V4L2_PIX_FMT_OV518: {
-		unsigned char *d;
-		int d_size;
-		int yvu = 0;
+/* Setup the planes of a frame stored in a single buffer, with the layout
+   V4L2 uses for single-planar formats: each plane directly follows the
+   previous one and the chroma planes of yuv420 have half the bytesperline.
+   A bytesperline which is too small (e.g. 0) means no padding. */
+static void v4lconvert_planes_init(struct v4lconvert_planes *planes,
+		unsigned char *buf, const struct v4l2_format *fmt)
+{
+	int i, n, bytes[3], lines[3];
+
+	memset(planes, 0, sizeof(*planes));
+	n = v4lconvert_plane_sizes(fmt->fmt.pix.pixelformat, fmt->fmt.pix.width,
+				   fmt->fmt.pix.height, bytes, lines);
+	planes->plane[0] = buf;
+	planes->stride[0] = fmt->fmt.pix.bytesperline;
+	if (n && planes->stride[0] < bytes[0])
+		planes->stride[0] = bytes[0];
+
+	for (i = 1; i < n; i++) {
+		planes->stride[i] = bytes[i] < bytes[0] ? planes->stride[0] / 2 :
+							  planes->stride[0];
+		planes->plane[i] = planes->plane[i - 1] +
+				   planes->stride[i - 1] * lines[i - 1];
+	}
+}
 
-		if (dest_pix_fmt != V4L2_PIX_FMT_YUV420 &&
-				dest_pix_fmt != V4L2_PIX_FMT_YVU420) {
-			d = v4lconvert_alloc_buffer(width * height * 3 / 2,
-					&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
-			if (!d)
-				return v4lconvert_oom_error(data);
-			d_size = width * height * 3 / 2;
-		} else {
-			d = dest;
-			d_size = dest_size;
-		}
+/* Setup planes for a frame without padding in *buf, which gets (re)allocated
+   when too small, returns the size of the frame or -1 on error */
+static int v4lconvert_planes_alloc(struct v4lconvert_planes *planes,
+		unsigned int pixelformat, int width, int height,
+		unsigned char **buf, int *buf_size)
+{
+	struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	int i, n, size = 0, bytes[3], lines[3];
 
-		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420)
-			yvu = 1;
+	n = v4lconvert_plane_sizes(pixelformat, width, height, bytes, lines);
+	for (i = 0; i < n; i++)
+		size += bytes[i] * lines[i];
 
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SPCA501:
-			v4lconvert_spca501_to_yuv420(src, d, width, height, yvu);
-			break;
-		case V4L2_PIX_FMT_SPCA505:
-			v4lconvert_spca505_to_yuv420(src, d, width, height, yvu);
-			break;
-		case V4L2_PIX_FMT_SPCA508:
-			v4lconvert_spca508_to_yuv420(src, d, width, height, yvu);
-			break;
-		case V4L2_PIX_FMT_CIT_YYVYUY:
-			v4lconvert_cit_yyvyuy_to_yuv420(src, d, width, height, yvu);
-			break;
-		case V4L2_PIX_FMT_KONICA420:
-			v4lconvert_konica_yuv420_to_yuv420(src, d, width, height, yvu);
-			break;
-		case V4L2_PIX_FMT_M420:
-			v4lconvert_m420_to_yuv420(src, d, width, height, yvu);
-			break;
-		case V4L2_PIX_FMT_SN9C20X_I420:
-			v4lconvert_sn9c20x_to_yuv420(src, d, width, height, yvu);
-			break;
-		case V4L2_PIX_FMT_CPIA1:
-			if (v4lconvert_cpia1_to_yuv420(data, src, src_size, d,
-						width, height, yvu)) {
-				/* Corrupt frame, better get another one */
-				errno = EAGAIN;
-				return -1;
-			}
-			break;
-#ifdef HAVE_LIBV4LCONVERT_HELPERS
-		case V4L2_PIX_FMT_OV511:
-			if (v4lconvert_helper_decompress(data, LIBV4LCONVERT_PRIV_DIR "/ov511-decomp",
-						src, src_size, d, d_size, width, height, yvu)) {
-				/* Corrupt frame, better get another one */
-				errno = EAGAIN;
-				return -1;
-			}
-			break;
-		case V4L2_PIX_FMT_OV518:
-			if (v4lconvert_helper_decompress(data, LIBV4LCONVERT_PRIV_DIR "/ov518-decomp",
-						src, src_size, d, d_size, width, height, yvu)) {
-				/* Corrupt frame, better get another one */
-				errno = EAGAIN;
-				return -1;
-			}
-			break;
-#endif
-		}
+	if (!v4lconvert_alloc_buffer(size, buf, buf_size))
+		return -1;
 
-		switch (dest_pix_fmt) {
-		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(data->convert_pixfmt_buf, dest, width,
-					height, bytesperline, yvu);
-			break;
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
-					height, bytesperline, yvu);
-			break;
-		}
+	fmt.fmt.pix.pixelformat = pixelformat;
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	v4lconvert_planes_init(planes, *buf, &fmt);
+
+	return size;
+}
+
+/* Returns the amount of bytes spanned by the planes of a frame, this is the
+   sum of the stride times the number of lines of each plane */
+static int v4lconvert_planes_size(const struct v4lconvert_planes *planes,
+		unsigned int pixelformat, int width, int height)
+{
+	int i, n, size = 0, bytes[3], lines[3];
+
+	n = v4lconvert_plane_sizes(pixelformat, width, height, bytes, lines);
+	for (i = 0; i < n; i++)
+		size += planes->stride[i] * lines[i];
+
+	return size;
+}
+
+/* Are the planes laid out as v4lconvert_planes_init() does it, with either
+   the given stride of the first plane (stride > 0) or no padding at all? */
+static int v4lconvert_planes_contiguous(const struct v4lconvert_planes *planes,
+		unsigned int pixelformat, int width, int height, int stride)
+{
+	struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	struct v4lconvert_planes expected;
+	int i, n, bytes[3], lines[3];
+
+	n = v4lconvert_plane_sizes(pixelformat, width, height, bytes, lines);
+
+	fmt.fmt.pix.pixelformat = pixelformat;
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.bytesperline = stride;
+	v4lconvert_planes_init(&expected, planes->plane[0], &fmt);
+
+	for (i = 0; i < n; i++)
+		if (planes->plane[i] != expected.plane[i] ||
+		    planes->stride[i] != expected.stride[i])
+			return 0;
+
+	return 1;
+}
+
+static void v4lconvert_copy_planes(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, unsigned int pixelformat,
+		int width, int height)
+{
+	int i, n, bytes[3], lines[3];
+
+	n = v4lconvert_plane_sizes(pixelformat, width, height, bytes, lines);
+	for (i = 0; i < n; i++)
+		v4lconvert_copy_lines(src->plane[i], dest->plane[i], bytes[i],
+				      lines[i], src->stride[i], dest->stride[i]);
+}
+
+/* Lines are done in small groups, so that they are still in the cache
+   when processing / mirroring them */
+#define V4LCONVERT_FUSED_LINES 16
+
+/* Conversions which can be split into bands of lines for data->threads */
+struct v4lconvert_lines_job {
+	const unsigned char *src;
+	unsigned char *dest;
+	int width;
+	int height;
+	int stride;
+	int dest_stride;
+	unsigned int pixfmt;
+	void (*packed)(const unsigned char *src, unsigned char *dest,
+			int width, int height, int stride, int dest_stride);
+	void (*bayer)(const unsigned char *bayer, unsigned char *rgb,
+			int width, int height, const unsigned int stride,
+			unsigned int pixfmt, int dest_stride, int first, int last,
+			v4lconvert_bayer_pairs_fn pairs);
+	v4lconvert_bayer_pairs_fn bayer_pairs;
+	/* For conversions to planar yuv */
+	const struct v4lconvert_planes *dest_planes;
+	int yvu;
+	/* Set when the lines must be processed as they are produced */
+	struct v4lprocessing_data *processing;
+	/* Set to expand the rgb24 lines to argb32 */
+	void (*rgb24_to_argb32)(const unsigned char *src, unsigned char *dest,
+			int width, int height, int stride, int dest_stride,
+			int bgr);
+};
+
+static void v4lconvert_packed_lines(void *arg, int first, int last)
+{
+	struct v4lconvert_lines_job *job = arg;
+	int i, n, line, width = job->width & ~1;
+
+	if (job->rgb24_to_argb32) {
+		/* Each line is converted to rgb24 at the start of its argb32
+		   line and expanded in place while it is still in the cache */
+		for (line = first; line < last; line++) {
+			unsigned char *d = job->dest + line * job->dest_stride;
+
+			job->packed(job->src + line * job->stride, d,
+				    job->width, 1, job->stride, job->dest_stride);
+			if (job->processing)
+				v4lprocessing_processing_line(job->processing,
+							      d, width);
+			job->rgb24_to_argb32(d, d, width, 1, width * 3,
+					     width * 4, 0);
+		}
+		return;
+	}
+
+	if (!job->processing) {
+		job->packed(job->src + first * job->stride,
+			    job->dest + first * job->dest_stride,
+			    job->width, last - first, job->stride,
+			    job->dest_stride);
+		return;
+	}
+
+	for (line = first; line < last; line += n) {
+		unsigned char *d = job->dest + line * job->dest_stride;
+
+		n = MIN(last - line, V4LCONVERT_FUSED_LINES);
+		job->packed(job->src + line * job->stride, d, job->width, n,
+			    job->stride, job->dest_stride);
+		for (i = 0; i < n; i++)
+			v4lprocessing_processing_line(job->processing,
+					d + i * job->dest_stride, width);
+	}
+}
+
+static void v4lconvert_packed_to_rgb(struct v4lconvert_data *data,
+		void (*packed)(const unsigned char *src, unsigned char *dest,
+			int width, int height, int stride, int dest_stride),
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride, int argb32)
+{
+	struct v4lconvert_lines_job job = {
+		.src = src, .dest = dest, .width = width, .height = height,
+		.stride = stride, .dest_stride = dest_stride, .packed = packed,
+	};
+
+	if (argb32)
+		job.rgb24_to_argb32 = data->kernels->rgb24_to_argb32;
+
+	if (v4lprocessing_processing_by_line(data->processing) == 1)
+		job.processing = data->processing;
+
+	v4lconvert_threads_run(data->threads, v4lconvert_packed_lines, &job,
+			height);
+}
+
+static void v4lconvert_bayer_lines(void *arg, int first, int last)
+{
+	struct v4lconvert_lines_job *job = arg;
+
+	job->bayer(job->src, job->dest + first * job->dest_stride, job->width,
+		   job->height, job->stride, job->pixfmt, job->dest_stride,
+		   first, last, job->bayer_pairs);
+}
+
+/* The kernel which demosaics the interior of the bayer lines */
+static v4lconvert_bayer_pairs_fn v4lconvert_bayer_pairs(
+		struct v4lconvert_data *data)
+{
+	if (data->demosaic == V4LCONVERT_DEMOSAIC_EDGE)
+		return v4lconvert_bayer_pairs_to_bgr24_edge;
+
+	return data->kernels->bayer_pairs_to_bgr24;
+}
+
+static void v4lconvert_bayer_to_rgbbgr24(struct v4lconvert_data *data,
+		void (*bayer)(const unsigned char *bayer, unsigned char *rgb,
+			int width, int height, const unsigned int stride,
+			unsigned int pixfmt, int dest_stride, int first, int last,
+			v4lconvert_bayer_pairs_fn pairs),
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride,
+		unsigned int pixfmt)
+{
+	struct v4lconvert_lines_job job = {
+		.src = src, .dest = dest, .width = width, .height = height,
+		.stride = stride, .dest_stride = dest_stride, .pixfmt = pixfmt,
+		.bayer = bayer, .bayer_pairs = v4lconvert_bayer_pairs(data),
+	};
+
+	v4lconvert_threads_run(data->threads, v4lconvert_bayer_lines, &job,
+			height);
+}
+
+static void v4lconvert_bayer_yuv420_lines(void *arg, int first, int last)
+{
+	struct v4lconvert_lines_job *job = arg;
+
+	v4lconvert_bayer_to_yuv420_lines(job->src, job->dest_planes,
+			job->width, job->height, job->stride, job->pixfmt,
+			job->yvu, first, last);
+}
+
+static void v4lconvert_bayer_to_yuv420(struct v4lconvert_data *data,
+		const unsigned char *src, const struct v4lconvert_planes *dest,
+		int width, int height, int stride, unsigned int pixfmt, int yvu)
+{
+	struct v4lconvert_lines_job job = {
+		.src = src, .width = width, .height = height, .stride = stride,
+		.pixfmt = pixfmt, .dest_planes = dest, .yvu = yvu,
+	};
+
+	v4lconvert_threads_run(data->threads, v4lconvert_bayer_yuv420_lines,
+			&job, height);
+}
+
+/* Conversion to rgb24 / bgr24 combined with flipping and / or cropping. The
+   converted lines are written straight to their final place in dest, instead
+   of going through a frame sized temporary buffer for each step. */
+struct v4lconvert_fused_job {
+	const unsigned char *src;
+	unsigned char *dest;
+	int src_width;
+	int src_height;
+	int stride;
+	int dest_stride;
+	unsigned int pixfmt;
+	int width;	/* dest width and height */
+	int height;
+	int x;		/* top left of the part of src which ends up in dest */
+	int y;
+	int hflip;
+	int vflip;
+	void (*packed)(const unsigned char *src, unsigned char *dest,
+			int width, int height, int stride, int dest_stride);
+	void (*bayer)(const unsigned char *bayer, unsigned char *rgb,
+			int width, int height, const unsigned int stride,
+			unsigned int pixfmt, int dest_stride, int first, int last,
+			v4lconvert_bayer_pairs_fn pairs);
+	v4lconvert_bayer_pairs_fn bayer_pairs;
+	struct v4lprocessing_data *processing;
+};
+
+static void v4lconvert_fused_lines(void *arg, int first, int last)
+{
+	struct v4lconvert_fused_job *job = arg;
+	int i, n, line, src_line, pitch = job->dest_stride;
+
+	for (line = first; line < last; line += n) {
+		unsigned char *d = job->dest + line * pitch;
+
+		n = MIN(last - line, V4LCONVERT_FUSED_LINES);
+		src_line = job->vflip ? job->y + job->height - 1 - line :
+					job->y + line;
+
+		if (job->packed) {
+			/* A negative stride walks the src lines bottom up */
+			job->packed(job->src + src_line * job->stride + job->x * 2,
+				    d, job->width, n,
+				    job->vflip ? -job->stride : job->stride, pitch);
+		} else {
+			for (i = 0; i < n; i++) {
+				int l = job->vflip ? src_line - i : src_line + i;
+
+				job->bayer(job->src, d + i * pitch,
+					   job->src_width, job->src_height,
+					   job->stride, job->pixfmt, pitch,
+					   l, l + 1, job->bayer_pairs);
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			if (job->processing)
+				v4lprocessing_processing_line(job->processing,
+						d + i * pitch, job->width);
+			if (job->hflip)
+				v4lconvert_hflip_rgbbgr24_line(d + i * pitch,
+							       job->width);
+		}
+	}
+}
+
+/* Fill in job if the conversion from src_fmt to dest_fmt with the given
+   flipping / cropping can be done in one pass, returns 0 if it cannot */
+static int v4lconvert_fused_setup(struct v4lconvert_data *data,
+		struct v4lconvert_fused_job *job,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		int processing, int hflip, int vflip, int crop)
+{
+	int src_width = src_fmt->fmt.pix.width;
+	int src_height = src_fmt->fmt.pix.height;
+	int width = dest_fmt->fmt.pix.width;
+	int height = dest_fmt->fmt.pix.height;
+	int bgr = dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_BGR24;
+
+	if (dest_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24 && !bgr)
+		return 0;
+
+	memset(job, 0, sizeof(*job));
+
+	if (crop) {
+		/* Only plain cropping, see v4lconvert_crop() */
+		if (width > src_width || height > src_height ||
+				v4lconvert_crop_scaler(data,
+					dest_fmt->fmt.pix.pixelformat,
+					src_width, src_height, width, height))
+			return 0;
+		/* Crop from the flipped image */
+		job->x = (src_width - width) / 2;
+		job->y = (src_height - height) / 2;
+		if (hflip)
+			job->x = src_width - width - job->x;
+		if (vflip)
+			job->y = src_height - height - job->y;
+	}
+
+	switch (src_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+		job->packed = bgr ? data->kernels->yuyv_to_bgr24 :
+				    data->kernels->yuyv_to_rgb24;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		job->packed = bgr ? data->kernels->yvyu_to_bgr24 :
+				    data->kernels->yvyu_to_rgb24;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		job->packed = bgr ? data->kernels->uyvy_to_bgr24 :
+				    data->kernels->uyvy_to_rgb24;
+		break;
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SRGGB8:
+		/* Demosaicing needs the whole line */
+		if (crop)
+			return 0;
+		job->bayer = bgr ? v4lconvert_bayer_to_bgr24_lines :
+				   v4lconvert_bayer_to_rgb24_lines;
+		job->bayer_pairs = v4lconvert_bayer_pairs(data);
+		break;
+	default:
+		return 0;
+	}
+
+	/* The packed kernels work on pairs of pixels */
+	if (job->packed && ((job->x & 1) || (width & 1)))
+		return 0;
+
+	/* Processing of yuv is done on the rgb24 result, which we never have
+	   in one piece, so it must be done line by line */
+	if (job->packed && processing) {
+		switch (v4lprocessing_processing_by_line(data->processing)) {
+		case -1:
+			return 0;
+		case 1:
+			job->processing = data->processing;
+			break;
+		}
+	}
+
+	job->src_width = src_width;
+	job->src_height = src_height;
+	job->stride = src_fmt->fmt.pix.bytesperline;
+	job->pixfmt = src_fmt->fmt.pix.pixelformat;
+	job->width = width;
+	job->height = height;
+	job->hflip = hflip;
+	job->vflip = vflip;
+
+	return 1;
+}
+
+/* nv12 and yuyv are made by packing yuv420, argb32 / xrgb32 by expanding
+   rgb24. This returns the format the other dest formats are made from. */
+static unsigned int v4lconvert_base_pixfmt(unsigned int pixelformat)
+{
+	switch (pixelformat) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUYV:
+		return V4L2_PIX_FMT_YUV420;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+		return V4L2_PIX_FMT_RGB24;
+	}
+	return pixelformat;
+}
+
+/* Does v4lconvert_convert_pixfmt() have a direct conversion from src_pix_fmt
+   to dest_pix_fmt, or must it go through the base format of dest_pix_fmt? */
+static int v4lconvert_direct_conversion(unsigned int src_pix_fmt,
+		unsigned int dest_pix_fmt)
+{
+	if (v4lconvert_base_pixfmt(dest_pix_fmt) == dest_pix_fmt)
+		return 1;
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		return 1;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		return dest_pix_fmt == V4L2_PIX_FMT_NV12 ||
+		       dest_pix_fmt == V4L2_PIX_FMT_YUYV;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+	case V4L2_PIX_FMT_BGR32:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_ABGR32:
+		return dest_pix_fmt == V4L2_PIX_FMT_XRGB32 ||
+		       dest_pix_fmt == V4L2_PIX_FMT_ARGB32;
+	}
+	return 0;
+}
+
+/* Does v4lconvert_convert_pixfmt() write dest frames of src_pix_fmt with the
+   strides of the dest planes? The others write frames without padding. */
+static int v4lconvert_stride_aware(unsigned int src_pix_fmt)
+{
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_MJPEG:
+	case V4L2_PIX_FMT_JPEG:
+	case V4L2_PIX_FMT_PJPG:
+	case V4L2_PIX_FMT_JPGL:
+	case V4L2_PIX_FMT_SPCA501:
+	case V4L2_PIX_FMT_SPCA505:
+	case V4L2_PIX_FMT_SPCA508:
+	case V4L2_PIX_FMT_CIT_YYVYUY:
+	case V4L2_PIX_FMT_KONICA420:
+	case V4L2_PIX_FMT_M420:
+	case V4L2_PIX_FMT_SN9C20X_I420:
+	case V4L2_PIX_FMT_CPIA1:
+	case V4L2_PIX_FMT_OV511:
+	case V4L2_PIX_FMT_OV518:
+	case V4L2_PIX_FMT_NV12_16L16:
+	case V4L2_PIX_FMT_SE401:
+	case V4L2_PIX_FMT_Y10BPACK:
+	case V4L2_PIX_FMT_HSV24:
+	case V4L2_PIX_FMT_HSV32:
+		return 0;
+	}
+	return 1;
+}
+
+/* jpeg_scale: decode jpeg's at 1/jpeg_scale of their size, fmt gets updated
+   to the size of the decoded image. The bytesperline of fmt is ignored, the
+   strides of the src planes are used instead. */
+static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
+	const struct v4lconvert_planes *src_planes, int src_size,
+	const struct v4lconvert_planes *dest_planes, int dest_size,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int jpeg_scale)
+{
+	int result = 0;
+	unsigned int src_pix_fmt = fmt->fmt.pix.pixelformat;
+	unsigned int width  = fmt->fmt.pix.width;
+	unsigned int height = fmt->fmt.pix.height;
+	unsigned int bytesperline = src_planes->stride[0];
+	unsigned char *src = src_planes->plane[0];
+	unsigned char *dest = dest_planes->plane[0];
+	int dest_stride = dest_planes->stride[0];
+
+	/* Some of the conversions below take the src stride from fmt */
+	fmt->fmt.pix.bytesperline = bytesperline;
+
+	/* The jpeg frames of cams which need rotate90 are transposed, width
+	   and height are only used for the size of the decoded frame */
+	if ((data->control_flags & V4LCONTROL_ROTATED_90_JPEG) &&
+	    (src_pix_fmt == V4L2_PIX_FMT_MJPEG ||
+	     src_pix_fmt == V4L2_PIX_FMT_JPEG ||
+	     src_pix_fmt == V4L2_PIX_FMT_PJPG)) {
+		width = fmt->fmt.pix.height;
+		height = fmt->fmt.pix.width;
+	}
+
+	if (dest_pix_fmt == V4L2_PIX_FMT_RGB48 &&
+	    !v4lconvert_bayer8_pixfmt(src_pix_fmt)) {
+		V4LCONVERT_ERR("rgb48 can only be made from raw bayer\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!v4lconvert_direct_conversion(src_pix_fmt, dest_pix_fmt)) {
+		unsigned int base_pix_fmt = v4lconvert_base_pixfmt(dest_pix_fmt);
+		struct v4lconvert_planes d = *dest_planes;
+		int d_size = dest_size;
+
+		/* rgb24 can be expanded to argb32 in place, yuv420 needs a
+		   temporary buffer to get repacked */
+		if (base_pix_fmt == V4L2_PIX_FMT_YUV420) {
+			d_size = v4lconvert_planes_alloc(&d, base_pix_fmt,
+					width / jpeg_scale, height / jpeg_scale,
+					&data->pack_buf, &data->pack_buf_size);
+			if (d_size < 0)
+				return v4lconvert_oom_error(data);
+		}
+
+		result = v4lconvert_convert_pixfmt(data, src_planes, src_size,
+				&d, d_size, fmt, base_pix_fmt, jpeg_scale);
+		if (result)
+			return result;
+
+		return v4lconvert_convert_pixfmt(data, &d, d_size,
+				dest_planes, dest_size, fmt, dest_pix_fmt, 1);
+	}
+
+	if (!v4lconvert_stride_aware(src_pix_fmt) &&
+	    !v4lconvert_planes_contiguous(dest_planes, dest_pix_fmt,
+				width / jpeg_scale, height / jpeg_scale, 0)) {
+		struct v4lconvert_planes d;
+		int d_size;
+
+		d_size = v4lconvert_planes_alloc(&d, dest_pix_fmt,
+				width / jpeg_scale, height / jpeg_scale,
+				&data->planes_buf, &data->planes_buf_size);
+		if (d_size < 0)
+			return v4lconvert_oom_error(data);
+
+		result = v4lconvert_convert_pixfmt(data, src_planes, src_size,
+				&d, d_size, fmt, dest_pix_fmt, jpeg_scale);
+		if (result)
+			return result;
+
+		v4lconvert_copy_planes(&d, dest_planes, dest_pix_fmt,
+				fmt->fmt.pix.width, fmt->fmt.pix.height);
+		return 0;
+	}
+
+	switch (src_pix_fmt) {
+	/* JPG and variants */
+	case V4L2_PIX_FMT_MJPEG:
+	case V4L2_PIX_FMT_JPEG:
+#ifdef HAVE_JPEG
+		if (data->flags & V4LCONVERT_USE_TINYJPEG) {
+#endif // HAVE_JPEG
+			result = v4lconvert_decode_jpeg_tinyjpeg(data,
+							src, src_size, dest,
+							fmt, dest_pix_fmt, 0,
+							jpeg_scale);
+#ifdef HAVE_JPEG
+		} else {
+			result = v4lconvert_decode_jpeg_libjpeg(data,
+							src, src_size, dest,
+							fmt, dest_pix_fmt,
+							jpeg_scale);
+			if (result == -1 && errno == EOPNOTSUPP) {
+				/* Fall back to tinyjpeg */
+				jpeg_destroy_decompress(&data->cinfo);
+				data->cinfo_initialized = 0;
+				data->flags |= V4LCONVERT_USE_TINYJPEG;
+				result = v4lconvert_decode_jpeg_tinyjpeg(data,
+							src, src_size, dest,
+							fmt, dest_pix_fmt, 0,
+							jpeg_scale);
+			}
+		}
+#endif // HAVE_JPEG
+		break;
+	case V4L2_PIX_FMT_PJPG:
+		result = v4lconvert_decode_jpeg_tinyjpeg(data, src, src_size,
+				dest, fmt, dest_pix_fmt,
+				TINYJPEG_FLAGS_PIXART_JPEG, 1);
+		break;
+	case V4L2_PIX_FMT_JPGL:
+		result = v4lconvert_decode_jpgl(src, src_size, dest_pix_fmt,
+						dest, width, height);
+		break;
+
+	/* Custom cam specific YUV formats */
+	case V4L2_PIX_FMT_SPCA501:
+	case V4L2_PIX_FMT_SPCA505:
+	case V4L2_PIX_FMT_SPCA508:
+	case V4L2_PIX_FMT_CIT_YYVYUY:
+	case V4L2_PIX_FMT_KONICA420:
+	case V4L2_PIX_FMT_M420:
+	case V4L2_PIX_FMT_SN9C20X_I420:
+	case V4L2_PIX_FMT_CPIA1:
+	case V4L2_PIX_FMT_OV511:
+	case V4L2_PIX_FMT_OV518: {
+		unsigned char *d;
+		int d_size;
+		int yvu = 0;
+
+		if (dest_pix_fmt != V4L2_PIX_FMT_YUV420 &&
+				dest_pix_fmt != V4L2_PIX_FMT_YVU420) {
+			d = v4lconvert_alloc_buffer(width * height * 3 / 2,
+					&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+			if (!d)
+				return v4lconvert_oom_error(data);
+			d_size = width * height * 3 / 2;
+		} else {
+			d = dest;
+			d_size = dest_size;
+		}
+
+		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420)
+			yvu = 1;
+
+		switch (src_pix_fmt) {
+		case V4L2_PIX_FMT_SPCA501:
+			v4lconvert_spca501_to_yuv420(src, d, width, height, yvu);
+			break;
+		case V4L2_PIX_FMT_SPCA505:
+			v4lconvert_spca505_to_yuv420(src, d, width, height, yvu);
+			break;
+		case V4L2_PIX_FMT_SPCA508:
+			v4lconvert_spca508_to_yuv420(src, d, width, height, yvu);
+			break;
+		case V4L2_PIX_FMT_CIT_YYVYUY:
+			v4lconvert_cit_yyvyuy_to_yuv420(src, d, width, height, yvu);
+			break;
+		case V4L2_PIX_FMT_KONICA420:
+			v4lconvert_konica_yuv420_to_yuv420(src, d, width, height, yvu);
+			break;
+		case V4L2_PIX_FMT_M420:
+			v4lconvert_m420_to_yuv420(src, d, width, height, yvu);
+			break;
+		case V4L2_PIX_FMT_SN9C20X_I420:
+			v4lconvert_sn9c20x_to_yuv420(src, d, width, height, yvu);
+			break;
+		case V4L2_PIX_FMT_CPIA1:
+			if (v4lconvert_cpia1_to_yuv420(data, src, src_size, d,
+						width, height, yvu)) {
+				/* Corrupt frame, better get another one */
+				errno = EAGAIN;
+				return -1;
+			}
+			break;
+#ifdef HAVE_LIBV4LCONVERT_HELPERS
+		case V4L2_PIX_FMT_OV511:
+		case V4L2_PIX_FMT_OV518: {
+			unsigned char *frame;
+
+			frame = v4lconvert_helper_decompress(data,
+					src_pix_fmt == V4L2_PIX_FMT_OV511 ?
+					LIBV4LCONVERT_PRIV_DIR "/ov511-decomp" :
+					LIBV4LCONVERT_PRIV_DIR "/ov518-decomp",
+					src, src_size, d, d_size, width, height, yvu);
+			if (!frame) {
+				/* Corrupt frame, better get another one */
+				errno = EAGAIN;
+				return -1;
+			}
+			/* The frame may be in the helper's shm, only copy it
+			   when it is the final result */
+			if (d == dest && frame != dest)
+				memcpy(dest, frame, width * height * 3 / 2);
+			else
+				d = frame;
+			break;
+		}
+#endif
+		}
+
+		if (d != dest) {
+			struct v4lconvert_planes p;
+			struct v4l2_format yuv_fmt = *fmt;
+
+			yuv_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+			yuv_fmt.fmt.pix.bytesperline = width;
+			v4lconvert_planes_init(&p, d, &yuv_fmt);
+			switch (dest_pix_fmt) {
+			case V4L2_PIX_FMT_RGB24:
+				data->kernels->yuv420_to_rgb24(&p, dest, width,
+						height, dest_stride, yvu);
+				break;
+			case V4L2_PIX_FMT_BGR24:
+				data->kernels->yuv420_to_bgr24(&p, dest, width,
+						height, dest_stride, yvu);
+				break;
+			}
+		}
 		break;
 	}
 
@@ -932,16 +1758,28 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_NV12:
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, bytesperline, 0);
+			data->kernels->nv12_to_rgb24(src_planes, dest, width, height,
+					dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, bytesperline, 1);
+			data->kernels->nv12_to_rgb24(src_planes, dest, width, height,
+					dest_stride, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_nv12_to_yuv420(src, dest, width, height, bytesperline, 0);
+			data->kernels->nv12_to_yuv420(src_planes, dest_planes,
+					width, height, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_nv12_to_yuv420(src, dest, width, height, bytesperline, 1);
+			data->kernels->nv12_to_yuv420(src_planes, dest_planes,
+					width, height, 1);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_copy_planes(src_planes, dest_planes,
+					V4L2_PIX_FMT_NV12, width, height);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_nv12_to_yuyv(src_planes, dest, width, height,
+					dest_stride);
 			break;
 		}
 		break;
@@ -1026,6 +1864,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		src_pix_fmt = tmpfmt.fmt.pix.pixelformat;
 		src = tmpbuf;
 		src_size = width * height;
+		bytesperline = width;
 		/* fall through */
 	}
 
@@ -1033,139 +1872,79 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_SBGGR10P:
 	case V4L2_PIX_FMT_SGBRG10P:
 	case V4L2_PIX_FMT_SGRBG10P:
-	case V4L2_PIX_FMT_SRGGB10P: {
-		int b10format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR10P:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB10P:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b10format = 0;
-			break;
-		}
-
-		if (b10format) {
-			if (src_size < ((width * height * 10)/8)) {
-				V4LCONVERT_ERR
-					("short raw bayer10 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer10p_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
 	case V4L2_PIX_FMT_SBGGR10:
 	case V4L2_PIX_FMT_SGBRG10:
 	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SRGGB10: {
-		int b10format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR10:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB10:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b10format = 0;
-			break;
-		}
-
-		if (b10format) {
-			if (src_size < (width * height * 2)) {
-				V4LCONVERT_ERR
-					("short raw bayer10 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer10_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
+	case V4L2_PIX_FMT_SRGGB10:
 	case V4L2_PIX_FMT_SBGGR16:
 	case V4L2_PIX_FMT_SGBRG16:
 	case V4L2_PIX_FMT_SGRBG16:
-	case V4L2_PIX_FMT_SRGGB16: {
-		int b16format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR16:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB16:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b16format = 0;
-			break;
-		}
-
-		if (b16format) {
-			if (src_size < ((width * height * 2))) {
-				V4LCONVERT_ERR
-					("short raw bayer16 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer16_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
-	/* Fall-through*/
+	case V4L2_PIX_FMT_SRGGB16:
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
-	case V4L2_PIX_FMT_SRGGB8:
-		if (src_size < (width * height)) {
+	case V4L2_PIX_FMT_SRGGB8: {
+		/* The 10, 12 and 16 bit formats get unpacked while
+		   demosaicing, a few lines at a time */
+		unsigned int pixfmt8 = v4lconvert_bayer8_pixfmt(src_pix_fmt);
+		int hi = pixfmt8 != src_pix_fmt;
+		unsigned char *bayer8;
+
+		if (src_size < width * height *
+				v4lconvert_bayer_bpp(src_pix_fmt) / 8) {
 			V4LCONVERT_ERR("short raw bayer data frame\n");
 			errno = EPIPE;
 			result = -1;
+			if (hi)
+				break;
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_rgbbgr24(data, hi ?
+					v4lconvert_bayer_hi_to_rgb24_lines :
+					v4lconvert_bayer_to_rgb24_lines,
+					src, dest, width, height, bytesperline,
+					dest_stride, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_rgbbgr24(data, hi ?
+					v4lconvert_bayer_hi_to_bgr24_lines :
+					v4lconvert_bayer_to_bgr24_lines,
+					src, dest, width, height, bytesperline,
+					dest_stride, src_pix_fmt);
+			break;
+		case V4L2_PIX_FMT_RGB48:
+			v4lconvert_bayer_to_rgbbgr24(data,
+					v4lconvert_bayer_to_rgb48_lines,
+					src, dest, width, height, bytesperline,
+					dest_stride, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0);
-			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 1);
+			if (hi) {
+				bayer8 = v4lconvert_alloc_buffer(width * height,
+						&data->convert_pixfmt_buf,
+						&data->convert_pixfmt_buf_size);
+				if (!bayer8)
+					return v4lconvert_oom_error(data);
+
+				v4lconvert_bayer_hi_to_bayer8(src, bayer8, width,
+						height, bytesperline, src_pix_fmt);
+				src = bayer8;
+				bytesperline = width;
+			}
+			v4lconvert_bayer_to_yuv420(data, src, dest_planes, width,
+					height, bytesperline, pixfmt8,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420);
 			break;
 		}
 		break;
+	}
 
 	case V4L2_PIX_FMT_SE401: {
 		unsigned char *d = NULL;
@@ -1196,13 +1975,14 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 						   width, height);
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_swap_rgb(d, dest, width, height);
+			v4lconvert_swap_rgb(d, dest, width, height, width * 3,
+					    dest_stride);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(d, dest, fmt, 0, 0, 3);
+			v4lconvert_rgb24_to_yuv420(d, dest_planes, fmt, 0, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(d, dest, fmt, 0, 1, 3);
+			v4lconvert_rgb24_to_yuv420(d, dest_planes, fmt, 0, 1, 3);
 			break;
 		}
 		break;
@@ -1219,11 +1999,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_RGB24:
 	        case V4L2_PIX_FMT_BGR24:
 			v4lconvert_y16_to_rgb24(src, dest, width, height,
+					bytesperline, dest_stride,
 					src_pix_fmt == V4L2_PIX_FMT_Y16);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_y16_to_yuv420(src, dest, fmt,
+			v4lconvert_y16_to_yuv420(src, dest_planes, fmt,
 					 src_pix_fmt == V4L2_PIX_FMT_Y16);
 			break;
 		}
@@ -1240,11 +2021,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
 	        case V4L2_PIX_FMT_BGR24:
-			v4lconvert_grey_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_grey_to_rgb24(src, dest, width, height, bytesperline,
+						 dest_stride);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_grey_to_yuv420(src, dest, fmt);
+			v4lconvert_grey_to_yuv420(src, dest_planes, fmt);
 			break;
 		}
 		break;
@@ -1277,16 +2059,18 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_rgb565_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_rgb565_to_rgb24(src, dest, width, height, bytesperline,
+						   dest_stride);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_rgb565_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_rgb565_to_bgr24(src, dest, width, height, bytesperline,
+						   dest_stride);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb565_to_yuv420(src, dest, fmt, 0);
+			v4lconvert_rgb565_to_yuv420(src, dest_planes, fmt, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb565_to_yuv420(src, dest, fmt, 1);
+			v4lconvert_rgb565_to_yuv420(src, dest_planes, fmt, 1);
 			break;
 		}
 		break;
@@ -1299,16 +2083,23 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			memcpy(dest, src, width * height * 3);
+			v4lconvert_copy_lines(src, dest, width * 3, height,
+					      bytesperline, dest_stride);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_swap_rgb(src, dest, width, height);
+			v4lconvert_swap_rgb(src, dest, width, height,
+					    bytesperline, dest_stride);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 0, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 0, 1, 3);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_ARGB32:
+			data->kernels->rgb24_to_argb32(src, dest, width, height,
+					bytesperline, dest_stride, 0);
 			break;
 		}
 		break;
@@ -1321,16 +2112,23 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_swap_rgb(src, dest, width, height);
+			v4lconvert_swap_rgb(src, dest, width, height,
+					    bytesperline, dest_stride);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			memcpy(dest, src, width * height * 3);
+			v4lconvert_copy_lines(src, dest, width * 3, height,
+					      bytesperline, dest_stride);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 0, 3);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 1, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 1, 3);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 1, 1, 3);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_ARGB32:
+			data->kernels->rgb24_to_argb32(src, dest, width, height,
+					bytesperline, dest_stride, 1);
 			break;
 		}
 		break;
@@ -1346,16 +2144,23 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		src++;
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_rgb32_to_rgb24(src, dest, width, height, 0);
+			v4lconvert_rgb32_to_rgb24(src, dest, width, height,
+					bytesperline, dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_rgb32_to_rgb24(src, dest, width, height, 1);
+			v4lconvert_rgb32_to_rgb24(src, dest, width, height,
+					bytesperline, dest_stride, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 4);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 0, 0, 4);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 4);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 0, 1, 4);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_ARGB32:
+			v4lconvert_rgb32_to_argb32(src, dest, width, height,
+					bytesperline, dest_stride, 0);
 			break;
 		}
 		break;
@@ -1370,16 +2175,23 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_rgb32_to_rgb24(src, dest, width, height, 1);
+			v4lconvert_rgb32_to_rgb24(src, dest, width, height,
+					bytesperline, dest_stride, 1);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_rgb32_to_rgb24(src, dest, width, height, 0);
+			v4lconvert_rgb32_to_rgb24(src, dest, width, height,
+					bytesperline, dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 0, 4);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 1, 0, 4);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 1, 4);
+			v4lconvert_rgb24_to_yuv420(src, dest_planes, fmt, 1, 1, 4);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_ARGB32:
+			v4lconvert_rgb32_to_argb32(src, dest, width, height,
+					bytesperline, dest_stride, 1);
 			break;
 		}
 		break;
@@ -1392,18 +2204,27 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
-					height, bytesperline, 0);
+			data->kernels->yuv420_to_rgb24(src_planes, dest, width,
+					height, dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
-					height, bytesperline, 0);
+			data->kernels->yuv420_to_bgr24(src_planes, dest, width,
+					height, dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			memcpy(dest, src, width * height * 3 / 2);
+			v4lconvert_copy_planes(src_planes, dest_planes,
+					       V4L2_PIX_FMT_YUV420, width, height);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_swap_uv(src, dest, fmt);
+			v4lconvert_swap_uv(src_planes, dest_planes, width, height);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuv420_to_nv12(src_planes, dest_planes, width,
+						  height, 0);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_yuv420_to_yuyv(src_planes, dest, width, height,
+						  dest_stride, 0);
 			break;
 		}
 		break;
@@ -1416,18 +2237,27 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
-					height, bytesperline, 1);
+			data->kernels->yuv420_to_rgb24(src_planes, dest, width,
+					height, dest_stride, 1);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
-					height, bytesperline, 1);
+			data->kernels->yuv420_to_bgr24(src_planes, dest, width,
+					height, dest_stride, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_swap_uv(src, dest, fmt);
+			v4lconvert_swap_uv(src_planes, dest_planes, width, height);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			memcpy(dest, src, width * height * 3 / 2);
+			v4lconvert_copy_planes(src_planes, dest_planes,
+					       V4L2_PIX_FMT_YVU420, width, height);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuv420_to_nv12(src_planes, dest_planes, width,
+						  height, 1);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_yuv420_to_yuyv(src_planes, dest, width, height,
+						  dest_stride, 1);
 			break;
 		}
 		break;
@@ -1440,7 +2270,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		if (!tmpbuf)
 			return v4lconvert_oom_error(data);
 
-		v4lconvert_nv16_to_yuyv(src, tmpbuf, width, height, bytesperline);
+		data->kernels->nv16_to_yuyv(src_planes, tmpbuf, width, height,
+					    width * 2);
 		src_pix_fmt = V4L2_PIX_FMT_YUYV;
 		src = tmpbuf;
 		bytesperline = width * 2;
@@ -1454,16 +2285,34 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuyv_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_to_rgb(data, data->kernels->yuyv_to_rgb24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuyv_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_to_rgb(data, data->kernels->yuyv_to_bgr24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 0);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_ARGB32:
+			v4lconvert_packed_to_rgb(data, data->kernels->yuyv_to_rgb24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 1);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuyv_to_nv12(src, dest_planes, width, height,
+						bytesperline, 0);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_packed_to_yuyv(src, dest, width, height,
+						  bytesperline, dest_stride, 0, 1, 2, 3);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			v4lconvert_yuyv_to_yuv420(src, dest_planes, width, height, bytesperline, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			v4lconvert_yuyv_to_yuv420(src, dest_planes, width, height, bytesperline, 1);
 			break;
 		}
 		break;
@@ -1477,7 +2326,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			return v4lconvert_oom_error(data);
 
 		/* Note NV61 is NV16 with U and V swapped so this becomes yvyu. */
-		v4lconvert_nv16_to_yuyv(src, tmpbuf, width, height, bytesperline);
+		data->kernels->nv16_to_yuyv(src_planes, tmpbuf, width, height,
+					    width * 2);
 		src_pix_fmt = V4L2_PIX_FMT_YVYU;
 		src = tmpbuf;
 		bytesperline = width * 2;
@@ -1491,18 +2341,36 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yvyu_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_to_rgb(data, data->kernels->yvyu_to_rgb24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yvyu_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_to_rgb(data, data->kernels->yvyu_to_bgr24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 0);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_ARGB32:
+			v4lconvert_packed_to_rgb(data, data->kernels->yvyu_to_rgb24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 1);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuyv_to_nv12(src, dest_planes, width, height,
+						bytesperline, 1);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_packed_to_yuyv(src, dest, width, height,
+						  bytesperline, dest_stride, 0, 3, 2, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			/* Note we use yuyv_to_yuv420 not v4lconvert_yvyu_to_yuv420,
 			   with the last argument reversed to make it have as we want */
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			v4lconvert_yuyv_to_yuv420(src, dest_planes, width, height, bytesperline, 1);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			v4lconvert_yuyv_to_yuv420(src, dest_planes, width, height, bytesperline, 0);
 			break;
 		}
 		break;
@@ -1515,16 +2383,34 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_uyvy_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_to_rgb(data, data->kernels->uyvy_to_rgb24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_uyvy_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_to_rgb(data, data->kernels->uyvy_to_bgr24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 0);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_ARGB32:
+			v4lconvert_packed_to_rgb(data, data->kernels->uyvy_to_rgb24,
+					src, dest, width, height, bytesperline,
+					dest_stride, 1);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_uyvy_to_nv12(src, dest_planes, width, height,
+						bytesperline);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_packed_to_yuyv(src, dest, width, height,
+						  bytesperline, dest_stride, 1, 0, 3, 2);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
+			v4lconvert_uyvy_to_yuv420(src, dest_planes, width, height, bytesperline, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 1);
+			v4lconvert_uyvy_to_yuv420(src, dest_planes, width, height, bytesperline, 1);
 			break;
 		}
 		break;
@@ -1536,24 +2422,36 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
+			v4lconvert_hsv_to_rgb24(src, dest, width, height,
+						bytesperline, width * 3, 0,
 						24, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 1,
+			v4lconvert_hsv_to_rgb24(src, dest, width, height,
+						bytesperline, width * 3, 1,
 						24, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
-			break;
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
+		case V4L2_PIX_FMT_YVU420: {
+			struct v4l2_format tmpfmt = *fmt;
+			unsigned char *rgb;
+
+			/* yuv420 is smaller than rgb24, go through a tmp buffer */
+			rgb = v4lconvert_alloc_buffer(width * height * 3,
+					&data->convert_pixfmt_buf,
+					&data->convert_pixfmt_buf_size);
+			if (!rgb)
+				return v4lconvert_oom_error(data);
+
+			v4lconvert_hsv_to_rgb24(src, rgb, width, height,
+						bytesperline, width * 3, 0,
 						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			tmpfmt.fmt.pix.bytesperline = width * 3;
+			v4lconvert_rgb24_to_yuv420(rgb, dest_planes, &tmpfmt, 0,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420, 3);
 			break;
 		}
+		}
 
 		break;
 
@@ -1565,24 +2463,36 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
+			v4lconvert_hsv_to_rgb24(src, dest, width, height,
+						bytesperline, width * 3, 0,
 						32, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 1,
+			v4lconvert_hsv_to_rgb24(src, dest, width, height,
+						bytesperline, width * 3, 1,
 						32, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
-			break;
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
+		case V4L2_PIX_FMT_YVU420: {
+			struct v4l2_format tmpfmt = *fmt;
+			unsigned char *rgb;
+
+			/* yuv420 is smaller than rgb24, go through a tmp buffer */
+			rgb = v4lconvert_alloc_buffer(width * height * 3,
+					&data->convert_pixfmt_buf,
+					&data->convert_pixfmt_buf_size);
+			if (!rgb)
+				return v4lconvert_oom_error(data);
+
+			v4lconvert_hsv_to_rgb24(src, rgb, width, height,
+						bytesperline, width * 3, 0,
 						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			tmpfmt.fmt.pix.bytesperline = width * 3;
+			v4lconvert_rgb24_to_yuv420(rgb, dest_planes, &tmpfmt, 0,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420, 3);
 			break;
 		}
+		}
 
 		break;
 
@@ -1600,56 +2510,251 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	return result;
 }
 
-int v4lconvert_convert(struct v4lconvert_data *data,
+/* Is the cost of converting to pixelformat that of converting to yuv rather
+   then to rgb? */
+static int v4lconvert_yuv_dest(unsigned int pixelformat)
+{
+	switch (pixelformat) {
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUYV:
+		return 1;
+	}
+	return 0;
+}
+
+/* Measure the cost of converting from src format src_index by converting a
+   synthetic frame, returns 0 for formats which cannot be calibrated like this
+   (compressed formats need a real frame) */
+static unsigned int v4lconvert_calibrate(struct v4lconvert_data *data,
+	int src_index, int yuv)
+{
+	const int width = 320, height = 240;
+	struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	struct v4lconvert_planes src_planes, dest_planes;
+	unsigned int dest_pix_fmt = yuv ? V4L2_PIX_FMT_YUV420 :
+					  V4L2_PIX_FMT_RGB24;
+	unsigned char *src, *dest = NULL;
+	int i, bpp = supported_src_pixfmts[src_index].bpp;
+	int src_size, dest_size = 0, bytes[3], lines[3], processing;
+	uint64_t start;
+
+	if (!bpp)
+		return 0;
+
+	src_size = width * height * bpp / 8;
+	src = malloc(src_size);
+	if (!src)
+		return 0;
+	/* Mid grey for the yuv formats */
+	memset(src, 0x80, src_size);
+
+	fmt.fmt.pix.pixelformat = supported_src_pixfmts[src_index].fmt;
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.bytesperline = width * bpp / 8;
+	fmt.fmt.pix.sizeimage = src_size;
+	if (v4lconvert_plane_sizes(fmt.fmt.pix.pixelformat, width, height,
+				   bytes, lines))
+		fmt.fmt.pix.bytesperline = bytes[0];
+	v4lconvert_planes_init(&src_planes, src, &fmt);
+	dest_size = v4lconvert_planes_alloc(&dest_planes, dest_pix_fmt,
+				width, height, &dest, &dest_size);
+
+	/* The grey frame must not feed autogain / whitebalance, nor should
+	   their cost be counted as that of the format */
+	processing = v4lprocessing_suspend(data->processing);
+
+	/* The first run warms up the caches */
+	for (i = 0; dest_size > 0 && i < 3; i++) {
+		struct v4l2_format f = fmt;
+
+		start = v4lconvert_cost_now();
+		if (v4lconvert_convert_pixfmt(data, &src_planes, src_size,
+				&dest_planes, dest_size, &f, dest_pix_fmt, 1))
+			break;
+		if (i)
+			v4lconvert_cost_update(data, fmt.fmt.pix.pixelformat,
+					       yuv, start, width * height);
+	}
+	v4lprocessing_resume(data->processing, processing);
+
+	free(src);
+	free(dest);
+	return v4lconvert_cost_get(data, fmt.fmt.pix.pixelformat, yuv);
+}
+
+/* The cost of converting from src format src_index in picoseconds per pixel,
+   measured when possible */
+static unsigned int v4lconvert_format_cost(struct v4lconvert_data *data,
+	int src_index, int yuv)
+{
+	unsigned int ps, ref_ps;
+	int ref_index = 0;
+
+	ps = v4lconvert_cost_get(data, supported_src_pixfmts[src_index].fmt,
+				 yuv);
+	if (!ps)
+		ps = v4lconvert_calibrate(data, src_index, yuv);
+	if (ps)
+		return ps;
+
+	/* Until a compressed format has actually been used, estimate its
+	   cost relative to yuyv from the static ranks */
+	while (supported_src_pixfmts[ref_index].fmt != V4L2_PIX_FMT_YUYV)
+		ref_index++;
+	ref_ps = v4lconvert_cost_get(data, supported_src_pixfmts[ref_index].fmt,
+				     yuv);
+	if (!ref_ps)
+		ref_ps = v4lconvert_calibrate(data, ref_index, yuv);
+	if (!ref_ps)
+		ref_ps = 1000;
+
+	if (yuv)
+		return ref_ps * supported_src_pixfmts[src_index].yuv_rank /
+			supported_src_pixfmts[ref_index].yuv_rank;
+	return ref_ps * supported_src_pixfmts[src_index].rgb_rank /
+		supported_src_pixfmts[ref_index].rgb_rank;
+}
+
+/* Rank src format src_index by the frame rate it can deliver, limited by
+   the requested fps, the bus bandwidth and the measured cost of converting
+   it, or when that is equal by the cpu load of converting it. Like
+   v4lconvert_get_rank() the lowest value wins. */
+static int v4lconvert_cost_rank(struct v4lconvert_data *data,
+	int src_index, int src_width, int src_height,
+	unsigned int dest_pixelformat)
+{
+	uint64_t pixels = (uint64_t)src_width * src_height;
+	uint64_t fps = data->fps * 1000; /* In millihertz */
+	uint64_t delivered = fps, ps = 0, load;
+	int bpp = supported_src_pixfmts[src_index].bpp;
+
+	if (!pixels)
+		return 0;
+
+	if (supported_src_pixfmts[src_index].fmt != dest_pixelformat)
+		ps = v4lconvert_format_cost(data, src_index,
+				v4lconvert_yuv_dest(dest_pixelformat));
+
+	/* There are 10^15 picosecond millihertz in a second */
+	if (ps && 1000000000000000ULL / (ps * pixels) < delivered)
+		delivered = 1000000000000000ULL / (ps * pixels);
+
+	if (data->bandwidth && bpp &&
+	    (uint64_t)data->bandwidth * 8000 / (pixels * bpp) < delivered)
+		delivered = (uint64_t)data->bandwidth * 8000 / (pixels * bpp);
+
+	/* In 1/1000 of a cpu */
+	load = ps * pixels * delivered / 1000000000000ULL;
+	if (load > 999)
+		load = 999;
+
+	return MIN(fps - delivered, V4LCONVERT_COST_RANK_GREY / 2000 - 1) *
+		1000 + load;
+}
+
+/* Run v4lprocessing on a frame in buf, which has the layout of planes */
+static void v4lconvert_processing(struct v4lconvert_data *data,
+		const struct v4lconvert_planes *planes, const struct v4l2_format *fmt)
+{
+	struct v4l2_format my_fmt = *fmt;
+
+	my_fmt.fmt.pix.bytesperline = planes->stride[0];
+	v4lprocessing_processing(data->processing, planes->plane[0], &my_fmt);
+}
+
+int v4lconvert_convert_planes(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,  /* in */
 		const struct v4l2_format *dest_fmt, /* in */
-		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+		const struct v4lconvert_planes *src, int src_size,
+		const struct v4lconvert_planes *dest, int dest_size)
 {
-	int res, dest_needed, temp_needed, processing, convert = 0;
-	int rotate90, vflip, hflip, crop;
-	unsigned char *convert1_dest = dest;
-	int convert1_dest_size = dest_size;
-	unsigned char *convert2_src = src, *convert2_dest = dest;
+	int res, dest_needed, processing, convert = 0, scale = 1;
+	int rotation, rotate90, vflip, hflip, crop;
+	unsigned int base_pix_fmt;
+	const struct v4lconvert_planes *convert2_src = src, *convert2_dest = dest;
+	const struct v4lconvert_planes *rotate90_src = src, *rotate90_dest = dest;
+	const struct v4lconvert_planes *flip_src = src, *flip_dest = dest;
+	const struct v4lconvert_planes *crop_src = src;
+	struct v4lconvert_planes repack, convert2, rotated, flipped;
 	int convert2_dest_size = dest_size;
-	unsigned char *rotate90_src = src, *rotate90_dest = dest;
-	unsigned char *flip_src = src, *flip_dest = dest;
-	unsigned char *crop_src = src;
 	struct v4l2_format my_src_fmt = *src_fmt;
 	struct v4l2_format my_dest_fmt = *dest_fmt;
+	unsigned int dest_pix_fmt = dest_fmt->fmt.pix.pixelformat;
+	int width, height, rotated_width, rotated_height;
+	uint64_t start;
+
+	my_src_fmt.fmt.pix.bytesperline = src->stride[0];
+	my_dest_fmt.fmt.pix.bytesperline = dest->stride[0];
 
 	processing = v4lprocessing_pre_processing(data->processing);
-	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
+	rotation = v4lcontrol_get_ctrl(data->control, V4LCONTROL_ROTATE);
 	hflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP);
 	vflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP);
-	crop = my_dest_fmt.fmt.pix.width != my_src_fmt.fmt.pix.width ||
-		my_dest_fmt.fmt.pix.height != my_src_fmt.fmt.pix.height;
 
-	if (/* If no conversion/processing is needed */
-			(src_fmt->fmt.pix.pixelformat == dest_fmt->fmt.pix.pixelformat &&
+	/* The size of the frame after converting it, the jpeg frames of cams
+	   which need rotate90 are transposed, src_fmt has their rotated size */
+	width = my_src_fmt.fmt.pix.width;
+	height = my_src_fmt.fmt.pix.height;
+	if (data->control_flags & V4LCONTROL_ROTATED_90_JPEG) {
+		rotation += 90;
+		width = my_src_fmt.fmt.pix.height;
+		height = my_src_fmt.fmt.pix.width;
+	}
+
+	/* 180 and 270 degrees are 0 and 90 degrees plus flipping both ways */
+	rotate90 = rotation % 180;
+	if (rotation % 360 >= 180) {
+		hflip = !hflip;
+		vflip = !vflip;
+	}
+
+	/* The dest planes only fit a frame of the dest size, so compare that
+	   with the size of the rotated src */
+	rotated_width = rotate90 ? height : width;
+	rotated_height = rotate90 ? width : height;
+	crop = my_dest_fmt.fmt.pix.width != rotated_width ||
+		my_dest_fmt.fmt.pix.height != rotated_height;
+
+	if (/* If no conversion/processing is needed, this is also how a
+	       same format yuyv / nv12 / xrgb32 / argb32 frame with neutral
+	       controls gets passed through */
+			(src_fmt->fmt.pix.pixelformat == dest_pix_fmt &&
 			 !processing && !rotate90 && !hflip && !vflip && !crop) ||
 			/* or if we should do processing/rotating/flipping but the app tries to
 			   use the native cam format, we just return an unprocessed frame copy */
-			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat)) {
+			!v4lconvert_supported_dst_format(dest_pix_fmt)) {
 		int to_copy = MIN(dest_size, src_size);
-		memcpy(dest, src, to_copy);
+
+		/* Only copy plane by plane when the layouts differ */
+		if (src_fmt->fmt.pix.pixelformat == dest_pix_fmt &&
+		    !v4lconvert_planes_contiguous(dest, dest_pix_fmt,
+				my_src_fmt.fmt.pix.width, my_src_fmt.fmt.pix.height,
+				src->stride[0])) {
+			to_copy = v4lconvert_planes_size(dest, dest_pix_fmt,
+					my_src_fmt.fmt.pix.width,
+					my_src_fmt.fmt.pix.height);
+			if (to_copy && dest_size >= to_copy &&
+			    src_size >= v4lconvert_planes_size(src, dest_pix_fmt,
+					my_src_fmt.fmt.pix.width,
+					my_src_fmt.fmt.pix.height)) {
+				v4lconvert_copy_planes(src, dest, dest_pix_fmt,
+						my_src_fmt.fmt.pix.width,
+						my_src_fmt.fmt.pix.height);
+				return to_copy;
+			}
+			to_copy = MIN(dest_size, src_size);
+		}
+		memcpy(dest->plane[0], src->plane[0], to_copy);
 		return to_copy;
 	}
 
 	/* sanity check, is the dest buffer large enough? */
-	switch (my_dest_fmt.fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		dest_needed = my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 3;
-		temp_needed = my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3;
-		break;
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-		dest_needed =
-			my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 3 / 2;
-		temp_needed =
-			my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3 / 2;
-		break;
-	default:
+	dest_needed = v4lconvert_planes_size(dest, dest_pix_fmt,
+			my_dest_fmt.fmt.pix.width, my_dest_fmt.fmt.pix.height);
+	if (!dest_needed) {
 		V4LCONVERT_ERR("Unknown dest format in conversion\n");
 		errno = EINVAL;
 		return -1;
@@ -1662,15 +2767,88 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		return -1;
 	}
 
+	/* Processing, rotating, flipping and cropping are done in the base
+	   format of the dest format, after which the result gets packed */
+	base_pix_fmt = v4lconvert_base_pixfmt(dest_pix_fmt);
+	if (base_pix_fmt != dest_pix_fmt &&
+			(processing || rotate90 || hflip || vflip || crop)) {
+		struct v4l2_format base_fmt = my_dest_fmt;
+		struct v4lconvert_planes d = *dest;
+		int d_size = dest_size;
+
+		base_fmt.fmt.pix.pixelformat = base_pix_fmt;
+		/* Expanding rgb24 to argb32 can be done in place */
+		if (base_pix_fmt == V4L2_PIX_FMT_YUV420) {
+			d_size = v4lconvert_planes_alloc(&d, base_pix_fmt,
+					base_fmt.fmt.pix.width,
+					base_fmt.fmt.pix.height,
+					&data->pack_buf, &data->pack_buf_size);
+			if (d_size < 0)
+				return v4lconvert_oom_error(data);
+		}
+
+		res = v4lconvert_convert_planes(data, src_fmt, &base_fmt,
+						src, src_size, &d, d_size);
+		if (res < 0)
+			return res;
+
+		res = v4lconvert_convert_pixfmt(data, &d, res, dest, dest_size,
+				&base_fmt, dest_pix_fmt, 1);
+		if (res)
+			return res;
+
+		return dest_needed;
+	}
+
+	/* v4lprocessing only knows about yuv420 frames with the chroma planes
+	   directly following the y plane */
+	if (processing && v4lconvert_is_yuv420(dest_pix_fmt) &&
+	    !v4lconvert_planes_contiguous(dest, dest_pix_fmt,
+				my_dest_fmt.fmt.pix.width,
+				my_dest_fmt.fmt.pix.height, dest->stride[0])) {
+		struct v4lconvert_planes d;
+		int d_size;
+
+		d_size = v4lconvert_planes_alloc(&d, dest_pix_fmt,
+				my_dest_fmt.fmt.pix.width,
+				my_dest_fmt.fmt.pix.height,
+				&data->planes_buf, &data->planes_buf_size);
+		if (d_size < 0)
+			return v4lconvert_oom_error(data);
+
+		res = v4lconvert_convert_planes(data, src_fmt, dest_fmt,
+						src, src_size, &d, d_size);
+		if (res < 0)
+			return res;
+
+		v4lconvert_copy_planes(&d, dest, dest_pix_fmt,
+				my_dest_fmt.fmt.pix.width,
+				my_dest_fmt.fmt.pix.height);
+		return dest_needed;
+	}
+
+	if (processing && v4lconvert_is_yuv420(my_src_fmt.fmt.pix.pixelformat) &&
+	    !v4lconvert_planes_contiguous(src, my_src_fmt.fmt.pix.pixelformat,
+				my_src_fmt.fmt.pix.width,
+				my_src_fmt.fmt.pix.height, src->stride[0])) {
+		src_size = v4lconvert_planes_alloc(&repack,
+				my_src_fmt.fmt.pix.pixelformat,
+				my_src_fmt.fmt.pix.width,
+				my_src_fmt.fmt.pix.height,
+				&data->repack_buf, &data->repack_buf_size);
+		if (src_size < 0)
+			return v4lconvert_oom_error(data);
 
-	/* Sometimes we need foo -> rgb -> bar as video processing (whitebalance,
-	   etc.) can only be done on rgb data */
-	if (processing && v4lconvert_processing_needs_double_conversion(
+		v4lconvert_copy_planes(src, &repack,
 				my_src_fmt.fmt.pix.pixelformat,
-				my_dest_fmt.fmt.pix.pixelformat))
-		convert = 2;
-	else if (my_dest_fmt.fmt.pix.pixelformat !=
-			my_src_fmt.fmt.pix.pixelformat ||
+				my_src_fmt.fmt.pix.width,
+				my_src_fmt.fmt.pix.height);
+		src = &repack;
+		my_src_fmt.fmt.pix.bytesperline = src->stride[0];
+		convert2_src = rotate90_src = flip_src = crop_src = src;
+	}
+
+	if (dest_pix_fmt != my_src_fmt.fmt.pix.pixelformat ||
 		 /* Special case if we do not need to do conversion, but we
 		    are not doing any other step involving copying either,
 		    force going through convert_pixfmt to copy the data from
@@ -1678,102 +2856,202 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		 (!rotate90 && !hflip && !vflip && !crop))
 		convert = 1;
 
-	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
-	   rotate -> flip -> crop, all steps are optional */
-	if (convert == 2) {
-		convert1_dest = v4lconvert_alloc_buffer(
-				my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3,
-				&data->convert1_buf, &data->convert1_buf_size);
-		if (!convert1_dest)
-			return v4lconvert_oom_error(data);
+	/* Try to do the conversion, flipping and cropping in a single pass */
+	if (convert == 1 && !rotate90 && (hflip || vflip || crop)) {
+		struct v4lconvert_fused_job job;
+
+		if (v4lconvert_fused_setup(data, &job, &my_src_fmt, &my_dest_fmt,
+				processing, hflip, vflip, crop)) {
+			int src_needed = job.src_width * job.src_height;
+
+			if (job.packed)
+				src_needed *= 2;
+			if (src_size < src_needed) {
+				V4LCONVERT_ERR("short raw data frame\n");
+				errno = EPIPE;
+				return -1;
+			}
+
+			/* Processing of bayer is done in place on the src */
+			if (processing)
+				v4lprocessing_processing(data->processing,
+						src->plane[0], &my_src_fmt);
+
+			job.src = src->plane[0];
+			job.dest = dest->plane[0];
+			job.dest_stride = dest->stride[0];
+			v4lconvert_threads_run(data->threads,
+					v4lconvert_fused_lines, &job, job.height);
+			return dest_needed;
+		}
+	}
+
+	/* processing -> convert_pixfmt -> processing -> rotate -> flip -> crop,
+	   all steps are optional. The intermediate frames have no padding. */
+	if (convert && crop) {
+		struct v4l2_format rotated_fmt = my_src_fmt;
 
-		convert1_dest_size =
-			my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3;
-		convert2_src = convert1_dest;
+		rotated_fmt.fmt.pix.width = rotated_width;
+		rotated_fmt.fmt.pix.height = rotated_height;
+		scale = v4lconvert_jpeg_scale(&rotated_fmt, &my_dest_fmt);
 	}
 
 	if (convert && (rotate90 || hflip || vflip || crop)) {
-		convert2_dest = v4lconvert_alloc_buffer(temp_needed,
+		convert2_dest_size = v4lconvert_planes_alloc(&convert2,
+				dest_pix_fmt, width / scale, height / scale,
 				&data->convert2_buf, &data->convert2_buf_size);
-		if (!convert2_dest)
+		if (convert2_dest_size < 0)
 			return v4lconvert_oom_error(data);
 
-		convert2_dest_size = temp_needed;
-		rotate90_src = flip_src = crop_src = convert2_dest;
+		convert2_dest = rotate90_src = flip_src = crop_src = &convert2;
 	}
 
 	if (rotate90 && (hflip || vflip || crop)) {
-		rotate90_dest = v4lconvert_alloc_buffer(temp_needed,
-				&data->rotate90_buf, &data->rotate90_buf_size);
-		if (!rotate90_dest)
+		if (v4lconvert_planes_alloc(&rotated, dest_pix_fmt,
+				rotated_width / scale, rotated_height / scale,
+				&data->rotate90_buf, &data->rotate90_buf_size) < 0)
 			return v4lconvert_oom_error(data);
 
-		flip_src = crop_src = rotate90_dest;
+		rotate90_dest = flip_src = crop_src = &rotated;
 	}
 
 	if ((vflip || hflip) && crop) {
-		flip_dest = v4lconvert_alloc_buffer(temp_needed, &data->flip_buf,
-				&data->flip_buf_size);
-		if (!flip_dest)
+		if (v4lconvert_planes_alloc(&flipped, dest_pix_fmt,
+				rotated_width / scale, rotated_height / scale,
+				&data->flip_buf, &data->flip_buf_size) < 0)
 			return v4lconvert_oom_error(data);
 
-		crop_src = flip_dest;
+		flip_dest = crop_src = &flipped;
 	}
 
 	/* Done setting sources / dest and allocating intermediate buffers,
 	   real conversion / processing / ... starts here. */
-	if (convert == 2) {
-		res = v4lconvert_convert_pixfmt(data, src, src_size,
-				convert1_dest, convert1_dest_size,
-				&my_src_fmt,
-				V4L2_PIX_FMT_RGB24);
-		if (res)
-			return res;
-
-		src_size = my_src_fmt.fmt.pix.sizeimage;
-	}
-
-	if (processing)
-		v4lprocessing_processing(data->processing, convert2_src, &my_src_fmt);
+	/* Processing yuv data is more expensive then processing rgb data, so
+	   when converting yuv to rgb leave the processing to after conversion */
+	if (processing && !(convert &&
+			v4lconvert_is_yuv420(my_src_fmt.fmt.pix.pixelformat) &&
+			!v4lconvert_is_yuv420(dest_pix_fmt)))
+		v4lconvert_processing(data, convert2_src, &my_src_fmt);
 
 	if (convert) {
+		/* Only plain conversions are timed for the cost model, flipping,
+		   cropping and processing would skew the cost of the format */
+		int timed = data->cost_model && !processing && !rotate90 &&
+			    !hflip && !vflip && !crop;
+
+		start = timed ? v4lconvert_cost_now() : 0;
 		res = v4lconvert_convert_pixfmt(data, convert2_src, src_size,
 				convert2_dest, convert2_dest_size,
-				&my_src_fmt,
-				my_dest_fmt.fmt.pix.pixelformat);
+				&my_src_fmt, dest_pix_fmt, scale);
 		if (res)
 			return res;
-
-		src_size = my_src_fmt.fmt.pix.sizeimage;
-
-		/* We call processing here again in case the source format was not
-		   rgb, but the dest is. v4lprocessing checks it self it only actually
-		   does the processing once per frame. */
+		if (timed)
+			v4lconvert_cost_update(data,
+					src_fmt->fmt.pix.pixelformat,
+					v4lconvert_yuv_dest(dest_pix_fmt), start,
+					width * height);
+
+		/* We call processing here again in case processing was not
+		   done on the source format. v4lprocessing checks it self it
+		   only actually does the processing once per frame. */
 		if (processing)
-			v4lprocessing_processing(data->processing, convert2_dest, &my_src_fmt);
+			v4lconvert_processing(data, convert2_dest, &my_src_fmt);
 	}
 
 	if (rotate90)
-		v4lconvert_rotate90(rotate90_src, rotate90_dest, &my_src_fmt);
+		v4lconvert_rotate90(data, rotate90_src, rotate90_dest,
+				    &my_src_fmt);
 
 	if (hflip || vflip)
-		v4lconvert_flip(flip_src, flip_dest, &my_src_fmt, hflip, vflip);
+		v4lconvert_flip(data, flip_src, flip_dest, &my_src_fmt,
+				hflip, vflip);
 
-	if (crop)
-		v4lconvert_crop(crop_src, dest, &my_src_fmt, &my_dest_fmt);
+	if (crop && v4lconvert_crop(data, crop_src, dest, &my_src_fmt,
+				    &my_dest_fmt))
+		return v4lconvert_oom_error(data);
 
 	return dest_needed;
 }
 
+int v4lconvert_convert(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	struct v4lconvert_planes src_planes, dest_planes;
+
+	v4lconvert_planes_init(&src_planes, src, src_fmt);
+	v4lconvert_planes_init(&dest_planes, dest, dest_fmt);
+
+	return v4lconvert_convert_planes(data, src_fmt, dest_fmt,
+			&src_planes, src_size, &dest_planes, dest_size);
+}
+
 const char *v4lconvert_get_error_message(struct v4lconvert_data *data)
 {
 	return data->error_msg;
 }
 
+/* Add a framesize of the src format with the given index, returns -1 when
+   there is no more room */
+static int v4lconvert_add_framesize(struct v4lconvert_data *data,
+		const struct v4l2_frmsizeenum *frmsize, int index)
+{
+	int j, match = 0;
+
+	/* Check we don't have the same one already */
+	for (j = 0; j < data->no_framesizes; j++) {
+		if (frmsize->type != data->framesizes[j].type)
+			continue;
+
+		switch (frmsize->type) {
+		case V4L2_FRMSIZE_TYPE_DISCRETE:
+			if (!memcmp(&frmsize->discrete, &data->framesizes[j].discrete,
+						sizeof(frmsize->discrete)))
+				match = 1;
+			break;
+		case V4L2_FRMSIZE_TYPE_CONTINUOUS:
+		case V4L2_FRMSIZE_TYPE_STEPWISE:
+			if (!memcmp(&frmsize->stepwise, &data->framesizes[j].stepwise,
+						sizeof(frmsize->stepwise)))
+				match = 1;
+			break;
+		}
+		if (match)
+			break;
+	}
+	/* Add this framesize if it is not already in our list */
+	if (!match) {
+		if (data->no_framesizes == V4LCONVERT_MAX_FRAMESIZES) {
+			fprintf(stderr, "libv4lconvert: warning more framesizes than I can handle!\n");
+			return -1;
+		}
+		data->framesizes[data->no_framesizes].type = frmsize->type;
+		memset(data->framesize_supported_src_formats[data->no_framesizes],
+		       0, sizeof(data->framesize_supported_src_formats[0]));
+		set_bit(index, data->framesize_supported_src_formats[data->no_framesizes]);
+
+		switch (frmsize->type) {
+		case V4L2_FRMSIZE_TYPE_DISCRETE:
+			data->framesizes[data->no_framesizes].discrete = frmsize->discrete;
+			break;
+		case V4L2_FRMSIZE_TYPE_CONTINUOUS:
+		case V4L2_FRMSIZE_TYPE_STEPWISE:
+			data->framesizes[data->no_framesizes].stepwise = frmsize->stepwise;
+			break;
+		}
+		data->no_framesizes++;
+	} else {
+		set_bit(index, data->framesize_supported_src_formats[j]);
+	}
+
+	return 0;
+}
+
 static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 		unsigned int pixelformat, int index)
 {
-	int i, j, match;
+	int i;
 	struct v4l2_frmsizeenum frmsize = { .pixel_format = pixelformat };
 
 	for (i = 0; ; i++) {
@@ -1782,51 +3060,226 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 				VIDIOC_ENUM_FRAMESIZES, &frmsize))
 			break;
 
-		/* We got a framesize, check we don't have the same one already */
-		match = 0;
-		for (j = 0; j < data->no_framesizes; j++) {
-			if (frmsize.type != data->framesizes[j].type)
-				continue;
+		if (v4lconvert_add_framesize(data, &frmsize, index))
+			return;
+	}
+}
 
-			switch (frmsize.type) {
-			case V4L2_FRMSIZE_TYPE_DISCRETE:
-				if (!memcmp(&frmsize.discrete, &data->framesizes[j].discrete,
-							sizeof(frmsize.discrete)))
-					match = 1;
-				break;
-			case V4L2_FRMSIZE_TYPE_CONTINUOUS:
-			case V4L2_FRMSIZE_TYPE_STEPWISE:
-				if (!memcmp(&frmsize.stepwise, &data->framesizes[j].stepwise,
-							sizeof(frmsize.stepwise)))
-					match = 1;
-				break;
-			}
-			if (match)
-				break;
+/* Get the cache file name and the key line identifying the driver version
+   the cached framesizes are for. Only USB devices are cached, where the ids
+   and device release identify the firmware. Returns -1 when not caching */
+static int v4lconvert_framesize_cache_key(struct v4lconvert_data *data,
+		char *path, int path_size, char *key, int key_size)
+{
+	unsigned short vendor_id, product_id, bcd_device;
+	struct v4l2_capability cap;
+	char name[64];
+	char *s;
+
+	s = getenv("LIBV4LCONVERT_FRAMESIZE_CACHE");
+	if (!s || !atoi(s) ||
+	    !v4lcontrol_get_usb_id(data->control, &vendor_id, &product_id,
+				   &bcd_device) ||
+	    data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+				 VIDIOC_QUERYCAP, &cap))
+		return -1;
+
+	snprintf(name, sizeof(name), "framesizes-%04x:%04x-%04x",
+		 vendor_id, product_id, bcd_device);
+	snprintf(key, key_size, "driver %.16s %u\n", (char *)cap.driver,
+		 cap.version);
+
+	return v4lconvert_cache_path(path, path_size, name);
+}
+
+/* The line listing the supported src formats, the cache is only valid for
+   the same set of formats */
+static void v4lconvert_framesize_cache_formats(struct v4lconvert_data *data,
+		char *buf, int size)
+{
+	int i, len;
+
+	len = snprintf(buf, size, "formats");
+	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts) && len < size; i++)
+		if (test_bit(i, data->supported_src_formats))
+			len += snprintf(buf + len, size - len, " 0x%08x",
+					supported_src_pixfmts[i].fmt);
+	if (len < size)
+		snprintf(buf + len, size - len, "\n");
+}
+
+static int v4lconvert_framesize_cache_load(struct v4lconvert_data *data,
+		const char *path, const char *key)
+{
+	char line[1024], formats[1024], *p, *end;
+	struct v4l2_frmsizeenum frmsize;
+	unsigned int v[6], pixelformat;
+	int i, n, ok = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	v4lconvert_framesize_cache_formats(data, formats, sizeof(formats));
+	if (!fgets(line, sizeof(line), f) || line[0] != '#' ||
+	    !fgets(line, sizeof(line), f) || strcmp(line, key) ||
+	    !fgets(line, sizeof(line), f) || strcmp(line, formats))
+		goto leave;
+
+	/* Lines of: type, 2 (discrete) or 6 (stepwise) sizes, src formats */
+	while (fgets(line, sizeof(line), f)) {
+		memset(&frmsize, 0, sizeof(frmsize));
+		frmsize.type = strtoul(line, &p, 10);
+		if (p == line)
+			goto leave;
+
+		n = frmsize.type == V4L2_FRMSIZE_TYPE_DISCRETE ? 2 : 6;
+		for (i = 0; i < n; i++) {
+			v[i] = strtoul(p, &end, 10);
+			if (end == p)
+				goto leave;
+			p = end;
 		}
-		/* Add this framesize if it is not already in our list */
-		if (!match) {
-			if (data->no_framesizes == V4LCONVERT_MAX_FRAMESIZES) {
-				fprintf(stderr, "libv4lconvert: warning more framesizes than I can handle!\n");
-				return;
-			}
-			data->framesizes[data->no_framesizes].type = frmsize.type;
-			data->framesize_supported_src_formats[data->no_framesizes] = 1ULL << index;
 
-			switch (frmsize.type) {
-			case V4L2_FRMSIZE_TYPE_DISCRETE:
-				data->framesizes[data->no_framesizes].discrete = frmsize.discrete;
-				break;
-			case V4L2_FRMSIZE_TYPE_CONTINUOUS:
-			case V4L2_FRMSIZE_TYPE_STEPWISE:
-				data->framesizes[data->no_framesizes].stepwise = frmsize.stepwise;
+		switch (frmsize.type) {
+		case V4L2_FRMSIZE_TYPE_DISCRETE:
+			frmsize.discrete.width = v[0];
+			frmsize.discrete.height = v[1];
+			break;
+		case V4L2_FRMSIZE_TYPE_CONTINUOUS:
+		case V4L2_FRMSIZE_TYPE_STEPWISE:
+			frmsize.stepwise.min_width = v[0];
+			frmsize.stepwise.max_width = v[1];
+			frmsize.stepwise.step_width = v[2];
+			frmsize.stepwise.min_height = v[3];
+			frmsize.stepwise.max_height = v[4];
+			frmsize.stepwise.step_height = v[5];
+			break;
+		default:
+			goto leave;
+		}
+
+		for (n = 0; ; n++) {
+			pixelformat = strtoul(p, &end, 16);
+			if (end == p)
 				break;
-			}
-			data->no_framesizes++;
-		} else {
-			data->framesize_supported_src_formats[j] |= 1ULL << index;
+			p = end;
+
+			for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++)
+				if (supported_src_pixfmts[i].fmt == pixelformat)
+					break;
+			if (i == ARRAY_SIZE(supported_src_pixfmts) ||
+			    !test_bit(i, data->supported_src_formats) ||
+			    v4lconvert_add_framesize(data, &frmsize, i))
+				goto leave;
 		}
+		if (!n)
+			goto leave;
+	}
+	ok = 1;
+
+leave:
+	fclose(f);
+	if (!ok) {
+		data->no_framesizes = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static void v4lconvert_framesize_cache_save(struct v4lconvert_data *data,
+		const char *path, const char *key)
+{
+	char tmp[PATH_MAX + 8], formats[1024];
+	int i, j, fd;
+	FILE *f;
+
+	/* Replace the file atomically, other processes may be reading it */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		return;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	v4lconvert_framesize_cache_formats(data, formats, sizeof(formats));
+	fprintf(f, "# libv4lconvert framesizes: type sizes src-formats\n");
+	fprintf(f, "%s%s", key, formats);
+	for (i = 0; i < data->no_framesizes; i++) {
+		fprintf(f, "%u", data->framesizes[i].type);
+		if (data->framesizes[i].type == V4L2_FRMSIZE_TYPE_DISCRETE)
+			fprintf(f, " %u %u", data->framesizes[i].discrete.width,
+				data->framesizes[i].discrete.height);
+		else
+			fprintf(f, " %u %u %u %u %u %u",
+				data->framesizes[i].stepwise.min_width,
+				data->framesizes[i].stepwise.max_width,
+				data->framesizes[i].stepwise.step_width,
+				data->framesizes[i].stepwise.min_height,
+				data->framesizes[i].stepwise.max_height,
+				data->framesizes[i].stepwise.step_height);
+		for (j = 0; j < ARRAY_SIZE(supported_src_pixfmts); j++)
+			if (test_bit(j, data->framesize_supported_src_formats[i]))
+				fprintf(f, " 0x%08x", supported_src_pixfmts[j].fmt);
+		fprintf(f, "\n");
+	}
+
+	if (fclose(f) || rename(tmp, path))
+		unlink(tmp);
+}
+
+/* (Re-)enumerate the framesizes of all supported src formats, and update the
+   cache when it is enabled */
+static void v4lconvert_refresh_framesizes(struct v4lconvert_data *data)
+{
+	char path[PATH_MAX], key[64];
+	int i, j;
+
+	data->no_framesizes = 0;
+	data->framesizes_cached = 0;
+
+	for (i = 0; ; i++) {
+		struct v4l2_fmtdesc fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+
+		fmt.index = i;
+
+		if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+				VIDIOC_ENUM_FMT, &fmt))
+			break;
+
+		for (j = 0; j < ARRAY_SIZE(supported_src_pixfmts); j++)
+			if (fmt.pixelformat == supported_src_pixfmts[j].fmt)
+				break;
+
+		if (j < ARRAY_SIZE(supported_src_pixfmts))
+			v4lconvert_get_framesizes(data, fmt.pixelformat, j);
+	}
+
+	if (!v4lconvert_framesize_cache_key(data, path, sizeof(path),
+					    key, sizeof(key)))
+		v4lconvert_framesize_cache_save(data, path, key);
+}
+
+/* Enumerating the framesizes can take a while with UVC cams with many modes,
+   so get them from the cache when possible */
+static void v4lconvert_init_framesizes(struct v4lconvert_data *data)
+{
+	char path[PATH_MAX], key[64];
+
+	if (!v4lconvert_framesize_cache_key(data, path, sizeof(path),
+					    key, sizeof(key)) &&
+	    !v4lconvert_framesize_cache_load(data, path, key)) {
+		data->framesizes_cached = 1;
+		return;
 	}
+
+	v4lconvert_refresh_framesizes(data);
 }
 
 int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
@@ -1851,6 +3304,12 @@ int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 	switch (frmsize->type) {
 	case V4L2_FRMSIZE_TYPE_DISCRETE:
 		frmsize->discrete = data->framesizes[frmsize->index].discrete;
+		if (v4lconvert_rotation_swaps_size(data)) {
+			frmsize->discrete.width =
+				data->framesizes[frmsize->index].discrete.height;
+			frmsize->discrete.height =
+				data->framesizes[frmsize->index].discrete.width;
+		}
 		/* Apply the same rounding algorithm as v4lconvert_try_format */
 		frmsize->discrete.width &= ~7;
 		frmsize->discrete.height &= ~1;
@@ -1858,6 +3317,17 @@ int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 	case V4L2_FRMSIZE_TYPE_CONTINUOUS:
 	case V4L2_FRMSIZE_TYPE_STEPWISE:
 		frmsize->stepwise = data->framesizes[frmsize->index].stepwise;
+		if (v4lconvert_rotation_swaps_size(data)) {
+			const struct v4l2_frmsize_stepwise *sw =
+				&data->framesizes[frmsize->index].stepwise;
+
+			frmsize->stepwise.min_width = sw->min_height;
+			frmsize->stepwise.max_width = sw->max_height;
+			frmsize->stepwise.step_width = sw->step_height;
+			frmsize->stepwise.min_height = sw->min_width;
+			frmsize->stepwise.max_height = sw->max_width;
+			frmsize->stepwise.step_height = sw->step_width;
+		}
 		break;
 	}
 
@@ -1989,3 +3459,86 @@ void v4lconvert_set_fps(struct v4lconvert_data *data, int fps)
 {
 	data->fps = fps;
 }
+
+int v4lconvert_get_threads(struct v4lconvert_data *data)
+{
+	return v4lconvert_threads_count(data->threads);
+}
+
+int v4lconvert_set_threads(struct v4lconvert_data *data, int threads)
+{
+	struct v4lconvert_threads *new_threads = NULL;
+
+	if (threads < 1 || threads > V4LCONVERT_MAX_THREADS + 1) {
+		V4LCONVERT_ERR("invalid no threads: %d\n", threads);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (threads == v4lconvert_threads_count(data->threads))
+		return 0;
+
+	/* The calling thread does part of the work too */
+	if (threads > 1) {
+		new_threads = v4lconvert_threads_create(threads - 1);
+		if (!new_threads) {
+			V4LCONVERT_ERR("creating conversion threads: %s\n",
+					strerror(errno));
+			return -1;
+		}
+	}
+
+	v4lconvert_threads_destroy(data->threads);
+	data->threads = new_threads;
+
+	return 0;
+}
+
+int v4lconvert_get_demosaic(struct v4lconvert_data *data)
+{
+	return data->demosaic;
+}
+
+int v4lconvert_set_demosaic(struct v4lconvert_data *data, int demosaic)
+{
+	switch (demosaic) {
+	case V4LCONVERT_DEMOSAIC_BILINEAR:
+	case V4LCONVERT_DEMOSAIC_EDGE:
+		data->demosaic = demosaic;
+		return 0;
+	}
+
+	V4LCONVERT_ERR("invalid demosaic algorithm: %d\n", demosaic);
+	errno = EINVAL;
+	return -1;
+}
+
+int v4lconvert_get_cost_model(struct v4lconvert_data *data)
+{
+	return data->cost_model;
+}
+
+void v4lconvert_set_cost_model(struct v4lconvert_data *data, int enable)
+{
+	data->cost_model = enable != 0;
+}
+
+int v4lconvert_get_scaler(struct v4lconvert_data *data)
+{
+	return data->scaler;
+}
+
+int v4lconvert_set_scaler(struct v4lconvert_data *data, int scaler)
+{
+	switch (scaler) {
+	case V4LCONVERT_SCALER_CROP:
+	case V4LCONVERT_SCALER_AREA:
+	case V4LCONVERT_SCALER_BILINEAR:
+		data->scaler = scaler;
+		return 0;
+	}
+
+	V4LCONVERT_ERR("invalid scaler: %d\n", scaler);
+	errno = EINVAL;
+	return -1;
+}
@@ -614,8 +614,10 @@ static int v4lconvert_ov511_to_yuv420(unsigned char *src, unsigned char *dest,
 int main(int argc, char *argv[])
 {
 	int width, height, yvu, src_size, dest_size;
+	int shm_fd = v4lconvert_helper_shm_fd(argc, argv);
 	unsigned char src_buf[500000];
 	unsigned char dest_buf[500000];
+	unsigned char *src = src_buf, *dest = dest_buf;
 
 	while (1) {
 		if (v4lconvert_helper_read(STDIN_FILENO, &width, sizeof(int), argv[0]))
@@ -636,7 +638,8 @@ int main(int argc, char *argv[])
 			return 2;
 		}
 
-		if (v4lconvert_helper_read(STDIN_FILENO, src_buf, src_size, argv[0]))
+		if (shm_fd == -1 &&
+		    v4lconvert_helper_read(STDIN_FILENO, src_buf, src_size, argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 
 
@@ -649,7 +652,11 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "%s: error: dest_buf too small, need: %d\n",
 					argv[0], dest_size);
 			dest_size = -1;
-		} else if (v4lconvert_ov511_to_yuv420(src_buf, dest_buf, width, height,
+		} else if (shm_fd != -1 &&
+			   v4lconvert_helper_shm_map(shm_fd, src_size, dest_size,
+					&src, &dest, argv[0])) {
+			dest_size = -1;
+		} else if (v4lconvert_ov511_to_yuv420(src, dest, width, height,
 					yvu, src_size))
 			dest_size = -1;
 
@@ -657,7 +664,8 @@ int main(int argc, char *argv[])
 					argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 
-		if (dest_size == -1)
+		/* In shm mode the data is already where libv4l wants it */
+		if (dest_size == -1 || shm_fd != -1)
 			continue;
 
 		if (v4lconvert_helper_write(STDOUT_FILENO, dest_buf, dest_size, argv[0]))
@@ -74,7 +74,8 @@ static int autogain_calculate_lookup_tables(
 		struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
-	int x, y, target, steps, avg_lum = 0;
+	int x, y, target, steps, avg_lum = 0, n = 0;
+	int width, height, bpl, step;
 	int gain, exposure, orig_gain, orig_exposure, exposure_low;
 	struct v4l2_control ctrl;
 	struct v4l2_queryctrl gainctrl, expoctrl;
@@ -105,39 +106,56 @@ static int autogain_calculate_lookup_tables(
 		return 0;
 	gain = orig_gain = ctrl.value;
 
+	/* Only look at the center of the image, sampled on a grid */
+	step = v4lprocessing_stats_step(data, fmt);
+	width = fmt->fmt.pix.width / 2;
+	height = fmt->fmt.pix.height / 2;
+	bpl = fmt->fmt.pix.bytesperline;
+
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SRGGB8:
-		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
-			fmt->fmt.pix.width / 4;
-
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-				avg_lum += *buf++;
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width / 2;
+	case V4L2_PIX_FMT_YUV420: /* Only looks at the Y plane */
+	case V4L2_PIX_FMT_YVU420:
+		/* Sample 2x2 blocks, so that bayer data is not biased
+		   towards a single color, the step is even when > 1 */
+		if (step < 2)
+			step = 2;
+		buf += (fmt->fmt.pix.height / 4 & ~1) * bpl +
+			(fmt->fmt.pix.width / 4 & ~1);
+
+		for (y = 0; y + 1 < height; y += step) {
+			for (x = 0; x + 1 < width; x += step) {
+				avg_lum += buf[x] + buf[x + 1] +
+					   buf[bpl + x] + buf[bpl + x + 1];
+				n += 4;
+			}
+			buf += step * bpl;
 		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width / 4;
 		break;
 
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
-			fmt->fmt.pix.width * 3 / 4;
-
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				avg_lum += *buf++;
-				avg_lum += *buf++;
-				avg_lum += *buf++;
+		buf += fmt->fmt.pix.height / 4 * bpl +
+			fmt->fmt.pix.width / 4 * 3;
+
+		for (y = 0; y < height; y += step) {
+			for (x = 0; x < width; x += step) {
+				avg_lum += buf[3 * x] + buf[3 * x + 1] +
+					   buf[3 * x + 2];
+				n += 3;
 			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3 / 2;
+			buf += step * bpl;
 		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width * 3 / 4;
 		break;
 	}
 
+	if (!n)
+		return 0;
+	avg_lum /= n;
+
 	/* If we are off a multiple of deadzone, do multiple steps to reach the
 	   desired lumination fast (with the risc of a slight overshoot) */
 	target = v4lcontrol_get_ctrl(data->control, V4LCONTROL_AUTOGAIN_TARGET);
@@ -196,7 +214,8 @@ static int autogain_calculate_lookup_tables(
 		   skip the next frame as that is still captured with the old settings,
 		   and another one just to be sure (because if we re-adjust based
 		   on the old settings we might overshoot). */
-		data->lookup_table_update_counter = V4L2PROCESSING_UPDATE_RATE - 2;
+		data->lookup_table_update_interval = 0;
+		data->lookup_table_update_min_frames = 3;
 	}
 
 	if (gain != orig_gain) {
@@ -24,7 +24,12 @@
 #include "../control/libv4lcontrol.h"
 #include "../libv4lsyscall-priv.h"
 
-#define V4L2PROCESSING_UPDATE_RATE 10
+/* Normal interval between lookup table updates in ms, this is 10 frames at
+   30 fps */
+#define V4L2PROCESSING_UPDATE_INTERVAL 333
+/* Filters gather their statistics from a grid of about this many samples,
+   so that their cost does not grow with the resolution */
+#define V4L2PROCESSING_STATS_SAMPLES (320 * 240)
 
 struct v4lprocessing_data {
 	struct v4lcontrol_data *control;
@@ -34,13 +39,26 @@ struct v4lprocessing_data {
 	/* True if any of the lookup tables does not contain
 	   linear 0-255 */
 	int lookup_table_active;
-	/* Counts the number of processed frames until a
-	   V4L2PROCESSING_UPDATE_RATE overflow happens */
-	int lookup_table_update_counter;
+	/* Time of the last lookup table update (in ms) and the number of
+	   frames processed since then. The next update happens when both
+	   lookup_table_update_interval ms and lookup_table_update_min_frames
+	   frames have passed, filters can change these to get the next
+	   update sooner or later. */
+	long long lookup_table_update_time;
+	int lookup_table_update_frames;
+	int lookup_table_update_interval;
+	int lookup_table_update_min_frames;
+	/* Step between statistics samples set through the environment, 0 to
+	   use V4L2PROCESSING_STATS_SAMPLES */
+	int stats_step;
 	/* RGB/BGR lookup tables */
 	unsigned char comp1[256];
 	unsigned char green[256];
 	unsigned char comp2[256];
+	/* comp1, green and comp2 after each other, for lut_rgb24 */
+	unsigned char lut[3 * 256 + 4];
+	void (*lut_rgb24)(unsigned char *buf, int width,
+			const unsigned char *lut);
 	/* Filter private data for filters which need it */
 	/* whitebalance.c data */
 	int green_avg;
@@ -61,6 +79,9 @@ struct v4lprocessing_filter {
 			unsigned char *buf, const struct v4l2_format *fmt);
 };
 
+int v4lprocessing_stats_step(struct v4lprocessing_data *data,
+		const struct v4l2_format *fmt);
+
 extern const struct v4lprocessing_filter whitebalance_filter;
 extern const struct v4lprocessing_filter autogain_filter;
 extern const struct v4lprocessing_filter gamma_filter;
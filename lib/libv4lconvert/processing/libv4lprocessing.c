@@ -22,6 +22,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include "libv4lprocessing.h"
 #include "libv4lprocessing-priv.h"
@@ -33,10 +34,19 @@ static const struct v4lprocessing_filter *filters[] = {
 	&gamma_filter,
 };
 
+static long long v4lprocessing_get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *control)
 {
 	struct v4lprocessing_data *data =
 		calloc(1, sizeof(struct v4lprocessing_data));
+	char *s;
 
 	if (!data) {
 		fprintf(stderr, "libv4lprocessing: error: out of memory!\n");
@@ -45,6 +55,15 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 
 	data->fd = fd;
 	data->control = control;
+	data->lut_rgb24 = v4lconvert_get_kernels()->lut_rgb24;
+	data->lookup_table_update_time = v4lprocessing_get_time();
+	data->lookup_table_update_interval = V4L2PROCESSING_UPDATE_INTERVAL;
+	data->lookup_table_update_min_frames = 1;
+
+	/* Allow overriding the statistics sampling step through environment */
+	s = getenv("LIBV4LCONVERT_STATS_STEP");
+	if (s)
+		data->stats_step = atoi(s);
 
 	return data;
 }
@@ -54,6 +73,28 @@ void v4lprocessing_destroy(struct v4lprocessing_data *data)
 	free(data);
 }
 
+/* Returns the step in pixels (in both directions) between the samples the
+   filters take for their statistics. This is 1 (use all pixels) or even, so
+   that filters for bayer / yuv420 data can take a 2x2 block at each sample. */
+int v4lprocessing_stats_step(struct v4lprocessing_data *data,
+		const struct v4l2_format *fmt)
+{
+	int step = data->stats_step;
+
+	if (step <= 0) {
+		step = 1;
+		while ((fmt->fmt.pix.width / step) *
+				(fmt->fmt.pix.height / step) >
+				V4L2PROCESSING_STATS_SAMPLES)
+			step++;
+	}
+
+	if (step > 1 && (step & 1))
+		step++;
+
+	return step;
+}
+
 int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 {
 	int i;
@@ -87,6 +128,111 @@ static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 				data->lookup_table_active = 1;
 		}
 	}
+
+	memcpy(data->lut, data->comp1, 256);
+	memcpy(data->lut + 256, data->green, 256);
+	memcpy(data->lut + 512, data->comp2, 256);
+}
+
+void v4lprocessing_lut_rgb24(unsigned char *buf, int width,
+		const unsigned char *lut)
+{
+	const unsigned char *comp1 = lut, *green = lut + 256, *comp2 = lut + 512;
+	int x;
+
+	for (x = 0; x < width; x++) {
+		buf[0] = comp1[buf[0]];
+		buf[1] = green[buf[1]];
+		buf[2] = comp2[buf[2]];
+		buf += 3;
+	}
+}
+
+/* Apply the lookup tables to planar yuv data in place. Each 2x2 block is
+   converted to rgb, the tables are applied and the result is converted back,
+   using the same formulas as the yuv420 <-> rgb24 conversion code in
+   rgbyuv.c. This gives (almost) the same result as converting the frame to
+   rgb, processing it and converting it back, but in a single pass and
+   without an intermediate frame buffer. */
+static void v4lprocessing_do_processing_yuv420(struct v4lprocessing_data *data,
+		unsigned char *buf, const struct v4l2_format *fmt)
+{
+	int i, x, y;
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int stride = fmt->fmt.pix.bytesperline;
+	unsigned char *ybuf = buf;
+	unsigned char *ubuf, *vbuf;
+	/* The lookup tables extended to -384 - 639 with clipping folded in,
+	   so that they can be indexed directly with y + chroma offset (the
+	   blue offset goes down to -258) */
+	unsigned char r_lut[1024], g_lut[1024], b_lut[1024];
+
+	for (i = 0; i < 1024; i++) {
+		int c = i < 384 ? 0 : (i < 640 ? i - 384 : 255);
+
+		r_lut[i] = data->comp1[c];
+		g_lut[i] = data->green[c];
+		b_lut[i] = data->comp2[c];
+	}
+
+	if (fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420) {
+		vbuf = buf + stride * height;
+		ubuf = vbuf + (stride * height) / 4;
+	} else {
+		ubuf = buf + stride * height;
+		vbuf = ubuf + (stride * height) / 4;
+	}
+
+	for (y = 0; y < height / 2; y++) {
+		unsigned char *y0 = ybuf, *y1 = ybuf + stride;
+
+		for (x = 0; x < width / 2; x++) {
+			int u = ubuf[x] - 128;
+			int v = vbuf[x] - 128;
+			/* u and v are signed, so multiply rather than shift
+			   them left (which is undefined for negative values) */
+			const unsigned char *r_l = r_lut + 384 + ((v * 3) >> 1);
+			const unsigned char *g_l = g_lut + 384 -
+				((u * 3 + v * 6) >> 3);
+			const unsigned char *b_l = b_lut + 384 + ((u * 129) >> 6);
+			int r, g, b, r_sum, g_sum, b_sum;
+
+#define PROCESS_PIXEL(p) \
+			r = r_l[p]; \
+			g = g_l[p]; \
+			b = b_l[p]; \
+			p = (8453 * r + 16594 * g + 3223 * b + 524288) >> 15
+
+			PROCESS_PIXEL(y0[0]);
+			r_sum = r;
+			g_sum = g;
+			b_sum = b;
+			PROCESS_PIXEL(y0[1]);
+			r_sum += r;
+			g_sum += g;
+			b_sum += b;
+			PROCESS_PIXEL(y1[0]);
+			r_sum += r;
+			g_sum += g;
+			b_sum += b;
+			PROCESS_PIXEL(y1[1]);
+			r_sum += r;
+			g_sum += g;
+			b_sum += b;
+#undef PROCESS_PIXEL
+
+			ubuf[x] = (-4878 * r_sum - 9578 * g_sum + 14456 * b_sum +
+				   4 * 4210688) >> 17;
+			vbuf[x] = (14456 * r_sum - 12105 * g_sum - 2351 * b_sum +
+				   4 * 4210688) >> 17;
+			y0 += 2;
+			y1 += 2;
+		}
+		ybuf += 2 * stride;
+		ubuf += stride / 2;
+		vbuf += stride / 2;
+	}
 }
 
 static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
@@ -138,20 +284,30 @@ static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
 		for (y = 0; y < fmt->fmt.pix.height; y++) {
-			for (x = 0; x < fmt->fmt.pix.width; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - 3 * fmt->fmt.pix.width;
+			data->lut_rgb24(buf, fmt->fmt.pix.width, data->lut);
+			buf += fmt->fmt.pix.bytesperline;
 		}
 		break;
+
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		v4lprocessing_do_processing_yuv420(data, buf, fmt);
+		break;
 	}
 }
 
+static int v4lprocessing_update_due(struct v4lprocessing_data *data)
+{
+	/* Count this frame */
+	int frames = data->lookup_table_update_frames + 1;
+
+	if (frames < data->lookup_table_update_min_frames)
+		return 0;
+
+	return v4lprocessing_get_time() - data->lookup_table_update_time >=
+		data->lookup_table_update_interval;
+}
+
 void v4lprocessing_processing(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
@@ -166,23 +322,62 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 	case V4L2_PIX_FMT_SRGGB8:
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
 		break;
 	default:
 		return; /* Non supported pix format */
 	}
 
-	if (data->controls_changed ||
-			data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE) {
+	if (data->controls_changed || v4lprocessing_update_due(data)) {
 		data->controls_changed = 0;
-		data->lookup_table_update_counter = 0;
-		/* Do this after resetting lookup_table_update_counter so that filters can
+		data->lookup_table_update_time = v4lprocessing_get_time();
+		data->lookup_table_update_frames = 0;
+		data->lookup_table_update_interval = V4L2PROCESSING_UPDATE_INTERVAL;
+		data->lookup_table_update_min_frames = 1;
+		/* Do this after resetting the update schedule so that filters can
 		   force the next update to be sooner when they changed camera settings */
 		v4lprocessing_update_lookup_tables(data, buf, fmt);
 	} else
-		data->lookup_table_update_counter++;
+		data->lookup_table_update_frames++;
 
 	if (data->lookup_table_active)
 		v4lprocessing_do_processing(data, buf, fmt);
 
 	data->do_process = 0;
 }
+
+int v4lprocessing_processing_by_line(struct v4lprocessing_data *data)
+{
+	if (!data->do_process)
+		return 0;
+
+	if (data->controls_changed || v4lprocessing_update_due(data))
+		return -1;
+
+	/* Same bookkeeping as v4lprocessing_processing() for frames which do
+	   not update the lookup tables */
+	data->lookup_table_update_frames++;
+	data->do_process = 0;
+
+	return data->lookup_table_active;
+}
+
+int v4lprocessing_suspend(struct v4lprocessing_data *data)
+{
+	int state = data->do_process;
+
+	data->do_process = 0;
+	return state;
+}
+
+void v4lprocessing_resume(struct v4lprocessing_data *data, int state)
+{
+	data->do_process = state;
+}
+
+void v4lprocessing_processing_line(struct v4lprocessing_data *data,
+		unsigned char *buf, int width)
+{
+	data->lut_rgb24(buf, width, data->lut);
+}
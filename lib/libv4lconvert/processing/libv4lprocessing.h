@@ -44,4 +44,31 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data);
 void v4lprocessing_processing(struct v4lprocessing_data *data,
   unsigned char *buf, const struct v4l2_format *fmt);
 
+/* Instead of calling v4lprocessing_processing() on the converted frame, a
+   conversion producing rgb24 / bgr24 can apply the processing to the lines
+   as it produces them, saving a pass over the frame. This is only possible
+   when the lookup tables do not need to be (re)calculated from this frame.
+   Returns 1 if the caller must call v4lprocessing_processing_line() on
+   all lines of this frame, 0 if there is no processing to do for this
+   frame, or -1 if v4lprocessing_processing() must be used on the frame as
+   the lookup tables must be updated. */
+int v4lprocessing_processing_by_line(struct v4lprocessing_data *data);
+
+/* Process width rgb24 / bgr24 pixels, this may be called from multiple
+   threads at once for different lines */
+void v4lprocessing_processing_line(struct v4lprocessing_data *data,
+  unsigned char *buf, int width);
+
+/* Make v4lprocessing_processing() and v4lprocessing_processing_by_line()
+   nops until v4lprocessing_resume(), so that frames which do not come from
+   the camera (such as the synthetic frames used to measure the conversion
+   cost) get converted without touching the processing state. Returns the
+   state to pass to v4lprocessing_resume(). */
+int v4lprocessing_suspend(struct v4lprocessing_data *data);
+void v4lprocessing_resume(struct v4lprocessing_data *data, int state);
+
+/* Plain C version of the lut_rgb24 conversion kernel */
+void v4lprocessing_lut_rgb24(unsigned char *buf, int width,
+  const unsigned char *lut);
+
 #endif
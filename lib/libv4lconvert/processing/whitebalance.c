@@ -94,14 +94,17 @@ static int whitebalance_calculate_lookup_tables_generic(
 
 		/*
 		 * If we are still converging to a stable update situation,
-		 * re-calc the lookup tables next frame, but only if no
-		 * other processing plugin has already asked for a shorter
-		 * update cycle, as asking for an update each frame while
-		 * some other pluging is trying to adjust hw settings is bad.
+		 * re-calc the lookup tables sooner. This is based on time
+		 * rather then on frames, so that we converge equally fast
+		 * independent of the framerate. Filters which are adjusting
+		 * hw settings may ask for a later update (in frames), as
+		 * updating each frame while some other plugin is trying to
+		 * adjust hw settings is bad.
 		 */
-		if (throttling && data->lookup_table_update_counter == 0)
-			data->lookup_table_update_counter =
-						V4L2PROCESSING_UPDATE_RATE;
+		if (throttling && data->lookup_table_update_interval >
+				  V4L2PROCESSING_UPDATE_INTERVAL / 10)
+			data->lookup_table_update_interval =
+				V4L2PROCESSING_UPDATE_INTERVAL / 10;
 	}
 
 	if (abs(data->green_avg - data->comp1_avg) < threshold &&
@@ -124,66 +127,128 @@ static int whitebalance_calculate_lookup_tables_bayer(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt, int starts_with_green)
 {
-	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0;
+	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0, n = 0;
 	int green_avg, comp1_avg, comp2_avg;
-
-	for (y = 0; y < fmt->fmt.pix.height; y += 2) {
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			a1 += *buf++;
-			a2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			b1 += *buf++;
-			b2 += *buf++;
+	int bpl = fmt->fmt.pix.bytesperline;
+	int step = v4lprocessing_stats_step(data, fmt);
+
+	/* Sample 2x2 blocks, so that we always get all 4 components, the step
+	   is always even when > 1 */
+	if (step < 2)
+		step = 2;
+
+	for (y = 0; y + 1 < fmt->fmt.pix.height; y += step) {
+		for (x = 0; x + 1 < fmt->fmt.pix.width; x += step) {
+			a1 += buf[x];
+			a2 += buf[x + 1];
+			b1 += buf[bpl + x];
+			b2 += buf[bpl + x + 1];
+			n++;
 		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+		buf += step * bpl;
 	}
 
+	if (!n)
+		return 0;
+
+	/* Norm avg to ~ 0 - 4095 */
 	if (starts_with_green) {
-		green_avg = a1 / 2 + b2 / 2;
-		comp1_avg = a2;
-		comp2_avg = b1;
+		green_avg = (a1 + b2) * 8LL / n;
+		comp1_avg = a2 * 16LL / n;
+		comp2_avg = b1 * 16LL / n;
 	} else {
-		green_avg = a2 / 2 + b1 / 2;
-		comp1_avg = a1;
-		comp2_avg = b2;
+		green_avg = (a2 + b1) * 8LL / n;
+		comp1_avg = a1 * 16LL / n;
+		comp2_avg = b2 * 16LL / n;
 	}
 
+	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
+			comp1_avg, comp2_avg);
+}
+
+static int whitebalance_calculate_lookup_tables_rgb(
+		struct v4lprocessing_data *data, unsigned char *buf,
+		const struct v4l2_format *fmt)
+{
+	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0, n = 0;
+	int step = v4lprocessing_stats_step(data, fmt);
+
+	for (y = 0; y < fmt->fmt.pix.height; y += step) {
+		for (x = 0; x < fmt->fmt.pix.width; x += step) {
+			comp1_avg += buf[3 * x];
+			green_avg += buf[3 * x + 1];
+			comp2_avg += buf[3 * x + 2];
+			n++;
+		}
+		buf += step * fmt->fmt.pix.bytesperline;
+	}
+
+	if (!n)
+		return 0;
+
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
+	green_avg = green_avg * 16LL / n;
+	comp1_avg = comp1_avg * 16LL / n;
+	comp2_avg = comp2_avg * 16LL / n;
 
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
 }
 
-static int whitebalance_calculate_lookup_tables_rgb(
+static int whitebalance_calculate_lookup_tables_yuv420(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt)
 {
-	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0;
+	int x, y, y_avg = 0, u_avg = 0, v_avg = 0, n = 0;
+	int green_avg, comp1_avg, comp2_avg;
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int stride = fmt->fmt.pix.bytesperline;
+	/* Sample 2x2 blocks of y together with the u and v of the block */
+	int step = v4lprocessing_stats_step(data, fmt);
+	unsigned char *ubuf, *vbuf;
+
+	if (step < 2)
+		step = 2;
+
+	if (fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420) {
+		vbuf = buf + stride * height;
+		ubuf = vbuf + (stride * height) / 4;
+	} else {
+		ubuf = buf + stride * height;
+		vbuf = ubuf + (stride * height) / 4;
+	}
 
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			comp1_avg += *buf++;
-			green_avg += *buf++;
-			comp2_avg += *buf++;
+	for (y = 0; y + 1 < height; y += step) {
+		for (x = 0; x + 1 < width; x += step) {
+			y_avg += buf[x] + buf[x + 1] + buf[stride + x] +
+				 buf[stride + x + 1];
+			u_avg += ubuf[x / 2];
+			v_avg += vbuf[x / 2];
+			n++;
 		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3;
+		buf += step * stride;
+		ubuf += step / 2 * stride / 2;
+		vbuf += step / 2 * stride / 2;
 	}
 
+	if (!n)
+		return 0;
+
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
+	y_avg = y_avg * 4LL / n;
+	u_avg = u_avg * 16LL / n - 128 * 16;
+	v_avg = v_avg * 16LL / n - 128 * 16;
+
+	/* The rgb averages are a linear function of the yuv averages */
+	comp1_avg = y_avg + ((v_avg * 1436) >> 10);
+	green_avg = y_avg - ((u_avg * 352 + v_avg * 731) >> 10);
+	comp2_avg = y_avg + ((u_avg * 1814) >> 10);
 
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
 }
 
-
 static int whitebalance_calculate_lookup_tables(
 		struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
@@ -200,6 +265,10 @@ static int whitebalance_calculate_lookup_tables(
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
 		return whitebalance_calculate_lookup_tables_rgb(data, buf, fmt);
+
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		return whitebalance_calculate_lookup_tables_yuv420(data, buf, fmt);
 	}
 
 	return 0; /* Should never happen */
@@ -34,35 +34,32 @@
 		(v) = ((14456 * (r) - 12105 * (g) - 2351 * (b) + 4210688) >> 15); \
 	} while (0)
 
-void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_rgb24_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp)
 {
 	int x, y;
-	unsigned char *udest, *vdest;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	unsigned char *ydest = dest->plane[0];
+	unsigned char *udest = dest->plane[uplane];
+	unsigned char *vdest = dest->plane[vplane];
 
 	/* Y */
 	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
 		for (x = 0; x < src_fmt->fmt.pix.width; x++) {
 			if (bgr)
-				RGB2Y(src[2], src[1], src[0], *dest++);
+				RGB2Y(src[2], src[1], src[0], *ydest++);
 			else
-				RGB2Y(src[0], src[1], src[2], *dest++);
+				RGB2Y(src[0], src[1], src[2], *ydest++);
 			src += bpp;
 		}
 
 		src += src_fmt->fmt.pix.bytesperline - bpp * src_fmt->fmt.pix.width;
+		ydest += dest->stride[0] - src_fmt->fmt.pix.width;
 	}
 	src -= src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline;
 
 	/* U + V */
-	if (yvu) {
-		vdest = dest;
-		udest = dest + src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 4;
-	} else {
-		udest = dest;
-		vdest = dest + src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 4;
-	}
-
 	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
 		for (x = 0; x < src_fmt->fmt.pix.width / 2; x++) {
 			int avg_src[3];
@@ -80,6 +77,8 @@ void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 			src += 2 * bpp;
 		}
 		src += 2 * src_fmt->fmt.pix.bytesperline - bpp * src_fmt->fmt.pix.width;
+		udest += dest->stride[uplane] - src_fmt->fmt.pix.width / 2;
+		vdest += dest->stride[vplane] - src_fmt->fmt.pix.width / 2;
 	}
 }
 
@@ -92,21 +91,15 @@ void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 
 #define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
 
-void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_yuv420_to_bgr24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu)
 {
 	int i, j;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
 
-	const unsigned char *ysrc = src;
-	const unsigned char *usrc, *vsrc;
-
-	if (yvu) {
-		vsrc = src + stride * height;
-		usrc = vsrc + (stride * height) / 4;
-	} else {
-		usrc = src + stride * height;
-		vsrc = usrc + (stride * height) / 4;
-	}
+	const unsigned char *ysrc = src->plane[0];
+	const unsigned char *usrc = src->plane[uplane];
+	const unsigned char *vsrc = src->plane[vplane];
 
 	for (i = 0; i < height; i++) {
 		for (j = 0; j < width; j += 2) {
@@ -138,33 +131,28 @@ void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
 			usrc++;
 			vsrc++;
 		}
-		ysrc += stride - width;
+		ysrc += src->stride[0] - width;
+		dest += dest_stride - width * 3;
 		/* Rewind u and v for next line */
 		if (!(i & 1)) {
 			usrc -= width / 2;
 			vsrc -= width / 2;
 		} else {
-			usrc += (stride - width) / 2;
-			vsrc += (stride - width) / 2;
+			usrc += src->stride[uplane] - width / 2;
+			vsrc += src->stride[vplane] - width / 2;
 		}
 	}
 }
 
-void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_yuv420_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu)
 {
 	int i, j;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
 
-	const unsigned char *ysrc = src;
-	const unsigned char *usrc, *vsrc;
-
-	if (yvu) {
-		vsrc = src + stride * height;
-		usrc = vsrc + (stride * height) / 4;
-	} else {
-		usrc = src + stride * height;
-		vsrc = usrc + (stride * height) / 4;
-	}
+	const unsigned char *ysrc = src->plane[0];
+	const unsigned char *usrc = src->plane[uplane];
+	const unsigned char *vsrc = src->plane[vplane];
 
 	for (i = 0; i < height; i++) {
 		for (j = 0; j < width; j += 2) {
@@ -196,20 +184,49 @@ void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
 			usrc++;
 			vsrc++;
 		}
-		ysrc += stride - width;
+		ysrc += src->stride[0] - width;
+		dest += dest_stride - width * 3;
 		/* Rewind u and v for next line */
 		if (!(i & 1)) {
 			usrc -= width / 2;
 			vsrc -= width / 2;
 		} else {
-			usrc += (stride - width) / 2;
-			vsrc += (stride - width) / 2;
+			usrc += src->stride[uplane] - width / 2;
+			vsrc += src->stride[vplane] - width / 2;
 		}
 	}
 }
 
+/* Convert a single line, used by the SIMD versions for the pixels left over
+   after their last full vector */
+void v4lconvert_yuv420_to_rgb24_line(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int bgr)
+{
+	int j;
+
+	for (j = 0; j < width; j += 2) {
+		int u1 = (((*usrc - 128) << 7) +  (*usrc - 128)) >> 6;
+		int rg = (((*usrc - 128) << 1) +  (*usrc - 128) +
+				((*vsrc - 128) << 2) + ((*vsrc - 128) << 1)) >> 3;
+		int v1 = (((*vsrc - 128) << 1) +  (*vsrc - 128)) >> 1;
+
+		*dest++ = CLIP(*ysrc + (bgr ? u1 : v1));
+		*dest++ = CLIP(*ysrc - rg);
+		*dest++ = CLIP(*ysrc + (bgr ? v1 : u1));
+		ysrc++;
+
+		*dest++ = CLIP(*ysrc + (bgr ? u1 : v1));
+		*dest++ = CLIP(*ysrc - rg);
+		*dest++ = CLIP(*ysrc + (bgr ? v1 : u1));
+		ysrc++;
+		usrc++;
+		vsrc++;
+	}
+}
+
 void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 
@@ -231,12 +248,13 @@ void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest,
 			*dest++ = CLIP(src[2] + v1);
 			src += 4;
 		}
-		src += stride - width * 2;
+		src += stride - (width & ~1) * 2;
+		dest += dest_stride - (width & ~1) * 3;
 	}
 }
 
 void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 
@@ -258,38 +276,37 @@ void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
 			*dest++ = CLIP(src[2] + u1);
 			src += 4;
 		}
-		src += stride - (width * 2);
+		src += stride - (width & ~1) * 2;
+		dest += dest_stride - (width & ~1) * 3;
 	}
 }
 
-void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_yuyv_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest, int width, int height,
+		int stride, int yvu)
 {
 	int i, j;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
 	const unsigned char *src1;
-	unsigned char *udest, *vdest;
+	unsigned char *ydest = dest->plane[0];
+	unsigned char *udest = dest->plane[uplane];
+	unsigned char *vdest = dest->plane[vplane];
 
 	/* copy the Y values */
 	src1 = src;
 	for (i = 0; i < height; i++) {
 		for (j = 0; j + 1 < width; j += 2) {
-			*dest++ = src1[0];
-			*dest++ = src1[2];
+			*ydest++ = src1[0];
+			*ydest++ = src1[2];
 			src1 += 4;
 		}
-		src1 += stride - width * 2;
+		src1 += stride - (width & ~1) * 2;
+		ydest += dest->stride[0] - (width & ~1);
 	}
 
 	/* copy the U and V values */
-	src++;				/* point to V */
+	src++;				/* point to U */
 	src1 = src + stride;		/* next line */
-	if (yvu) {
-		vdest = dest;
-		udest = dest + width * height / 4;
-	} else {
-		udest = dest;
-		vdest = dest + width * height / 4;
-	}
 	for (i = 0; i < height; i += 2) {
 		for (j = 0; j + 1 < width; j += 2) {
 			*udest++ = ((int) src[0] + src1[0]) / 2;	/* U */
@@ -297,33 +314,36 @@ void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
 			src += 4;
 			src1 += 4;
 		}
-		src1 += stride - width * 2;
+		src1 += stride - (width & ~1) * 2;
 		src = src1;
 		src1 += stride;
+		udest += dest->stride[uplane] - width / 2;
+		vdest += dest->stride[vplane] - width / 2;
 	}
 }
 
-void v4lconvert_nv16_to_yuyv(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+void v4lconvert_nv16_to_yuyv(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride)
 {
 	const unsigned char *y, *cbcr;
 	int i, j;
 
-	y = src;
-	cbcr = src + stride * height;
+	y = src->plane[0];
+	cbcr = src->plane[1];
 
 	for (i = 0; i < height; i++) {
 		for (j = 0; j < width; j++) {
 			*dest++ = *y++;
 			*dest++ = *cbcr++;
 		}
-		y += stride - width;
-		cbcr += stride - width;
+		y += src->stride[0] - width;
+		cbcr += src->stride[1] - width;
+		dest += dest_stride - width * 2;
 	}
 }
 
 void v4lconvert_yvyu_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 
@@ -345,12 +365,13 @@ void v4lconvert_yvyu_to_bgr24(const unsigned char *src, unsigned char *dest,
 			*dest++ = CLIP(src[2] + v1);
 			src += 4;
 		}
-		src += stride - (width * 2);
+		src += stride - (width & ~1) * 2;
+		dest += dest_stride - (width & ~1) * 3;
 	}
 }
 
 void v4lconvert_yvyu_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 
@@ -372,12 +393,13 @@ void v4lconvert_yvyu_to_rgb24(const unsigned char *src, unsigned char *dest,
 			*dest++ = CLIP(src[2] + u1);
 			src += 4;
 		}
-		src += stride - (width * 2);
+		src += stride - (width & ~1) * 2;
+		dest += dest_stride - (width & ~1) * 3;
 	}
 }
 
 void v4lconvert_uyvy_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 
@@ -399,12 +421,13 @@ void v4lconvert_uyvy_to_bgr24(const unsigned char *src, unsigned char *dest,
 			*dest++ = CLIP(src[3] + v1);
 			src += 4;
 		}
-		src += stride - width * 2;
+		src += stride - (width & ~1) * 2;
+		dest += dest_stride - (width & ~1) * 3;
 	}
 }
 
 void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 
@@ -426,37 +449,36 @@ void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
 			*dest++ = CLIP(src[3] + u1);
 			src += 4;
 		}
-		src += stride - width * 2;
+		src += stride - (width & ~1) * 2;
+		dest += dest_stride - (width & ~1) * 3;
 	}
 }
 
-void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_uyvy_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest, int width, int height,
+		int stride, int yvu)
 {
 	int i, j;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
 	const unsigned char *src1;
-	unsigned char *udest, *vdest;
+	unsigned char *ydest = dest->plane[0];
+	unsigned char *udest = dest->plane[uplane];
+	unsigned char *vdest = dest->plane[vplane];
 
 	/* copy the Y values */
 	src1 = src;
 	for (i = 0; i < height; i++) {
 		for (j = 0; j + 1 < width; j += 2) {
-			*dest++ = src1[1];
-			*dest++ = src1[3];
+			*ydest++ = src1[1];
+			*ydest++ = src1[3];
 			src1 += 4;
 		}
-		src1 += stride - width * 2;
+		src1 += stride - (width & ~1) * 2;
+		ydest += dest->stride[0] - (width & ~1);
 	}
 
 	/* copy the U and V values */
 	src1 = src + stride;		/* next line */
-	if (yvu) {
-		vdest = dest;
-		udest = dest + width * height / 4;
-	} else {
-		udest = dest;
-		vdest = dest + width * height / 4;
-	}
 	for (i = 0; i < height; i += 2) {
 		for (j = 0; j + 1 < width; j += 2) {
 			*udest++ = ((int) src[0] + src1[0]) / 2;	/* U */
@@ -464,58 +486,48 @@ void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
 			src += 4;
 			src1 += 4;
 		}
-		src1 += stride - width * 2;
+		src1 += stride - (width & ~1) * 2;
 		src = src1;
 		src1 += stride;
+		udest += dest->stride[uplane] - width / 2;
+		vdest += dest->stride[vplane] - width / 2;
 	}
 }
 
 void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
-		int width, int height)
+		int width, int height, int stride, int dest_stride)
 {
-	int i;
+	int i, j;
 
-	for (i = 0; i < (width * height); i++) {
-		unsigned char tmp0, tmp1;
-		tmp0 = *src++;
-		tmp1 = *src++;
-		*dst++ = *src++;
-		*dst++ = tmp1;
-		*dst++ = tmp0;
+	for (i = 0; i < height; i++) {
+		for (j = 0; j < width; j++) {
+			unsigned char tmp0, tmp1;
+			tmp0 = *src++;
+			tmp1 = *src++;
+			*dst++ = *src++;
+			*dst++ = tmp1;
+			*dst++ = tmp0;
+		}
+		src += stride - width * 3;
+		dst += dest_stride - width * 3;
 	}
 }
 
-void v4lconvert_swap_uv(const unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt)
+/* yuv420 <-> yvu420, as the planes are in the order of their format this
+   copies the first chroma plane of src to the second one of dst and v.v. */
+void v4lconvert_swap_uv(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dst, int width, int height)
 {
-	int y;
-
-	/* Copy Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
-		memcpy(dest, src, src_fmt->fmt.pix.width);
-		dest += src_fmt->fmt.pix.width;
-		src += src_fmt->fmt.pix.bytesperline;
-	}
-
-	/* Copy component 2 */
-	src += src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline / 4;
-	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
-		memcpy(dest, src, src_fmt->fmt.pix.width / 2);
-		dest += src_fmt->fmt.pix.width / 2;
-		src += src_fmt->fmt.pix.bytesperline / 2;
-	}
-
-	/* Copy component 1 */
-	src -= src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline / 2;
-	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
-		memcpy(dest, src, src_fmt->fmt.pix.width / 2);
-		dest += src_fmt->fmt.pix.width / 2;
-		src += src_fmt->fmt.pix.bytesperline / 2;
-	}
+	v4lconvert_copy_lines(src->plane[0], dst->plane[0], width, height,
+			      src->stride[0], dst->stride[0]);
+	v4lconvert_copy_lines(src->plane[2], dst->plane[1], width / 2,
+			      height / 2, src->stride[2], dst->stride[1]);
+	v4lconvert_copy_lines(src->plane[1], dst->plane[2], width / 2,
+			      height / 2, src->stride[1], dst->stride[2]);
 }
 
 void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 	while (--height >= 0) {
@@ -530,11 +542,12 @@ void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
 			src += 2;
 		}
 		src += stride - 2 * width;
+		dest += dest_stride - 3 * width;
 	}
 }
 
 void v4lconvert_rgb565_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 	while (--height >= 0) {
@@ -549,15 +562,21 @@ void v4lconvert_rgb565_to_bgr24(const unsigned char *src, unsigned char *dest,
 			src += 2;
 		}
 		src += stride - 2 * width;
+		dest += dest_stride - 3 * width;
 	}
 }
 
-void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_rgb565_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, int yvu)
 {
 	int x, y;
 	unsigned short tmp;
-	unsigned char *udest, *vdest;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	int next_line = src_fmt->fmt.pix.bytesperline / 2;
+	unsigned char *ydest = dest->plane[0];
+	unsigned char *udest = dest->plane[uplane];
+	unsigned char *vdest = dest->plane[vplane];
 	unsigned r[4], g[4], b[4];
 	int avg_src[3];
 
@@ -568,22 +587,15 @@ void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
 			r[0] = 0xf8 & (tmp << 3);
 			g[0] = 0xfc & (tmp >> 3);
 			b[0] = 0xf8 & (tmp >> 8);
-			RGB2Y(r[0], g[0], b[0], *dest++);
+			RGB2Y(r[0], g[0], b[0], *ydest++);
 			src += 2;
 		}
 		src += src_fmt->fmt.pix.bytesperline - 2 * src_fmt->fmt.pix.width;
+		ydest += dest->stride[0] - src_fmt->fmt.pix.width;
 	}
 	src -= src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline;
 
 	/* U + V */
-	if (yvu) {
-		vdest = dest;
-		udest = dest + src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 4;
-	} else {
-		udest = dest;
-		vdest = dest + src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 4;
-	}
-
 	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
 		for (x = 0; x < src_fmt->fmt.pix.width / 2; x++) {
 			tmp = *(unsigned short *)src;
@@ -596,12 +608,12 @@ void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
 			g[1] = 0xfc & (tmp >> 3);
 			b[1] = 0xf8 & (tmp >> 8);
 
-			tmp = *(((unsigned short *)src) + src_fmt->fmt.pix.bytesperline);
+			tmp = *(((unsigned short *)src) + next_line);
 			r[2] = 0xf8 & (tmp << 3);
 			g[2] = 0xfc & (tmp >> 3);
 			b[2] = 0xf8 & (tmp >> 8);
 
-			tmp = *(((unsigned short *)src) + src_fmt->fmt.pix.bytesperline + 1);
+			tmp = *(((unsigned short *)src) + next_line + 1);
 			r[3] = 0xf8 & (tmp << 3);
 			g[3] = 0xfc & (tmp >> 3);
 			b[3] = 0xf8 & (tmp >> 8);
@@ -613,11 +625,14 @@ void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
 			src += 4;
 		}
 		src += 2 * src_fmt->fmt.pix.bytesperline - 2 * src_fmt->fmt.pix.width;
+		udest += dest->stride[uplane] - src_fmt->fmt.pix.width / 2;
+		vdest += dest->stride[vplane] - src_fmt->fmt.pix.width / 2;
 	}
 }
 
 void v4lconvert_y16_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int little_endian)
+		int width, int height, int stride, int dest_stride,
+		int little_endian)
 {
 	int j;
 
@@ -631,30 +646,48 @@ void v4lconvert_y16_to_rgb24(const unsigned char *src, unsigned char *dest,
 			*dest++ = *src;
 			src+=2;
 		}
+		src += stride - 2 * width;
+		dest += dest_stride - 3 * width;
+	}
+}
+
+/* Clear the U and V planes of a yuv420 / yvu420 frame */
+static void clear_uv_planes(const struct v4lconvert_planes *dest,
+		int width, int height)
+{
+	int i;
+
+	for (i = 0; i < height / 2; i++) {
+		memset(dest->plane[1] + i * dest->stride[1], 0x80, width / 2);
+		memset(dest->plane[2] + i * dest->stride[2], 0x80, width / 2);
 	}
 }
 
-void v4lconvert_y16_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_y16_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt, int little_endian)
 {
 	int x, y;
+	unsigned char *ydest = dest->plane[0];
 
 	if (little_endian)
 		src++;
 
 	/* Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++)
+	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
 		for (x = 0; x < src_fmt->fmt.pix.width; x++){
-			*dest++ = *src;
+			*ydest++ = *src;
 			src+=2;
 		}
+		src += src_fmt->fmt.pix.bytesperline - 2 * src_fmt->fmt.pix.width;
+		ydest += dest->stride[0] - src_fmt->fmt.pix.width;
+	}
 
-	/* Clear U/V */
-	memset(dest, 0x80, src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 2);
+	clear_uv_planes(dest, src_fmt->fmt.pix.width, src_fmt->fmt.pix.height);
 }
 
 void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride, int dest_stride)
 {
 	int j;
 	while (--height >= 0) {
@@ -665,21 +698,20 @@ void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
 			src++;
 		}
 		src += stride - width;
+		dest += dest_stride - 3 * width;
 	}
 }
 
-void v4lconvert_grey_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_grey_to_yuv420(const unsigned char *src,
+		const struct v4lconvert_planes *dest,
 		const struct v4l2_format *src_fmt)
 {
-	int x, y;
-
 	/* Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++)
-		for (x = 0; x < src_fmt->fmt.pix.width; x++)
-			*dest++ = *src++;
+	v4lconvert_copy_lines(src, dest->plane[0], src_fmt->fmt.pix.width,
+			      src_fmt->fmt.pix.height,
+			      src_fmt->fmt.pix.bytesperline, dest->stride[0]);
 
-	/* Clear U/V */
-	memset(dest, 0x80, src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 2);
+	clear_uv_planes(dest, src_fmt->fmt.pix.width, src_fmt->fmt.pix.height);
 }
 
 /* Unpack buffer of (vw bit) data into padded 16bit buffer. */
@@ -765,7 +797,7 @@ int v4lconvert_y10b_to_yuv420(struct v4lconvert_data *data,
 }
 
 void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height,int bgr)
+		int width, int height, int stride, int dest_stride, int bgr)
 {
 	int j;
 	while (--height >= 0) {
@@ -783,6 +815,8 @@ void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
 				src+=1;
 			}
 		}
+		src += stride - 4 * width;
+		dest += dest_stride - 3 * width;
 	}
 }
 
@@ -842,14 +876,15 @@ static void hsvtorgb(const unsigned char *hsv, unsigned char *rgb,
 }
 
 void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int bgr, int Xin, unsigned char hsv_enc){
+		int width, int height, int stride, int dest_stride, int bgr,
+		int Xin, unsigned char hsv_enc){
 	int j, k;
 	int bppIN = Xin / 8;
 	unsigned char rgb[3];
 
 	src += bppIN - 3;
 
-	while (--height >= 0)
+	while (--height >= 0) {
 		for (j = 0; j < width; j++) {
 			hsvtorgb(src, rgb, hsv_enc);
 			for (k = 0; k < 3; k++)
@@ -859,14 +894,17 @@ void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 					*dest++ = rgb[k];
 			src += bppIN;
 		}
+		src += stride - bppIN * width;
+		dest += dest_stride - 3 * width;
+	}
 }
 
-void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int bgr)
+void v4lconvert_nv12_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int bgr)
 {
 	int i, j;
-	const unsigned char *ysrc = src;
-	const unsigned char *uvsrc = src + stride * height;
+	const unsigned char *ysrc = src->plane[0];
+	const unsigned char *uvsrc = src->plane[1];
 
 	for (i = 0; i < height; i++) {
 		for (j = 0; j < width; j ++) {
@@ -884,31 +922,47 @@ void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
 				uvsrc += 2;
 		}
 
-		ysrc += stride - width;
+		ysrc += src->stride[0] - width;
+		dest += dest_stride - width * 3;
 		/* Rewind u and v for next line */
 		if (!(i&1))
 			uvsrc -= width;
 		else
-			uvsrc += stride - width;
+			uvsrc += src->stride[1] - width;
 	}
 }
 
-void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_nv12_to_rgb24_line(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int width, int bgr)
 {
-	int i, j;
-	const unsigned char *ysrc = src;
-	const unsigned char *uvsrc = src + stride * height;
-	unsigned char *ydst = dest;
-	unsigned char *udst, *vdst;
-
-	if (yvu) {
-		vdst = ydst + width * height;
-		udst = vdst + ((width / 2) * (height / 2));
-	} else {
-		udst = ydst + width * height;
-		vdst = udst + ((width / 2) * (height / 2));
+	int j;
+
+	for (j = 0; j < width; j++) {
+		if (bgr) {
+			*dest++ = YUV2B(*ysrc, *uvsrc, *(uvsrc + 1));
+			*dest++ = YUV2G(*ysrc, *uvsrc, *(uvsrc + 1));
+			*dest++ = YUV2R(*ysrc, *uvsrc, *(uvsrc + 1));
+		} else {
+			*dest++ = YUV2R(*ysrc, *uvsrc, *(uvsrc + 1));
+			*dest++ = YUV2G(*ysrc, *uvsrc, *(uvsrc + 1));
+			*dest++ = YUV2B(*ysrc, *uvsrc, *(uvsrc + 1));
+		}
+		ysrc++;
+		if (j&1)
+			uvsrc += 2;
 	}
+}
+
+void v4lconvert_nv12_to_yuv420(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, int width, int height, int yvu)
+{
+	int i, j;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	const unsigned char *ysrc = src->plane[0];
+	const unsigned char *uvsrc = src->plane[1];
+	unsigned char *ydst = dest->plane[0];
+	unsigned char *udst = dest->plane[uplane];
+	unsigned char *vdst = dest->plane[vplane];
 
 	for (i = 0; i < height; i++) {
 		for (j = 0; j < width; j++) {
@@ -919,8 +973,230 @@ void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
 			}
 		}
 
-		ysrc += stride - width;
-		if ((i % 2) == 0)
-			uvsrc += stride - width;
+		ysrc += src->stride[0] - width;
+		ydst += dest->stride[0] - width;
+		if ((i % 2) == 0) {
+			uvsrc += src->stride[1] - width;
+			udst += dest->stride[uplane] - width / 2;
+			vdst += dest->stride[vplane] - width / 2;
+		}
+	}
+}
+
+void v4lconvert_nv12_to_yuyv(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride)
+{
+	int i, j;
+	const unsigned char *ysrc = src->plane[0];
+	const unsigned char *uvsrc = src->plane[1];
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*dest++ = ysrc[j];
+			*dest++ = uvsrc[j];
+			*dest++ = ysrc[j + 1];
+			*dest++ = uvsrc[j + 1];
+		}
+		ysrc += src->stride[0];
+		dest += dest_stride - (width & ~1) * 2;
+		if (i & 1)
+			uvsrc += src->stride[1];
+	}
+}
+
+void v4lconvert_yuv420_to_nv12(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, int width, int height, int yvu)
+{
+	int i, j;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	const unsigned char *usrc = src->plane[uplane];
+	const unsigned char *vsrc = src->plane[vplane];
+	unsigned char *uvdest = dest->plane[1];
+
+	v4lconvert_copy_lines(src->plane[0], dest->plane[0], width, height,
+			      src->stride[0], dest->stride[0]);
+
+	for (i = 0; i < height / 2; i++) {
+		for (j = 0; j < width / 2; j++) {
+			uvdest[2 * j] = usrc[j];
+			uvdest[2 * j + 1] = vsrc[j];
+		}
+		usrc += src->stride[uplane];
+		vsrc += src->stride[vplane];
+		uvdest += dest->stride[1];
+	}
+}
+
+void v4lconvert_yuv420_to_yuyv(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu)
+{
+	int i, j;
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	const unsigned char *ysrc = src->plane[0];
+	const unsigned char *usrc = src->plane[uplane];
+	const unsigned char *vsrc = src->plane[vplane];
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*dest++ = ysrc[j];
+			*dest++ = usrc[j / 2];
+			*dest++ = ysrc[j + 1];
+			*dest++ = vsrc[j / 2];
+		}
+		ysrc += src->stride[0];
+		dest += dest_stride - (width & ~1) * 2;
+		if (i & 1) {
+			usrc += src->stride[uplane];
+			vsrc += src->stride[vplane];
+		}
+	}
+}
+
+void v4lconvert_yuyv_to_nv12(const unsigned char *src,
+		const struct v4lconvert_planes *dest, int width, int height,
+		int stride, int yvu)
+{
+	int i, j;
+	const unsigned char *src1;
+	unsigned char *ydest = dest->plane[0];
+	unsigned char *uvdest = dest->plane[1];
+
+	/* copy the Y values */
+	src1 = src;
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*ydest++ = src1[0];
+			*ydest++ = src1[2];
+			src1 += 4;
+		}
+		src1 += stride - (width & ~1) * 2;
+		ydest += dest->stride[0] - (width & ~1);
+	}
+
+	/* average the U and V values of 2 lines, yvu swaps them */
+	for (i = 0; i < height; i += 2) {
+		src1 = src + stride;
+		for (j = 0; j + 1 < width; j += 2) {
+			*uvdest++ = ((int) src[yvu ? 3 : 1] + src1[yvu ? 3 : 1]) / 2;
+			*uvdest++ = ((int) src[yvu ? 1 : 3] + src1[yvu ? 1 : 3]) / 2;
+			src += 4;
+			src1 += 4;
+		}
+		src += 2 * stride - (width & ~1) * 2;
+		uvdest += dest->stride[1] - (width & ~1);
+	}
+}
+
+void v4lconvert_uyvy_to_nv12(const unsigned char *src,
+		const struct v4lconvert_planes *dest, int width, int height,
+		int stride)
+{
+	int i, j;
+	const unsigned char *src1;
+	unsigned char *ydest = dest->plane[0];
+	unsigned char *uvdest = dest->plane[1];
+
+	/* copy the Y values */
+	src1 = src;
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*ydest++ = src1[1];
+			*ydest++ = src1[3];
+			src1 += 4;
+		}
+		src1 += stride - (width & ~1) * 2;
+		ydest += dest->stride[0] - (width & ~1);
+	}
+
+	/* average the U and V values of 2 lines */
+	for (i = 0; i < height; i += 2) {
+		src1 = src + stride;
+		for (j = 0; j + 1 < width; j += 2) {
+			*uvdest++ = ((int) src[0] + src1[0]) / 2;
+			*uvdest++ = ((int) src[2] + src1[2]) / 2;
+			src += 4;
+			src1 += 4;
+		}
+		src += 2 * stride - (width & ~1) * 2;
+		uvdest += dest->stride[1] - (width & ~1);
+	}
+}
+
+/* Reorder the bytes of 4:2:2 packed yuv, the order of src is given by the
+   offsets of y0, u, y1 and v in each group of 4 bytes */
+void v4lconvert_packed_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride,
+		int y0, int u, int y1, int v)
+{
+	int j;
+
+	while (--height >= 0) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*dest++ = src[y0];
+			*dest++ = src[u];
+			*dest++ = src[y1];
+			*dest++ = src[v];
+			src += 4;
+		}
+		src += stride - (width & ~1) * 2;
+		dest += dest_stride - (width & ~1) * 2;
+	}
+}
+
+/* Copy lines of length bytes, from and to frames with the given strides */
+void v4lconvert_copy_lines(const unsigned char *src, unsigned char *dest,
+		int length, int lines, int stride, int dest_stride)
+{
+	while (--lines >= 0) {
+		memcpy(dest, src, length);
+		dest += dest_stride;
+		src += stride;
+	}
+}
+
+/* Expand rgb24 / bgr24 to argb32 / xrgb32, which in memory is a (0xff) alpha
+   byte followed by r, g and b. The pixels are done from last to first, so that
+   the conversion can be done in place (src == dest, stride <= dest_stride). */
+void v4lconvert_rgb24_to_argb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride, int bgr)
+{
+	int i;
+
+	src += height * stride;
+	dest += height * dest_stride;
+	while (--height >= 0) {
+		src -= stride;
+		dest -= dest_stride;
+		for (i = width - 1; i >= 0; i--) {
+			unsigned char c0, c1, c2;
+
+			c0 = src[i * 3];
+			c1 = src[i * 3 + 1];
+			c2 = src[i * 3 + 2];
+			dest[i * 4] = 0xff;
+			dest[i * 4 + 1] = bgr ? c2 : c0;
+			dest[i * 4 + 2] = c1;
+			dest[i * 4 + 3] = bgr ? c0 : c2;
+		}
+	}
+}
+
+/* src points to the first color byte of the first pixel, like with
+   v4lconvert_rgb32_to_rgb24() */
+void v4lconvert_rgb32_to_argb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int dest_stride, int bgr)
+{
+	int j;
+
+	while (--height >= 0) {
+		for (j = 0; j < width; j++) {
+			*dest++ = 0xff;
+			*dest++ = bgr ? src[2] : src[0];
+			*dest++ = src[1];
+			*dest++ = bgr ? src[0] : src[2];
+			src += 4;
+		}
+		src += stride - 4 * width;
+		dest += dest_stride - 4 * width;
 	}
 }
@@ -0,0 +1,704 @@
+/*
+
+# NEON versions of the conversion kernels
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+#include "tinyjpeg-internal.h"
+
+#ifdef V4LCONVERT_HAVE_NEON
+
+#include <arm_neon.h>
+
+typedef void (*packed_to_rgb24_fn)(const unsigned char *src,
+		unsigned char *dst, int width, int height, int stride,
+		int dest_stride);
+
+/*
+ * Packed yuv 4:2:2 -> rgb24 / bgr24
+ *
+ * vld4 splits 16 pixel pairs into y0, u, y1, v planes (in the order given by
+ * the indexes below), the math is the same shift and add sequence as the C
+ * code in rgbyuv.c on 16 bit lanes, so the output is bit-exact with it.
+ */
+
+struct neon_chroma {
+	int16x8_t u1, rg, v1;
+};
+
+static inline struct neon_chroma neon_chroma_terms(uint8x8_t u8, uint8x8_t v8)
+{
+	const uint8x8_t c128 = vdup_n_u8(128);
+	int16x8_t u = vreinterpretq_s16_u16(vsubl_u8(u8, c128));
+	int16x8_t v = vreinterpretq_s16_u16(vsubl_u8(v8, c128));
+	struct neon_chroma c;
+
+	c.u1 = vshrq_n_s16(vaddq_s16(vshlq_n_s16(u, 7), u), 6);
+	c.rg = vshrq_n_s16(vaddq_s16(vaddq_s16(vshlq_n_s16(u, 1), u),
+			vaddq_s16(vshlq_n_s16(v, 2), vshlq_n_s16(v, 1))), 3);
+	c.v1 = vshrq_n_s16(vaddq_s16(vshlq_n_s16(v, 1), v), 1);
+	return c;
+}
+
+/* Returns r, g, b for 8 pixels sharing their chroma with the matching 8
+   pixels of the other y plane */
+static inline uint8x8x3_t neon_yuv_to_rgb(uint8x8_t y8, struct neon_chroma c)
+{
+	int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(y8));
+	uint8x8x3_t rgb;
+
+	rgb.val[0] = vqmovun_s16(vaddq_s16(y, c.v1));
+	rgb.val[1] = vqmovun_s16(vsubq_s16(y, c.rg));
+	rgb.val[2] = vqmovun_s16(vaddq_s16(y, c.u1));
+	return rgb;
+}
+
+/* Zip even and odd pixels back together and store them as 24 bpp */
+static inline void neon_store_rgb24(unsigned char *dest, uint8x8x3_t even,
+		uint8x8x3_t odd, int bgr)
+{
+	uint8x8x2_t zr = vzip_u8(even.val[0], odd.val[0]);
+	uint8x8x2_t zg = vzip_u8(even.val[1], odd.val[1]);
+	uint8x8x2_t zb = vzip_u8(even.val[2], odd.val[2]);
+	uint8x16x3_t out;
+
+	out.val[bgr ? 2 : 0] = vcombine_u8(zr.val[0], zr.val[1]);
+	out.val[1] = vcombine_u8(zg.val[0], zg.val[1]);
+	out.val[bgr ? 0 : 2] = vcombine_u8(zb.val[0], zb.val[1]);
+	vst3q_u8(dest, out);
+}
+
+static inline void neon_packed_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride, int y0_idx, int u_idx, int y1_idx, int v_idx, int bgr,
+		packed_to_rgb24_fn c_version)
+{
+	while (--height >= 0) {
+		int i, j;
+
+		for (j = 0; j + 32 <= width; j += 32) {
+			uint8x16x4_t in = vld4q_u8(src + j * 2);
+
+			for (i = 0; i < 2; i++) {
+				uint8x8_t y0, y1, u, v;
+				struct neon_chroma c;
+
+				if (i == 0) {
+					y0 = vget_low_u8(in.val[y0_idx]);
+					y1 = vget_low_u8(in.val[y1_idx]);
+					u = vget_low_u8(in.val[u_idx]);
+					v = vget_low_u8(in.val[v_idx]);
+				} else {
+					y0 = vget_high_u8(in.val[y0_idx]);
+					y1 = vget_high_u8(in.val[y1_idx]);
+					u = vget_high_u8(in.val[u_idx]);
+					v = vget_high_u8(in.val[v_idx]);
+				}
+				c = neon_chroma_terms(u, v);
+				neon_store_rgb24(dest + j * 3 + i * 48,
+						 neon_yuv_to_rgb(y0, c),
+						 neon_yuv_to_rgb(y1, c), bgr);
+			}
+		}
+
+		if (j < width)
+			c_version(src + j * 2, dest + j * 3, width - j, 1, stride,
+				  dest_stride);
+		src += stride;
+		dest += dest_stride;
+	}
+}
+
+static void neon_yuyv_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			0, 1, 2, 3, 0, v4lconvert_yuyv_to_rgb24);
+}
+
+static void neon_yuyv_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			0, 1, 2, 3, 1, v4lconvert_yuyv_to_bgr24);
+}
+
+static void neon_yvyu_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			0, 3, 2, 1, 0, v4lconvert_yvyu_to_rgb24);
+}
+
+static void neon_yvyu_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			0, 3, 2, 1, 1, v4lconvert_yvyu_to_bgr24);
+}
+
+static void neon_uyvy_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			1, 0, 3, 2, 0, v4lconvert_uyvy_to_rgb24);
+}
+
+static void neon_uyvy_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	neon_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			1, 0, 3, 2, 1, v4lconvert_uyvy_to_bgr24);
+}
+
+/* Planar yuv 4:2:0 -> rgb24 / bgr24, same math as the packed version */
+static inline void neon_yuv420_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride,
+		int yvu, int bgr)
+{
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src->plane[0] + i * src->stride[0];
+		const unsigned char *ul = src->plane[uplane] +
+					  (i / 2) * src->stride[uplane];
+		const unsigned char *vl = src->plane[vplane] +
+					  (i / 2) * src->stride[vplane];
+		unsigned char *d = dest + i * dest_stride;
+
+		for (j = 0; j + 16 <= width; j += 16) {
+			uint8x8x2_t y = vld2_u8(ysrc + j);
+			struct neon_chroma c = neon_chroma_terms(
+					vld1_u8(ul + j / 2), vld1_u8(vl + j / 2));
+
+			neon_store_rgb24(d + j * 3, neon_yuv_to_rgb(y.val[0], c),
+					 neon_yuv_to_rgb(y.val[1], c), bgr);
+		}
+		if (j < width)
+			v4lconvert_yuv420_to_rgb24_line(ysrc + j, ul + j / 2,
+					vl + j / 2, d + j * 3, width - j, bgr);
+	}
+}
+
+static void neon_yuv420_to_rgb(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu)
+{
+	neon_yuv420_to_rgb24(src, dest, width, height, dest_stride, yvu, 0);
+}
+
+static void neon_yuv420_to_bgr(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu)
+{
+	neon_yuv420_to_rgb24(src, dest, width, height, dest_stride, yvu, 1);
+}
+
+/* NV12 -> rgb24 / bgr24, the YUV2R / YUV2B ((c * f) >> 10) is done as a
+   doubling high half multiply of c << 5, YUV2G in 32 bits */
+static void neon_nv12_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int bgr)
+{
+	const uint8x8_t c128 = vdup_n_u8(128);
+	int i, j, k;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src->plane[0] + i * src->stride[0];
+		const unsigned char *uvl = src->plane[1] + (i / 2) * src->stride[1];
+		unsigned char *d = dest + i * dest_stride;
+
+		for (j = 0; j + 16 <= width; j += 16) {
+			uint8x8x2_t y = vld2_u8(ysrc + j);
+			uint8x8x2_t uv = vld2_u8(uvl + j);
+			int16x8_t u = vreinterpretq_s16_u16(vsubl_u8(uv.val[0], c128));
+			int16x8_t v = vreinterpretq_s16_u16(vsubl_u8(uv.val[1], c128));
+			int16x8_t r_off = vqdmulhq_n_s16(vshlq_n_s16(v, 5), 1436);
+			int16x8_t b_off = vqdmulhq_n_s16(vshlq_n_s16(u, 5), 1814);
+			int32x4_t g_lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(u), 352),
+						     vget_low_s16(v), 731);
+			int32x4_t g_hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(u), 352),
+						     vget_high_s16(v), 731);
+			int16x8_t g_off = vcombine_s16(vshrn_n_s32(g_lo, 10),
+						       vshrn_n_s32(g_hi, 10));
+			uint8x8x3_t rgb[2];
+
+			for (k = 0; k < 2; k++) {
+				int16x8_t yk = vreinterpretq_s16_u16(vmovl_u8(y.val[k]));
+
+				rgb[k].val[0] = vqmovun_s16(vaddq_s16(yk, r_off));
+				rgb[k].val[1] = vqmovun_s16(vsubq_s16(yk, g_off));
+				rgb[k].val[2] = vqmovun_s16(vaddq_s16(yk, b_off));
+			}
+			neon_store_rgb24(d + j * 3, rgb[0], rgb[1], bgr);
+		}
+		if (j < width)
+			v4lconvert_nv12_to_rgb24_line(ysrc + j, uvl + j,
+					d + j * 3, width - j, bgr);
+	}
+}
+
+/* NV12 -> yuv420 / yvu420, deinterleaving of the chroma plane */
+static void neon_nv12_to_yuv420(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, int width, int height, int yvu)
+{
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	const unsigned char *uvsrc = src->plane[1];
+	unsigned char *udst = dest->plane[uplane];
+	unsigned char *vdst = dest->plane[vplane];
+	int i, j;
+
+	v4lconvert_copy_lines(src->plane[0], dest->plane[0], width, height,
+			      src->stride[0], dest->stride[0]);
+
+	for (i = 0; i < (height + 1) / 2; i++) {
+		for (j = 0; j + 32 <= width; j += 32) {
+			uint8x16x2_t uv = vld2q_u8(uvsrc + j);
+
+			vst1q_u8(udst + j / 2, uv.val[0]);
+			vst1q_u8(vdst + j / 2, uv.val[1]);
+		}
+		for (; j < width; j += 2) {
+			udst[j / 2] = uvsrc[j];
+			vdst[j / 2] = uvsrc[j + 1];
+		}
+		udst += dest->stride[uplane];
+		vdst += dest->stride[vplane];
+		uvsrc += src->stride[1];
+	}
+}
+
+/* NV16 -> yuyv, interleaving of the luma and chroma planes */
+static void neon_nv16_to_yuyv(const struct v4lconvert_planes *planes,
+		unsigned char *dest, int width, int height, int dest_stride)
+{
+	const unsigned char *src = planes->plane[0];
+	const unsigned char *cbcr = planes->plane[1];
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 16 <= width; j += 16) {
+			uint8x16x2_t yc;
+
+			yc.val[0] = vld1q_u8(src + j);
+			yc.val[1] = vld1q_u8(cbcr + j);
+			vst2q_u8(dest + j * 2, yc);
+		}
+		for (; j < width; j++) {
+			dest[j * 2] = src[j];
+			dest[j * 2 + 1] = cbcr[j];
+		}
+		src += planes->stride[0];
+		cbcr += planes->stride[1];
+		dest += dest_stride;
+	}
+}
+
+/* rgb24 / bgr24 -> argb32, going from the last line and block to the first
+   keeps this working in place, as each block is stored beyond the src bytes
+   which are still to be loaded */
+static void neon_rgb24_to_argb32(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride, int bgr)
+{
+	while (--height >= 0) {
+		const unsigned char *s = src + height * stride;
+		unsigned char *d = dest + height * dest_stride;
+		int i = width & ~15;
+
+		v4lconvert_rgb24_to_argb32(s + i * 3, d + i * 4, width - i, 1,
+					   0, 0, bgr);
+
+		while (i > 0) {
+			uint8x16x3_t rgb;
+			uint8x16x4_t argb;
+
+			i -= 16;
+			rgb = vld3q_u8(s + i * 3);
+			argb.val[0] = vdupq_n_u8(0xff);
+			argb.val[1] = bgr ? rgb.val[2] : rgb.val[0];
+			argb.val[2] = rgb.val[1];
+			argb.val[3] = bgr ? rgb.val[0] : rgb.val[2];
+			vst4q_u8(d + i * 4, argb);
+		}
+	}
+}
+
+/*
+ * Lookup tables for rgb24 / bgr24 (software whitebalance / gamma)
+ *
+ * vld3 splits the components, each 256 byte table is looked up as 4 parts
+ * of 64 bytes with tbl / tbx, which leave lanes with an index outside the
+ * current part 0 / alone.
+ */
+static inline uint8x16x4_t neon_load_64(const unsigned char *p)
+{
+	uint8x16x4_t t;
+
+	t.val[0] = vld1q_u8(p);
+	t.val[1] = vld1q_u8(p + 16);
+	t.val[2] = vld1q_u8(p + 32);
+	t.val[3] = vld1q_u8(p + 48);
+	return t;
+}
+
+static inline uint8x16_t neon_lut_16(uint8x16_t idx, const unsigned char *lut)
+{
+	const uint8x16_t c64 = vdupq_n_u8(64);
+	uint8x16_t r = vqtbl4q_u8(neon_load_64(lut), idx);
+	int i;
+
+	for (i = 1; i < 4; i++) {
+		idx = vsubq_u8(idx, c64);
+		r = vqtbx4q_u8(r, neon_load_64(lut + 64 * i), idx);
+	}
+	return r;
+}
+
+static void neon_lut_rgb24(unsigned char *buf, int width,
+		const unsigned char *lut)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x3_t p = vld3q_u8(buf);
+
+		p.val[0] = neon_lut_16(p.val[0], lut);
+		p.val[1] = neon_lut_16(p.val[1], lut + 256);
+		p.val[2] = neon_lut_16(p.val[2], lut + 512);
+		vst3q_u8(buf, p);
+		buf += 48;
+	}
+	v4lprocessing_lut_rgb24(buf, width - x, lut);
+}
+
+/*
+ * Bilinear bayer demosaicing, see v4lconvert_bayer_pairs_to_bgr24()
+ *
+ * vld2 splits the even and odd pixels of a line, the averages of 2 pixels are
+ * done with rhadd and those of 4 pixels by adding in 16 bits and a rounding
+ * narrowing shift, which gives the same results as the C version.
+ */
+static inline uint8x16_t neon_avg4(uint8x16_t a, uint8x16_t b, uint8x16_t c,
+		uint8x16_t d)
+{
+	uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(a), vget_low_u8(b)),
+				  vaddl_u8(vget_low_u8(c), vget_low_u8(d)));
+	uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(a), vget_high_u8(b)),
+				  vaddl_u8(vget_high_u8(c), vget_high_u8(d)));
+
+	return vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2));
+}
+
+static void neon_bayer_pairs_to_bgr24(const unsigned char *bayer, int stride,
+		unsigned char *bgr, int pairs, int blue_line)
+{
+	int i;
+
+	/* The loads of the pixels 2 further go 1 byte beyond the 16th pair */
+	for (i = 0; i + 16 < pairs; i += 16) {
+		const unsigned char *p = bayer + 2 * i;
+		uint8x16x2_t a = vld2q_u8(p), a2 = vld2q_u8(p + 2);
+		uint8x16x2_t b = vld2q_u8(p + stride), b2 = vld2q_u8(p + stride + 2);
+		uint8x16x2_t c = vld2q_u8(p + 2 * stride);
+		uint8x16x2_t c2 = vld2q_u8(p + 2 * stride + 2);
+		uint8x16x2_t other, green, own;
+		uint8x16x3_t lo, hi;
+
+		/* The first pixel of a pair has its own color, the other
+		   color from the 4 diagonals and green from the 4 sides */
+		other = vzipq_u8(neon_avg4(a.val[0], a2.val[0], c.val[0], c2.val[0]),
+				 vrhaddq_u8(a2.val[0], c2.val[0]));
+		green = vzipq_u8(neon_avg4(a.val[1], b.val[0], b2.val[0], c.val[1]),
+				 b2.val[0]);
+		own = vzipq_u8(b.val[1], vrhaddq_u8(b.val[1], b2.val[1]));
+
+		lo.val[0] = blue_line ? other.val[0] : own.val[0];
+		lo.val[1] = green.val[0];
+		lo.val[2] = blue_line ? own.val[0] : other.val[0];
+		hi.val[0] = blue_line ? other.val[1] : own.val[1];
+		hi.val[1] = green.val[1];
+		hi.val[2] = blue_line ? own.val[1] : other.val[1];
+		vst3q_u8(bgr + 6 * i, lo);
+		vst3q_u8(bgr + 6 * i + 48, hi);
+	}
+	v4lconvert_bayer_pairs_to_bgr24(bayer + 2 * i, stride, bgr + 6 * i,
+					pairs - i, blue_line);
+}
+
+/*
+ * Weighted sums of lines for the scaler, see v4lconvert_scale_rows()
+ */
+static void neon_scale_rows(uint16_t *acc, const unsigned char *src, int n,
+		int weight, int add)
+{
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		uint8x16_t s = vld1q_u8(src + i);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(s));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(s));
+
+		if (add) {
+			lo = vmlaq_n_u16(vld1q_u16(acc + i), lo, weight);
+			hi = vmlaq_n_u16(vld1q_u16(acc + i + 8), hi, weight);
+		} else {
+			lo = vmulq_n_u16(lo, weight);
+			hi = vmulq_n_u16(hi, weight);
+		}
+		vst1q_u16(acc + i, lo);
+		vst1q_u16(acc + i + 8, hi);
+	}
+	v4lconvert_scale_rows(acc + i, src + i, n - i, weight, add);
+}
+
+/*
+ * Integer IDCT, see jidctint.c
+ *
+ * Same approach as the SSE2 version: the 8 rows of the block are kept in 8
+ * registers, the block is transposed between the passes and back for storing.
+ * The formulas are rearranged in the same way so that each output is a sum of
+ * 2 products of 16 bit inputs, done with mull / mlal in 32 bits.
+ */
+static inline void neon_idct_1d_half(const int16x4_t x[8], int32x4_t out[8])
+{
+	int16x4_t z3 = vadd_s16(x[7], x[3]);
+	int16x4_t z4 = vadd_s16(x[5], x[1]);
+	int32x4_t tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+	int32x4_t z3s, z4s;
+
+	/* Even part */
+	tmp3 = vmlal_n_s16(vmull_n_s16(x[2], FIX_0_541196100 + FIX_0_765366865),
+			   x[6], FIX_0_541196100);
+	tmp2 = vmlal_n_s16(vmull_n_s16(x[2], FIX_0_541196100),
+			   x[6], FIX_0_541196100 - FIX_1_847759065);
+	tmp0 = vaddq_s32(vshll_n_s16(x[0], CONST_BITS),
+			 vshll_n_s16(x[4], CONST_BITS));
+	tmp1 = vsubq_s32(vshll_n_s16(x[0], CONST_BITS),
+			 vshll_n_s16(x[4], CONST_BITS));
+
+	tmp10 = vaddq_s32(tmp0, tmp3);
+	tmp13 = vsubq_s32(tmp0, tmp3);
+	tmp11 = vaddq_s32(tmp1, tmp2);
+	tmp12 = vsubq_s32(tmp1, tmp2);
+
+	/* Odd part */
+	z3s = vmlal_n_s16(vmull_n_s16(z3, FIX_1_175875602 - FIX_1_961570560),
+			  z4, FIX_1_175875602);
+	z4s = vmlal_n_s16(vmull_n_s16(z3, FIX_1_175875602),
+			  z4, FIX_1_175875602 - FIX_0_390180644);
+
+	tmp0 = vmlal_n_s16(vmlal_n_s16(z3s, x[7],
+			FIX_0_298631336 - FIX_0_899976223),
+			x[1], -FIX_0_899976223);
+	tmp3 = vmlal_n_s16(vmlal_n_s16(z4s, x[7], -FIX_0_899976223),
+			x[1], FIX_1_501321110 - FIX_0_899976223);
+	tmp1 = vmlal_n_s16(vmlal_n_s16(z4s, x[5],
+			FIX_2_053119869 - FIX_2_562915447),
+			x[3], -FIX_2_562915447);
+	tmp2 = vmlal_n_s16(vmlal_n_s16(z3s, x[5], -FIX_2_562915447),
+			x[3], FIX_3_072711026 - FIX_2_562915447);
+
+	out[0] = vaddq_s32(tmp10, tmp3);
+	out[7] = vsubq_s32(tmp10, tmp3);
+	out[1] = vaddq_s32(tmp11, tmp2);
+	out[6] = vsubq_s32(tmp11, tmp2);
+	out[2] = vaddq_s32(tmp12, tmp1);
+	out[5] = vsubq_s32(tmp12, tmp1);
+	out[3] = vaddq_s32(tmp13, tmp0);
+	out[4] = vsubq_s32(tmp13, tmp0);
+}
+
+static inline void neon_idct_1d(int16x8_t x[8], int32x4_t lo[8],
+		int32x4_t hi[8])
+{
+	int16x4_t half[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		half[i] = vget_low_s16(x[i]);
+	neon_idct_1d_half(half, lo);
+	for (i = 0; i < 8; i++)
+		half[i] = vget_high_s16(x[i]);
+	neon_idct_1d_half(half, hi);
+}
+
+static inline void neon_transpose_8x8(int16x8_t x[8])
+{
+	int16x8x2_t t[4];
+	int32x4x2_t a[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		t[i] = vtrnq_s16(x[2 * i], x[2 * i + 1]);
+	for (i = 0; i < 2; i++) {
+		a[2 * i] = vtrnq_s32(vreinterpretq_s32_s16(t[2 * i].val[0]),
+				     vreinterpretq_s32_s16(t[2 * i + 1].val[0]));
+		a[2 * i + 1] = vtrnq_s32(vreinterpretq_s32_s16(t[2 * i].val[1]),
+					 vreinterpretq_s32_s16(t[2 * i + 1].val[1]));
+	}
+	/* a[0] holds columns 0, 4 and 2, 6 of rows 0 - 3, a[1] columns 1, 5
+	   and 3, 7, a[2] and a[3] the same for rows 4 - 7 */
+	for (i = 0; i < 4; i++) {
+		int16x8_t top = vreinterpretq_s16_s32(a[i & 1].val[i >> 1]);
+		int16x8_t bottom = vreinterpretq_s16_s32(a[2 + (i & 1)].val[i >> 1]);
+
+		x[2 * (i >> 1) + (i & 1)] = vcombine_s16(vget_low_s16(top),
+							 vget_low_s16(bottom));
+		x[2 * (i >> 1) + (i & 1) + 4] = vcombine_s16(vget_high_s16(top),
+							     vget_high_s16(bottom));
+	}
+}
+
+static void neon_jpeg_idct_islow(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride)
+{
+	int16x8_t x[8];
+	int32x4_t lo[8], hi[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		x[i] = vmulq_s16(vld1q_s16(coef + i * 8),
+				 vld1q_s16(quant + i * 8));
+
+	neon_idct_1d(x, lo, hi);
+	for (i = 0; i < 8; i++)
+		x[i] = vcombine_s16(vqrshrn_n_s32(lo[i], CONST_BITS - PASS1_BITS),
+				    vqrshrn_n_s32(hi[i], CONST_BITS - PASS1_BITS));
+	neon_transpose_8x8(x);
+
+	neon_idct_1d(x, lo, hi);
+	for (i = 0; i < 8; i++)
+		x[i] = vcombine_s16(
+			vqmovn_s32(vrshrq_n_s32(lo[i], CONST_BITS + PASS1_BITS + 3)),
+			vqmovn_s32(vrshrq_n_s32(hi[i], CONST_BITS + PASS1_BITS + 3)));
+	neon_transpose_8x8(x);
+
+	/* Saturate to -128 - 127 and add 128 (flip the sign bit) */
+	for (i = 0; i < 8; i++)
+		vst1_u8(output_buf + i * stride,
+			veor_u8(vreinterpret_u8_s8(vqmovn_s16(x[i])),
+				vdup_n_u8(0x80)));
+}
+
+/*
+ * Mirroring and rotating 8 bit planes, see flip.c
+ */
+static void neon_hflip_u8(const unsigned char *src, unsigned char *dest,
+		int width)
+{
+	int i;
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		uint8x16_t x = vrev64q_u8(vld1q_u8(src + width - 16 - i));
+
+		vst1q_u8(dest + i, vcombine_u8(vget_high_u8(x),
+					       vget_low_u8(x)));
+	}
+	v4lconvert_hflip_u8(src, dest + i, width - i);
+}
+
+/* The 8x8 block of which dest line j is src column j read bottom up, the
+   8 src lines are loaded last line first, so that this is a transpose */
+static inline void neon_rotate90_8x8(const unsigned char *src,
+		int src_stride, unsigned char *dest, int dest_stride)
+{
+	uint8x8_t r[8];
+	uint8x8x2_t a[4];
+	uint16x4x2_t b[4];
+	uint32x2x2_t c[4];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = vld1_u8(src + (7 - i) * src_stride);
+	for (i = 0; i < 4; i++)
+		a[i] = vtrn_u8(r[2 * i], r[2 * i + 1]);
+	/* b[0] / b[2] hold columns 0 + 4 and 2 + 6, b[1] / b[3] 1 + 5 and 3 + 7 */
+	for (i = 0; i < 2; i++) {
+		b[i] = vtrn_u16(vreinterpret_u16_u8(a[0].val[i]),
+				vreinterpret_u16_u8(a[1].val[i]));
+		b[i + 2] = vtrn_u16(vreinterpret_u16_u8(a[2].val[i]),
+				    vreinterpret_u16_u8(a[3].val[i]));
+	}
+	/* c[i].val[0] is column i, c[i].val[1] column i + 4 */
+	c[0] = vtrn_u32(vreinterpret_u32_u16(b[0].val[0]),
+			vreinterpret_u32_u16(b[2].val[0]));
+	c[1] = vtrn_u32(vreinterpret_u32_u16(b[1].val[0]),
+			vreinterpret_u32_u16(b[3].val[0]));
+	c[2] = vtrn_u32(vreinterpret_u32_u16(b[0].val[1]),
+			vreinterpret_u32_u16(b[2].val[1]));
+	c[3] = vtrn_u32(vreinterpret_u32_u16(b[1].val[1]),
+			vreinterpret_u32_u16(b[3].val[1]));
+	for (i = 0; i < 4; i++) {
+		vst1_u8(dest + i * dest_stride,
+			vreinterpret_u8_u32(c[i].val[0]));
+		vst1_u8(dest + (i + 4) * dest_stride,
+			vreinterpret_u8_u32(c[i].val[1]));
+	}
+}
+
+static void neon_rotate90_u8(const unsigned char *src, int src_stride,
+		unsigned char *dest, int dest_stride, int width, int height)
+{
+	int x, y, w = width & ~7, h = height & ~7;
+
+	/* Dest block (x, y) comes from src lines width - 8 - x and up */
+	for (y = 0; y < h; y += 8)
+		for (x = 0; x < w; x += 8)
+			neon_rotate90_8x8(src + (width - 8 - x) * src_stride + y,
+					src_stride, dest + y * dest_stride + x,
+					dest_stride);
+
+	/* The right and bottom edges */
+	if (w < width)
+		v4lconvert_rotate90_u8(src, src_stride, dest + w,
+				       dest_stride, width - w, h);
+	if (h < height)
+		v4lconvert_rotate90_u8(src + h, src_stride,
+				       dest + h * dest_stride, dest_stride,
+				       width, height - h);
+}
+
+const struct v4lconvert_kernels v4lconvert_neon_kernels = {
+	.name = "neon",
+	.yuyv_to_rgb24 = neon_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = neon_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = neon_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = neon_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = neon_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = neon_uyvy_to_bgr24,
+	.yuv420_to_rgb24 = neon_yuv420_to_rgb,
+	.yuv420_to_bgr24 = neon_yuv420_to_bgr,
+	.nv12_to_rgb24 = neon_nv12_to_rgb24,
+	.nv12_to_yuv420 = neon_nv12_to_yuv420,
+	.nv16_to_yuyv = neon_nv16_to_yuyv,
+	.rgb24_to_argb32 = neon_rgb24_to_argb32,
+	.lut_rgb24 = neon_lut_rgb24,
+	.bayer_pairs_to_bgr24 = neon_bayer_pairs_to_bgr24,
+	.scale_rows = neon_scale_rows,
+	.jpeg_idct_islow = neon_jpeg_idct_islow,
+	.hflip_u8 = neon_hflip_u8,
+	.rotate90_u8 = neon_rotate90_u8,
+};
+
+#endif /* V4LCONVERT_HAVE_NEON */
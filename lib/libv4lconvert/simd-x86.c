@@ -0,0 +1,1094 @@
+/*
+
+# SSE2 / AVX2 versions of the conversion kernels
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+#include "tinyjpeg-internal.h"
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+
+#include <immintrin.h>
+
+/* The kernels are compiled for the instruction set they use through target
+   attributes, so that the library itself can still be build for the baseline
+   cpu and the right version is picked at runtime. */
+#define SSE2_FN __attribute__((target("sse2")))
+#define AVX2_FN __attribute__((target("avx2")))
+
+/* Byte order of a pair of pixels in packed yuv 4:2:2 */
+enum { PACKED_YUYV, PACKED_YVYU, PACKED_UYVY };
+
+typedef void (*packed_to_rgb24_fn)(const unsigned char *src,
+		unsigned char *dst, int width, int height, int stride,
+		int dest_stride);
+
+/*
+ * Packed yuv 4:2:2 -> rgb24 / bgr24
+ *
+ * All arithmetic is done on 16 bit lanes using the exact same shifts and adds
+ * as the multiplication free C code in rgbyuv.c, none of the intermediate
+ * values exceeds 16 bits and packus saturation does the CLIP(), so the output
+ * is bit-exact with the C version.
+ */
+
+/* Split 8 pixels worth of packed yuv into 16 bit y and (u - 128), (v - 128)
+   lanes, with the chroma values duplicated for both pixels of a pair */
+static inline SSE2_FN void sse2_unpack_yuv422(__m128i in, int layout,
+		__m128i *y, __m128i *u, __m128i *v)
+{
+	const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i c, first, second;
+
+	if (layout == PACKED_UYVY) {
+		*y = _mm_srli_epi16(in, 8);
+		c = _mm_and_si128(in, lo_mask);
+	} else {
+		*y = _mm_and_si128(in, lo_mask);
+		c = _mm_srli_epi16(in, 8);
+	}
+
+	first = _mm_and_si128(c, _mm_set1_epi32(0xffff));
+	first = _mm_or_si128(first, _mm_slli_epi32(first, 16));
+	second = _mm_srli_epi32(c, 16);
+	second = _mm_or_si128(second, _mm_slli_epi32(second, 16));
+
+	if (layout == PACKED_YVYU) {
+		*u = _mm_sub_epi16(second, c128);
+		*v = _mm_sub_epi16(first, c128);
+	} else {
+		*u = _mm_sub_epi16(first, c128);
+		*v = _mm_sub_epi16(second, c128);
+	}
+}
+
+static inline SSE2_FN void sse2_yuv_to_rgb(__m128i y, __m128i u, __m128i v,
+		__m128i *r, __m128i *g, __m128i *b)
+{
+	__m128i u1 = _mm_srai_epi16(_mm_add_epi16(_mm_slli_epi16(u, 7), u), 6);
+	__m128i rg = _mm_srai_epi16(_mm_add_epi16(
+			_mm_add_epi16(_mm_slli_epi16(u, 1), u),
+			_mm_add_epi16(_mm_slli_epi16(v, 2), _mm_slli_epi16(v, 1))), 3);
+	__m128i v1 = _mm_srai_epi16(_mm_add_epi16(_mm_slli_epi16(v, 1), v), 1);
+
+	*r = _mm_add_epi16(y, v1);
+	*g = _mm_sub_epi16(y, rg);
+	*b = _mm_add_epi16(y, u1);
+}
+
+/* Store 16 pixels of 3 planar components as 24 bpp. SSE2 has no byte
+   shuffle, so this builds 32 bit xrgb pixels and stores those 3 bytes apart,
+   writing 1 byte beyond the last pixel. */
+static inline SSE2_FN void sse2_store_rgb24(unsigned char *dest,
+		__m128i c0, __m128i c1, __m128i c2)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo01 = _mm_unpacklo_epi8(c0, c1);
+	__m128i hi01 = _mm_unpackhi_epi8(c0, c1);
+	__m128i lo2 = _mm_unpacklo_epi8(c2, zero);
+	__m128i hi2 = _mm_unpackhi_epi8(c2, zero);
+	__m128i px[4];
+	int i, j;
+
+	px[0] = _mm_unpacklo_epi16(lo01, lo2);
+	px[1] = _mm_unpackhi_epi16(lo01, lo2);
+	px[2] = _mm_unpacklo_epi16(hi01, hi2);
+	px[3] = _mm_unpackhi_epi16(hi01, hi2);
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			int p = _mm_cvtsi128_si32(px[i]);
+
+			memcpy(dest, &p, 4);
+			dest += 3;
+			px[i] = _mm_srli_si128(px[i], 4);
+		}
+	}
+}
+
+/* Converts 16 pixels at a time while at least vec_width pixels are left,
+   returns the number of pixels done */
+static inline SSE2_FN int sse2_packed_to_rgb24_line(const unsigned char *src,
+		unsigned char *dest, int j, int vec_width, int layout, int bgr)
+{
+	for (; j + 16 <= vec_width; j += 16) {
+		__m128i y, u, v, r0, g0, b0, r1, g1, b1, r, g, b;
+
+		sse2_unpack_yuv422(_mm_loadu_si128((const __m128i *)(src + j * 2)),
+				layout, &y, &u, &v);
+		sse2_yuv_to_rgb(y, u, v, &r0, &g0, &b0);
+		sse2_unpack_yuv422(_mm_loadu_si128((const __m128i *)(src + j * 2 + 16)),
+				layout, &y, &u, &v);
+		sse2_yuv_to_rgb(y, u, v, &r1, &g1, &b1);
+
+		r = _mm_packus_epi16(r0, r1);
+		g = _mm_packus_epi16(g0, g1);
+		b = _mm_packus_epi16(b0, b1);
+		if (bgr)
+			sse2_store_rgb24(dest + j * 3, b, g, r);
+		else
+			sse2_store_rgb24(dest + j * 3, r, g, b);
+	}
+	return j;
+}
+
+static inline SSE2_FN void sse2_packed_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride, int layout, int bgr, packed_to_rgb24_fn c_version)
+{
+	/* Like the c version, an odd last pixel is left alone */
+	int w = width & ~1;
+
+	while (--height >= 0) {
+		/* Stores may go 1 byte beyond the line, which gets overwritten
+		   by the next line, except on the last one */
+		int j = sse2_packed_to_rgb24_line(src, dest, 0,
+				height ? w : w - 1, layout, bgr);
+
+		if (j < width)
+			c_version(src + j * 2, dest + j * 3, width - j, 1, stride,
+				  dest_stride);
+		src += stride;
+		dest += dest_stride;
+	}
+}
+
+static SSE2_FN void sse2_yuyv_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	sse2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YUYV, 0, v4lconvert_yuyv_to_rgb24);
+}
+
+static SSE2_FN void sse2_yuyv_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	sse2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YUYV, 1, v4lconvert_yuyv_to_bgr24);
+}
+
+static SSE2_FN void sse2_yvyu_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	sse2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YVYU, 0, v4lconvert_yvyu_to_rgb24);
+}
+
+static SSE2_FN void sse2_yvyu_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	sse2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YVYU, 1, v4lconvert_yvyu_to_bgr24);
+}
+
+static SSE2_FN void sse2_uyvy_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	sse2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_UYVY, 0, v4lconvert_uyvy_to_rgb24);
+}
+
+static SSE2_FN void sse2_uyvy_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	sse2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_UYVY, 1, v4lconvert_uyvy_to_bgr24);
+}
+
+/*
+ * Planar yuv 4:2:0 -> rgb24 / bgr24
+ *
+ * Same multiplication free math as the packed version, the chroma of a line
+ * pair is duplicated horizontally by unpacking it against itself.
+ */
+
+static inline SSE2_FN void sse2_yuv420_to_rgb24(
+		const struct v4lconvert_planes *src, unsigned char *dest,
+		int width, int height, int dest_stride, int yvu, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src->plane[0] + i * src->stride[0];
+		const unsigned char *ul = src->plane[uplane] +
+					  (i / 2) * src->stride[uplane];
+		const unsigned char *vl = src->plane[vplane] +
+					  (i / 2) * src->stride[vplane];
+		unsigned char *d = dest + i * dest_stride;
+		/* Stores go 1 byte beyond the line, see the packed version */
+		int vec_width = (i < height - 1) ? width : width - 1;
+
+		for (j = 0; j + 16 <= vec_width; j += 16) {
+			__m128i y = _mm_loadu_si128((const __m128i *)(ysrc + j));
+			__m128i u = _mm_sub_epi16(_mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)(ul + j / 2)), zero), c128);
+			__m128i v = _mm_sub_epi16(_mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)(vl + j / 2)), zero), c128);
+			__m128i r0, g0, b0, r1, g1, b1, r, g, b;
+
+			sse2_yuv_to_rgb(_mm_unpacklo_epi8(y, zero),
+					_mm_unpacklo_epi16(u, u),
+					_mm_unpacklo_epi16(v, v), &r0, &g0, &b0);
+			sse2_yuv_to_rgb(_mm_unpackhi_epi8(y, zero),
+					_mm_unpackhi_epi16(u, u),
+					_mm_unpackhi_epi16(v, v), &r1, &g1, &b1);
+
+			r = _mm_packus_epi16(r0, r1);
+			g = _mm_packus_epi16(g0, g1);
+			b = _mm_packus_epi16(b0, b1);
+			if (bgr)
+				sse2_store_rgb24(d + j * 3, b, g, r);
+			else
+				sse2_store_rgb24(d + j * 3, r, g, b);
+		}
+		if (j < width)
+			v4lconvert_yuv420_to_rgb24_line(ysrc + j, ul + j / 2,
+					vl + j / 2, d + j * 3, width - j, bgr);
+	}
+}
+
+static SSE2_FN void sse2_yuv420_to_rgb(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu)
+{
+	sse2_yuv420_to_rgb24(src, dest, width, height, dest_stride, yvu, 0);
+}
+
+static SSE2_FN void sse2_yuv420_to_bgr(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int yvu)
+{
+	sse2_yuv420_to_rgb24(src, dest, width, height, dest_stride, yvu, 1);
+}
+
+/*
+ * NV12 -> rgb24 / bgr24
+ *
+ * The C version uses the YUV2R / YUV2G / YUV2B macros, which multiply by
+ * 10 bit fixed point factors. For r and b ((c * f) >> 10) equals
+ * mulhi(c << 6, f), g needs the sum of 2 products before the shift, which
+ * is done in 32 bits with madd.
+ */
+
+static inline SSE2_FN void sse2_nv12_to_rgb(__m128i y, __m128i u, __m128i v,
+		__m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i g_coefs = _mm_set1_epi32((731 << 16) | 352);
+	__m128i g_lo = _mm_srai_epi32(_mm_madd_epi16(
+			_mm_unpacklo_epi16(u, v), g_coefs), 10);
+	__m128i g_hi = _mm_srai_epi32(_mm_madd_epi16(
+			_mm_unpackhi_epi16(u, v), g_coefs), 10);
+
+	*r = _mm_add_epi16(y, _mm_mulhi_epi16(_mm_slli_epi16(v, 6),
+					      _mm_set1_epi16(1436)));
+	*g = _mm_sub_epi16(y, _mm_packs_epi32(g_lo, g_hi));
+	*b = _mm_add_epi16(y, _mm_mulhi_epi16(_mm_slli_epi16(u, 6),
+					      _mm_set1_epi16(1814)));
+}
+
+static SSE2_FN void sse2_nv12_to_rgb24(const struct v4lconvert_planes *src,
+		unsigned char *dest, int width, int height, int dest_stride, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+	const __m128i c128 = _mm_set1_epi16(128);
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src->plane[0] + i * src->stride[0];
+		const unsigned char *uvl = src->plane[1] + (i / 2) * src->stride[1];
+		unsigned char *d = dest + i * dest_stride;
+		int vec_width = (i < height - 1) ? width : width - 1;
+
+		for (j = 0; j + 16 <= vec_width; j += 16) {
+			__m128i y = _mm_loadu_si128((const __m128i *)(ysrc + j));
+			__m128i uv = _mm_loadu_si128((const __m128i *)(uvl + j));
+			__m128i u = _mm_sub_epi16(_mm_and_si128(uv, lo_mask), c128);
+			__m128i v = _mm_sub_epi16(_mm_srli_epi16(uv, 8), c128);
+			__m128i r0, g0, b0, r1, g1, b1, r, g, b;
+
+			sse2_nv12_to_rgb(_mm_unpacklo_epi8(y, zero),
+					 _mm_unpacklo_epi16(u, u),
+					 _mm_unpacklo_epi16(v, v), &r0, &g0, &b0);
+			sse2_nv12_to_rgb(_mm_unpackhi_epi8(y, zero),
+					 _mm_unpackhi_epi16(u, u),
+					 _mm_unpackhi_epi16(v, v), &r1, &g1, &b1);
+
+			r = _mm_packus_epi16(r0, r1);
+			g = _mm_packus_epi16(g0, g1);
+			b = _mm_packus_epi16(b0, b1);
+			if (bgr)
+				sse2_store_rgb24(d + j * 3, b, g, r);
+			else
+				sse2_store_rgb24(d + j * 3, r, g, b);
+		}
+		if (j < width)
+			v4lconvert_nv12_to_rgb24_line(ysrc + j, uvl + j,
+					d + j * 3, width - j, bgr);
+	}
+}
+
+/* NV12 -> yuv420 / yvu420, deinterleaving of the chroma plane */
+static SSE2_FN void sse2_nv12_to_yuv420(const struct v4lconvert_planes *src,
+		const struct v4lconvert_planes *dest, int width, int height, int yvu)
+{
+	const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+	int uplane = yvu ? 2 : 1, vplane = 3 - uplane;
+	const unsigned char *uvsrc = src->plane[1];
+	unsigned char *udst = dest->plane[uplane];
+	unsigned char *vdst = dest->plane[vplane];
+	int i, j;
+
+	v4lconvert_copy_lines(src->plane[0], dest->plane[0], width, height,
+			      src->stride[0], dest->stride[0]);
+
+	for (i = 0; i < (height + 1) / 2; i++) {
+		for (j = 0; j + 32 <= width; j += 32) {
+			__m128i uv0 = _mm_loadu_si128((const __m128i *)(uvsrc + j));
+			__m128i uv1 = _mm_loadu_si128((const __m128i *)(uvsrc + j + 16));
+
+			_mm_storeu_si128((__m128i *)(udst + j / 2),
+				_mm_packus_epi16(_mm_and_si128(uv0, lo_mask),
+						 _mm_and_si128(uv1, lo_mask)));
+			_mm_storeu_si128((__m128i *)(vdst + j / 2),
+				_mm_packus_epi16(_mm_srli_epi16(uv0, 8),
+						 _mm_srli_epi16(uv1, 8)));
+		}
+		for (; j < width; j += 2) {
+			udst[j / 2] = uvsrc[j];
+			vdst[j / 2] = uvsrc[j + 1];
+		}
+		udst += dest->stride[uplane];
+		vdst += dest->stride[vplane];
+		uvsrc += src->stride[1];
+	}
+}
+
+/* NV16 -> yuyv, interleaving of the luma and chroma planes */
+static SSE2_FN void sse2_nv16_to_yuyv(const struct v4lconvert_planes *planes,
+		unsigned char *dest, int width, int height, int dest_stride)
+{
+	const unsigned char *src = planes->plane[0];
+	const unsigned char *cbcr = planes->plane[1];
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 16 <= width; j += 16) {
+			__m128i y = _mm_loadu_si128((const __m128i *)(src + j));
+			__m128i c = _mm_loadu_si128((const __m128i *)(cbcr + j));
+
+			_mm_storeu_si128((__m128i *)(dest + j * 2),
+					 _mm_unpacklo_epi8(y, c));
+			_mm_storeu_si128((__m128i *)(dest + j * 2 + 16),
+					 _mm_unpackhi_epi8(y, c));
+		}
+		for (; j < width; j++) {
+			dest[j * 2] = src[j];
+			dest[j * 2 + 1] = cbcr[j];
+		}
+		src += planes->stride[0];
+		cbcr += planes->stride[1];
+		dest += dest_stride;
+	}
+}
+
+/*
+ * Bilinear bayer demosaicing, see v4lconvert_bayer_pairs_to_bgr24()
+ *
+ * The even and odd pixels of a line are split into 16 bit lanes, in which the
+ * sums of 4 pixels are done exactly as in the C version and avg does the
+ * rounded average of 2 pixels. The 2 pixels of each pair are merged back
+ * into bytes by shifting the second one into the high half of the lanes.
+ */
+static inline SSE2_FN int sse2_bayer_pairs_to_bgr24_line(
+		const unsigned char *bayer, int stride, unsigned char *bgr,
+		int i, int pairs, int blue_line)
+{
+	const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+	const __m128i two = _mm_set1_epi16(2);
+
+	/* Loads go 1 byte beyond the 8th pair and stores 1 byte beyond its
+	   bgr, the last pair is left to the caller for both */
+	for (; i + 8 < pairs; i += 8) {
+		const unsigned char *p = bayer + 2 * i;
+		__m128i a = _mm_loadu_si128((const __m128i *)p);
+		__m128i a2 = _mm_loadu_si128((const __m128i *)(p + 2));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + stride));
+		__m128i b2 = _mm_loadu_si128((const __m128i *)(p + stride + 2));
+		__m128i c = _mm_loadu_si128((const __m128i *)(p + 2 * stride));
+		__m128i c2 = _mm_loadu_si128((const __m128i *)(p + 2 * stride + 2));
+		__m128i ae = _mm_and_si128(a, lo_mask), ao = _mm_srli_epi16(a, 8);
+		__m128i ae2 = _mm_and_si128(a2, lo_mask);
+		__m128i be = _mm_and_si128(b, lo_mask), bo = _mm_srli_epi16(b, 8);
+		__m128i be2 = _mm_and_si128(b2, lo_mask), bo2 = _mm_srli_epi16(b2, 8);
+		__m128i ce = _mm_and_si128(c, lo_mask), co = _mm_srli_epi16(c, 8);
+		__m128i ce2 = _mm_and_si128(c2, lo_mask);
+		__m128i other, green, own;
+
+		/* The first pixel of a pair has its own color, the other
+		   color from the 4 diagonals and green from the 4 sides */
+		other = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(ae, ae2),
+				_mm_add_epi16(_mm_add_epi16(ce, ce2), two)), 2);
+		other = _mm_or_si128(other,
+				_mm_slli_epi16(_mm_avg_epu16(ae2, ce2), 8));
+		green = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(ao, co),
+				_mm_add_epi16(_mm_add_epi16(be, be2), two)), 2);
+		green = _mm_or_si128(green, _mm_slli_epi16(be2, 8));
+		own = _mm_or_si128(bo, _mm_slli_epi16(_mm_avg_epu16(bo, bo2), 8));
+
+		if (blue_line)
+			sse2_store_rgb24(bgr + 6 * i, other, green, own);
+		else
+			sse2_store_rgb24(bgr + 6 * i, own, green, other);
+	}
+	return i;
+}
+
+static SSE2_FN void sse2_bayer_pairs_to_bgr24(const unsigned char *bayer,
+		int stride, unsigned char *bgr, int pairs, int blue_line)
+{
+	int i = sse2_bayer_pairs_to_bgr24_line(bayer, stride, bgr, 0, pairs,
+					       blue_line);
+
+	v4lconvert_bayer_pairs_to_bgr24(bayer + 2 * i, stride, bgr + 6 * i,
+					pairs - i, blue_line);
+}
+
+/*
+ * Weighted sums of lines for the scaler, see v4lconvert_scale_rows()
+ */
+static SSE2_FN void sse2_scale_rows(uint16_t *acc, const unsigned char *src,
+		int n, int weight, int add)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w = _mm_set1_epi16(weight);
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), w);
+		__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), w);
+
+		if (add) {
+			lo = _mm_add_epi16(lo,
+				_mm_loadu_si128((const __m128i *)(acc + i)));
+			hi = _mm_add_epi16(hi,
+				_mm_loadu_si128((const __m128i *)(acc + i + 8)));
+		}
+		_mm_storeu_si128((__m128i *)(acc + i), lo);
+		_mm_storeu_si128((__m128i *)(acc + i + 8), hi);
+	}
+	v4lconvert_scale_rows(acc + i, src + i, n - i, weight, add);
+}
+
+/*
+ * Integer IDCT, see jidctint.c
+ *
+ * The 8 rows of the block are kept in 8 registers, so that the column pass
+ * does all 8 columns at once, the block is transposed for the row pass and
+ * transposed back for storing. All multiplications by constants are done with
+ * madd on pairs of 16 bit inputs, for this the formulas from the C version are
+ * rearranged so that each output is a sum of 2 products, e.g.
+ *   tmp3 = (z2 + z3) * c0541 + z2 * c0765 = z2 * (c0541 + c0765) + z3 * c0541
+ * which gives the exact same 32 bit results.
+ */
+
+#define SSE2_IDCT_PAIR(a, b) _mm_setr_epi16(a, b, a, b, a, b, a, b)
+
+static inline SSE2_FN void sse2_idct_1d(__m128i x[8], int shift)
+{
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	__m128i z3 = _mm_add_epi16(x[7], x[3]);
+	__m128i z4 = _mm_add_epi16(x[5], x[1]);
+	__m128i out[2][8];
+	int i, h;
+
+	for (h = 0; h < 2; h++) {
+		__m128i e26, e04, o71, o53, z34;
+		__m128i tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+		__m128i z3s, z4s;
+
+		if (h == 0) {
+			e26 = _mm_unpacklo_epi16(x[2], x[6]);
+			e04 = _mm_unpacklo_epi16(x[0], x[4]);
+			o71 = _mm_unpacklo_epi16(x[7], x[1]);
+			o53 = _mm_unpacklo_epi16(x[5], x[3]);
+			z34 = _mm_unpacklo_epi16(z3, z4);
+		} else {
+			e26 = _mm_unpackhi_epi16(x[2], x[6]);
+			e04 = _mm_unpackhi_epi16(x[0], x[4]);
+			o71 = _mm_unpackhi_epi16(x[7], x[1]);
+			o53 = _mm_unpackhi_epi16(x[5], x[3]);
+			z34 = _mm_unpackhi_epi16(z3, z4);
+		}
+
+		/* Even part */
+		tmp3 = _mm_madd_epi16(e26, SSE2_IDCT_PAIR(
+				FIX_0_541196100 + FIX_0_765366865,
+				FIX_0_541196100));
+		tmp2 = _mm_madd_epi16(e26, SSE2_IDCT_PAIR(
+				FIX_0_541196100,
+				FIX_0_541196100 - FIX_1_847759065));
+		tmp0 = _mm_madd_epi16(e04, SSE2_IDCT_PAIR(
+				1 << CONST_BITS, 1 << CONST_BITS));
+		tmp1 = _mm_madd_epi16(e04, SSE2_IDCT_PAIR(
+				1 << CONST_BITS, -(1 << CONST_BITS)));
+
+		tmp10 = _mm_add_epi32(tmp0, tmp3);
+		tmp13 = _mm_sub_epi32(tmp0, tmp3);
+		tmp11 = _mm_add_epi32(tmp1, tmp2);
+		tmp12 = _mm_sub_epi32(tmp1, tmp2);
+
+		/* Odd part */
+		z3s = _mm_madd_epi16(z34, SSE2_IDCT_PAIR(
+				FIX_1_175875602 - FIX_1_961570560,
+				FIX_1_175875602));
+		z4s = _mm_madd_epi16(z34, SSE2_IDCT_PAIR(
+				FIX_1_175875602,
+				FIX_1_175875602 - FIX_0_390180644));
+
+		tmp0 = _mm_add_epi32(z3s, _mm_madd_epi16(o71, SSE2_IDCT_PAIR(
+				FIX_0_298631336 - FIX_0_899976223,
+				-FIX_0_899976223)));
+		tmp3 = _mm_add_epi32(z4s, _mm_madd_epi16(o71, SSE2_IDCT_PAIR(
+				-FIX_0_899976223,
+				FIX_1_501321110 - FIX_0_899976223)));
+		tmp1 = _mm_add_epi32(z4s, _mm_madd_epi16(o53, SSE2_IDCT_PAIR(
+				FIX_2_053119869 - FIX_2_562915447,
+				-FIX_2_562915447)));
+		tmp2 = _mm_add_epi32(z3s, _mm_madd_epi16(o53, SSE2_IDCT_PAIR(
+				-FIX_2_562915447,
+				FIX_3_072711026 - FIX_2_562915447)));
+
+		out[h][0] = _mm_add_epi32(tmp10, tmp3);
+		out[h][7] = _mm_sub_epi32(tmp10, tmp3);
+		out[h][1] = _mm_add_epi32(tmp11, tmp2);
+		out[h][6] = _mm_sub_epi32(tmp11, tmp2);
+		out[h][2] = _mm_add_epi32(tmp12, tmp1);
+		out[h][5] = _mm_sub_epi32(tmp12, tmp1);
+		out[h][3] = _mm_add_epi32(tmp13, tmp0);
+		out[h][4] = _mm_sub_epi32(tmp13, tmp0);
+	}
+
+	for (i = 0; i < 8; i++)
+		x[i] = _mm_packs_epi32(
+			_mm_sra_epi32(_mm_add_epi32(out[0][i], round), count),
+			_mm_sra_epi32(_mm_add_epi32(out[1][i], round), count));
+}
+
+static inline SSE2_FN void sse2_transpose_8x8(__m128i x[8])
+{
+	__m128i a[8], b[8];
+	int i;
+
+	for (i = 0; i < 8; i += 2) {
+		a[i] = _mm_unpacklo_epi16(x[i], x[i + 1]);
+		a[i + 1] = _mm_unpackhi_epi16(x[i], x[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		b[i] = _mm_unpacklo_epi32(a[i], a[i + 2]);
+		b[i + 1] = _mm_unpackhi_epi32(a[i], a[i + 2]);
+		b[i + 2] = _mm_unpacklo_epi32(a[i + 1], a[i + 3]);
+		b[i + 3] = _mm_unpackhi_epi32(a[i + 1], a[i + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		x[2 * i] = _mm_unpacklo_epi64(b[i], b[i + 4]);
+		x[2 * i + 1] = _mm_unpackhi_epi64(b[i], b[i + 4]);
+	}
+}
+
+static SSE2_FN void sse2_jpeg_idct_islow(const int16_t *coef,
+		const int16_t *quant, uint8_t *output_buf, int stride)
+{
+	__m128i x[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		x[i] = _mm_mullo_epi16(
+			_mm_loadu_si128((const __m128i *)(coef + i * 8)),
+			_mm_loadu_si128((const __m128i *)(quant + i * 8)));
+
+	sse2_idct_1d(x, CONST_BITS - PASS1_BITS);
+	sse2_transpose_8x8(x);
+	sse2_idct_1d(x, CONST_BITS + PASS1_BITS + 3);
+	sse2_transpose_8x8(x);
+
+	/* Saturate to -128 - 127 and add 128 (flip the sign bit) */
+	for (i = 0; i < 8; i += 2) {
+		__m128i p = _mm_xor_si128(_mm_packs_epi16(x[i], x[i + 1]),
+					  _mm_set1_epi8(-128));
+
+		_mm_storel_epi64((__m128i *)(output_buf + i * stride), p);
+		_mm_storel_epi64((__m128i *)(output_buf + (i + 1) * stride),
+				 _mm_srli_si128(p, 8));
+	}
+}
+
+/*
+ * Mirroring and rotating 8 bit planes, see flip.c
+ */
+static inline SSE2_FN __m128i sse2_reverse_16(__m128i x)
+{
+	/* Reverse the dwords, the words in each dword and the bytes in each
+	   word */
+	x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+static SSE2_FN void sse2_hflip_u8(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int i;
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)
+					    (src + width - 16 - i));
+
+		_mm_storeu_si128((__m128i *)(dest + i), sse2_reverse_16(x));
+	}
+	v4lconvert_hflip_u8(src, dest + i, width - i);
+}
+
+/* The 8x8 block of which dest line j is src column j read bottom up, the
+   8 src lines are loaded last line first, so that this is a transpose */
+static inline SSE2_FN void sse2_rotate90_8x8(const unsigned char *src,
+		int src_stride, unsigned char *dest, int dest_stride)
+{
+	__m128i r[8], a[4], b[4], c[4];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = _mm_loadl_epi64((const __m128i *)
+				       (src + (7 - i) * src_stride));
+	for (i = 0; i < 4; i++)
+		a[i] = _mm_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+	b[0] = _mm_unpacklo_epi16(a[0], a[1]);
+	b[1] = _mm_unpackhi_epi16(a[0], a[1]);
+	b[2] = _mm_unpacklo_epi16(a[2], a[3]);
+	b[3] = _mm_unpackhi_epi16(a[2], a[3]);
+	c[0] = _mm_unpacklo_epi32(b[0], b[2]);
+	c[1] = _mm_unpackhi_epi32(b[0], b[2]);
+	c[2] = _mm_unpacklo_epi32(b[1], b[3]);
+	c[3] = _mm_unpackhi_epi32(b[1], b[3]);
+	for (i = 0; i < 4; i++) {
+		_mm_storel_epi64((__m128i *)(dest + 2 * i * dest_stride), c[i]);
+		_mm_storel_epi64((__m128i *)(dest + (2 * i + 1) * dest_stride),
+				 _mm_srli_si128(c[i], 8));
+	}
+}
+
+static SSE2_FN void sse2_rotate90_u8(const unsigned char *src,
+		int src_stride, unsigned char *dest, int dest_stride,
+		int width, int height)
+{
+	int x, y, w = width & ~7, h = height & ~7;
+
+	/* Dest block (x, y) comes from src lines width - 8 - x and up */
+	for (y = 0; y < h; y += 8)
+		for (x = 0; x < w; x += 8)
+			sse2_rotate90_8x8(src + (width - 8 - x) * src_stride + y,
+					src_stride, dest + y * dest_stride + x,
+					dest_stride);
+
+	/* The right and bottom edges */
+	if (w < width)
+		v4lconvert_rotate90_u8(src, src_stride, dest + w,
+				       dest_stride, width - w, h);
+	if (h < height)
+		v4lconvert_rotate90_u8(src + h, src_stride,
+				       dest + h * dest_stride, dest_stride,
+				       width, height - h);
+}
+
+/* AVX2 versions, same algorithm on 32 pixels at a time */
+
+static inline AVX2_FN void avx2_unpack_yuv422(__m256i in, int layout,
+		__m256i *y, __m256i *u, __m256i *v)
+{
+	const __m256i lo_mask = _mm256_set1_epi16(0x00ff);
+	const __m256i c128 = _mm256_set1_epi16(128);
+	__m256i c, first, second;
+
+	if (layout == PACKED_UYVY) {
+		*y = _mm256_srli_epi16(in, 8);
+		c = _mm256_and_si256(in, lo_mask);
+	} else {
+		*y = _mm256_and_si256(in, lo_mask);
+		c = _mm256_srli_epi16(in, 8);
+	}
+
+	first = _mm256_and_si256(c, _mm256_set1_epi32(0xffff));
+	first = _mm256_or_si256(first, _mm256_slli_epi32(first, 16));
+	second = _mm256_srli_epi32(c, 16);
+	second = _mm256_or_si256(second, _mm256_slli_epi32(second, 16));
+
+	if (layout == PACKED_YVYU) {
+		*u = _mm256_sub_epi16(second, c128);
+		*v = _mm256_sub_epi16(first, c128);
+	} else {
+		*u = _mm256_sub_epi16(first, c128);
+		*v = _mm256_sub_epi16(second, c128);
+	}
+}
+
+static inline AVX2_FN void avx2_yuv_to_rgb(__m256i y, __m256i u, __m256i v,
+		__m256i *r, __m256i *g, __m256i *b)
+{
+	__m256i u1 = _mm256_srai_epi16(
+			_mm256_add_epi16(_mm256_slli_epi16(u, 7), u), 6);
+	__m256i rg = _mm256_srai_epi16(_mm256_add_epi16(
+			_mm256_add_epi16(_mm256_slli_epi16(u, 1), u),
+			_mm256_add_epi16(_mm256_slli_epi16(v, 2),
+					 _mm256_slli_epi16(v, 1))), 3);
+	__m256i v1 = _mm256_srai_epi16(
+			_mm256_add_epi16(_mm256_slli_epi16(v, 1), v), 1);
+
+	*r = _mm256_add_epi16(y, v1);
+	*g = _mm256_sub_epi16(y, rg);
+	*b = _mm256_add_epi16(y, u1);
+}
+
+/* Store 32 pixels of 3 planar components as 24 bpp, writing 4 bytes beyond
+   the last pixel. The components are expected in the lane order resulting
+   from packus on 2 registers: pixels 0-7, 16-23 | 8-15, 24-31. */
+static inline AVX2_FN void avx2_store_rgb24(unsigned char *dest,
+		__m256i c0, __m256i c1, __m256i c2)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i shuf = _mm256_setr_epi8(
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	__m256i lo01 = _mm256_unpacklo_epi8(c0, c1);	/* 0-7   | 8-15  */
+	__m256i hi01 = _mm256_unpackhi_epi8(c0, c1);	/* 16-23 | 24-31 */
+	__m256i lo2 = _mm256_unpacklo_epi8(c2, zero);
+	__m256i hi2 = _mm256_unpackhi_epi8(c2, zero);
+	__m256i q0, q1, q2, q3;
+
+	q0 = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(lo01, lo2), shuf);
+	q1 = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(lo01, lo2), shuf);
+	q2 = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(hi01, hi2), shuf);
+	q3 = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(hi01, hi2), shuf);
+
+	_mm_storeu_si128((__m128i *)(dest + 0), _mm256_castsi256_si128(q0));
+	_mm_storeu_si128((__m128i *)(dest + 12), _mm256_castsi256_si128(q1));
+	_mm_storeu_si128((__m128i *)(dest + 24), _mm256_extracti128_si256(q0, 1));
+	_mm_storeu_si128((__m128i *)(dest + 36), _mm256_extracti128_si256(q1, 1));
+	_mm_storeu_si128((__m128i *)(dest + 48), _mm256_castsi256_si128(q2));
+	_mm_storeu_si128((__m128i *)(dest + 60), _mm256_castsi256_si128(q3));
+	_mm_storeu_si128((__m128i *)(dest + 72), _mm256_extracti128_si256(q2, 1));
+	_mm_storeu_si128((__m128i *)(dest + 84), _mm256_extracti128_si256(q3, 1));
+}
+
+static inline AVX2_FN void avx2_packed_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride, int layout, int bgr, packed_to_rgb24_fn c_version)
+{
+	int w = width & ~1;
+
+	while (--height >= 0) {
+		/* Stores may go 4 bytes beyond the line, see sse2 version */
+		int vec_width = height ? w : w - 2;
+		int j;
+
+		for (j = 0; j + 32 <= vec_width; j += 32) {
+			__m256i y, u, v, r0, g0, b0, r1, g1, b1, r, g, b;
+
+			avx2_unpack_yuv422(_mm256_loadu_si256(
+					(const __m256i *)(src + j * 2)),
+					layout, &y, &u, &v);
+			avx2_yuv_to_rgb(y, u, v, &r0, &g0, &b0);
+			avx2_unpack_yuv422(_mm256_loadu_si256(
+					(const __m256i *)(src + j * 2 + 32)),
+					layout, &y, &u, &v);
+			avx2_yuv_to_rgb(y, u, v, &r1, &g1, &b1);
+
+			r = _mm256_packus_epi16(r0, r1);
+			g = _mm256_packus_epi16(g0, g1);
+			b = _mm256_packus_epi16(b0, b1);
+			if (bgr)
+				avx2_store_rgb24(dest + j * 3, b, g, r);
+			else
+				avx2_store_rgb24(dest + j * 3, r, g, b);
+		}
+		j = sse2_packed_to_rgb24_line(src, dest, j,
+				height ? w : w - 1, layout, bgr);
+
+		if (j < width)
+			c_version(src + j * 2, dest + j * 3, width - j, 1, stride,
+				  dest_stride);
+		src += stride;
+		dest += dest_stride;
+	}
+}
+
+static AVX2_FN void avx2_yuyv_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	avx2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YUYV, 0, v4lconvert_yuyv_to_rgb24);
+}
+
+static AVX2_FN void avx2_yuyv_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	avx2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YUYV, 1, v4lconvert_yuyv_to_bgr24);
+}
+
+static AVX2_FN void avx2_yvyu_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	avx2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YVYU, 0, v4lconvert_yvyu_to_rgb24);
+}
+
+static AVX2_FN void avx2_yvyu_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	avx2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_YVYU, 1, v4lconvert_yvyu_to_bgr24);
+}
+
+static AVX2_FN void avx2_uyvy_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	avx2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_UYVY, 0, v4lconvert_uyvy_to_rgb24);
+}
+
+static AVX2_FN void avx2_uyvy_to_bgr24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride)
+{
+	avx2_packed_to_rgb24(src, dest, width, height, stride, dest_stride,
+			PACKED_UYVY, 1, v4lconvert_uyvy_to_bgr24);
+}
+
+/* rgb24 / bgr24 -> argb32, the 24 bytes of 8 pixels are spread over the two
+   128 bit lanes by a dword permute and then expanded by a byte shuffle. Going
+   from the last block to the first keeps this working in place, as each block
+   is stored beyond the src bytes which are still to be loaded. */
+static AVX2_FN void avx2_rgb24_to_argb32_line(const unsigned char *src,
+		unsigned char *dest, int width, int bgr)
+{
+	const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+	const __m256i shuf = bgr ?
+		_mm256_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3,
+				 -1, 8, 7, 6, -1, 11, 10, 9,
+				 -1, 2, 1, 0, -1, 5, 4, 3,
+				 -1, 8, 7, 6, -1, 11, 10, 9) :
+		_mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5,
+				 -1, 6, 7, 8, -1, 9, 10, 11,
+				 -1, 0, 1, 2, -1, 3, 4, 5,
+				 -1, 6, 7, 8, -1, 9, 10, 11);
+	const __m256i alpha = _mm256_set1_epi32(0xff);
+	int i = width > 16 ? width - 16 : 0;
+
+	/* The loads read 8 bytes past their 8 pixels, so the last pixels are
+	   done by the C version */
+	v4lconvert_rgb24_to_argb32(src + i * 3, dest + i * 4, width - i, 1, 0, 0,
+				   bgr);
+
+	while (i >= 8) {
+		__m256i v;
+
+		i -= 8;
+		v = _mm256_loadu_si256((const __m256i *)(src + i * 3));
+		v = _mm256_permutevar8x32_epi32(v, spread);
+		v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuf), alpha);
+		_mm256_storeu_si256((__m256i *)(dest + i * 4), v);
+	}
+
+	v4lconvert_rgb24_to_argb32(src, dest, i, 1, 0, 0, bgr);
+}
+
+/* Lines are done from last to first, like in the C version */
+static AVX2_FN void avx2_rgb24_to_argb32(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int dest_stride, int bgr)
+{
+	while (--height >= 0)
+		avx2_rgb24_to_argb32_line(src + height * stride,
+					  dest + height * dest_stride, width, bgr);
+}
+
+/* Like the SSE2 version, with 16 pairs at a time */
+static AVX2_FN void avx2_bayer_pairs_to_bgr24(const unsigned char *bayer,
+		int stride, unsigned char *bgr, int pairs, int blue_line)
+{
+	const __m256i lo_mask = _mm256_set1_epi16(0x00ff);
+	const __m256i two = _mm256_set1_epi16(2);
+	int i;
+
+	/* Stores go 4 bytes beyond the 16th pair, which is less than the
+	   6 bytes of the pairs left to the SSE2 / C version */
+	for (i = 0; i + 16 < pairs; i += 16) {
+		const unsigned char *p = bayer + 2 * i;
+		__m256i a = _mm256_loadu_si256((const __m256i *)p);
+		__m256i a2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(p + stride));
+		__m256i b2 = _mm256_loadu_si256((const __m256i *)(p + stride + 2));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(p + 2 * stride));
+		__m256i c2 = _mm256_loadu_si256((const __m256i *)(p + 2 * stride + 2));
+		__m256i ae = _mm256_and_si256(a, lo_mask), ao = _mm256_srli_epi16(a, 8);
+		__m256i ae2 = _mm256_and_si256(a2, lo_mask);
+		__m256i be = _mm256_and_si256(b, lo_mask), bo = _mm256_srli_epi16(b, 8);
+		__m256i be2 = _mm256_and_si256(b2, lo_mask), bo2 = _mm256_srli_epi16(b2, 8);
+		__m256i ce = _mm256_and_si256(c, lo_mask), co = _mm256_srli_epi16(c, 8);
+		__m256i ce2 = _mm256_and_si256(c2, lo_mask);
+		__m256i other, green, own;
+
+		other = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(ae, ae2),
+				_mm256_add_epi16(_mm256_add_epi16(ce, ce2), two)), 2);
+		other = _mm256_or_si256(other,
+				_mm256_slli_epi16(_mm256_avg_epu16(ae2, ce2), 8));
+		green = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(ao, co),
+				_mm256_add_epi16(_mm256_add_epi16(be, be2), two)), 2);
+		green = _mm256_or_si256(green, _mm256_slli_epi16(be2, 8));
+		own = _mm256_or_si256(bo,
+				_mm256_slli_epi16(_mm256_avg_epu16(bo, bo2), 8));
+
+		/* avx2_store_rgb24() wants the 64 bit quarters in the order
+		   packus gives: 0, 2, 1, 3 */
+		other = _mm256_permute4x64_epi64(other, 0xd8);
+		green = _mm256_permute4x64_epi64(green, 0xd8);
+		own = _mm256_permute4x64_epi64(own, 0xd8);
+		if (blue_line)
+			avx2_store_rgb24(bgr + 6 * i, other, green, own);
+		else
+			avx2_store_rgb24(bgr + 6 * i, own, green, other);
+	}
+	i = sse2_bayer_pairs_to_bgr24_line(bayer, stride, bgr, i, pairs,
+					   blue_line);
+	v4lconvert_bayer_pairs_to_bgr24(bayer + 2 * i, stride, bgr + 6 * i,
+					pairs - i, blue_line);
+}
+
+static AVX2_FN void avx2_scale_rows(uint16_t *acc, const unsigned char *src,
+		int n, int weight, int add)
+{
+	const __m256i w = _mm256_set1_epi16(weight);
+	int i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i lo = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)(src + i))), w);
+		__m256i hi = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)(src + i + 16))), w);
+
+		if (add) {
+			lo = _mm256_add_epi16(lo,
+				_mm256_loadu_si256((const __m256i *)(acc + i)));
+			hi = _mm256_add_epi16(hi,
+				_mm256_loadu_si256((const __m256i *)(acc + i + 16)));
+		}
+		_mm256_storeu_si256((__m256i *)(acc + i), lo);
+		_mm256_storeu_si256((__m256i *)(acc + i + 16), hi);
+	}
+	sse2_scale_rows(acc + i, src + i, n - i, weight, add);
+}
+
+static AVX2_FN void avx2_hflip_u8(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m256i reverse = _mm256_setr_epi8(
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	int i;
+
+	for (i = 0; i + 32 <= width; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)
+					       (src + width - 32 - i));
+
+		/* Reverse the bytes in each lane, then swap the lanes */
+		x = _mm256_shuffle_epi8(x, reverse);
+		x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 3, 2));
+		_mm256_storeu_si256((__m256i *)(dest + i), x);
+	}
+	sse2_hflip_u8(src, dest + i, width - i);
+}
+
+const struct v4lconvert_kernels v4lconvert_sse2_kernels = {
+	.name = "sse2",
+	.yuyv_to_rgb24 = sse2_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = sse2_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = sse2_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = sse2_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = sse2_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = sse2_uyvy_to_bgr24,
+	.yuv420_to_rgb24 = sse2_yuv420_to_rgb,
+	.yuv420_to_bgr24 = sse2_yuv420_to_bgr,
+	.nv12_to_rgb24 = sse2_nv12_to_rgb24,
+	.nv12_to_yuv420 = sse2_nv12_to_yuv420,
+	.nv16_to_yuyv = sse2_nv16_to_yuyv,
+	/* Needs a byte shuffle, which SSE2 does not have */
+	.rgb24_to_argb32 = v4lconvert_rgb24_to_argb32,
+	/* There is no byte table lookup instruction, and AVX2 gathers are
+	   no faster than scalar lookups */
+	.lut_rgb24 = v4lprocessing_lut_rgb24,
+	.bayer_pairs_to_bgr24 = sse2_bayer_pairs_to_bgr24,
+	.scale_rows = sse2_scale_rows,
+	.jpeg_idct_islow = sse2_jpeg_idct_islow,
+	.hflip_u8 = sse2_hflip_u8,
+	.rotate90_u8 = sse2_rotate90_u8,
+};
+
+const struct v4lconvert_kernels v4lconvert_avx2_kernels = {
+	.name = "avx2",
+	.yuyv_to_rgb24 = avx2_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = avx2_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = avx2_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = avx2_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = avx2_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = avx2_uyvy_to_bgr24,
+	/* These are bound by memory bandwidth rather than by arithmetic, the
+	   SSE2 versions are as fast as an AVX2 version would be */
+	.yuv420_to_rgb24 = sse2_yuv420_to_rgb,
+	.yuv420_to_bgr24 = sse2_yuv420_to_bgr,
+	.nv12_to_rgb24 = sse2_nv12_to_rgb24,
+	.nv12_to_yuv420 = sse2_nv12_to_yuv420,
+	.nv16_to_yuyv = sse2_nv16_to_yuyv,
+	.rgb24_to_argb32 = avx2_rgb24_to_argb32,
+	.lut_rgb24 = v4lprocessing_lut_rgb24,
+	.bayer_pairs_to_bgr24 = avx2_bayer_pairs_to_bgr24,
+	.scale_rows = avx2_scale_rows,
+	/* A block is only 8 lanes of 16 bits wide */
+	.jpeg_idct_islow = sse2_jpeg_idct_islow,
+	.hflip_u8 = avx2_hflip_u8,
+	/* Bound by the strided loads, wider blocks do not help */
+	.rotate90_u8 = sse2_rotate90_u8,
+};
+
+#endif /* V4LCONVERT_HAVE_X86_SIMD */
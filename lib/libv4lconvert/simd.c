@@ -0,0 +1,86 @@
+/*
+
+# Conversion kernel selection based on cpu features
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "libv4lconvert-priv.h"
+#include "tinyjpeg-internal.h"
+
+const struct v4lconvert_kernels v4lconvert_c_kernels = {
+	.name = "c",
+	.yuyv_to_rgb24 = v4lconvert_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = v4lconvert_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = v4lconvert_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = v4lconvert_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = v4lconvert_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = v4lconvert_uyvy_to_bgr24,
+	.yuv420_to_rgb24 = v4lconvert_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = v4lconvert_yuv420_to_bgr24,
+	.nv12_to_rgb24 = v4lconvert_nv12_to_rgb24,
+	.nv12_to_yuv420 = v4lconvert_nv12_to_yuv420,
+	.nv16_to_yuyv = v4lconvert_nv16_to_yuyv,
+	.rgb24_to_argb32 = v4lconvert_rgb24_to_argb32,
+	.lut_rgb24 = v4lprocessing_lut_rgb24,
+	.bayer_pairs_to_bgr24 = v4lconvert_bayer_pairs_to_bgr24,
+	.scale_rows = v4lconvert_scale_rows,
+	.jpeg_idct_islow = tinyjpeg_idct_islow,
+	.hflip_u8 = v4lconvert_hflip_u8,
+	.rotate90_u8 = v4lconvert_rotate90_u8,
+};
+
+/* Supported implementations, best first */
+const struct v4lconvert_kernels *v4lconvert_supported_kernels(int i)
+{
+	const struct v4lconvert_kernels *kernels[4];
+	int count = 0;
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		kernels[count++] = &v4lconvert_avx2_kernels;
+	if (__builtin_cpu_supports("sse2"))
+		kernels[count++] = &v4lconvert_sse2_kernels;
+#endif
+#ifdef V4LCONVERT_HAVE_NEON
+	/* Advanced SIMD is a mandatory part of armv8-a */
+	kernels[count++] = &v4lconvert_neon_kernels;
+#endif
+	kernels[count++] = &v4lconvert_c_kernels;
+
+	return i < count ? kernels[i] : NULL;
+}
+
+/* Returns the fastest kernels the cpu supports. The LIBV4LCONVERT_SIMD
+   environment variable can be set to the name of an implementation (e.g.
+   "c" or "sse2") to select a specific one for testing / benchmarking. */
+const struct v4lconvert_kernels *v4lconvert_get_kernels(void)
+{
+	const struct v4lconvert_kernels *kernels;
+	const char *s = getenv("LIBV4LCONVERT_SIMD");
+	int i;
+
+	if (s) {
+		for (i = 0; (kernels = v4lconvert_supported_kernels(i)); i++)
+			if (!strcmp(kernels->name, s))
+				return kernels;
+	}
+
+	return v4lconvert_supported_kernels(0);
+}
@@ -0,0 +1,177 @@
+/*
+
+# Worker threads for splitting a conversion into bands of lines
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "libv4lconvert-priv.h"
+
+/* Frames smaller then this are not worth waking up the workers for */
+#define V4LCONVERT_THREADS_MIN_LINES 32
+
+struct v4lconvert_threads {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	int count;	/* no worker threads, excluding the calling thread */
+	pthread_t threads[V4LCONVERT_MAX_THREADS];
+	/* The job currently being run */
+	void (*func)(void *arg, int first, int last);
+	void *arg;
+	int lines;
+	int bands;
+	int next_band;
+	int bands_done;
+	unsigned int generation;
+	int stop;
+};
+
+/* Run bands of the current job until there are none left, must be called
+   with the lock held */
+static void v4lconvert_threads_do_bands(struct v4lconvert_threads *threads)
+{
+	while (threads->next_band < threads->bands) {
+		int band = threads->next_band++;
+		/* Keep bands a multiple of 2 lines for subsampled / bayer data */
+		int band_lines = ((threads->lines / threads->bands) + 1) & ~1;
+		int first = band * band_lines;
+		int last = (band == threads->bands - 1) ? threads->lines :
+			first + band_lines;
+
+		if (first > threads->lines)
+			first = threads->lines;
+		if (last > threads->lines)
+			last = threads->lines;
+
+		pthread_mutex_unlock(&threads->lock);
+		if (first < last)
+			threads->func(threads->arg, first, last);
+		pthread_mutex_lock(&threads->lock);
+
+		if (++threads->bands_done == threads->bands)
+			pthread_cond_signal(&threads->done_cond);
+	}
+}
+
+static void *v4lconvert_threads_worker(void *arg)
+{
+	struct v4lconvert_threads *threads = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&threads->lock);
+	while (1) {
+		while (!threads->stop && generation == threads->generation)
+			pthread_cond_wait(&threads->work_cond, &threads->lock);
+		if (threads->stop)
+			break;
+		generation = threads->generation;
+		v4lconvert_threads_do_bands(threads);
+	}
+	pthread_mutex_unlock(&threads->lock);
+
+	return NULL;
+}
+
+struct v4lconvert_threads *v4lconvert_threads_create(int count)
+{
+	struct v4lconvert_threads *threads;
+	int i;
+
+	if (count < 1 || count > V4LCONVERT_MAX_THREADS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	threads = calloc(1, sizeof(*threads));
+	if (!threads)
+		return NULL;
+
+	pthread_mutex_init(&threads->lock, NULL);
+	pthread_cond_init(&threads->work_cond, NULL);
+	pthread_cond_init(&threads->done_cond, NULL);
+
+	for (i = 0; i < count; i++) {
+		errno = pthread_create(&threads->threads[i], NULL,
+				v4lconvert_threads_worker, threads);
+		if (errno)
+			break;
+		threads->count++;
+	}
+
+	if (threads->count != count) {
+		v4lconvert_threads_destroy(threads);
+		return NULL;
+	}
+
+	return threads;
+}
+
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads)
+{
+	int i;
+
+	if (!threads)
+		return;
+
+	pthread_mutex_lock(&threads->lock);
+	threads->stop = 1;
+	pthread_cond_broadcast(&threads->work_cond);
+	pthread_mutex_unlock(&threads->lock);
+
+	for (i = 0; i < threads->count; i++)
+		pthread_join(threads->threads[i], NULL);
+
+	pthread_cond_destroy(&threads->done_cond);
+	pthread_cond_destroy(&threads->work_cond);
+	pthread_mutex_destroy(&threads->lock);
+	free(threads);
+}
+
+int v4lconvert_threads_count(struct v4lconvert_threads *threads)
+{
+	return threads ? threads->count + 1 : 1;
+}
+
+/* Call func for bands of lines covering 0 - lines, in parallel on the worker
+   threads and the calling thread. Returns when all bands are done. Without
+   worker threads (threads == NULL) this simply calls func(arg, 0, lines). */
+void v4lconvert_threads_run(struct v4lconvert_threads *threads,
+		void (*func)(void *arg, int first, int last), void *arg, int lines)
+{
+	if (!threads || lines < V4LCONVERT_THREADS_MIN_LINES) {
+		func(arg, 0, lines);
+		return;
+	}
+
+	pthread_mutex_lock(&threads->lock);
+	threads->func = func;
+	threads->arg = arg;
+	threads->lines = lines;
+	threads->bands = threads->count + 1;
+	threads->next_band = 0;
+	threads->bands_done = 0;
+	threads->generation++;
+	pthread_cond_broadcast(&threads->work_cond);
+
+	v4lconvert_threads_do_bands(threads);
+	while (threads->bands_done != threads->bands)
+		pthread_cond_wait(&threads->done_cond, &threads->lock);
+	pthread_mutex_unlock(&threads->lock);
+}
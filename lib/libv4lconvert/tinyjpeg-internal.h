@@ -36,6 +36,7 @@
 #define __TINYJPEG_INTERNAL_H_
 
 #include <setjmp.h>
+#include <stdint.h>
 
 #define SANITY_CHECK 1
 
@@ -47,25 +48,29 @@ struct jdec_private;
 
 #define HUFFMAN_TABLES	   4
 #define COMPONENTS	   3
-#define JPEG_MAX_WIDTH	   2048
-#define JPEG_MAX_HEIGHT	   2048
+#define JPEG_MAX_WIDTH	   4096
+#define JPEG_MAX_HEIGHT	   4096
 
 struct huffman_table {
 	/* Fast look up table, using HUFFMAN_HASH_NBITS bits we can have directly the symbol,
-	 * if the symbol is <0, then we need to look into the tree table */
+	 * if the symbol is <0, then we need to decode the remaining bits one by one */
 	short int lookup[HUFFMAN_HASH_SIZE];
-	/* code size: give the number of bits of a symbol is encoded */
+	/* code size: give the number of bits of the symbol at this lookup position */
 	unsigned char code_size[HUFFMAN_HASH_SIZE];
-	/* some place to store value that is not encoded in the lookup table
-	 * IMPROVEME: Calculate if 256 value is enough to store all values
-	 */
-	uint16_t slowtable[16 - HUFFMAN_HASH_NBITS][256];
+	/* For codes which fit in HUFFMAN_HASH_NBITS together with the value bits
+	 * following them: (value << 8) | (count_0 << 4) | total nbits, else 0 */
+	short int fast_coef[HUFFMAN_HASH_SIZE];
+	/* Codes longer than HUFFMAN_HASH_NBITS: largest code of each length (-1 if
+	 * there are none), and the offset from a code to its index in huffval */
+	int maxcode[17];
+	int valoffset[17];
+	unsigned char huffval[256];
 };
 
 struct component {
 	unsigned int Hfactor;
 	unsigned int Vfactor;
-	float *Q_table;		/* Pointer to the quantisation table to use */
+	int16_t *Q_table;	/* Pointer to the quantisation table to use */
 	struct huffman_table *AC_table;
 	struct huffman_table *DC_table;
 	short int previous_DC;	/* Previous DC coefficient */
@@ -93,7 +98,7 @@ struct jdec_private {
 	unsigned int reservoir, nbits_in_reservoir;
 
 	struct component component_infos[COMPONENTS];
-	float Q_tables[COMPONENTS][64];		/* quantization tables */
+	int16_t Q_tables[COMPONENTS][64];	/* quantization tables */
 	struct huffman_table HTDC[HUFFMAN_TABLES];	/* DC huffman tables   */
 	struct huffman_table HTAC[HUFFMAN_TABLES];	/* AC huffman tables   */
 	int default_huffman_table_initialized;
@@ -106,6 +111,10 @@ struct jdec_private {
 	unsigned char marker;			/* for PJPG (Pixart JPEG) */
 	unsigned char first_marker;		/* for PJPG (Pixart JPEG) */
 
+	/* Dequantization + IDCT, the fastest version the cpu supports */
+	void (*idct)(const int16_t *coef, const int16_t *quant,
+		     uint8_t *output_buf, int stride);
+
 	/* Temp space used after the IDCT to store each components */
 	uint8_t Y[64 * 4], Cr[64], Cb[64];
 
@@ -118,10 +127,53 @@ struct jdec_private {
 	/* Temp buffers for multipass planar JPG -> RGB decoding */
 	int tmp_buf_y_size;
 	uint8_t *tmp_buf[COMPONENTS];
+
+	/* For decoding restart intervals in parallel, threads is NULL when
+	   not using threads */
+	struct v4lconvert_threads *threads;
+	const unsigned char **rst_streams;	/* Start of each restart interval */
+	int rst_streams_size;
+
+	/* Decoding at 1/2, 1/4 or 1/8 of the size, see tinyjpeg_set_scale() */
+	unsigned int scale;
+	uint8_t *scaled_buf;
+	int scaled_buf_size;
 };
 
-#define IDCT tinyjpeg_idct_float
-void tinyjpeg_idct_float (struct component *compptr, uint8_t *output_buf, int stride);
+/*
+ * Integer inverse DCT, see jidctint.c. The constants are scaled by
+ * 2^CONST_BITS, the output of the first pass is scaled by 2^PASS1_BITS.
+ * They are shared with the SSE2 and NEON versions, which must produce
+ * identical results.
+ */
+#define CONST_BITS  13
+#define PASS1_BITS  2
+
+#define FIX_0_298631336  2446		/* FIX(0.298631336) */
+#define FIX_0_390180644  3196		/* FIX(0.390180644) */
+#define FIX_0_541196100  4433		/* FIX(0.541196100) */
+#define FIX_0_765366865  6270		/* FIX(0.765366865) */
+#define FIX_0_899976223  7373		/* FIX(0.899976223) */
+#define FIX_1_175875602  9633		/* FIX(1.175875602) */
+#define FIX_1_501321110  12299		/* FIX(1.501321110) */
+#define FIX_1_847759065  15137		/* FIX(1.847759065) */
+#define FIX_1_961570560  16069		/* FIX(1.961570560) */
+#define FIX_2_053119869  16819		/* FIX(2.053119869) */
+#define FIX_2_562915447  20995		/* FIX(2.562915447) */
+#define FIX_3_072711026  25172		/* FIX(3.072711026) */
+
+#define IDCT(compptr, output_buf, stride) \
+	priv->idct((compptr)->DCT, (compptr)->Q_table, output_buf, stride)
+void tinyjpeg_idct_islow(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride);
+
+/* Reduced size IDCTs, see jidctred.c */
+void tinyjpeg_idct_4x4(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride);
+void tinyjpeg_idct_2x2(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride);
+void tinyjpeg_idct_1x1(const int16_t *coef, const int16_t *quant,
+		uint8_t *output_buf, int stride);
 
 #endif
 
@@ -36,6 +36,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "tinyjpeg.h"
 #include "tinyjpeg-internal.h"
@@ -134,6 +135,19 @@ static const unsigned char zigzag[64] = {
 	35, 36, 48, 49, 57, 58, 62, 63
 };
 
+/* The inverse of the above, the natural order position of the coefficients
+   in zigzag order */
+static const unsigned char dezigzag[64] = {
+	0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
 /* Set up the standard Huffman tables (cf. JPEG standard section K.3) */
 /* IMPORTANT: these are only valid for 8-bit data precision! */
 static const unsigned char bits_dc_luminance[17] = {
@@ -257,20 +271,23 @@ const unsigned char standard_quantization[][64] = { {
  *
  */
 #define fill_nbits(reservoir, nbits_in_reservoir, stream, nbits_wanted) do { \
-	while (nbits_in_reservoir < nbits_wanted) { \
-		unsigned char c; \
-		if (stream >= priv->stream_end) { \
+	if (nbits_in_reservoir < nbits_wanted) { \
+		/* Fill up to 25 - 32 bits, so that we don't need to refill for \
+		   the next few codes */ \
+		while (nbits_in_reservoir <= 24 && stream < priv->stream_end) { \
+			unsigned char c = *stream++; \
+			reservoir <<= 8; \
+			if (c == 0xff && *stream == 0x00) \
+				stream++; \
+			reservoir |= c; \
+			nbits_in_reservoir += 8; \
+		} \
+		if (nbits_in_reservoir < nbits_wanted) { \
 			snprintf(priv->error_string, sizeof(priv->error_string), \
 					"fill_nbits error: need %u more bits\n", \
 					nbits_wanted - nbits_in_reservoir); \
 			longjmp(priv->jump_state, -EIO); \
 		} \
-		c = *stream++; \
-		reservoir <<= 8; \
-		if (c == 0xff && *stream == 0x00) \
-			stream++; \
-		reservoir |= c; \
-		nbits_in_reservoir += 8; \
 	} \
 }  while (0);
 
@@ -312,39 +329,32 @@ static void resync(struct jdec_private *priv);
  * To speedup the procedure, we look HUFFMAN_HASH_NBITS bits and the code is
  * lower than HUFFMAN_HASH_NBITS we have automaticaly the length of the code
  * and the value by using two lookup table.
- * Else if the value is not found, just search (linear) into an array for each
- * bits is the code is present.
+ * Else if the value is not found, we look at one more bit at a time, as the
+ * codes of a given length are consecutive numbers, the code is found when it
+ * is not larger then the largest code of the length we are looking at.
  *
  * If the code is not present for any reason, -1 is return.
  */
 static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table *huffman_table)
 {
 	int value, hcode;
-	unsigned int extra_nbits, nbits;
-	uint16_t *slowtable;
+	unsigned int nbits;
 
 	look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
 	value = huffman_table->lookup[hcode];
 	if (value >= 0) {
-		unsigned int code_size = huffman_table->code_size[value];
+		unsigned int code_size = huffman_table->code_size[hcode];
 
 		skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, code_size);
 		return value;
 	}
 
 	/* Decode more bits each time ... */
-	for (extra_nbits = 0; extra_nbits < 16 - HUFFMAN_HASH_NBITS; extra_nbits++) {
-		nbits = HUFFMAN_HASH_NBITS + 1 + extra_nbits;
-
+	for (nbits = HUFFMAN_HASH_NBITS + 1; nbits <= 16; nbits++) {
 		look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits, hcode);
-		slowtable = huffman_table->slowtable[extra_nbits];
-		/* Search if the code is in this array */
-		while (slowtable[0]) {
-			if (slowtable[0] == hcode) {
-				skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits);
-				return slowtable[1];
-			}
-			slowtable += 2;
+		if (hcode <= huffman_table->maxcode[nbits]) {
+			skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits);
+			return huffman_table->huffval[hcode + huffman_table->valoffset[nbits]];
 		}
 	}
 	snprintf(priv->error_string, sizeof(priv->error_string),
@@ -356,7 +366,11 @@ static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table
 /**
  *
  * Decode a single block that contains the DCT coefficients.
- * The table coefficients is already dezigzaged at the end of the operation.
+ * The coefficients are stored in natural order (dezigzaged) right away.
+ *
+ * Most codes are short and are followed by only a few bits for the value of
+ * the coefficient, for these the fast_coef table gives the number of zeros to
+ * skip, the value and the total number of bits from a single lookahead.
  *
  */
 static void process_Huffman_data_unit(struct jdec_private *priv, int component)
@@ -364,27 +378,45 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	unsigned char j;
 	unsigned int huff_code;
 	unsigned char size_val, count_0;
+	int hcode, fast;
+	short int value;
 
 	struct component *c = &priv->component_infos[component];
-	short int DCT[64];
 
 	/* Initialize the DCT coef table */
-	memset(DCT, 0, sizeof(DCT));
+	memset(c->DCT, 0, sizeof(c->DCT));
 
 	/* DC coefficient decoding */
-	huff_code = get_next_huffman_code(priv, c->DC_table);
-	if (huff_code) {
-		get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, huff_code, DCT[0]);
-		DCT[0] += c->previous_DC;
-		c->previous_DC = DCT[0];
+	look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
+	fast = c->DC_table->fast_coef[hcode];
+	if (fast) {
+		skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, fast & 15);
+		value = fast >> 8;
 	} else {
-		DCT[0] = c->previous_DC;
+		huff_code = get_next_huffman_code(priv, c->DC_table);
+		value = 0;
+		if (huff_code)
+			get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, huff_code, value);
 	}
+	c->DCT[0] = value + c->previous_DC;
+	c->previous_DC = c->DCT[0];
 
 
 	/* AC coefficient decoding */
 	j = 1;
 	while (j < 64) {
+		look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
+		fast = c->AC_table->fast_coef[hcode];
+		if (fast) {
+			skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, fast & 15);
+			j += (fast >> 4) & 15;	/* skip count_0 zeroes */
+			if (j < 64) {
+				c->DCT[dezigzag[j]] = fast >> 8;
+				j++;
+			}
+			continue;
+		}
+
 		huff_code = get_next_huffman_code(priv, c->AC_table);
 
 		size_val = huff_code & 0xF;
@@ -398,7 +430,8 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 		} else {
 			j += count_0;	/* skip count_0 zeroes */
 			if (j < 64) {
-				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[j]);
+				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, value);
+				c->DCT[dezigzag[j]] = value;
 				j++;
 			}
 		}
@@ -409,9 +442,6 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 				"error: more than 63 AC components (%d) in huffman unit\n", (int)j);
 		longjmp(priv->jump_state, -EIO);
 	}
-
-	for (j = 0; j < 64; j++)
-		c->DCT[j] = DCT[zigzag[j]];
 }
 
 /*
@@ -419,19 +449,26 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
  *
  * lookup will return the symbol if the code is less or equal than HUFFMAN_HASH_NBITS.
  * code_size will be used to known how many bits this symbol is encoded.
- * slowtable will be used when the first lookup didn't give the result.
+ * fast_coef combines the lookup with decoding the value bits which follow.
+ * maxcode, valoffset and huffval will be used when the first lookup didn't
+ * give the result.
  */
 static int build_huffman_table(struct jdec_private *priv, const unsigned char *bits, const unsigned char *vals, struct huffman_table *table)
 {
-	unsigned int i, j, code, code_size, val, nbits;
+	unsigned int i, j, code, code_size, val, nbits, count;
 	unsigned char huffsize[257], *hz;
 	unsigned int huffcode[257], *hc;
-	int slowtable_used[16 - HUFFMAN_HASH_NBITS];
 
 	/*
 	 * Build a temp array
 	 *   huffsize[X] => numbers of bits to write vals[X]
 	 */
+	count = 0;
+	for (i = 1; i <= 16; i++)
+		count += bits[i];
+	if (count > 256)
+		error("More than 256 codes in a Huffman table\n");
+
 	hz = huffsize;
 	for (i = 1; i <= 16; i++) {
 		for (j = 1; j <= bits[i]; j++)
@@ -440,8 +477,7 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 	*hz = 0;
 
 	memset(table->lookup, 0xff, sizeof(table->lookup));
-	for (i = 0; i < (16 - HUFFMAN_HASH_NBITS); i++)
-		slowtable_used[i] = 0;
+	memset(table->fast_coef, 0, sizeof(table->fast_coef));
 
 	/* Build a temp array
 	 *   huffcode[X] => code used to write vals[X]
@@ -455,12 +491,27 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 			*hc++ = code++;
 			hz++;
 		}
+		if (code > (1U << nbits))
+			error("Invalid Huffman table, too many codes of length %u\n", nbits);
 		code <<= 1;
 		nbits++;
 	}
 
 	/*
-	 * Build the lookup table, and the slowtable if needed.
+	 * Build the tables for codes longer than HUFFMAN_HASH_NBITS.
+	 */
+	for (i = 0, nbits = 1; nbits <= 16; nbits++) {
+		if (bits[nbits]) {
+			table->valoffset[nbits] = (int)i - (int)huffcode[i];
+			i += bits[nbits];
+			table->maxcode[nbits] = huffcode[i - 1];
+		} else {
+			table->maxcode[nbits] = -1;
+		}
+	}
+
+	/*
+	 * Build the lookup table.
 	 */
 	for (i = 0; huffsize[i]; i++) {
 		val = vals[i];
@@ -469,7 +520,7 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 
 		trace("val=%2.2x code=%8.8x codesize=%2.2d\n", i, code, code_size);
 
-		table->code_size[val] = code_size;
+		table->huffval[i] = val;
 		if (code_size <= HUFFMAN_HASH_NBITS) {
 			/*
 			 * Good: val can be put in the lookup table, so fill all value of this
@@ -478,26 +529,42 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 			int repeat = 1UL << (HUFFMAN_HASH_NBITS - code_size);
 
 			code <<= HUFFMAN_HASH_NBITS - code_size;
-			while (repeat--)
+			while (repeat--) {
+				table->code_size[code] = code_size;
 				table->lookup[code++] = val;
-
-		} else {
-			/* Perhaps sorting the array will be an optimization */
-			int slowtable_index = code_size - HUFFMAN_HASH_NBITS - 1;
-
-			if (slowtable_used[slowtable_index] == 254)
-				error("slow Huffman table overflow\n");
-
-			table->slowtable[slowtable_index][slowtable_used[slowtable_index]]
-				= code;
-			table->slowtable[slowtable_index][slowtable_used[slowtable_index] + 1]
-				= val;
-			slowtable_used[slowtable_index] += 2;
+			}
 		}
 	}
 
-	for (i = 0; i < (16 - HUFFMAN_HASH_NBITS); i++)
-		table->slowtable[i][slowtable_used[i]] = 0;
+	/*
+	 * Build the fast_coef table: for codes followed by a value which both
+	 * fit in the lookahead, store the value, the number of zeros preceding
+	 * it and the total number of bits as (value << 8) | (count_0 << 4) | nbits
+	 */
+	for (code = 0; code < HUFFMAN_HASH_SIZE; code++) {
+		int size_val, extra, value;
+
+		if (table->lookup[code] < 0)
+			continue;
+
+		code_size = table->code_size[code];
+		size_val = table->lookup[code] & 0xf;
+		/* The value must fit in 8 bits signed */
+		if (size_val == 0 || size_val > 7 ||
+		    code_size + size_val > HUFFMAN_HASH_NBITS)
+			continue;
+
+		extra = (code >> (HUFFMAN_HASH_NBITS - code_size - size_val)) &
+			((1 << size_val) - 1);
+		/* Same sign extension as get_nbits() */
+		if (extra < (1 << (size_val - 1)))
+			value = extra - (1 << size_val) + 1;
+		else
+			value = extra;
+
+		table->fast_coef[code] = value * 256 +
+			(table->lookup[code] >> 4) * 16 + code_size + size_val;
+	}
 
 	return 0;
 }
@@ -1380,7 +1447,7 @@ static void decode_MCU_2x1_3planes(struct jdec_private *priv)
 	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table);
+static void build_quantization_table(int16_t *qtable, const unsigned char *ref_table);
 
 static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 {
@@ -1657,34 +1724,20 @@ static void print_SOF(const unsigned char *stream)
  *
  ******************************************************************************/
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table)
+static void build_quantization_table(int16_t *qtable, const unsigned char *ref_table)
 {
-	/* Taken from libjpeg. Copyright Independent JPEG Group's LLM idct.
-	 * For float AA&N IDCT method, divisors are equal to quantization
-	 * coefficients scaled by scalefactor[row]*scalefactor[col], where
-	 *   scalefactor[0] = 1
-	 *   scalefactor[k] = cos(k*PI/16) * sqrt(2)    for k=1..7
-	 * We apply a further scale factor of 8.
-	 * What's actually stored is 1/divisor so that the inner loop can
-	 * use a multiplication rather than a division.
-	 */
-	int i, j;
-	static const double aanscalefactor[8] = {
-		1.0, 1.387039845, 1.306562965, 1.175875602,
-		1.0, 0.785694958, 0.541196100, 0.275899379
-	};
-	const unsigned char *zz = zigzag;
-
-	for (i = 0; i < 8; i++)
-		for (j = 0; j < 8; j++)
-			*qtable++ = ref_table[*zz++] * aanscalefactor[i] * aanscalefactor[j];
+	/* The integer IDCT takes the quantization table as is, just bring it
+	 * in natural order */
+	int i;
 
+	for (i = 0; i < 64; i++)
+		qtable[i] = ref_table[zigzag[i]];
 }
 
 static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 {
 	int qi;
-	float *table;
+	int16_t *table;
 	const unsigned char *dqt_block_end;
 
 	trace("> DQT marker\n");
@@ -1743,6 +1796,8 @@ static int parse_SOF(struct jdec_private *priv, const unsigned char *stream)
 #endif
 		c->Vfactor = sampling_factor & 0xf;
 		c->Hfactor = sampling_factor >> 4;
+		if (Q_table >= COMPONENTS)
+			error("Bad Quantization table index: %d\n", Q_table);
 		c->Q_table = priv->Q_tables[Q_table];
 		trace("Component:%d  factor:%dx%d  Quantization table:%d\n",
 				cid, c->Hfactor, c->Hfactor, Q_table);
@@ -2077,10 +2132,23 @@ bogus_jpeg_format:
 struct jdec_private *tinyjpeg_init(void)
 {
 	struct jdec_private *priv;
+	int i;
 
 	priv = (struct jdec_private *)calloc(1, sizeof(struct jdec_private));
 	if (priv == NULL)
 		return NULL;
+
+	/* Make Huffman tables which get used without being defined fail to
+	   decode anything */
+	for (i = 0; i < HUFFMAN_TABLES; i++) {
+		memset(priv->HTDC[i].lookup, 0xff, sizeof(priv->HTDC[i].lookup));
+		memset(priv->HTDC[i].maxcode, 0xff, sizeof(priv->HTDC[i].maxcode));
+		memset(priv->HTAC[i].lookup, 0xff, sizeof(priv->HTAC[i].lookup));
+		memset(priv->HTAC[i].maxcode, 0xff, sizeof(priv->HTAC[i].maxcode));
+	}
+
+	priv->idct = v4lconvert_get_kernels()->jpeg_idct_islow;
+	priv->scale = 1;
 	return priv;
 }
 
@@ -2101,6 +2169,8 @@ void tinyjpeg_free(struct jdec_private *priv)
 	}
 	priv->tmp_buf_y_size = 0;
 	free(priv->stream_filtered);
+	free(priv->rst_streams);
+	free(priv->scaled_buf);
 	free(priv);
 }
 
@@ -2171,6 +2241,7 @@ static const convert_colorspace_fct convert_colorspace_grey[4] = {
 };
 
 int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt);
+static int tinyjpeg_decode_scaled(struct jdec_private *priv, int pixfmt);
 
 /* This function parses and removes the special Pixart JPEG chunk headers */
 static int pixart_filter(struct jdec_private *priv, unsigned char *dest,
@@ -2231,6 +2302,144 @@ kernel: 0xff 0xff 0x00 0xff 0x96, and we skip one unknown byte */
 	error("Short Pixart JPEG frame\n");
 }
 
+/*
+ * Find the start of each restart interval in the entropy coded data,
+ * returns the number of intervals found. Stops at the first marker which
+ * is not the next RST marker in sequence.
+ */
+static int find_rst_streams(struct jdec_private *priv, int intervals)
+{
+	const unsigned char *stream = priv->stream;
+	int found = 1;
+
+	if (priv->rst_streams_size < intervals) {
+		const unsigned char **rst_streams;
+
+		rst_streams = realloc(priv->rst_streams,
+				intervals * sizeof(*rst_streams));
+		if (!rst_streams)
+			return 0;
+		priv->rst_streams = rst_streams;
+		priv->rst_streams_size = intervals;
+	}
+
+	priv->rst_streams[0] = stream;
+	while (found < intervals) {
+		stream = memchr(stream, 0xff, priv->stream_end - stream);
+		if (!stream)
+			break;
+		/* Skip any padding ff byte (this is normal) */
+		while (stream < priv->stream_end && *stream == 0xff)
+			stream++;
+		if (stream >= priv->stream_end)
+			break;
+		if (*stream == 0x00) {
+			stream++;
+			continue;
+		}
+		if (*stream != RST + ((found - 1) & 7))
+			break;
+		priv->rst_streams[found++] = ++stream;
+	}
+
+	return found;
+}
+
+struct decode_rst_job {
+	struct jdec_private *priv;
+	decode_MCU_fct decode_MCU;
+	convert_colorspace_fct convert_to_pixfmt;
+	unsigned int mcus_per_row;
+	unsigned int mcus;
+	const unsigned int *bytes_per_blocklines;
+	const unsigned int *bytes_per_mcu;
+	pthread_mutex_t lock;
+	int error;
+};
+
+/*
+ * Decode restart intervals first - last. As the decoder state is kept in
+ * struct jdec_private, each band works on a private copy of it, the tables
+ * in the copy still point to the (read only) ones of the original.
+ */
+static void decode_rst_intervals(void *arg, int first, int last)
+{
+	struct decode_rst_job *job = arg;
+	struct jdec_private band_priv, *priv = &band_priv;
+	unsigned int mcu, end;
+	int i, c;
+
+	memcpy(priv, job->priv, sizeof(*priv));
+
+	if (setjmp(priv->jump_state)) {
+		pthread_mutex_lock(&job->lock);
+		if (!job->error)
+			memcpy(job->priv->error_string, priv->error_string,
+					sizeof(priv->error_string));
+		job->error = 1;
+		pthread_mutex_unlock(&job->lock);
+		return;
+	}
+
+	for (i = first; i < last; i++) {
+		priv->stream = job->priv->rst_streams[i];
+		resync(priv);
+
+		mcu = i * priv->restart_interval;
+		end = mcu + priv->restart_interval;
+		if (end > job->mcus)
+			end = job->mcus;
+
+		for (; mcu < end; mcu++) {
+			unsigned int x = mcu % job->mcus_per_row;
+			unsigned int y = mcu / job->mcus_per_row;
+
+			for (c = 0; c < COMPONENTS; c++)
+				priv->plane[c] = priv->components[c] +
+					y * job->bytes_per_blocklines[c] +
+					x * job->bytes_per_mcu[c];
+			job->decode_MCU(priv);
+			job->convert_to_pixfmt(priv);
+		}
+	}
+}
+
+/*
+ * Decode the restart intervals in parallel on priv->threads. Returns 1 when
+ * the stream could not be split at its restart markers, in which case the
+ * caller should fall back to decoding it sequentially.
+ */
+static int decode_rst_parallel(struct jdec_private *priv,
+		decode_MCU_fct decode_MCU, convert_colorspace_fct convert_to_pixfmt,
+		unsigned int mcus_per_row, unsigned int mcus,
+		const unsigned int *bytes_per_blocklines,
+		const unsigned int *bytes_per_mcu)
+{
+	struct decode_rst_job job;
+	int intervals;
+
+	intervals = (mcus + priv->restart_interval - 1) / priv->restart_interval;
+	if (intervals < 2 || find_rst_streams(priv, intervals) != intervals)
+		return 1;
+
+	job.priv = priv;
+	job.decode_MCU = decode_MCU;
+	job.convert_to_pixfmt = convert_to_pixfmt;
+	job.mcus_per_row = mcus_per_row;
+	job.mcus = mcus;
+	job.bytes_per_blocklines = bytes_per_blocklines;
+	job.bytes_per_mcu = bytes_per_mcu;
+	job.error = 0;
+	pthread_mutex_init(&job.lock, NULL);
+
+	v4lconvert_threads_run(priv->threads, decode_rst_intervals, &job,
+			intervals);
+
+	pthread_mutex_destroy(&job.lock);
+
+	return job.error ? -1 : 0;
+}
+
 /**
  * Decode and convert the jpeg image into @pixfmt@ image
  *
@@ -2248,6 +2457,9 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	if (setjmp(priv->jump_state))
 		return -1;
 
+	if (priv->scale > 1)
+		return tinyjpeg_decode_scaled(priv, pixfmt);
+
 	if (priv->flags & TINYJPEG_FLAGS_PLANAR_JPEG)
 		return tinyjpeg_decode_planar(priv, pixfmt);
 
@@ -2364,6 +2576,21 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	bytes_per_mcu[1] *= xstride_by_mcu / 8;
 	bytes_per_mcu[2] *= xstride_by_mcu / 8;
 
+	/* With restart markers, the intervals can be decoded independently */
+	if (priv->threads && priv->restart_interval > 0 &&
+	    !(priv->flags & TINYJPEG_FLAGS_PIXART_JPEG)) {
+		unsigned int mcus_per_row =
+			(priv->width + xstride_by_mcu - 1) / xstride_by_mcu;
+		int ret;
+
+		ret = decode_rst_parallel(priv, decode_MCU, convert_to_pixfmt,
+				mcus_per_row,
+				mcus_per_row * (priv->height / ystride_by_mcu),
+				bytes_per_blocklines, bytes_per_mcu);
+		if (ret <= 0)
+			return ret;
+	}
+
 	/* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
 	for (y = 0; y < priv->height / ystride_by_mcu; y++) {
 		//trace("Decoding row %d\n", y);
@@ -2397,6 +2624,187 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	return 0;
 }
 
+/*
+ * Decode the image at 1/priv->scale of its size, using the reduced size
+ * IDCTs which only use the low frequency coefficients. The components are
+ * decoded into planes, which then get converted to @pixfmt@.
+ */
+static int tinyjpeg_decode_scaled(struct jdec_private *priv, int pixfmt)
+{
+	void (*idct)(const int16_t *coef, const int16_t *quant,
+		     uint8_t *output_buf, int stride);
+	unsigned int hf = priv->component_infos[cY].Hfactor;
+	unsigned int vf = priv->component_infos[cY].Vfactor;
+	unsigned int bs = 8 / priv->scale;	/* Output size of a block */
+	unsigned int width = priv->width / priv->scale;
+	unsigned int height = priv->height / priv->scale;
+	unsigned int mcus_x, mcus_y, c_width, c_height, decoded_height;
+	unsigned int x, y, i, j, y_stride, c_stride;
+	uint8_t *y_buf, *u_buf = NULL, *v_buf = NULL;
+
+	switch (priv->scale) {
+	case 2:
+		idct = tinyjpeg_idct_4x4;
+		break;
+	case 4:
+		idct = tinyjpeg_idct_2x2;
+		break;
+	case 8:
+		idct = tinyjpeg_idct_1x1;
+		break;
+	default:
+		error("Bad scale: %u\n", priv->scale);
+	}
+
+	if (priv->flags & (TINYJPEG_FLAGS_PIXART_JPEG | TINYJPEG_FLAGS_PLANAR_JPEG))
+		error("Scaled decoding not supported for Pixart or planar JPEG's\n");
+	if (hf > 2 || vf > 2)
+		error("Scaled decoding not supported for %ux%u sampling\n", hf, vf);
+
+	/* Like tinyjpeg_decode() we ignore a partial MCU row at the bottom */
+	mcus_x = priv->width / (8 * hf);
+	mcus_y = priv->height / (8 * vf);
+	decoded_height = mcus_y * vf * bs;
+	c_width = mcus_x * bs;
+	c_height = mcus_y * bs;
+	y_stride = width;
+	c_stride = c_width;
+
+	switch (pixfmt) {
+	case TINYJPEG_FMT_YUV420P:
+		if (width % 2 || height % 2)
+			error("Bad scaled size for YUV420P: %ux%u\n", width, height);
+		y_buf = priv->components[0];
+		if (hf == 2 && vf == 2) {
+			/* The chroma planes already have the right size */
+			u_buf = priv->components[1];
+			v_buf = priv->components[2];
+			break;
+		}
+		priv->scaled_buf = v4lconvert_alloc_buffer(2 * c_width * c_height,
+				&priv->scaled_buf, &priv->scaled_buf_size);
+		if (!priv->scaled_buf)
+			error("Out of memory!\n");
+		u_buf = priv->scaled_buf;
+		v_buf = u_buf + c_width * c_height;
+		break;
+
+	case TINYJPEG_FMT_RGB24:
+	case TINYJPEG_FMT_BGR24:
+		priv->scaled_buf = v4lconvert_alloc_buffer(width * decoded_height +
+				2 * c_width * c_height,
+				&priv->scaled_buf, &priv->scaled_buf_size);
+		if (!priv->scaled_buf)
+			error("Out of memory!\n");
+		y_buf = priv->scaled_buf;
+		u_buf = y_buf + width * decoded_height;
+		v_buf = u_buf + c_width * c_height;
+		break;
+
+	case TINYJPEG_FMT_GREY:
+		y_buf = priv->components[0];
+		break;
+
+	default:
+		error("Bad pixel format\n");
+	}
+
+	resync(priv);
+
+	for (y = 0; y < mcus_y; y++) {
+		for (x = 0; x < mcus_x; x++) {
+			for (j = 0; j < vf; j++) {
+				for (i = 0; i < hf; i++) {
+					process_Huffman_data_unit(priv, cY);
+					idct(priv->component_infos[cY].DCT,
+					     priv->component_infos[cY].Q_table,
+					     y_buf + ((y * vf + j) * y_stride +
+						      x * hf + i) * bs,
+					     y_stride);
+				}
+			}
+
+			/* For grey we still need to skip over the chroma */
+			process_Huffman_data_unit(priv, cCb);
+			if (u_buf)
+				idct(priv->component_infos[cCb].DCT,
+				     priv->component_infos[cCb].Q_table,
+				     u_buf + (y * c_stride + x) * bs, c_stride);
+
+			process_Huffman_data_unit(priv, cCr);
+			if (v_buf)
+				idct(priv->component_infos[cCr].DCT,
+				     priv->component_infos[cCr].Q_table,
+				     v_buf + (y * c_stride + x) * bs, c_stride);
+
+			if (priv->restarts_to_go > 0) {
+				priv->restarts_to_go--;
+				if (priv->restarts_to_go == 0) {
+					priv->stream -= (priv->nbits_in_reservoir / 8);
+					resync(priv);
+					if (find_next_rst_marker(priv) < 0)
+						return -1;
+				}
+			}
+		}
+	}
+
+#define SCALEBITS       10
+#define ONE_HALF        (1UL << (SCALEBITS - 1))
+#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
+
+	switch (pixfmt) {
+	case TINYJPEG_FMT_YUV420P:
+		if (hf == 2 && vf == 2)
+			break;
+		/* Pick every other chroma pixel / line, like the YCrCB_to_YUV420P
+		   functions do */
+		for (y = 0; y < decoded_height / 2; y++) {
+			const uint8_t *u = u_buf + (y * 2 / vf) * c_stride;
+			const uint8_t *v = v_buf + (y * 2 / vf) * c_stride;
+			uint8_t *u_dest = priv->components[1] + y * width / 2;
+			uint8_t *v_dest = priv->components[2] + y * width / 2;
+
+			for (x = 0; x < width / 2; x++) {
+				u_dest[x] = u[x * 2 / hf];
+				v_dest[x] = v[x * 2 / hf];
+			}
+		}
+		break;
+
+	case TINYJPEG_FMT_RGB24:
+	case TINYJPEG_FMT_BGR24: {
+		int r_offset = pixfmt == TINYJPEG_FMT_RGB24 ? 0 : 2;
+		int b_offset = 2 - r_offset;
+
+		for (y = 0; y < decoded_height; y++) {
+			const uint8_t *Y = y_buf + y * y_stride;
+			const uint8_t *Cb = u_buf + (y / vf) * c_stride;
+			const uint8_t *Cr = v_buf + (y / vf) * c_stride;
+			uint8_t *p = priv->components[0] + y * width * 3;
+
+			for (x = 0; x < width; x++, p += 3) {
+				int l, cb, cr;
+
+				l  = Y[x] << SCALEBITS;
+				cb = Cb[x / hf] - 128;
+				cr = Cr[x / hf] - 128;
+				p[r_offset] = clamp((l + FIX(1.40200) * cr + ONE_HALF) >> SCALEBITS);
+				p[1] = clamp((l - FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF) >> SCALEBITS);
+				p[b_offset] = clamp((l + FIX(1.77200) * cb + ONE_HALF) >> SCALEBITS);
+			}
+		}
+		break;
+	}
+	}
+
+#undef SCALEBITS
+#undef ONE_HALF
+#undef FIX
+
+	return 0;
+}
+
 int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 {
 	unsigned int i, x, y;
@@ -2668,3 +3076,22 @@ int tinyjpeg_set_flags(struct jdec_private *priv, int flags)
 	return oldflags;
 }
 
+/*
+ * Decode the image at 1/scale of its size, scale can be 1, 2, 4 or 8. Not
+ * supported for Pixart and planar JPEG's.
+ */
+int tinyjpeg_set_scale(struct jdec_private *priv, unsigned int scale)
+{
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+		error("Bad scale: %u\n", scale);
+
+	priv->scale = scale;
+	return 0;
+}
+
+/* Decode restart intervals in parallel using these worker threads */
+void tinyjpeg_set_threads(struct jdec_private *priv, struct v4lconvert_threads *threads)
+{
+	priv->threads = threads;
+}
+